@@ -65,7 +65,7 @@ public:
 	inline void Reserve(OffsetType capacity)
 	{
 		offsets.Reserve(capacity);
-		data.reserve(capacity);
+		data.Reserve(capacity);
 	}
 
 	inline OffsetType Size() const { return offsets.Size(); }
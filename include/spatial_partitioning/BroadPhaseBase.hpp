@@ -4,11 +4,65 @@
 
 #pragma once
 
+#include <chrono>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include "./IntersectionCallbacks.hpp"
 #include "EntityTypes.hpp"
 
 namespace spp
 {
+/*
+ * Structure and quality metrics of broadphase tree:
+ * 	root has depth 0, leaf is a node whose entities are tested directly,
+ * 	for hierarchies with entities as separate leaves (Dbvh, Dbvt) each
+ * 	entity is a leaf with bounds stored for it by tree.
+ * 	SAH cost uses traversal and intersection cost equal 1 and is relative to
+ * 	surface of root bounds, entities outside of tree (brute forced) cost 1.
+ */
+struct BroadphaseStatistics {
+	// number of entities in leaves at given depth
+	std::vector<int64_t> depthHistogram;
+	int64_t entitiesCount = 0;
+	// internal nodes
+	int64_t nodesCount = 0;
+	int64_t leavesCount = 0;
+	// entities tested with every query
+	int64_t unsortedEntitiesCount = 0;
+	int32_t maxDepth = 0;
+
+	// average number of entities in leaf
+	double leafFill = 0.0;
+	double sahCost = 0.0;
+	// sum of volumes of intersections of sibling nodes
+	double siblingOverlapVolume = 0.0;
+	// sum of surfaces of leaves bounds divided by sum of surfaces of tight
+	// bounds of their entities, equals 1 when bounds are not inflated
+	double inflationRatio = 1.0;
+
+	// accumulated values used by Finish()
+	double rootSurface = 0.0;
+	double nodesSurface = 0.0;
+	double leavesCost = 0.0;
+	double leavesSurface = 0.0;
+	double tightSurface = 0.0;
+
+	void AddNode(int32_t depth, float surface);
+	void AddLeaf(int32_t depth, float surface, float tight, int64_t entities);
+	void AddSiblings(const Aabb &a, const Aabb &b);
+	void AddUnsorted(int64_t entities);
+	// Adds statistics of subtree, which sizes are scaled by scale. Unsorted
+	// entities of subtree are tested only when bounds of surface
+	// boundsSurface are hit, or with every query when boundsSurface is 0.
+	void Merge(const BroadphaseStatistics &sub, int32_t depth,
+			   float scale = 1.0f, double boundsSurface = 0.0);
+	// Calculates derived metrics from accumulated values
+	void Finish();
+};
+
 SPP_TEMPLATE_DECL
 class BroadphaseBase;
 
@@ -50,9 +104,31 @@ public:
 
 	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) = 0;
 	virtual void Update(EntityType entity, Aabb aabb) = 0;
+	// Update with velocity of entity (displacement per update), used by
+	// structures that store aabbs enlarged in direction of movement. Default
+	// implementation ignores velocity.
+	virtual void Update(EntityType entity, Aabb aabb, glm::vec3 velocity);
 	virtual void Remove(EntityType entity) = 0;
 	virtual void SetMask(EntityType entity, MaskType mask) = 0;
 
+	// Batched variants of Add/Update/Remove, used when many entities change
+	// at once (ex. after physics step). Each entity may occur at most once in
+	// a batch. Default implementations call Add/Update/Remove for each
+	// element.
+	virtual void
+	AddBatch(std::span<const std::tuple<EntityType, Aabb, MaskType>> entities);
+	virtual void
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities);
+	virtual void RemoveBatch(std::span<const EntityType> entities);
+
+	// Builds structure from arrays of entities at once (ex. on level load),
+	// structure needs to be empty and all spans of the same size. Default
+	// implementation calls Add for each entity between StartFastAdding() and
+	// StopFastAdding(), followed by Rebuild().
+	virtual void BulkLoad(std::span<const EntityType> entities,
+						  std::span<const Aabb> aabbs,
+						  std::span<const MaskType> masks);
+
 	virtual int32_t GetCount() const = 0;
 	virtual bool Exists(EntityType entity) const = 0;
 
@@ -61,12 +137,28 @@ public:
 
 	// maybe rename/add Optimize() function
 	virtual void Rebuild() = 0;
+	// Continues rebuild started by previous call (or starts a new one) for at
+	// most budget of time, at least one unit of work is always done. Returns
+	// progress of current rebuild in range [0, 1], where 1 means it is
+	// finished. Default implementation does full Rebuild().
+	virtual float RebuildFor(std::chrono::microseconds budget);
+
+	// Default implementation treats all entities as unsorted
+	virtual BroadphaseStatistics GetStatistics();
 
 	// returns number of tested entities
 	virtual void IntersectAabb(AabbCallback &callback) = 0;
 	virtual void IntersectRay(RayCallback &callback) = 0;
+	// True when queries modify structure even without pending changes (ex.
+	// query cost accounting), such structure cannot be queried by many
+	// threads at once. Default returns false.
+	virtual bool QueriesModifyState() const;
 
 	virtual BroadphaseBaseIterator *RestartIterator() = 0;
+
+protected:
+	// Number of threads used by BulkLoad for given number of entities
+	static int32_t GetBulkLoadThreadsCount(size_t entitiesCount);
 };
 
 SPP_EXTERN_VARIANTS(BroadphaseBaseIterator)
@@ -32,9 +32,16 @@ public:
 	virtual void ShrinkToFit() override;
 
 	void IncrementalOptimize(int iterations);
+	// Leaves store aabbs enlarged by margin and by velocity multiplied by
+	// velocityPrediction (btDbvt::update with velocity and margin), Update is
+	// skipped while new aabb fits inside of enlarged one
+	void SetEnlargedAabbs(bool enabled, float margin = 0.1f,
+						  float velocityPrediction = 1.0f);
 
 	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
 	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Update(EntityType entity, Aabb aabb,
+						glm::vec3 velocity) override;
 	virtual void Remove(EntityType entity) override;
 	virtual void SetMask(EntityType entity, MaskType mask) override;
 
@@ -49,6 +56,8 @@ public:
 
 	virtual void Rebuild() override;
 
+	virtual BroadphaseStatistics GetStatistics() override;
+
 	friend class btDbvtAabbCb;
 	friend class btDbvtRayCb;
 
@@ -66,9 +75,11 @@ private:
 	};
 	AssociativeArray<EntityType, int32_t, Data, false> ents;
 	bullet::btDbvt dbvt;
-	bullet::btAlignedObjectArray<const bullet::btDbvtNode *> stack;
 
 	size_t requiresRebuild = 0;
+	float fatMargin = 0.0f;
+	float fatVelocityPrediction = 0.0f;
+	bool enlargedAabbs = false;
 
 	class Iterator final : public BroadphaseBaseIterator
 	{
@@ -7,8 +7,10 @@
 #include <cstdint>
 
 #include <vector>
+#include <memory>
 
 #include "DenseSparseIntMap.hpp"
+#include "FlatGroupIntMap.hpp"
 #include "BroadPhaseBase.hpp"
 
 namespace spp
@@ -173,6 +175,43 @@ public:
 	virtual void Remove(EntityType entity) override;
 	virtual void SetMask(EntityType entity, MaskType mask) override;
 
+	// Moves entity out of tree into brute force entities at end, it's old
+	// place becomes hole and is refitted. Entities already at end are only
+	// updated. When there are already maxNumberOfBruteforceEntities at end,
+	// entity is updated in place as with Update() and false is returned.
+	bool UpdateIntoBruteForce(EntityType entity, Aabb aabb);
+
+	// With ON_UPDATE_EXTEND_AABB policy nodes of updated entities are marked
+	// dirty and refitted once at the end
+	virtual void
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities) override;
+
+	// Upper levels of tree are split on single thread, independent subtrees
+	// are built in parallel
+	virtual void BulkLoad(std::span<const EntityType> entities,
+						  std::span<const Aabb> aabbs,
+						  std::span<const MaskType> masks) override;
+	// Same as BulkLoad but does not write offsets of entities into
+	// (possibly shared) entities offsets map, RegisterAllOffsets() needs to be
+	// called afterwards. Used to build many instances sharing single map in
+	// parallel.
+	void BulkLoadWithoutOffsets(std::span<const EntityType> entities,
+								std::span<const Aabb> aabbs,
+								std::span<const MaskType> masks,
+								int32_t threadsCount);
+	// Same as Rebuild but does not write offsets of entities, see
+	// BulkLoadWithoutOffsets()
+	void RebuildWithoutOffsets(int32_t threadsCount);
+	void RegisterAllOffsets();
+
+	// Appends binary image of tree to buffer, pending rebuild or refit is
+	// finished first. Offsets of entities are not stored.
+	void Serialize(std::vector<uint8_t> &buffer);
+	// Restores image written by Serialize() into empty instance without
+	// rebuilding, RegisterAllOffsets() needs to be called afterwards. Advances
+	// buffer past the image, returns false if buffer is malformed.
+	bool DeserializeWithoutOffsets(std::span<const uint8_t> &buffer);
+
 	EntityType GetEntityByOffset(int32_t offset) const;
 
 	virtual int32_t GetCount() const override;
@@ -187,12 +226,34 @@ public:
 	enum AabbUpdatePolicy : uint8_t {
 		ON_UPDATE_EXTEND_AABB,
 		ON_UPDATE_QUEUE_FULL_REBUILD_ON_NEXT_READ,
+		// Marks lowest nodes as dirty, all of them are refitted with single
+		// bottom-up sweep over heap levels on next read
+		ON_UPDATE_REFIT_ON_NEXT_READ,
 	};
 
 	void SetAabbUpdatePolicy(AabbUpdatePolicy policy);
 	AabbUpdatePolicy GetAabbUpdatePolicy() const;
 
+	// When ratio of holes left by Remove to all entity slots exceeds given
+	// value, holes are filled with entities from brute force tail and only
+	// their ancestors are refitted. 0 disables compaction.
+	void SetHolesCompactionRatio(float ratio);
+
 	virtual void Rebuild() override;
+	// Copies entities into shadow instance and executes its RebuildStep()
+	// until done or out of budget. Meanwhile this structure is queried from
+	// old tree and modified as usual, changed entities are recorded. When
+	// shadow is built, recorded changes are applied to it, it is swapped in
+	// and offsets of entities are registered, all in slices within budget.
+	// Entities added in the meantime are left in brute force tail. Needs
+	// memory for second copy of entities and nodes.
+	virtual float RebuildFor(std::chrono::microseconds budget) override;
+
+	// Recalculates aabbs of nodes marked as dirty, without changing tree
+	// structure
+	void Refit();
+
+	virtual BroadphaseStatistics GetStatistics() override;
 
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
@@ -202,20 +263,42 @@ public:
 		int32_t size = 0;
 		int32_t stage = 0;
 		int32_t it = 0;
+		// number of entities processed by nodes in stage 5
+		int64_t work = 0;
 		bool done = false;
 	};
 	bool RebuildStep(RebuildProgress &progress);
+	float GetRebuildProgress(const RebuildProgress &progress) const;
 
 	void SplitLatterHalfToEmpty(BvhMedianSplitHeap &other);
 
 private:
 	void PruneEmptyEntitiesAtEnd();
 	void UpdateAabb(int32_t entityOffset);
+	void QueueRebuild();
+	void AddHole(int32_t offset);
+	void CompactHolesIfNeeded();
+	void MarkDirty(int32_t entityOffset);
+	void ClearDirty();
+	int32_t FindOffset(EntityType entity) const;
+	void SetOffset(EntityType entity, int32_t offset);
+	void RefitNode(int32_t nodeId, int32_t treeEntities);
+	void FinishRebuildFor();
+	bool RebuildForStep();
+	float GetRebuildForProgress() const;
+	void RecordRebuildForChange(EntityType entity);
+	void ReconcileShadowEntity(EntityType entity);
+	void RemoveFromShadow(int32_t shadowOffset);
+	void SwapInRebuildShadow();
+	void PrepareRebuild();
 	void RebuildNode(int32_t nodeId);
+	void RebuildNodesParallel(int32_t threadsCount);
 	int32_t RebuildNodePartial(int32_t nodeId, int32_t *tcount);
 
 	void _Internal_IntersectAabb(AabbCallback &cb, const int32_t nodeId);
 	void _Internal_IntersectRay(RayCallback &cb, const int32_t nodeId);
+	void _Internal_GetStatistics(BroadphaseStatistics &stats,
+								 const int32_t nodeId, int32_t depth) const;
 	
 	void RecalcTreeStructureForValidEnttiesData();
 
@@ -243,12 +326,56 @@ public:
 	int32_t entitiesCount = 0;
 	int32_t entitiesPowerOfTwoCount = 0;
 	bool rebuildTree = false;
+	// set by BulkLoad, offsets are written after building tree
+	bool skipOffsetsInRebuild = false;
 	AabbUpdatePolicy updatePolicy = ON_UPDATE_EXTEND_AABB;
 
+	// offsets of removed entities inside of tree, may contain offsets already
+	// reused or trimmed (they are validated when used)
+	std::vector<int32_t> holes;
+	float holesCompactionRatio = 0.125f;
+
+	// used by ON_UPDATE_REFIT_ON_NEXT_READ
+	std::vector<uint8_t> dirtyNodes;
+	int32_t dirtyMin = 0x7FFFFFFF;
+	int32_t dirtyMax = -1;
+
+	// used by RebuildFor, tree is rebuilt inside of rebuildShadow
+	enum RebuildForStage : uint8_t {
+		REBUILD_FOR_REFIT_OLD_TREE,
+		REBUILD_FOR_COPY,
+		REBUILD_FOR_BUILD,
+		REBUILD_FOR_SCAN_SHADOW,
+		REBUILD_FOR_SCAN_ENTITIES,
+		REBUILD_FOR_APPLY_CHANGES,
+		REBUILD_FOR_REGISTER_OFFSETS,
+	};
+	// number of entities or nodes processed by single RebuildForStep()
+	inline const static int32_t REBUILD_FOR_SLICE = 4096;
+	std::unique_ptr<BvhMedianSplitHeap> rebuildShadow;
+	RebuildProgress rebuildForProgress;
+	RebuildForStage rebuildForStage = REBUILD_FOR_COPY;
+	int32_t rebuildForCursor = 0;
+	bool rebuildForPending = false;
+	// Entities added, updated, moved or removed since copying started. When
+	// too many are recorded, list is dropped and all entities are compared
+	// with shadow instead.
+	std::vector<EntityType> rebuildForChanged;
+	bool rebuildForChangesLost = false;
+	bool rebuildForScanEntities = false;
+	// Offsets of entities inside of rebuildShadow. After swap they are used
+	// for entities whose offsets are not registered yet.
+	FlatGroupIntMap<EntityType, int32_t> rebuildForOffsets;
+	// Nodes do not bound all entities because of queued rebuild. If this is
+	// set when RebuildFor starts, old tree is refitted first and all
+	// entities are tested linearly until then.
+	bool nodesOutdated = false;
+
 	class Iterator final : public BroadphaseBaseIterator
 	{
 	public:
 		Iterator(BvhMedianSplitHeap &bp);
+		Iterator(Iterator &&other) = default;
 		virtual ~Iterator();
 
 		Iterator &operator=(Iterator &&other) = default;
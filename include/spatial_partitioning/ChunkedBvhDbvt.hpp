@@ -5,12 +5,16 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <random>
 
 #include "../../glm/glm/ext/vector_uint3_sized.hpp"
 
 #include "./BroadPhaseBase.hpp"
 #include "./BvhMedianSplitHeap.hpp"
+#include "./FlatIntMap.hpp"
+#include "./RebuildExecutor.hpp"
 // #include "./BulletDbvt.hpp"
 
 template <> struct std::hash<glm::u16vec3> {
@@ -71,6 +75,31 @@ public:
 	virtual void Remove(EntityType entity) override;
 	virtual void SetMask(EntityType entity, MaskType mask) override;
 
+	// Entities are grouped by chunk, so that each chunk is looked up once
+	// and its bvh receives all of its updates at once
+	virtual void AddBatch(std::span<const std::tuple<EntityType, Aabb, MaskType>>
+							  entities) override;
+	virtual void
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities) override;
+	virtual void RemoveBatch(std::span<const EntityType> entities) override;
+
+	// Bvh of each chunk is built at once, chunks are built in parallel
+	virtual void BulkLoad(std::span<const EntityType> entities,
+						  std::span<const Aabb> aabbs,
+						  std::span<const MaskType> masks) override;
+
+	// Adds entities that do not exist, and sets aabbs and masks of existing
+	// ones. When entity is repeated in batch, its last entry is used.
+	// Intended for ingesting snapshots of large part of the world: moves
+	// between chunks are applied serially, then every chunk touched by the
+	// batch is fully rebuilt with its new content by worker threads that
+	// each own different chunks. Offsets are written to the shared map
+	// serially at the end. Batches smaller than 1/INGEST_MIN_FRACTION_INVERSE
+	// of entities go through UpdateBatch() and AddBatch() instead.
+	void IngestBatch(
+		std::span<const std::tuple<EntityType, Aabb, MaskType>> entities);
+	inline const static size_t INGEST_MIN_FRACTION_INVERSE = 16;
+
 	virtual int32_t GetCount() const override;
 	virtual bool Exists(EntityType entity) const override;
 
@@ -81,14 +110,99 @@ public:
 	virtual void IntersectRay(RayCallback &callback) override;
 
 	virtual void Rebuild() override;
+	// Rebuilds changed chunks one after another (each with it's own
+	// BvhMedianSplitHeap::RebuildFor()), then outer objects and chunks bvh
+	virtual float RebuildFor(std::chrono::microseconds budget) override;
+
+	// Chunks bvh nodes and leaves are counted as nodes, depths of entities in
+	// chunks are counted from depth 1
+	virtual BroadphaseStatistics GetStatistics() override;
 
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
 public:
+	// Does single unit of RebuildFor() work
 	void RebuildIncremental();
+	// Rebuilds chunks with changes in parallel, then outer objects and
+	// chunks bvh on calling thread
+	void RebuildChangedChunks();
+	// Entities moved inside of their chunk go into dynamic stage of the chunk
+	// (brute force entities at end of it's bvh) instead of queueing rebuild
+	// of whole chunk. Chunk is queued for rebuild when dynamic stage exceeds
+	// half of the limit, when it is full moved entities are refitted in
+	// chunk tree.
+	void SetChunkDynamicEntitiesLimit(int32_t limit);
+	// Max threads used by Rebuild(), RebuildChangedChunks() and
+	// IngestBatch(),
+	// 0 - use std::thread::hardware_concurrency()
+	void SetThreadsCount(int32_t threadsCount);
+	// Parallel work is done on workers of executor and calling thread. When
+	// not set, executor with hardware_concurrency() - 1 workers is created
+	// on first parallel call.
+	void SetRebuildExecutor(std::shared_ptr<RebuildExecutor> executor);
+
+	enum RayTraversalMode {
+		// Chunks are found by ray test of chunks bvh
+		RAY_TRAVERSAL_CHUNKS_BVH,
+		// Chunk grid of each level is marched along the ray (3D-DDA), until
+		// cutFactor is before next cell boundary
+		RAY_TRAVERSAL_GRID_MARCHING,
+	};
+	void SetRayTraversalMode(RayTraversalMode mode);
+	RayTraversalMode GetRayTraversalMode() const;
+
+	// Statistics of each chunk in global units, with root at chunk bounds
+	std::vector<std::pair<int32_t, BroadphaseStatistics>> GetChunksStatistics();
+
+	// Geometry of finest chunks level, coarser levels are scaled from it
+	struct ChunkGeometry {
+		// Edge length of chunk
+		float chunkSize = 64.0f;
+		// Quantization steps per unit inside chunk,
+		// chunkSize * chunkSizeMultiplier needs to be at most 21840
+		float chunkSizeMultiplier = 32.0f;
+		// Larger entities go to coarser levels, at most chunkSize / 2
+		float maxChunkedEntitySize = 32.0f;
+	};
+
+	// Entities are reinserted when geometry changes while not empty, chunked
+	// entities keep their quantized aabbs then
+	void SetChunkGeometry(ChunkGeometry geometry);
+	ChunkGeometry GetChunkGeometry() const;
+
+	// Picks geometry from size and density of sample of aabbs, so that at
+	// most outerFraction of entities are outer objects and occupied chunks
+	// contain on average at most targetEntitiesPerChunk entities (unless
+	// limited by entity sizes)
+	static ChunkGeometry
+	ComputeChunkGeometry(std::span<const Aabb> aabbs,
+						 int32_t targetEntitiesPerChunk = 256,
+						 float outerFraction = 0.01f);
+	// Computes geometry from contained entities and applies it
+	void AutoTuneChunkGeometry(int32_t targetEntitiesPerChunk = 256,
+							   float outerFraction = 0.01f);
+	// When enabled BulkLoad() computes geometry from loaded entities
+	void SetAutoTuneOnBulkLoad(bool enable,
+							   int32_t targetEntitiesPerChunk = 256,
+							   float outerFraction = 0.01f);
+
+	// Id of chunk to which entity with given aabb belongs, -1 for outer
+	// objects
+	int32_t GetChunkIdFromAabb(Aabb aabb) const;
+	// Appends binary image of chunk (it's bvh with entities) to buffer,
+	// returns false if chunk does not exist
+	bool SerializeChunk(int32_t chunkId, std::vector<uint8_t> &buffer);
+	// Serializes chunk and removes it with all of it's entities, they do not
+	// exist until chunk is loaded again
+	bool UnloadChunk(int32_t chunkId, std::vector<uint8_t> &buffer);
+	// Loads chunk serialized with the same chunk geometry, without
+	// rebuilding it. Fails if chunk is already loaded or if any of it's
+	// entities exists. Advances buffer past loaded chunk.
+	bool LoadChunk(std::span<const uint8_t> &buffer);
 
 private: // callbacks
 	struct Chunk;
+	struct ChunkLevel;
 
 	class AabbCallbacks
 	{
@@ -146,6 +260,8 @@ private: // callbacks
 			ChunkedBvhDbvt::RayCallback *orgCb;
 			ChunkedBvhDbvt *dbvt;
 			RayCallbacks::IntraChunkCb intraCb;
+			// level for which intraCb dir, invDir and length are scaled
+			const ChunkLevel *preparedLevel;
 
 			void InitFrom(ChunkedBvhDbvt::RayCallback &cb,
 						  ChunkedBvhDbvt *dbvt);
@@ -161,24 +277,27 @@ private: // callbacks
 	friend class RayCallbacks::IntraChunkCb;
 
 private:
+	struct BatchEntry {
+		int32_t chunkId;
+		EntityType entity;
+		MaskType mask;
+		Aabb aabb;
+	};
+
+	void SortBatchEntriesByChunk();
+	void AdvanceRoundRobin(int32_t steps);
+
 	struct Chunk {
 		Chunk();
 		Chunk(Chunk &&chunk);
 		Chunk &operator=(Chunk &&chunk);
 		~Chunk();
 
-		void Init(ChunkedBvhDbvt *bp, int32_t chunkId, float chunkSize,
+		void Init(ChunkedBvhDbvt *bp, int32_t chunkId, int32_t level,
 				  Aabb aabb);
 
 		ChunkedBvhDbvt *bp = nullptr;
-		
-		inline const static glm::vec3 invScale = glm::vec3(ChunkedBvhDbvt::chunkSizeMultiplier);
-		inline const static glm::vec3 scale = glm::vec3(1.0f) / invScale;
-		inline const static Aabb_i32 localAabbInner =
-			{-glm::ivec3(ChunkedBvhDbvt::chunkSize * ChunkedBvhDbvt::chunkSizeMultiplier),
-					  glm::ivec3(ChunkedBvhDbvt::chunkSize * ChunkedBvhDbvt::chunkSizeMultiplier)};
-		inline const static Aabb_i32 localAabb = 
-			{(localAabbInner.min * 3 / 2), (localAabbInner.max * 3) / 2};
+		const ChunkLevel *level = nullptr;
 
 		Aabb globalAabb;
 		Aabb globalAabbInner;
@@ -187,9 +306,11 @@ private:
 		int32_t chunkId;
 
 		int changes = 0;
+		void MarkChanged(int count = 1);
 
 		void Add(EntityType entity, Aabb aabb, MaskType mask);
 		void Update(EntityType entity, Aabb aabb);
+		void UpdateBatch(std::span<const BatchEntry> entries);
 		void Remove(EntityType entity);
 
 		int32_t GetCount() const;
@@ -220,25 +341,110 @@ private:
 	const Chunk *GetChunkOfEntity(EntityType entity, int32_t &offset) const;
 	int32_t GetChunkIdOfEntity(EntityType entity, int32_t &offset);
 
-	int32_t GetChunkIdFromAabb(Aabb aabb) const;
-
 	Chunk *GetOrInitChunk(int32_t chunkId, Aabb aabb);
 
 	Chunk *GetChunkById(uint32_t chunkId);
+	const Chunk *GetChunkById(uint32_t chunkId) const;
+	// Removes chunk from chunksBvh and from chunks, last chunk is moved into
+	// it's place
+	void RemoveChunk(int32_t chunkId);
+
+	// Rebuilds bvhs of chunks in parallel, offsets are registered afterwards
+	// on calling thread
+	void RebuildChunks(std::span<Chunk *const> list);
+	// Runs worker on calling thread and on up to threads - 1 workers of
+	// executor. Worker needs to take work from shared counter, jobs not
+	// started before calling thread finished its worker are skipped.
+	void RunParallel(int32_t threads, const std::function<void()> &worker);
+
+	// Visits chunks of level in order of cells of chunk grid along the ray
+	void IntersectRayGridMarching(typename RayCallbacks::InterChunkCb &cb,
+								  int32_t level);
+
+	// Sets geometry and values derived from it, needs to be empty
+	void ApplyChunkGeometry(ChunkGeometry geometry);
+	void BulkLoadChunks(std::span<const EntityType> entities,
+						std::span<const Aabb> aabbs,
+						std::span<const MaskType> masks);
 
 private:
-	inline const static float chunkSize = 64.0f;
-	inline const static float chunkSizeMultiplier = 32.0f;
-	inline const static float maxChunkedEntitySize = 32.0f;
+	float chunkSize = 64.0f;
+	float chunkSizeMultiplier = 32.0f;
+	float maxChunkedEntitySize = 32.0f;
+
+	// Each next level has 4 times larger chunks and entities, quantization
+	// is coarsened only when needed to fit int16. Only entities not fitting
+	// into any level are outer objects.
+	inline const static int32_t CHUNK_LEVELS = 3;
+	inline const static int32_t CHUNK_LEVEL_FACTOR = 4;
+
+	struct ChunkLevel {
+		float chunkSize;
+		float maxEntitySize;
+		// chunk offsets need to be in (-limitOffset, limitOffset)
+		int32_t limitOffset;
+		glm::vec3 scale;
+		glm::vec3 invScale;
+		Aabb_i32 localAabbInner;
+		Aabb_i32 localAabb;
+	};
+	// derived from geometry
+	ChunkLevel chunkLevels[CHUNK_LEVELS];
+	int32_t chunksCountPerLevel[CHUNK_LEVELS] = {0};
+
+	RayTraversalMode rayTraversalMode = RAY_TRAVERSAL_CHUNKS_BVH;
+
+	int32_t chunkDynamicEntitiesLimit = 32;
 
+	bool autoTuneOnBulkLoad = false;
+	int32_t autoTuneTargetEntitiesPerChunk = 256;
+	float autoTuneOuterFraction = 0.01f;
+
+	// Chunk id of level 0 stores 10 bits per axis. Ids of higher levels have
+	// CHUNK_ID_LEVEL_BIT set, level - 1 in bits 24-25 and 8 bits per axis.
 	inline const static int limitChunkOffset = 512 - 2;
+	inline const static int limitChunkOffsetHigherLevels = 128 - 2;
+	inline const static int32_t CHUNK_ID_LEVEL_BIT = 1 << 30;
+
+	static int32_t EncodeChunkId(glm::ivec3 offset, int32_t level);
+	static glm::ivec3 DecodeChunkId(int32_t chunkId, int32_t &level);
+
+	// 'SPCH'
+	inline const static uint32_t CHUNK_IMAGE_MAGIC = 0x48435053;
+	inline const static uint32_t CHUNK_IMAGE_VERSION = 1;
+	using ChunkNodeData =
+		typename decltype(InternalBvhHeap::nodesHeapAabb)::value_type;
+	using ChunkData = typename decltype(InternalBvhHeap::entitiesData)::value_type;
+	struct ChunkImageHeader {
+		uint32_t magic;
+		uint32_t version;
+		// raw records of chunk bvh are stored, their layout needs to match
+		uint32_t sizeofNodeData;
+		uint32_t sizeofData;
+		int32_t chunkId;
+		float chunkSize;
+		float chunkSizeMultiplier;
+	};
 
-	size_t incrementalIterator1 = 0, incrementalIterator2 = 0;
+	size_t incrementalIterator = 0;
 	int32_t roundRobinCounter = 0;
+	int32_t threadsCount = 0;
+	std::shared_ptr<RebuildExecutor> executor;
 	std::mt19937_64 mt{0};
 
 	uint32_t entitiesCount = 0;
 
+	// chunks with changes > 0 in order of first change, used by RebuildFor
+	std::vector<int32_t> dirtyChunks;
+	size_t dirtyChunksHead = 0;
+	int32_t rebuildForDone = 0;
+	bool outerObjectsChanged = false;
+	bool chunksBvhChanged = false;
+
+	// used by batch operations
+	std::vector<BatchEntry> batchEntries;
+	std::vector<std::pair<EntityType, Aabb_i16>> batchLocal;
+
 	/*
 	 * Segment:
 	 *    lsb   -   chunk id (glm::i16vec3 serialized by 10 lower bits each
@@ -248,9 +454,11 @@ private:
 	 */
 	MapType entitiesOffsets;
 
-	HashMap<int32_t, Chunk> chunks;
-	
-	
+	// Chunks are stored contiguously, chunkIdToIndex maps chunk id (which
+	// cannot be 0) to index in chunks. Pointers to chunks are invalidated
+	// when chunks are added or removed.
+	std::vector<Chunk> chunks;
+	FlatIntMap<uint32_t, int32_t> chunkIdToIndex;
 
 	BroadphaseBase<Aabb, uint32_t, uint32_t, 0> *chunksBvh;
 // 	BulletDbvt<Aabb, uint32_t, uint32_t, 0> chunksBvh;
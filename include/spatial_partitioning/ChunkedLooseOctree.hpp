@@ -7,9 +7,9 @@
 #include <cstdint>
 
 #include <memory>
+#include <vector>
 
 #include "../../glm/glm/ext/vector_int3.hpp"
-#include "../../glm/glm/ext/vector_int4.hpp"
 
 #include "AssociativeArray.hpp"
 #include "BvhMedianSplitHeap.hpp"
@@ -54,6 +54,8 @@ public:
 
 	virtual void Rebuild() override;
 
+	virtual BroadphaseStatistics GetStatistics() override;
+
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
 public:
@@ -71,24 +73,36 @@ public:
 	std::shared_ptr<void> GetChunkData(int32_t chunkId);
 	void SetChunkData(int32_t chunkId, std::shared_ptr<void> chunksData);
 
-	void GetChunks(Aabb aabb, std::vector<int32_t> chunks);
+	// Writes into chunkIds (cleared first) ids of existing chunks which cells
+	// intersect aabb
+	void GetChunks(Aabb aabb, std::vector<int32_t> &chunkIds) const;
+	// Writes into chunkIds (cleared first) ids of existing chunks which cells
+	// pass isIn, nodes which cells do not pass isIn are not descended into
 	void GetChunks(bool (*isIn)(Aabb test, void *testData), void *testData,
-				   std::vector<int32_t> chunksData);
+				   std::vector<int32_t> &chunkIds) const;
 
+	// Calls func for every chunk with chunk data, which cell passes isIn.
+	// Chunks are distributed over threadsCount threads (0 - use
+	// std::thread::hardware_concurrency()), func may modify only its own
+	// chunk data and cannot modify ChunkedLooseOctree.
 	void ForEachChunkData(bool (*isIn)(Aabb test, void *testData),
 						  void *testData,
 						  void (*func)(ChunkedLooseOctree &self, int32_t chunk,
 									   void *userData),
-						  void *userData);
+						  void *userData, int32_t threadsCount = 0);
 
 private:
-	glm::ivec3 GetMaxChunk(glm::vec3 point) const;
-	glm::ivec3 GetMinChunk(glm::vec3 point) const;
-	glm::ivec4 GetNodePosSize(Aabb aabb) const;
 	bool FitsInChunk(Aabb aabb) const;
+	AabbCentered GetLooseAabb(int32_t nodeId) const;
+	int32_t GetCreateChildId(int32_t nodeId, glm::vec3 pos);
 
 	void _Internal_IntersectAabb(AabbCallback &cb, const int32_t nodeId);
 	void _Internal_IntersectRay(RayCallback &cb, const int32_t nodeId);
+	void _Internal_GetStatistics(BroadphaseStatistics &stats,
+								 const int32_t nodeId, int32_t depth) const;
+	void _Internal_GetChunks(bool (*isIn)(Aabb test, void *testData),
+							 void *testData, std::vector<int32_t> &chunkIds,
+							 const int32_t nodeId) const;
 
 private:
 	struct Data {
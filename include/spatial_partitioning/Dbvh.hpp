@@ -41,9 +41,20 @@ public:
 
 	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
 	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Update(EntityType entity, Aabb aabb,
+						glm::vec3 velocity) override;
 	virtual void Remove(EntityType entity) override;
 	virtual void SetMask(EntityType entity, MaskType mask) override;
 
+	// Refits each common ancestor of updated entities once
+	virtual void
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities) override;
+
+	// Builds tree top-down with median splits, upper levels spawn threads
+	virtual void BulkLoad(std::span<const EntityType> entities,
+						  std::span<const Aabb> aabbs,
+						  std::span<const MaskType> masks) override;
+
 	virtual int32_t GetCount() const override;
 	virtual bool Exists(EntityType entity) const override;
 
@@ -54,15 +65,31 @@ public:
 	virtual void IntersectRay(RayCallback &callback) override;
 
 	virtual void Rebuild() override;
+	// Applies best rotation to each node, sweeping nodes array from place
+	// where previous call finished
+	virtual float RebuildFor(std::chrono::microseconds budget) override;
+
+	virtual BroadphaseStatistics GetStatistics() override;
 
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
+	// Nodes store aabbs of entities enlarged by margin and by velocity
+	// multiplied by velocityPrediction, Update does not touch the tree while
+	// new aabb fits inside of enlarged one
+	void SetEnlargedAabbs(bool enabled, float margin = 0.1f,
+						  float velocityPrediction = 1.0f);
+
 private:
+	Aabb EnlargedAabb(const Aabb &aabb, glm::vec3 velocity) const;
+
 	void UpdateAabb(const int32_t nodeId);
 	void UpdateAabbAndMask(const int32_t nodeId);
 	void UpdateAabbSimple(const int32_t nodeId);
 	void UpdateMask(const int32_t nodeId);
 	void RebuildNode(int32_t nodeId);
+	Aabb RefitMarked(int32_t nodeId);
+	int32_t BuildRange(std::span<int32_t> offsets, int32_t begin,
+					   int32_t parent, int32_t threadsCount);
 
 	void FastRebalance();
 	void RebalanceNodesRecursively(int32_t nodeId, int32_t depth);
@@ -83,6 +110,9 @@ private:
 
 	void _Internal_IntersectAabb(AabbCallback &cb, const int32_t nodeId);
 	void _Internal_IntersectRay(RayCallback &cb, const int32_t nodeId);
+	void _Internal_GetStatistics(BroadphaseStatistics &stats,
+								 const int32_t nodeId, int32_t depth,
+								 float surface) const;
 
 	int32_t CountDepth() const;
 	int32_t CountNodes() const;
@@ -111,6 +141,20 @@ private:
 
 	int32_t rootNode = 0;
 	bool fastRebalance = false;
+	// next node to be rebalanced by RebuildFor
+	int32_t rebalanceCursor = 1;
+	// ancestors of entities updated by UpdateBatch
+	std::vector<uint8_t> refitMarks;
+	// used by BulkLoad
+	std::vector<int32_t> buildOffsets;
+	std::vector<glm::vec3> buildCenters;
+
+	// enlarged aabbs of entities indexed by offset, used only when
+	// enlargedAabbs is set
+	std::vector<Aabb> fatAabbs;
+	float fatMargin = 0.0f;
+	float fatVelocityPrediction = 0.0f;
+	bool enlargedAabbs = false;
 
 	class Iterator final : public BroadphaseBaseIterator
 	{
@@ -31,12 +31,33 @@ public:
 	virtual void ShrinkToFit() override;
 
 	void IncrementalOptimize(int iterations);
+	// SAH driven reinsertion of the worst nodes, returns number of
+	// reinserted nodes
+	int32_t SahOptimize(std::chrono::microseconds budget);
+	// Budget of SahOptimize executed with each incremental optimisation,
+	// 0 disables it
+	void SetSahOptimizeBudget(std::chrono::microseconds budget);
+	// Leaves store aabbs enlarged by margin and by velocity multiplied by
+	// velocityPrediction, Update is skipped while new aabb fits inside of
+	// enlarged one
+	void SetEnlargedAabbs(bool enabled, float margin = 0.1f,
+						  float velocityPrediction = 1.0f);
 
 	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
 	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Update(EntityType entity, Aabb aabb,
+						glm::vec3 velocity) override;
 	virtual void Remove(EntityType entity) override;
 	virtual void SetMask(EntityType entity, MaskType mask) override;
 
+	virtual void
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities) override;
+
+	// Builds tree top-down with median splits, upper levels spawn threads
+	virtual void BulkLoad(std::span<const EntityType> entities,
+						  std::span<const Aabb> aabbs,
+						  std::span<const MaskType> masks) override;
+
 	virtual int32_t GetCount() const override;
 	virtual bool Exists(EntityType entity) const override;
 
@@ -47,6 +68,10 @@ public:
 	virtual void IntersectRay(RayCallback &callback) override;
 
 	virtual void Rebuild() override;
+	// Rebuild is a single incremental optimisation pass over all leaves
+	virtual float RebuildFor(std::chrono::microseconds budget) override;
+
+	virtual BroadphaseStatistics GetStatistics() override;
 
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
@@ -64,6 +89,12 @@ private:
 	btDbvt<SPP_TEMPLATE_ARGS_OFFSET> dbvt;
 
 	size_t requiresRebuild = 0;
+	std::chrono::microseconds sahOptimizeBudget{0};
+	// used by RebuildFor
+	int32_t rebuildForPassesLeft = 0;
+	int32_t rebuildForPassesTotal = 0;
+	// used by UpdateBatch
+	std::vector<OffsetType> batchOffsets;
 
 	class Iterator final : public BroadphaseBaseIterator
 	{
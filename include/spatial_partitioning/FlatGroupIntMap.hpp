@@ -0,0 +1,278 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <bit>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace spp
+{
+/*
+ * Open addressing map of integer keys with one control byte per slot (7 bits
+ * of hash, empty or deleted marker). Lookup compares control bytes of whole
+ * group of slots at once (SSE2 when available, 64 bit SWAR otherwise), keys
+ * are compared only for matching control bytes. Keys are mixed before use,
+ * so structured keys (ex. Morton codes) do not cluster. Keys and values are
+ * stored in single array, so there is no allocation per entry. References to
+ * values are invalidated only by inserting new keys.
+ */
+template <typename KeyUIntType, typename ValueType>
+class FlatGroupIntMap final
+{
+public:
+	inline FlatGroupIntMap() {}
+	inline ~FlatGroupIntMap() {}
+
+	inline FlatGroupIntMap(const FlatGroupIntMap &) = default;
+	inline FlatGroupIntMap(FlatGroupIntMap &) = default;
+	inline FlatGroupIntMap(FlatGroupIntMap &&) = default;
+
+	inline void Clear()
+	{
+		ctrl.clear();
+		entries.clear();
+		size = 0;
+		tombstones = 0;
+		mask = 0;
+	}
+
+	inline void Reserve(size_t capacity)
+	{
+		if (capacity * 2 > entries.size()) {
+			Rehash(capacity);
+		}
+	}
+
+	// Returns value of key, inserts default constructed value if not present
+	inline ValueType &operator[](KeyUIntType key)
+	{
+		if (ValueType *v = find(key)) {
+			return *v;
+		}
+		if ((size + tombstones + 1) * 8 > entries.size() * 7) {
+			Rehash(size + 1);
+		}
+		const uint64_t h = Hash(key);
+		for (size_t pos = (h >> 7) & mask & ~(GROUP - 1);;
+			 pos = (pos + GROUP) & mask) {
+			const auto bits = MatchEmptyOrDeleted(pos);
+			if (bits) {
+				const size_t i = pos + std::countr_zero(bits) / SLOT_BITS;
+				if (ctrl[i] == CTRL_DELETED) {
+					--tombstones;
+				}
+				ctrl[i] = h & 0x7F;
+				entries[i].key = key;
+				entries[i].value = {};
+				++size;
+				return entries[i].value;
+			}
+		}
+	}
+
+	inline bool Remove(KeyUIntType key)
+	{
+		const size_t i = FindSlot(key);
+		if (i == NOT_FOUND) {
+			return false;
+		}
+		// Probing of any key stops at group with empty slot, so slot of such
+		// group does not need tombstone.
+		if (MatchEmpty(i & ~(GROUP - 1))) {
+			ctrl[i] = CTRL_EMPTY;
+		} else {
+			ctrl[i] = CTRL_DELETED;
+			++tombstones;
+		}
+		entries[i].value = {};
+		--size;
+		return true;
+	}
+
+	inline ValueType *find(KeyUIntType key)
+	{
+		return (ValueType *)(((const FlatGroupIntMap *)this)->find(key));
+	}
+
+	inline const ValueType *find(KeyUIntType key) const
+	{
+		const size_t i = FindSlot(key);
+		return i == NOT_FOUND ? nullptr : &entries[i].value;
+	}
+
+	inline bool Has(KeyUIntType key) const { return find(key) != nullptr; }
+
+	// func(KeyUIntType key, const ValueType &value)
+	template <typename F> inline void ForEach(F &&func) const
+	{
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (ctrl[i] >= 0) {
+				func(entries[i].key, entries[i].value);
+			}
+		}
+	}
+
+	__attribute__((noinline)) void ShrinkToFit()
+	{
+		if (size == 0) {
+			Clear();
+			ctrl.shrink_to_fit();
+			entries.shrink_to_fit();
+		} else if (size * 8 < entries.size() || tombstones) {
+			Rehash(size);
+		}
+	}
+
+	inline size_t Size() const { return size; }
+	// Slots of removed keys in groups without empty slot, reused by inserts
+	// and dropped by rehash
+	inline size_t GetTombstonesCount() const { return tombstones; }
+
+	inline size_t GetMemoryUsage() const
+	{
+		return ctrl.capacity() + entries.capacity() * sizeof(Entry);
+	}
+
+private:
+#if defined(__SSE2__)
+	static constexpr size_t GROUP = 16;
+	static constexpr size_t SLOT_BITS = 1;
+#else
+	static constexpr size_t GROUP = 8;
+	static constexpr size_t SLOT_BITS = 8;
+	static constexpr uint64_t LSBS = 0x0101010101010101llu;
+	static constexpr uint64_t MSBS = 0x8080808080808080llu;
+#endif
+	static constexpr int8_t CTRL_EMPTY = -128;
+	static constexpr int8_t CTRL_DELETED = -2;
+	static constexpr size_t NOT_FOUND = ~(size_t)0;
+
+	static inline uint64_t Hash(KeyUIntType key)
+	{
+		// murmur3 finalizer
+		uint64_t h = key;
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDllu;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53llu;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// Bitmasks of slots in group starting at pos, slot n is bit n*SLOT_BITS.
+	// SWAR variant of Match may report false positives, keys are compared
+	// anyway.
+#if defined(__SSE2__)
+	inline uint32_t Match(size_t pos, int8_t h2) const
+	{
+		const __m128i g = _mm_loadu_si128((const __m128i *)(ctrl.data() + pos));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+	}
+
+	inline uint32_t MatchEmpty(size_t pos) const
+	{
+		const __m128i g = _mm_loadu_si128((const __m128i *)(ctrl.data() + pos));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(CTRL_EMPTY)));
+	}
+
+	inline uint32_t MatchEmptyOrDeleted(size_t pos) const
+	{
+		const __m128i g = _mm_loadu_si128((const __m128i *)(ctrl.data() + pos));
+		return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), g));
+	}
+#else
+	inline uint64_t Load(size_t pos) const
+	{
+		uint64_t g;
+		memcpy(&g, ctrl.data() + pos, sizeof(g));
+		if constexpr (std::endian::native == std::endian::big) {
+			g = __builtin_bswap64(g);
+		}
+		return g;
+	}
+
+	inline uint64_t Match(size_t pos, int8_t h2) const
+	{
+		const uint64_t x = Load(pos) ^ (LSBS * (uint8_t)h2);
+		return (x - LSBS) & ~x & MSBS;
+	}
+
+	inline uint64_t MatchEmpty(size_t pos) const
+	{
+		const uint64_t g = Load(pos);
+		return g & ~(g << 6) & MSBS;
+	}
+
+	inline uint64_t MatchEmptyOrDeleted(size_t pos) const
+	{
+		const uint64_t g = Load(pos);
+		return g & ~(g << 7) & MSBS;
+	}
+#endif
+
+	inline size_t FindSlot(KeyUIntType key) const
+	{
+		if (size == 0) {
+			return NOT_FOUND;
+		}
+		const uint64_t h = Hash(key);
+		for (size_t pos = (h >> 7) & mask & ~(GROUP - 1);;
+			 pos = (pos + GROUP) & mask) {
+			for (auto bits = Match(pos, h & 0x7F); bits; bits &= bits - 1) {
+				const size_t i = pos + std::countr_zero(bits) / SLOT_BITS;
+				if (entries[i].key == key) {
+					return i;
+				}
+			}
+			if (MatchEmpty(pos)) {
+				return NOT_FOUND;
+			}
+		}
+	}
+
+	// Rebuilds table with capacity of at least 2 * count, drops tombstones
+	void Rehash(size_t count)
+	{
+		size_t capacity = GROUP * 2;
+		while (capacity < count * 2) {
+			capacity <<= 1;
+		}
+		std::vector<int8_t> oldCtrl;
+		std::vector<Entry> old;
+		oldCtrl.swap(ctrl);
+		old.swap(entries);
+		ctrl.resize(capacity, CTRL_EMPTY);
+		entries.resize(capacity);
+		mask = capacity - 1;
+		size = 0;
+		tombstones = 0;
+		for (size_t i = 0; i < old.size(); ++i) {
+			if (oldCtrl[i] >= 0) {
+				(*this)[old[i].key] = std::move(old[i].value);
+			}
+		}
+	}
+
+private:
+	struct Entry {
+		KeyUIntType key = 0;
+		ValueType value = {};
+	};
+
+	std::vector<int8_t> ctrl;
+	std::vector<Entry> entries;
+	size_t size = 0;
+	size_t tombstones = 0;
+	size_t mask = 0;
+};
+} // namespace spp
@@ -0,0 +1,167 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <vector>
+
+namespace spp
+{
+/*
+ * Open addressing (linear probing) map of integer keys, all entries are
+ * stored in single array. EMPTY_KEY cannot be used as key. Removal shifts
+ * following entries back, so there are no tombstones.
+ */
+template <typename KeyUIntType, typename ValueType, KeyUIntType EMPTY_KEY = 0>
+class FlatIntMap final
+{
+public:
+	inline FlatIntMap() {}
+	inline ~FlatIntMap() {}
+
+	inline FlatIntMap(const FlatIntMap &) = default;
+	inline FlatIntMap(FlatIntMap &) = default;
+	inline FlatIntMap(FlatIntMap &&) = default;
+
+	inline void Clear()
+	{
+		entries.clear();
+		size = 0;
+		mask = 0;
+	}
+
+	inline void Reserve(size_t capacity)
+	{
+		if (capacity * 2 > entries.size()) {
+			Rehash(capacity);
+		}
+	}
+
+	inline void Set(KeyUIntType key, ValueType value)
+	{
+		assert(key != EMPTY_KEY);
+		if ((size + 1) * 2 > entries.size()) {
+			Rehash(size + 1);
+		}
+		for (size_t i = Hash(key);; i = (i + 1) & mask) {
+			Entry &e = entries[i];
+			if (e.key == key) {
+				e.value = value;
+				return;
+			} else if (e.key == EMPTY_KEY) {
+				e.key = key;
+				e.value = value;
+				++size;
+				return;
+			}
+		}
+	}
+
+	inline void Remove(KeyUIntType key)
+	{
+		if (size == 0) {
+			return;
+		}
+		size_t i = Hash(key);
+		for (;; i = (i + 1) & mask) {
+			if (entries[i].key == key) {
+				break;
+			} else if (entries[i].key == EMPTY_KEY) {
+				return;
+			}
+		}
+		// move back entries which probe sequence passes through removed slot
+		for (size_t j = (i + 1) & mask;; j = (j + 1) & mask) {
+			if (entries[j].key == EMPTY_KEY) {
+				break;
+			}
+			const size_t home = Hash(entries[j].key);
+			if (((j - home) & mask) >= ((j - i) & mask)) {
+				entries[i] = entries[j];
+				i = j;
+			}
+		}
+		entries[i].key = EMPTY_KEY;
+		--size;
+	}
+
+	inline ValueType *find(KeyUIntType key)
+	{
+		return (ValueType *)(((const FlatIntMap *)this)->find(key));
+	}
+
+	inline const ValueType *find(KeyUIntType key) const
+	{
+		if (size == 0) {
+			return nullptr;
+		}
+		for (size_t i = Hash(key);; i = (i + 1) & mask) {
+			const Entry &e = entries[i];
+			if (e.key == key) {
+				return &e.value;
+			} else if (e.key == EMPTY_KEY) {
+				return nullptr;
+			}
+		}
+	}
+
+	inline bool Has(KeyUIntType key) const { return find(key) != nullptr; }
+
+	__attribute__((noinline)) void ShrinkToFit()
+	{
+		if (size == 0) {
+			Clear();
+			entries.shrink_to_fit();
+		} else if (size * 8 < entries.size()) {
+			Rehash(size);
+		}
+	}
+
+	inline size_t Size() const { return size; }
+
+	inline size_t GetMemoryUsage() const
+	{
+		return entries.capacity() * sizeof(Entry);
+	}
+
+private:
+	inline size_t Hash(KeyUIntType key) const
+	{
+		// fibonacci hashing, keys of neighbouring chunks are spread
+		return (size_t(uint64_t(key) * 0x9E3779B97F4A7C15llu >> 32)) & mask;
+	}
+
+	// Rebuilds table with capacity of at least 2 * count
+	void Rehash(size_t count)
+	{
+		size_t capacity = 16;
+		while (capacity < count * 2) {
+			capacity <<= 1;
+		}
+		std::vector<Entry> old;
+		old.swap(entries);
+		entries.resize(capacity, Entry{EMPTY_KEY, {}});
+		mask = capacity - 1;
+		size = 0;
+		for (const Entry &e : old) {
+			if (e.key != EMPTY_KEY) {
+				Set(e.key, e.value);
+			}
+		}
+	}
+
+private:
+	struct Entry {
+		KeyUIntType key;
+		ValueType value;
+	};
+
+	std::vector<Entry> entries;
+	size_t size = 0;
+	size_t mask = 0;
+};
+} // namespace spp
@@ -6,11 +6,10 @@
 
 #include <cstdint>
 
-#include <unordered_map>
-
 #include "../../glm/glm/ext/vector_int3.hpp"
 
 #include "AssociativeArray.hpp"
+#include "FlatGroupIntMap.hpp"
 #include "BroadPhaseBase.hpp"
 
 namespace spp
@@ -20,8 +19,11 @@ namespace experimental
 /*
  * Max objects count: 2<<30
  *
- * Restrict positions ranges to less than 2^21 * resolution.
- * Position ranges cannot be more than +-2^31 * resolution.
+ * Positions need to be in range of +-2^20 * resolution, levels cannot be
+ * more than 20.
+ *
+ * Nodes are stored in flat hash table keyed by Morton code of node position
+ * prefixed with level marker bit.
  */
 SPP_TEMPLATE_DECL
 class HashLooseOctree final : public BroadphaseBase<SPP_TEMPLATE_ARGS>
@@ -58,22 +60,37 @@ public:
 
 	virtual void Rebuild() override;
 
+	virtual BroadphaseStatistics GetStatistics() override;
+
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
 private:
-	static int32_t FindBestPrime(int32_t capacity);
 	// value of level should be 0 initially
 	int32_t CalcHashMinLevel(Aabb aabb);
-	uint64_t Hash(const glm::vec3 pos, int32_t level) const;
-	uint64_t Hash(const glm::ivec3 pos, int32_t level) const;
+	glm::ivec3 CalcLocalPos(Aabb aabb) const;
+	// key of node containing local position pos at level, all levels above
+	// levels map to single node of objects not fitting into octree
+	uint64_t NodeKey(glm::ivec3 pos, int32_t level) const;
+	static void DecodeNodeKey(uint64_t key, glm::ivec3 &pos, int32_t &level);
+	static int32_t ChildId(glm::ivec3 pos, int32_t level);
+
+	// Links entity into node at level and increments children counts of its
+	// ancestors below untilLevel, UnlinkNode reverts that and removes empty
+	// nodes.
+	void LinkNode(int32_t offset, glm::ivec3 pos, int32_t level,
+				  int32_t untilLevel);
+	void UnlinkNode(int32_t offset, glm::ivec3 pos, int32_t level,
+					int32_t untilLevel);
 
 	static Aabb CalcLocalAabbOfNode(glm::ivec3 pos, int32_t level);
+	spp::Aabb CalcLocalLooseAabbOfNode(glm::ivec3 pos, int32_t level) const;
+	// loose bounds of node in world space
+	spp::Aabb CalcLooseAabbOfNode(glm::ivec3 pos, int32_t level) const;
 
 	void _Internal_IntersectAabb(AabbCallback &cb, glm::ivec3 pos,
 								 int32_t level, const Aabb &cbaabb);
 	void _Inernal_IntersectAabbIterateOverData(AabbCallback &cb,
-											   int32_t firstNode,
-											   const Aabb &cbaabb);
+											   int32_t firstNode);
 
 	void _Internal_IntersectRay(RayCallback &cb, glm::ivec3 pos, int32_t level);
 	void _Inernal_IntersectRayIterateOverData(RayCallback &cb,
@@ -96,46 +113,13 @@ private:
 		inline bool HasIndirectChildren() const
 		{
 			const int64_t *v = (const int64_t *)childrenInNodesCounts;
-			return v[0] | v[0] | v[2] | v[3];
+			return v[0] | v[1] | v[2] | v[3];
 		};
 	};
 
 	AssociativeArray<EntityType, int32_t, Data> data;
 
-	struct Key {
-		Key(const Key &o) : pos(o.pos), level(o.level) {}
-		Key(const HashLooseOctree<SPP_TEMPLATE_ARGS> *bp, glm::ivec3 pos,
-			int32_t level)
-			: pos(pos >> level), level(level)
-		{
-			if (level > bp->levels) {
-				pos = {0, 0, 0};
-				level = bp->levels + 1;
-			}
-		}
-		inline bool operator==(const Key &o) const
-		{
-			return pos == o.pos && level == o.level;
-		}
-		struct Hash {
-		public:
-			Hash(const Hash &o) : bp(o.bp) {}
-			Hash(HashLooseOctree<SPP_TEMPLATE_ARGS> *bp) : bp(bp) {}
-			HashLooseOctree<SPP_TEMPLATE_ARGS> *bp;
-			size_t operator()(const Key &v) const
-			{
-				return bp->Hash(v.pos, v.level);
-			}
-		};
-
-	private:
-		glm::ivec3 pos;
-		int32_t level;
-	};
-
-	std::unordered_map<Key, NodeData,
-					   typename HashLooseOctree<SPP_TEMPLATE_ARGS>::Key::Hash>
-		nodes;
+	FlatGroupIntMap<uint64_t, NodeData> nodes;
 
 public:
 	const float loosenessFactor;
@@ -21,8 +21,12 @@ misrepresented as being the original software.
 
 #pragma once
 
+#include <chrono>
+#include <span>
+
 #include "IntersectionCallbacks.hpp"
 #include "AssociativeArray.hpp"
+#include "BroadPhaseBase.hpp"
 
 namespace spp
 {
@@ -42,11 +46,50 @@ public:
 	void clear();
 	bool empty() const { return (0 == rootId); }
 	void optimizeIncremental(int passes);
+	/*
+	 * Reinserts internal nodes with the worst SAH inefficiency (Bittner et
+	 * al. 2013): node is detached, its both subtrees are reinserted at best
+	 * sibling found with branch-and-bound search. Stops when budget is used,
+	 * next call continues from where previous one stopped.
+	 * Returns number of reinserted nodes.
+	 */
+	int optimizeSah(std::chrono::nanoseconds budget);
 
 	void insert(const Aabb &aabb, OffsetType entityOffset);
+	/*
+	 * Builds tree of empty btDbvt top-down from all given entities (aabbs
+	 * need to be already stored in ents). Each range of leaves is split at
+	 * median of centers along longest axis. Internal node is identified by
+	 * position of its split, so that nodes can be created by many threads
+	 * without synchronisation.
+	 */
+	void build(std::span<OffsetType> entityOffsets, int32_t threadsCount);
+
+	/*
+	 * When enabled leaves store enlarged aabbs: exact aabb expanded by margin
+	 * and by velocity multiplied by velocityPrediction. Exact aabbs are still
+	 * used for tests of leaves in queries.
+	 */
+	void setEnlargedAabbs(bool enabled, float margin, float velocityPrediction);
+	bool isEnlargedAabbs() const { return enlargedAabbs; }
+	/*
+	 * Returns false when enlarged aabb of leaf still contains new exact aabb
+	 * (already stored in ents) and leaf does not need to be updated.
+	 * Otherwise recalculates enlarged aabb and returns true.
+	 */
+	bool updateEnlargedAabb(OffsetType entityOffset, const glm::vec3 &velocity);
 
 	void updateLeaf(OffsetType leaf, int lookahead = -1);
 	void updateEntityOffset(OffsetType entityOffset, const Aabb &aabb);
+	/*
+	 * Updates leaves of many entities (aabbs need to be already stored in
+	 * ents). Leaves still contained by their parents stay in place and their
+	 * ancestors are refitted once with single pass over affected subtrees.
+	 * Other leaves are removed first and reinserted in Morton order of their
+	 * centers, so that consecutive insertions descend through the same
+	 * subtrees.
+	 */
+	void updateEntityOffsets(std::span<const OffsetType> entityOffsets);
 	void remove(OffsetType entityOffset);
 
 	void updateOffsetOfEntity(OffsetType oldEntityOffset,
@@ -56,6 +99,7 @@ public:
 	void rayTestInternal(RayCallback &cb);
 
 	size_t GetMemoryUsage() const;
+	void getStatistics(BroadphaseStatistics &stats) const;
 
 	void IsTreeValid(OffsetType node = 0) const;
 	bool ContainsRecurence(OffsetType node, OffsetType rel = 0) const;
@@ -88,6 +132,8 @@ protected:
 	Aabb getAabb(OffsetType node) const;
 	OffsetType getParent(OffsetType node) const;
 	Aabb getLeafAabb(OffsetType leaf) const;
+	Aabb getLeafEntityAabb(OffsetType leaf) const;
+	Aabb enlargedAabb(const Aabb &aabb, const glm::vec3 &velocity) const;
 	OffsetType getLeafParent(OffsetType leaf) const;
 	Aabb getNodeAabb(OffsetType node) const;
 	OffsetType getNodeParent(OffsetType node) const;
@@ -106,6 +152,14 @@ protected:
 	OffsetType removeleaf(OffsetType leaf);
 	OffsetType sort(OffsetType n, OffsetType &r);
 
+	void refitUpwards(OffsetType node);
+	Aabb refitMarked(OffsetType node);
+	void detachNode(OffsetType node);
+	void insertSubtree(OffsetType sub);
+	OffsetType findBestSibling(const Aabb &aabb);
+	OffsetType buildRange(std::span<OffsetType> entityOffsets, size_t begin,
+						  OffsetType parent, int32_t threadsCount);
+
 protected:
 	OffsetType rootId = 0;
 	unsigned m_opath = 0;
@@ -114,7 +168,29 @@ protected:
 					 spp::btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::Data, false> *ents;
 	std::vector<NodeData> nodes;
 
-	std::vector<OffsetType> stack;
+	struct SahEntry {
+		float cost;
+		OffsetType node;
+		bool operator<(const SahEntry &o) const { return cost > o.cost; }
+	};
+	std::vector<SahEntry> sahQueue;
+	std::vector<SahEntry> sahCandidates;
+	size_t sahCursor = 1;
+
+	// used by updateEntityOffsets
+	std::vector<std::pair<uint32_t, OffsetType>> batchMoved;
+	std::vector<OffsetType> batchInPlace;
+	std::vector<uint8_t> refitMarks;
+
+	// used by build, centers of entities indexed by entity offset
+	std::vector<glm::vec3> buildCenters;
+
+	// enlarged aabbs of leaves indexed by entity offset, used only when
+	// enlargedAabbs is set
+	std::vector<Aabb> fatAabbs;
+	float fatMargin = 0.0f;
+	float fatVelocityPrediction = 0.0f;
+	bool enlargedAabbs = false;
 
 	/*
 	 * nodes[0] - first emtpty node id holder
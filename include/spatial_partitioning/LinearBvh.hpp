@@ -0,0 +1,128 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "DenseSparseIntMap.hpp"
+#include "BroadPhaseBase.hpp"
+
+namespace spp
+{
+/*
+ * Linear BVH (Karras 2012):
+ * 	Entities are sorted by Morton code of their centers using parallel LSD
+ * 	radix sort, internal nodes are derived from sorted codes by Karras split
+ * 	method and node aabbs are refitted bottom-up in parallel.
+ * Build is O(n) and scales with cores, tree quality is worse than
+ * BvhMedianSplitHeap. Intended for structures rebuilt very often (as
+ * optimised/rebuilding stage of ThreeStageDbvh).
+ *
+ * 30 bit Morton codes are used for up to 262144 entities, 63 bit otherwise.
+ *
+ * Newly added entities are tested by brute force until next Rebuild().
+ * Update extends ancestors aabbs without restructuring tree.
+ */
+SPP_TEMPLATE_DECL
+class LinearBvh final : public BroadphaseBase<SPP_TEMPLATE_ARGS>
+{
+public:
+	using AabbCallback = spp::AabbCallback<SPP_TEMPLATE_ARGS>;
+	using RayCallback = spp::RayCallback<SPP_TEMPLATE_ARGS>;
+	using BroadphaseBaseIterator =
+		spp::BroadphaseBaseIterator<SPP_TEMPLATE_ARGS>;
+
+	LinearBvh(EntityType denseEntityRange);
+	virtual ~LinearBvh();
+
+	virtual const char *GetName() const override;
+
+	virtual void Clear() override;
+	virtual size_t GetMemoryUsage() const override;
+	virtual void ShrinkToFit() override;
+
+	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
+	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Remove(EntityType entity) override;
+	virtual void SetMask(EntityType entity, MaskType mask) override;
+
+	virtual int32_t GetCount() const override;
+	virtual bool Exists(EntityType entity) const override;
+
+	virtual Aabb GetAabb(EntityType entity) const override;
+	virtual MaskType GetMask(EntityType entity) const override;
+
+	virtual void IntersectAabb(AabbCallback &callback) override;
+	virtual void IntersectRay(RayCallback &callback) override;
+
+	virtual void Rebuild() override;
+
+	virtual BroadphaseBaseIterator *RestartIterator() override;
+
+	// 0 - use std::thread::hardware_concurrency()
+	void SetThreadsCount(int32_t threadsCount);
+
+private:
+	struct BuildSharedData;
+	void BuildThread(int32_t threadId, BuildSharedData &shared);
+	void UpdateMasksUpwards(int32_t leaf);
+	void ExtendUpwards(int32_t leaf, Aabb aabb);
+
+private:
+	inline const static uint32_t LEAF_BIT = 0x80000000u;
+	inline const static uint32_t NONE = 0xFFFFFFFFu;
+
+	struct Data {
+		Aabb aabb;
+		EntityType entity;
+		MaskType mask;
+	};
+
+	struct NodeData {
+		Aabb aabb;
+		MaskType mask;
+		uint32_t parent;
+		uint32_t children[2];
+	};
+
+	DenseSparseIntMap<EntityType, int32_t, true, -1> entitiesOffsets;
+
+	std::vector<Data> entitiesData;
+	std::vector<NodeData> nodes;
+	std::vector<uint32_t> leafParents;
+
+	std::vector<uint64_t> mortonCodes;
+	std::vector<int32_t> sortedIndices;
+	std::vector<Data> tmpEntitiesData;
+	std::vector<uint32_t> visits;
+
+	int32_t leavesCount = 0;
+	int32_t entitiesCount = 0;
+	int32_t maxNumberOfBruteforceEntities = 16;
+	int32_t threadsCount = 0;
+	bool rebuildTree = false;
+
+	class Iterator final : public BroadphaseBaseIterator
+	{
+	public:
+		Iterator(LinearBvh &bp);
+		virtual ~Iterator();
+
+		Iterator &operator=(Iterator &&other) = default;
+
+		virtual bool Next() override;
+		virtual bool Valid() override;
+		bool FetchData();
+
+		std::vector<Data> *data;
+		int it;
+	} iterator;
+};
+
+SPP_EXTERN_VARIANTS(LinearBvh)
+
+} // namespace spp
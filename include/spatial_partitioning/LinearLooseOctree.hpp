@@ -0,0 +1,170 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "../../glm/glm/ext/vector_int3.hpp"
+
+#include "AssociativeArray.hpp"
+#include "BroadPhaseBase.hpp"
+
+namespace spp
+{
+namespace experimental
+{
+/*
+ * Loose octree without pointers between nodes. Nodes (occupied ones and all
+ * their ancestors) are stored in single array in preorder of Morton code of
+ * their position, so subtree of node is range of following nodes ended by
+ * its skip index. Entities of node are stored contiguously in single array.
+ *
+ * Entities added or moved out of their node are kept in pending list, which
+ * is scanned linearly by queries, until Rebuild() regroups all entities. Call
+ * Rebuild() at the end of each tick, it is also called automatically when
+ * pending list grows too large.
+ *
+ * Positions need to be in range of +-2^20 * resolution, entities outside of
+ * it are treated as not fitting into octree. Levels cannot be more than 20.
+ */
+SPP_TEMPLATE_DECL
+class LinearLooseOctree final : public BroadphaseBase<SPP_TEMPLATE_ARGS>
+{
+public:
+	using AabbCallback = spp::AabbCallback<SPP_TEMPLATE_ARGS>;
+	using RayCallback = spp::RayCallback<SPP_TEMPLATE_ARGS>;
+	using BroadphaseBaseIterator =
+		spp::BroadphaseBaseIterator<SPP_TEMPLATE_ARGS>;
+
+	LinearLooseOctree(float resolution, int32_t levels,
+					  float loosenessFactor = 1.5);
+	virtual ~LinearLooseOctree();
+
+	virtual const char *GetName() const override;
+
+	virtual void Clear() override;
+	virtual size_t GetMemoryUsage() const override;
+	virtual void ShrinkToFit() override;
+
+	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
+	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Remove(EntityType entity) override;
+	virtual void SetMask(EntityType entity, MaskType mask) override;
+
+	virtual int32_t GetCount() const override;
+	virtual bool Exists(EntityType entity) const override;
+
+	virtual Aabb GetAabb(EntityType entity) const override;
+	virtual MaskType GetMask(EntityType entity) const override;
+
+	virtual void IntersectAabb(AabbCallback &callback) override;
+	virtual void IntersectRay(RayCallback &callback) override;
+
+	// Regroups entities into nodes
+	virtual void Rebuild() override;
+
+	virtual BroadphaseStatistics GetStatistics() override;
+
+	virtual BroadphaseBaseIterator *RestartIterator() override;
+
+private:
+	struct NodeKey {
+		// Morton code of minimal corner of node at level 0
+		uint64_t code;
+		int32_t level;
+
+		inline bool operator==(const NodeKey &o) const
+		{
+			return code == o.code && level == o.level;
+		}
+		// preorder, parents before their descendants
+		inline bool operator<(const NodeKey &o) const
+		{
+			return code < o.code || (code == o.code && level > o.level);
+		}
+	};
+
+	// returns false for entities not fitting into octree
+	bool CalcNodeKey(Aabb aabb, NodeKey &key) const;
+	bool IsSameNode(Aabb a, Aabb b) const;
+
+	void AddToPending(int32_t offset);
+	void RemoveFromPending(int32_t offset);
+	// Moves entity from its node to pending list
+	void DetachFromNode(int32_t offset);
+	void RebuildIfNeeded();
+
+	spp::Aabb CalcLocalLooseAabbOfNode(int32_t nodeId) const;
+
+private:
+	struct Data {
+		AabbCentered aabb;
+		EntityType entity = 0;
+		MaskType mask = 0;
+		// offset in entities, -1 when pending
+		int32_t slot = -1;
+		int32_t pendingId = -1;
+	};
+
+	struct Entity {
+		AabbCentered aabb;
+		EntityType entity = 0;
+		MaskType mask = 0;
+	};
+
+	struct NodeData {
+		// minimal corner in local units
+		glm::ivec3 pos;
+		int32_t level;
+		int32_t firstEntity;
+		int32_t entitiesCount;
+		// first node after subtree of this node
+		int32_t skip;
+		// sum of masks of subtree
+		MaskType mask;
+	};
+
+	AssociativeArray<EntityType, int32_t, Data> data;
+
+	// entities not fitting into octree first, then entities of nodes in order
+	// of nodes
+	std::vector<Entity> entities;
+	int32_t bigEntitiesCount = 0;
+	// entities removed from their slots since last Rebuild()
+	int32_t deadEntitiesCount = 0;
+	std::vector<NodeData> nodes;
+	std::vector<int32_t> pending;
+
+public:
+	const float loosenessFactor;
+	const float invLoosenessFactor;
+	const float resolution;
+	const float invResolution;
+
+	const int32_t levels;
+
+	class Iterator final : public BroadphaseBaseIterator
+	{
+	public:
+		Iterator(LinearLooseOctree &bp);
+		virtual ~Iterator();
+
+		Iterator &operator=(Iterator &&other) = default;
+
+		virtual bool Next() override;
+		virtual bool Valid() override;
+		bool FetchData();
+
+		std::vector<Data> *data;
+		int it;
+	} iterator;
+};
+
+SPP_EXTERN_VARIANTS(LinearLooseOctree)
+
+} // namespace experimental
+} // namespace spp
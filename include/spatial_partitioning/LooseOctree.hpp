@@ -54,6 +54,8 @@ public:
 
 	virtual void Rebuild() override;
 
+	virtual BroadphaseStatistics GetStatistics() override;
+
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
 private:
@@ -68,6 +70,8 @@ private:
 	void _Internal_IntersectAabb(AabbCallback &cb, const int32_t nodeId);
 	void _Internal_IntersectRay(RayCallback &cb, const int32_t nodeId,
 								int32_t level);
+	void _Internal_GetStatistics(BroadphaseStatistics &stats,
+								 const int32_t nodeId, int32_t depth) const;
 
 	// 	int32_t GetChildIdFromCenter(glm::vec3 p) const;
 	// 	glm::vec3 GetCenterOffset(int32_t depth);
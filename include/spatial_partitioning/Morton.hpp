@@ -0,0 +1,34 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cstdint>
+
+namespace spp
+{
+// spreads lower 21 bits of v to every third bit
+inline uint64_t SpreadBits3(uint64_t v)
+{
+	v &= 0x1FFFFF;
+	v = (v | v << 32) & 0x1F00000000FFFFllu;
+	v = (v | v << 16) & 0x1F0000FF0000FFllu;
+	v = (v | v << 8) & 0x100F00F00F00F00Fllu;
+	v = (v | v << 4) & 0x10C30C30C30C30C3llu;
+	v = (v | v << 2) & 0x1249249249249249llu;
+	return v;
+}
+
+// inverse of SpreadBits3, gathers every third bit into lower 21 bits
+inline uint64_t CompactBits3(uint64_t v)
+{
+	v &= 0x1249249249249249llu;
+	v = (v ^ (v >> 2)) & 0x10C30C30C30C30C3llu;
+	v = (v ^ (v >> 4)) & 0x100F00F00F00F00Fllu;
+	v = (v ^ (v >> 8)) & 0x1F0000FF0000FFllu;
+	v = (v ^ (v >> 16)) & 0x1F00000000FFFFllu;
+	v = (v ^ (v >> 32)) & 0x1FFFFFllu;
+	return v;
+}
+} // namespace spp
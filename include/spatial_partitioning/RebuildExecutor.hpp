@@ -0,0 +1,70 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spp
+{
+/*
+ * Background executor of asynchronous rebuilds (ex. of ThreeStageDbvh).
+ * 	Workers sleep on condition variable until rebuild is enqueued, pending
+ * 	rebuild with highest priority (number of entities) is executed first.
+ * 	Destructor stops workers after their current rebuilds, pending rebuilds
+ * 	are dropped and their finished flags are set, so that their owners do
+ * 	not wait for them forever.
+ */
+class RebuildExecutor final
+{
+public:
+	// threadsCount: 0 - use std::thread::hardware_concurrency()
+	// lowPriority: lower scheduling priority of workers
+	// pinnedCpu: pin workers to given cpu, -1 - do not pin
+	RebuildExecutor(int32_t threadsCount = 1, bool lowPriority = true,
+					int32_t pinnedCpu = -1);
+	~RebuildExecutor();
+
+	RebuildExecutor(const RebuildExecutor &) = delete;
+	RebuildExecutor &operator=(const RebuildExecutor &) = delete;
+
+	// rebuild is called on worker thread, after it finished is set to true.
+	// Dropped rebuild has finished set to true without being called.
+	void Enqueue(int64_t priority, std::shared_ptr<std::atomic<bool>> finished,
+				 std::function<void()> &&rebuild);
+
+	int32_t GetPendingCount();
+	int32_t GetThreadsCount() const;
+
+private:
+	void WorkerThread(bool lowPriority, int32_t pinnedCpu);
+
+private:
+	struct Job {
+		int64_t priority;
+		std::shared_ptr<std::atomic<bool>> finished;
+		std::function<void()> rebuild;
+
+		bool operator<(const Job &other) const
+		{
+			return priority < other.priority;
+		}
+	};
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	// max-heap by priority
+	std::vector<Job> jobs;
+	std::vector<std::thread> threads;
+	bool stop = false;
+};
+} // namespace spp
@@ -0,0 +1,158 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#pragma once
+
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "BroadPhaseBase.hpp"
+
+namespace spp
+{
+/*
+ * Double buffered broadphase for queries concurrent with updates:
+ * 	Single writer thread applies Add/Update/Remove/SetMask/Rebuild/Clear to
+ * 	private copy and logs them, Commit() publishes that copy. Reader threads
+ * 	query last published copy without locks through Reader objects (one per
+ * 	thread). Previously published copy becomes next private copy after all
+ * 	readers, which started before publication, leave it (epoch based
+ * 	reclamation), then logged operations are replayed on it.
+ * Queries and getters of SnapshotBroadphase itself are for writer thread.
+ * Lazy refits of wrapped structures are flushed before publication.
+ * Wrapped structures need to keep published copy unchanged during queries,
+ * structures which QueriesModifyState() (ex. ThreeStageDbvh) are rejected.
+ */
+SPP_TEMPLATE_DECL
+class SnapshotBroadphase final : public BroadphaseBase<SPP_TEMPLATE_ARGS>
+{
+public:
+	using AabbCallback = spp::AabbCallback<SPP_TEMPLATE_ARGS>;
+	using RayCallback = spp::RayCallback<SPP_TEMPLATE_ARGS>;
+	using BroadphaseBaseIterator =
+		spp::BroadphaseBaseIterator<SPP_TEMPLATE_ARGS>;
+
+	// a and b need to be empty, configured the same way and their
+	// QueriesModifyState() needs to return false
+	SnapshotBroadphase(std::unique_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> &&a,
+					   std::unique_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> &&b,
+					   int32_t maxReaders = 64);
+	virtual ~SnapshotBroadphase();
+
+	virtual const char *GetName() const override;
+
+	virtual void Clear() override;
+	virtual size_t GetMemoryUsage() const override;
+	virtual void ShrinkToFit() override;
+
+	virtual void Add(EntityType entity, Aabb aabb, MaskType mask) override;
+	virtual void Update(EntityType entity, Aabb aabb) override;
+	virtual void Remove(EntityType entity) override;
+	virtual void SetMask(EntityType entity, MaskType mask) override;
+
+	virtual int32_t GetCount() const override;
+	virtual bool Exists(EntityType entity) const override;
+
+	virtual Aabb GetAabb(EntityType entity) const override;
+	virtual MaskType GetMask(EntityType entity) const override;
+
+	virtual void IntersectAabb(AabbCallback &callback) override;
+	virtual void IntersectRay(RayCallback &callback) override;
+
+	virtual void Rebuild() override;
+
+	virtual BroadphaseStatistics GetStatistics() override;
+
+	virtual BroadphaseBaseIterator *RestartIterator() override;
+
+	// Publishes changes done since last commit to readers
+	void Commit();
+	// Number of commits done, readers observe it via Reader::GetVersion()
+	uint64_t GetVersion() const;
+
+	class Reader final
+	{
+	public:
+		Reader() = default;
+		Reader(Reader &&other);
+		Reader &operator=(Reader &&other);
+		~Reader();
+
+		Reader(const Reader &) = delete;
+		Reader &operator=(const Reader &) = delete;
+
+		// Can be nested (called from within callback of this reader)
+		void IntersectAabb(AabbCallback &callback);
+		void IntersectRay(RayCallback &callback);
+		// Version of last published snapshot
+		uint64_t GetVersion() const;
+
+	private:
+		friend class SnapshotBroadphase;
+		Reader(SnapshotBroadphase *owner, int32_t slot);
+
+		SnapshotBroadphase *owner = nullptr;
+		int32_t slot = -1;
+	};
+
+	// Thread safe, waits until reader slot is released when all are taken
+	Reader CreateReader();
+	// Thread safe, returns false when all reader slots are taken
+	bool TryCreateReader(Reader &reader);
+
+private:
+	// Writable private copy, waits for readers of previous snapshot
+	BroadphaseBase<SPP_TEMPLATE_ARGS> *Writable();
+	// Private copy if it is up to date, published one otherwise
+	BroadphaseBase<SPP_TEMPLATE_ARGS> *Current() const;
+	void WaitForReaders(uint64_t epoch);
+
+private:
+	enum OperationType : uint8_t {
+		OP_ADD,
+		OP_UPDATE,
+		OP_REMOVE,
+		OP_SET_MASK,
+		OP_REBUILD,
+		OP_CLEAR,
+	};
+
+	struct Operation {
+		Aabb aabb;
+		EntityType entity;
+		MaskType mask;
+		OperationType type;
+	};
+
+	struct alignas(64) ReaderSlot {
+		// epoch at which reader started query, 0 when idle
+		std::atomic<uint64_t> epoch = 0;
+		std::atomic<bool> used = false;
+	};
+
+	std::unique_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> structures[2];
+
+	std::atomic<BroadphaseBase<SPP_TEMPLATE_ARGS> *> published;
+	BroadphaseBase<SPP_TEMPLATE_ARGS> *privateCopy = nullptr;
+	// private copy needs replay of replayLog after readers leave it
+	bool privateReady = true;
+	uint64_t reclaimEpoch = 0;
+
+	std::atomic<uint64_t> epoch = 1;
+	std::atomic<uint64_t> version = 0;
+	std::unique_ptr<ReaderSlot[]> slots;
+	int32_t maxReaders = 0;
+
+	// operations since last commit
+	std::vector<Operation> log;
+	// operations of last commit, not yet applied to private copy
+	std::vector<Operation> replayLog;
+};
+
+SPP_EXTERN_VARIANTS(SnapshotBroadphase)
+
+} // namespace spp
@@ -6,8 +6,11 @@
 
 #include <memory>
 #include <atomic>
+#include <tuple>
+#include <vector>
 
 #include "HashMap.hpp"
+#include "RebuildExecutor.hpp"
 #include "BroadPhaseBase.hpp"
 
 namespace spp
@@ -49,9 +52,14 @@ public:
 
 	virtual void IntersectAabb(AabbCallback &callback) override;
 	virtual void IntersectRay(RayCallback &callback) override;
+	// Queries integrate finished rebuilds and account their own cost
+	virtual bool QueriesModifyState() const override;
 
 	virtual void Rebuild() override;
 
+	// Merged statistics of optimised and dynamic stages
+	virtual BroadphaseStatistics GetStatistics() override;
+
 	virtual BroadphaseBaseIterator *RestartIterator() override;
 
 	void SetRebuildSchedulerFunction(
@@ -60,19 +68,61 @@ public:
 			std::shared_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> dbvh,
 			std::shared_ptr<void> data),
 		std::shared_ptr<void> scheduleUpdateUserData = nullptr);
+	// Schedules rebuilds on executor, executor is kept alive by this object
+	void SetRebuildExecutor(std::shared_ptr<RebuildExecutor> executor);
+
+	// Entities of dynamic stage not added/updated for at least ticks calls
+	// of Tick() are sleeping and are moved to optimised stage on rebuild,
+	// entities still moving stay in dynamic stage. 0 - disabled, all
+	// entities are moved on rebuild.
+	void SetSleepingTicks(int32_t ticks);
+	// Advances time used for sleeping entities detection (ex. once per
+	// frame), starts rebuild when many entities fell asleep in dynamic stage.
+	void Tick();
 
 private:
 	void TryIntegrateOptimised();
 	void TryScheduleRebuild();
 
+	static void ScheduleRebuildOnExecutor(
+		std::shared_ptr<std::atomic<bool>> finishedRebuilding,
+		std::shared_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> dbvh,
+		std::shared_ptr<void> executor);
+
+	// Adaptive rebuild triggering: nodes and entities tested per query above
+	// average of queries done while dynamic stage was small (baseline) are
+	// accumulated since last rebuild. Rebuild is started when time of these
+	// excess tests exceeds measured time of last rebuild.
+	void RegisterQueryCost(size_t dynamicTests, size_t optimisedTests);
+	void ResetQueryCost();
+	bool ShouldRebuild() const;
+	bool IsSleeping(EntityType entity) const;
+	void MarkAwake(EntityType entity);
+	void ResetSleeping();
+	template <typename CB> void IntersectMeasured(CB &cb);
+
 private:
 	std::shared_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> dbvhs[2];
 
 	std::shared_ptr<std::atomic<bool>> _finishedRebuilding;
 	std::atomic<bool> *finishedRebuilding;
 	std::shared_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> _rebuild;
-	std::vector<EntityType> toRemoveAfterRebuild;
-	HashMap<EntityType, MaskType> setMaskAfterRebuild;
+
+	enum PendingOperationType : uint8_t {
+		OP_REMOVE,
+		// entity lives in dynamic stage, its copy in rebuilt one is removed
+		OP_DYNAMIC,
+		OP_SET_MASK,
+	};
+	struct PendingOperation {
+		PendingOperationType type;
+		MaskType mask;
+	};
+	// Operations done during rebuild, deduplicated by entity. Entities in
+	// dynamic stage without operation were copied to rebuilt stage unchanged.
+	HashMap<EntityType, PendingOperation> operationsAfterRebuild;
+	std::vector<EntityType> integrationRemoves;
+	std::vector<std::tuple<EntityType, Aabb, MaskType>> integrationDynamic;
 	int32_t optimisedUpdates = 0;
 	int32_t tests = 0;
 	bool clear = false;
@@ -84,6 +134,30 @@ private:
 
 	int32_t dynamicUpdates = 0;
 
+	// tests above baseline since last rebuild
+	double excessTests = 0.0;
+	// average tests per query while dynamic stage is small, negative if
+	// unknown
+	double baselineTests = -1.0;
+	double baselineTestsSum = 0.0;
+	int64_t baselineQueries = 0;
+	// exponential moving average of time of single node/entity test
+	double nanosecondsPerTest = 0.0;
+	// time of last rebuild spent in calling thread, negative if not measured
+	double rebuildNanoseconds = -1.0;
+	uint32_t queriesCount = 0;
+	// size of dynamic stage right after rebuild (awake entities)
+	int32_t dynamicCountAfterRebuild = 0;
+
+	// tick of last add/update of entities, may contain entities that are
+	// already in optimised stage
+	HashMap<EntityType, int32_t> lastUpdateTicks;
+	// number of awake entities by tick % sleepingTicks of their last update
+	std::vector<int32_t> awakeByTick;
+	int32_t awakeCount = 0;
+	int32_t sleepingTicks = 0;
+	int32_t currentTick = 0;
+
 	BroadphaseBase<SPP_TEMPLATE_ARGS> *rebuild = nullptr;
 	BroadphaseBase<SPP_TEMPLATE_ARGS> *optimised = nullptr;
 	BroadphaseBase<SPP_TEMPLATE_ARGS> *dynamic = nullptr;
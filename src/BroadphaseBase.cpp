@@ -2,10 +2,105 @@
 // Copyright (c) 2024-2025 Marek Zalewski aka Drwalin
 // You should have received a copy of the MIT License along with this program.
 
+#include <algorithm>
+#include <thread>
+
 #include "../include/spatial_partitioning/BroadPhaseBase.hpp"
 
 namespace spp
 {
+void BroadphaseStatistics::AddNode(int32_t depth, float surface)
+{
+	++nodesCount;
+	nodesSurface += surface;
+	maxDepth = std::max(maxDepth, depth);
+}
+
+void BroadphaseStatistics::AddLeaf(int32_t depth, float surface,
+								   float tight, int64_t entities)
+{
+	++leavesCount;
+	maxDepth = std::max(maxDepth, depth);
+	if (entities <= 0) {
+		return;
+	}
+	if (depthHistogram.size() <= (size_t)depth) {
+		depthHistogram.resize(depth + 1, 0);
+	}
+	depthHistogram[depth] += entities;
+	entitiesCount += entities;
+	leavesCost += (double)surface * entities;
+	leavesSurface += surface;
+	tightSurface += tight;
+}
+
+void BroadphaseStatistics::AddSiblings(const Aabb &a, const Aabb &b)
+{
+	if (a.HasIntersection(b)) {
+		siblingOverlapVolume += (a * b).GetVolume();
+	}
+}
+
+void BroadphaseStatistics::AddUnsorted(int64_t entities)
+{
+	if (entities <= 0) {
+		return;
+	}
+	if (depthHistogram.size() == 0) {
+		depthHistogram.resize(1, 0);
+	}
+	depthHistogram[0] += entities;
+	entitiesCount += entities;
+	unsortedEntitiesCount += entities;
+}
+
+void BroadphaseStatistics::Merge(const BroadphaseStatistics &sub,
+								 int32_t depth, float scale,
+								 double boundsSurface)
+{
+	const double s2 = (double)scale * scale;
+	const double s3 = s2 * scale;
+
+	if (depthHistogram.size() < sub.depthHistogram.size() + depth) {
+		depthHistogram.resize(sub.depthHistogram.size() + depth, 0);
+	}
+	for (size_t i = 0; i < sub.depthHistogram.size(); ++i) {
+		depthHistogram[i + depth] += sub.depthHistogram[i];
+	}
+	entitiesCount += sub.entitiesCount;
+	nodesCount += sub.nodesCount;
+	leavesCount += sub.leavesCount;
+	maxDepth = std::max(maxDepth, sub.maxDepth + depth);
+
+	siblingOverlapVolume += sub.siblingOverlapVolume * s3;
+	nodesSurface += sub.nodesSurface * s2;
+	leavesCost += sub.leavesCost * s2;
+	leavesSurface += sub.leavesSurface * s2;
+	tightSurface += sub.tightSurface * s2;
+
+	if (boundsSurface > 0.0) {
+		leavesCost += boundsSurface * sub.unsortedEntitiesCount;
+	} else {
+		unsortedEntitiesCount += sub.unsortedEntitiesCount;
+	}
+}
+
+void BroadphaseStatistics::Finish()
+{
+	sahCost = unsortedEntitiesCount;
+	if (rootSurface > 0.0) {
+		sahCost += (nodesSurface + leavesCost) / rootSurface;
+	}
+	leafFill = 0.0;
+	if (leavesCount > 0) {
+		leafFill = double(entitiesCount - unsortedEntitiesCount) / leavesCount;
+	}
+	inflationRatio = 1.0;
+	if (tightSurface > 0.0) {
+		inflationRatio = leavesSurface / tightSurface;
+	}
+}
+
 SPP_TEMPLATE_DECL
 BroadphaseBaseIterator<SPP_TEMPLATE_ARGS>::~BroadphaseBaseIterator() {}
 SPP_TEMPLATE_DECL
@@ -18,6 +113,88 @@ void BroadphaseBase<SPP_TEMPLATE_ARGS>::StartFastAdding() {}
 SPP_TEMPLATE_DECL
 void BroadphaseBase<SPP_TEMPLATE_ARGS>::StopFastAdding() {}
 
+SPP_TEMPLATE_DECL
+void BroadphaseBase<SPP_TEMPLATE_ARGS>::BulkLoad(
+	std::span<const EntityType> entities, std::span<const Aabb> aabbs,
+	std::span<const MaskType> masks)
+{
+	assert(entities.size() == aabbs.size());
+	assert(entities.size() == masks.size());
+	StartFastAdding();
+	for (size_t i = 0; i < entities.size(); ++i) {
+		Add(entities[i], aabbs[i], masks[i]);
+	}
+	StopFastAdding();
+	Rebuild();
+}
+
+SPP_TEMPLATE_DECL
+int32_t
+BroadphaseBase<SPP_TEMPLATE_ARGS>::GetBulkLoadThreadsCount(size_t entitiesCount)
+{
+	const size_t MIN_ENTITIES_PER_THREAD = 16384;
+	const int32_t threads = std::thread::hardware_concurrency();
+	return std::clamp<int32_t>(entitiesCount / MIN_ENTITIES_PER_THREAD, 1,
+							   std::max(threads, 1));
+}
+
+SPP_TEMPLATE_DECL
+float BroadphaseBase<SPP_TEMPLATE_ARGS>::RebuildFor(
+	[[maybe_unused]] std::chrono::microseconds budget)
+{
+	Rebuild();
+	return 1.0f;
+}
+
+SPP_TEMPLATE_DECL
+void BroadphaseBase<SPP_TEMPLATE_ARGS>::AddBatch(
+	std::span<const std::tuple<EntityType, Aabb, MaskType>> entities)
+{
+	for (const auto &[entity, aabb, mask] : entities) {
+		Add(entity, aabb, mask);
+	}
+}
+
+SPP_TEMPLATE_DECL
+void BroadphaseBase<SPP_TEMPLATE_ARGS>::Update(
+	EntityType entity, Aabb aabb, [[maybe_unused]] glm::vec3 velocity)
+{
+	Update(entity, aabb);
+}
+
+SPP_TEMPLATE_DECL
+void BroadphaseBase<SPP_TEMPLATE_ARGS>::UpdateBatch(
+	std::span<const std::pair<EntityType, Aabb>> entities)
+{
+	for (const auto &[entity, aabb] : entities) {
+		Update(entity, aabb);
+	}
+}
+
+SPP_TEMPLATE_DECL
+void BroadphaseBase<SPP_TEMPLATE_ARGS>::RemoveBatch(
+	std::span<const EntityType> entities)
+{
+	for (const EntityType entity : entities) {
+		Remove(entity);
+	}
+}
+
+SPP_TEMPLATE_DECL
+bool BroadphaseBase<SPP_TEMPLATE_ARGS>::QueriesModifyState() const
+{
+	return false;
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics BroadphaseBase<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+	stats.AddUnsorted(GetCount());
+	stats.Finish();
+	return stats;
+}
+
 SPP_DEFINE_VARIANTS(BroadphaseBaseIterator)
 SPP_DEFINE_VARIANTS(BroadphaseBase)
 
@@ -2,6 +2,9 @@
 // Copyright (c) 2024-2025 Marek Zalewski aka Drwalin
 // You should have received a copy of the MIT License along with this program.
 
+#include <memory>
+#include <vector>
+
 #include "../include/spatial_partitioning/BulletDbvt.hpp"
 
 static bullet::btVector3 bt(glm::vec3 v) { return {v.x, v.y, v.z}; }
@@ -14,6 +17,34 @@ static bullet::btDbvtAabbMm bt(spp::Aabb_i16 v)
 {
 	return bullet::btDbvtVolume::FromMM(bt(v.min), bt(v.max));
 }
+static spp::Aabb spp_aabb(const bullet::btDbvtAabbMm &v)
+{
+	return {{v.Mins().x(), v.Mins().y(), v.Mins().z()},
+			{v.Maxs().x(), v.Maxs().y(), v.Maxs().z()}};
+}
+
+namespace
+{
+// Traversal stacks are per thread, so that queries can run concurrently, and
+// per nesting level of queries started from callbacks.
+struct QueryStack {
+	using Stack = bullet::btAlignedObjectArray<const bullet::btDbvtNode *>;
+
+	QueryStack()
+	{
+		if (stacks.size() <= depth) {
+			stacks.push_back(std::make_unique<Stack>());
+		}
+		stack = stacks[depth++].get();
+	}
+	~QueryStack() { --depth; }
+
+	Stack *stack;
+
+	inline static thread_local std::vector<std::unique_ptr<Stack>> stacks;
+	inline static thread_local size_t depth = 0;
+};
+} // namespace
 
 namespace spp
 {
@@ -40,8 +71,7 @@ size_t BulletDbvt<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
 {
 	return ents.GetMemoryUsage() +
 		   (GetCount() * 2 - 1) * sizeof(bullet::btDbvtNode) +
-		   dbvt.m_stkStack.capacity() * sizeof(bullet::btDbvt::sStkNN) +
-		   stack.capacity() * sizeof(const bullet::btDbvtNode *);
+		   dbvt.m_stkStack.capacity() * sizeof(bullet::btDbvt::sStkNN);
 }
 
 SPP_TEMPLATE_DECL
@@ -70,6 +100,9 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
 
 	int32_t offset = ents.Add(entity, Data{aabb, nullptr, entity, mask});
 	bullet::btDbvtAabbMm volume = bt(aabb.Expanded(BIG_EPSILON));
+	if (enlargedAabbs) {
+		volume.Expand(bullet::btVector3(fatMargin, fatMargin, fatMargin));
+	}
 	bullet::btDbvtNode *node = dbvt.insert(volume, (void *)(int64_t)offset);
 	ents[offset].node = node;
 	requiresRebuild++;
@@ -77,18 +110,55 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
 
 SPP_TEMPLATE_DECL
 void BulletDbvt<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
+{
+	BulletDbvt::Update(entity, aabb, {0, 0, 0});
+}
+
+SPP_TEMPLATE_DECL
+void BulletDbvt<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb,
+										   glm::vec3 velocity)
 {
 	int32_t offset = ents.GetOffset(entity);
 	if (offset > 0) {
 		ents[offset].aabb = aabb;
 		bullet::btDbvtAabbMm volume = bt(aabb.Expanded(BIG_EPSILON));
-		dbvt.update(ents[offset].node, volume);
-		requiresRebuild++;
+		if (enlargedAabbs) {
+			if (dbvt.update(ents[offset].node, volume,
+							bt(velocity * fatVelocityPrediction), fatMargin)) {
+				requiresRebuild++;
+			}
+		} else {
+			dbvt.update(ents[offset].node, volume);
+			requiresRebuild++;
+		}
 	} else {
 		assert(Exists(entity) == true);
 	}
 }
 
+SPP_TEMPLATE_DECL
+void BulletDbvt<SPP_TEMPLATE_ARGS>::SetEnlargedAabbs(bool enabled,
+													float margin,
+													float velocityPrediction)
+{
+	fatMargin = margin;
+	fatVelocityPrediction = velocityPrediction;
+	if (enabled == enlargedAabbs) {
+		return;
+	}
+	enlargedAabbs = enabled;
+	for (Data &d : ents._Data()._Data()) {
+		if (d.node != nullptr) {
+			bullet::btDbvtAabbMm volume = bt(d.aabb.Expanded(BIG_EPSILON));
+			if (enlargedAabbs) {
+				volume.Expand(bullet::btVector3(margin, margin, margin));
+			}
+			dbvt.update(d.node, volume);
+		}
+	}
+	requiresRebuild += ents.Size();
+}
+
 SPP_TEMPLATE_DECL
 void BulletDbvt<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
 {
@@ -171,8 +241,14 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 		{
 			int32_t offset = (int32_t)(int64_t)(leaf->data);
 			if (bp->ents[offset].mask & cb->mask) {
-				cb->callback(cb, bp->ents[offset].entity);
-				cb->testedCount++;
+				if (bp->enlargedAabbs) {
+					// leaf volume is enlarged, test exact aabb
+					cb->ExecuteIfRelevant(bp->ents[offset].aabb,
+										  bp->ents[offset].entity);
+				} else {
+					cb->callback(cb, bp->ents[offset].entity);
+					cb->testedCount++;
+				}
 			}
 		}
 
@@ -182,8 +258,9 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 
 	btDbvtAabbCb btCb{this, &cb};
 
+	QueryStack stack;
 	bullet::btDbvtVolume bounds = bt(cb.aabb);
-	dbvt.collideTVNoStackAlloc(dbvt.m_root, bounds, stack, btCb);
+	dbvt.collideTVNoStackAlloc(dbvt.m_root, bounds, *stack.stack, btCb);
 }
 
 SPP_TEMPLATE_DECL
@@ -230,6 +307,10 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
 			int32_t offset = (int32_t)(uint64_t)(leaf->data);
 			BulletDbvt::Data &data = bp->ents[offset];
 			if (cb->mask & data.mask) {
+				if (bp->enlargedAabbs && cb->IsRelevant(data.aabb) == false) {
+					// leaf volume is enlarged, exact aabb is missed
+					return;
+				}
 				auto res = cb->ExecuteCallback(data.entity);
 				if (res.intersection) {
 					assert(res.dist >= 0);
@@ -250,10 +331,41 @@ void BulletDbvt<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
 
 	btDbvtRayCb btCb{this, &cb};
 
+	QueryStack stack;
 	dbvt.rayTestInternal(dbvt.m_root, bt(cb.start), bt(cb.end),
 						 btCb.m_rayDirectionInverse, btCb.m_signs,
 						 btCb.m_lambda_max, bullet::btVector3(0, 0, 0),
-						 bullet::btVector3(0, 0, 0), stack, btCb);
+						 bullet::btVector3(0, 0, 0), *stack.stack, btCb);
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics BulletDbvt<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+	if (dbvt.m_root == nullptr) {
+		stats.Finish();
+		return stats;
+	}
+	stats.rootSurface = spp_aabb(dbvt.m_root->volume).GetSurface();
+	std::vector<std::pair<const bullet::btDbvtNode *, int32_t>> stk;
+	stk.push_back({dbvt.m_root, 0});
+	while (stk.empty() == false) {
+		const auto [node, depth] = stk.back();
+		stk.pop_back();
+		const float surface = spp_aabb(node->volume).GetSurface();
+		if (node->isleaf()) {
+			const int32_t offset = (int32_t)(int64_t)node->data;
+			stats.AddLeaf(depth, surface, ents[offset].aabb.GetSurface(), 1);
+			continue;
+		}
+		stats.AddNode(depth, surface);
+		stats.AddSiblings(spp_aabb(node->childs[0]->volume),
+						  spp_aabb(node->childs[1]->volume));
+		stk.push_back({node->childs[0], depth + 1});
+		stk.push_back({node->childs[1], depth + 1});
+	}
+	stats.Finish();
+	return stats;
 }
 
 SPP_TEMPLATE_DECL
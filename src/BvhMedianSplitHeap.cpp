@@ -3,8 +3,10 @@
 // You should have received a copy of the MIT License along with this program.
 
 #include <cstdio>
+#include <cstring>
 
 #include <bit>
+#include <thread>
 #include <algorithm>
 
 #include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
@@ -63,6 +65,16 @@ BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	return updatePolicy;
 }
 
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::SetHolesCompactionRatio(float ratio)
+{
+	holesCompactionRatio = ratio;
+	if (holesCompactionRatio <= 0.0f) {
+		holes.clear();
+	}
+}
+
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 											   SegmentType)>::Clear()
@@ -81,6 +93,14 @@ void BvhMedianSplitHeap<
 	entitiesCount = 0;
 	entitiesPowerOfTwoCount = 0;
 	bruteForceEntitiesAtEndCount = 0;
+	dirtyNodes.clear();
+	dirtyMin = 0x7FFFFFFF;
+	dirtyMax = -1;
+	rebuildForPending = false;
+	rebuildForChanged.clear();
+	rebuildForOffsets.Clear();
+	nodesOutdated = false;
+	holes.clear();
 }
 
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
@@ -91,7 +111,11 @@ BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 	return (entitiesOffsets.owning ? entitiesOffsets.GetMemoryUsage()
 								   : (size_t)0) +
 		   nodesHeapAabb.capacity() * sizeof(NodeData) +
-		   entitiesData.capacity() * sizeof(Data);
+		   entitiesData.capacity() * sizeof(Data) + dirtyNodes.capacity() +
+		   holes.capacity() * sizeof(int32_t) +
+		   (rebuildShadow ? rebuildShadow->GetMemoryUsage() : (size_t)0) +
+		   rebuildForChanged.capacity() * sizeof(EntityType) +
+		   rebuildForOffsets.GetMemoryUsage();
 }
 
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
@@ -100,6 +124,11 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 {
 	nodesHeapAabb.shrink_to_fit();
 	entitiesData.shrink_to_fit();
+	dirtyNodes.shrink_to_fit();
+	if (rebuildForPending == false) {
+		rebuildShadow.reset();
+		rebuildForChanged.shrink_to_fit();
+	}
 }
 
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
@@ -111,12 +140,14 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		assert(!"Entity already exists");
 		return;
 	}
-	entitiesOffsets.Set(entity, entitiesData.size());
+	SetOffset(entity, entitiesData.size());
 	entitiesData.push_back({aabb, entity, mask});
 	bruteForceEntitiesAtEndCount++;
 	++entitiesCount;
-	if (bruteForceEntitiesAtEndCount > maxNumberOfBruteforceEntities) {
-		rebuildTree = true;
+	CompactHolesIfNeeded();
+	if (bruteForceEntitiesAtEndCount > maxNumberOfBruteforceEntities &&
+		rebuildForPending == false) {
+		QueueRebuild();
 	}
 	assert(bruteForceEntitiesAtEndCount <= entitiesData.size());
 }
@@ -125,16 +156,98 @@ SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	SKIP_LOW_LAYERS, SegmentType)>::Update(EntityType entity, Aabb aabb)
 {
-	uint32_t offset = entitiesOffsets[entity];
+	uint32_t offset = FindOffset(entity);
 	entitiesData[offset].aabb = aabb;
+	RecordRebuildForChange(entity);
 	assert(bruteForceEntitiesAtEndCount <= entitiesData.size());
 	if ((offset + bruteForceEntitiesAtEndCount) >= entitiesData.size()) {
 		return;
 	}
-	if (updatePolicy == ON_UPDATE_EXTEND_AABB && rebuildTree == false) {
+	switch (updatePolicy) {
+	case ON_UPDATE_EXTEND_AABB:
 		UpdateAabb(offset);
+		break;
+	case ON_UPDATE_REFIT_ON_NEXT_READ:
+		MarkDirty(offset);
+		break;
+	default:
+		// tree is queried until pending RebuildFor finishes, so it is kept
+		// valid
+		if (rebuildForPending) {
+			UpdateAabb(offset);
+		} else {
+			QueueRebuild();
+			nodesOutdated = true;
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	UpdateIntoBruteForce(EntityType entity, Aabb aabb)
+{
+	const uint32_t offset = FindOffset(entity);
+	if ((offset + bruteForceEntitiesAtEndCount) >= entitiesData.size()) {
+		entitiesData[offset].aabb = aabb;
+		RecordRebuildForChange(entity);
+		return true;
+	} else if (rebuildTree && rebuildForPending == false) {
+		// all entities will be moved by queued rebuild anyway
+		Update(entity, aabb);
+		return true;
+	} else if (bruteForceEntitiesAtEndCount >= maxNumberOfBruteforceEntities) {
+		// brute force entities are full, entity stays in tree
+		Update(entity, aabb);
+		return false;
+	}
+
+	const Data data{aabb, entity, entitiesData[offset].mask};
+	entitiesData[offset].entity = EMPTY_ENTITY;
+	entitiesData[offset].mask = 0;
+	AddHole(offset);
+	if (updatePolicy == ON_UPDATE_REFIT_ON_NEXT_READ) {
+		MarkDirty(offset);
 	} else {
-		rebuildTree = true;
+		UpdateAabb(offset);
+	}
+
+	SetOffset(entity, entitiesData.size());
+	entitiesData.push_back(data);
+	bruteForceEntitiesAtEndCount++;
+	CompactHolesIfNeeded();
+	assert(bruteForceEntitiesAtEndCount <= entitiesData.size());
+	return true;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	UpdateBatch(std::span<const std::pair<EntityType, Aabb>> entities)
+{
+	const int32_t treeEntities =
+		entitiesData.size() - bruteForceEntitiesAtEndCount;
+	for (const auto &[entity, aabb] : entities) {
+		const uint32_t offset = FindOffset(entity);
+		entitiesData[offset].aabb = aabb;
+		RecordRebuildForChange(entity);
+		if ((int32_t)offset >= treeEntities) {
+			continue;
+		}
+		switch (updatePolicy) {
+		case ON_UPDATE_EXTEND_AABB:
+		case ON_UPDATE_REFIT_ON_NEXT_READ:
+			MarkDirty(offset);
+			break;
+		default:
+			if (rebuildForPending) {
+				MarkDirty(offset);
+			} else {
+				QueueRebuild();
+				nodesOutdated = true;
+			}
+		}
+	}
+	if (updatePolicy != ON_UPDATE_REFIT_ON_NEXT_READ) {
+		Refit();
 	}
 }
 
@@ -143,16 +256,13 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	SKIP_LOW_LAYERS, SegmentType)>::Remove(EntityType entity)
 {
 	assert(bruteForceEntitiesAtEndCount <= entitiesData.size());
-	auto it = entitiesOffsets.find(entity);
-	if (it == nullptr) {
+	const int32_t offset = FindOffset(entity);
+	if (offset < 0) {
 		return;
 	}
 
-	uint32_t offset = EntitiesOffsetsMapType::get_offset_from_it(it);
-
-	assert(offset != -1);
-
 	entitiesOffsets.Remove(entity);
+	RecordRebuildForChange(entity);
 	entitiesData[offset].entity = EMPTY_ENTITY;
 	entitiesData[offset].mask = 0;
 
@@ -168,7 +278,7 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		if (offset + 1 < entitiesData.size()) {
 			std::swap(entitiesData[offset],
 					  entitiesData[entitiesData.size() - 1]);
-			entitiesOffsets.Set(entitiesData[offset].entity, offset);
+			SetOffset(entitiesData[offset].entity, offset);
 		}
 		entitiesData.resize(entitiesData.size() - 1);
 		bruteForceEntitiesAtEndCount--;
@@ -177,30 +287,135 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		return;
 	}
 
+	AddHole(offset);
 	PruneEmptyEntitiesAtEnd();
 
-	if (rebuildTree == false) {
+	if (updatePolicy == ON_UPDATE_REFIT_ON_NEXT_READ) {
+		MarkDirty(offset);
+	} else {
 		UpdateAabb(offset);
 	}
+	CompactHolesIfNeeded();
 	assert(bruteForceEntitiesAtEndCount <= entitiesData.size());
 }
 
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
-	SKIP_LOW_LAYERS, SegmentType)>::SetMask(EntityType entity, MaskType mask)
+	SKIP_LOW_LAYERS, SegmentType)>::QueueRebuild()
+{
+	rebuildTree = true;
+	// queued rebuild prunes all empty slots
+	holes.clear();
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::AddHole(int32_t offset)
+{
+	if (rebuildTree == false && holesCompactionRatio > 0.0f) {
+		holes.push_back(offset);
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+int32_t BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::FindOffset(EntityType entity) const
 {
 	auto it = entitiesOffsets.find(entity);
 	if (it == nullptr) {
+		return -1;
+	}
+	const int32_t offset = EntitiesOffsetsMapType::get_offset_from_it(it);
+	if (rebuildForPending &&
+		rebuildForStage == REBUILD_FOR_REGISTER_OFFSETS &&
+		(offset >= entitiesData.size() ||
+		 entitiesData[offset].entity != entity)) {
+		// rebuilt tree is swapped in, but offset is not registered yet
+		const int32_t *shadowOffset = rebuildForOffsets.find(entity);
+		assert(shadowOffset != nullptr);
+		return *shadowOffset;
+	}
+	return offset;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::SetOffset(EntityType entity, int32_t offset)
+{
+	entitiesOffsets.Set(entity, offset);
+	RecordRebuildForChange(entity);
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::CompactHolesIfNeeded()
+{
+	if (rebuildTree || holes.empty() || holesCompactionRatio <= 0.0f) {
+		return;
+	}
+	const int32_t holesCount = entitiesData.size() - entitiesCount;
+	if (holesCount <= holesCompactionRatio * entitiesData.size()) {
 		return;
 	}
 
-	uint32_t offset = EntitiesOffsetsMapType::get_offset_from_it(it);
+	auto refit = [this](int32_t offset) {
+		if (updatePolicy == ON_UPDATE_REFIT_ON_NEXT_READ) {
+			MarkDirty(offset);
+		} else {
+			UpdateAabb(offset);
+		}
+	};
+
+	// fill holes with entities from brute force tail
+	while (bruteForceEntitiesAtEndCount > 0 && holes.empty() == false) {
+		const int32_t offset = holes.back();
+		holes.pop_back();
+		const int32_t treeEntities =
+			entitiesData.size() - bruteForceEntitiesAtEndCount;
+		if (offset >= treeEntities ||
+			entitiesData[offset].entity != EMPTY_ENTITY) {
+			continue;
+		}
+		entitiesData[offset] = entitiesData.back();
+		entitiesData.pop_back();
+		--bruteForceEntitiesAtEndCount;
+		SetOffset(entitiesData[offset].entity, offset);
+		refit(offset);
+	}
+
+	// Tail is empty, move entities from the end of tree into the highest
+	// holes. Entities are sorted spatially, so the highest holes are the
+	// closest to them in tree.
+	std::sort(holes.begin(), holes.end());
+	while (holes.empty() == false) {
+		PruneEmptyEntitiesAtEnd();
+		const int32_t offset = holes.back();
+		holes.pop_back();
+		if (offset >= entitiesData.size() ||
+			entitiesData[offset].entity != EMPTY_ENTITY) {
+			continue;
+		}
+		const int32_t last = entitiesData.size() - 1;
+		entitiesData[offset] = entitiesData[last];
+		entitiesData.pop_back();
+		SetOffset(entitiesData[offset].entity, offset);
+		refit(offset);
+		refit(last);
+	}
+	PruneEmptyEntitiesAtEnd();
+}
 
-	if (entitiesData[offset].mask == mask) {
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::SetMask(EntityType entity, MaskType mask)
+{
+	const int32_t offset = FindOffset(entity);
+	if (offset < 0 || entitiesData[offset].mask == mask) {
 		return;
 	}
 
 	entitiesData[offset].mask = mask;
+	RecordRebuildForChange(entity);
 	if ((offset + bruteForceEntitiesAtEndCount) >= entitiesData.size()) {
 		return;
 	}
@@ -248,9 +463,8 @@ SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 Aabb BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	SKIP_LOW_LAYERS, SegmentType)>::GetAabb(EntityType entity) const
 {
-	auto it = entitiesOffsets.find(entity);
-	if (it != nullptr) {
-		uint32_t offset = EntitiesOffsetsMapType::get_offset_from_it(it);
+	const int32_t offset = FindOffset(entity);
+	if (offset >= 0) {
 		return entitiesData[offset].aabb;
 	}
 	return {};
@@ -260,9 +474,8 @@ SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 MaskType BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	SKIP_LOW_LAYERS, SegmentType)>::GetMask(EntityType entity) const
 {
-	auto it = entitiesOffsets.find(entity);
-	if (it != nullptr) {
-		uint32_t offset = EntitiesOffsetsMapType::get_offset_from_it(it);
+	const int32_t offset = FindOffset(entity);
+	if (offset >= 0) {
 		return entitiesData[offset].mask;
 	}
 	return 0;
@@ -276,15 +489,20 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		return;
 	}
 
-	if (rebuildTree) {
+	if (rebuildTree && rebuildForPending == false) {
 		Rebuild();
+	} else if (dirtyMax >= 0) {
+		Refit();
 	}
 
 	cb.broadphase = this;
 
-	_Internal_IntersectAabb(cb, 1);
-	for (int32_t i = entitiesData.size() - bruteForceEntitiesAtEndCount;
-		 i < entitiesData.size(); ++i) {
+	int32_t i = 0;
+	if (nodesOutdated == false) {
+		_Internal_IntersectAabb(cb, 1);
+		i = entitiesData.size() - bruteForceEntitiesAtEndCount;
+	}
+	for (; i < entitiesData.size(); ++i) {
 		auto &ed = entitiesData[i];
 		if (ed.mask & cb.mask) {
 			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
@@ -339,16 +557,21 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		return;
 	}
 
-	if (rebuildTree) {
+	if (rebuildTree && rebuildForPending == false) {
 		Rebuild();
+	} else if (dirtyMax >= 0) {
+		Refit();
 	}
 
 	cb.broadphase = this;
 	cb.InitVariables();
 
-	_Internal_IntersectRay(cb, 1);
-	for (int32_t i = entitiesData.size() - bruteForceEntitiesAtEndCount;
-		 i < entitiesData.size(); ++i) {
+	int32_t i = 0;
+	if (nodesOutdated == false) {
+		_Internal_IntersectRay(cb, 1);
+		i = entitiesData.size() - bruteForceEntitiesAtEndCount;
+	}
+	for (; i < entitiesData.size(); ++i) {
 		auto &ed = entitiesData[i];
 		if (ed.mask & cb.mask) {
 			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
@@ -423,9 +646,25 @@ SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 											   SegmentType)>::Rebuild()
 {
+	PrepareRebuild();
+	entitiesOffsets.Reserve(entitiesCount);
+	RebuildNode(1);
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
+											   SegmentType)>::PrepareRebuild()
+{
+	rebuildForPending = false;
+	rebuildForChanged.clear();
+	rebuildForOffsets.Clear();
 	rebuildTree = false;
-	entitiesPowerOfTwoCount = std::bit_ceil((uint32_t)entitiesCount);
+	nodesOutdated = false;
+	holes.clear();
+	entitiesPowerOfTwoCount =
+		std::max<int32_t>(std::bit_ceil((uint32_t)entitiesCount), 2);
 	bruteForceEntitiesAtEndCount = 0;
+	ClearDirty();
 
 	if (SKIP_LOW_LAYERS) {
 		nodesHeapAabb.resize(entitiesPowerOfTwoCount >> SKIP_LOW_LAYERS);
@@ -437,8 +676,6 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 		n.mask = 0;
 	}
 
-	entitiesOffsets.Reserve(entitiesCount);
-
 	{ // prune empty entities data
 		PruneEmptyEntitiesAtEnd();
 		for (int32_t i = 0; i + 1 < entitiesData.size(); ++i) {
@@ -448,8 +685,224 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
 			}
 		}
 	}
+}
 
-	RebuildNode(1);
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	BulkLoad(std::span<const EntityType> entities, std::span<const Aabb> aabbs,
+			 std::span<const MaskType> masks)
+{
+	entitiesOffsets.Reserve(entities.size());
+	BulkLoadWithoutOffsets(entities, aabbs, masks,
+						   this->GetBulkLoadThreadsCount(entities.size()));
+	RegisterAllOffsets();
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	BulkLoadWithoutOffsets(std::span<const EntityType> entities,
+						   std::span<const Aabb> aabbs,
+						   std::span<const MaskType> masks,
+						   int32_t threadsCount)
+{
+	assert(entitiesCount == 0);
+	assert(entities.size() == aabbs.size());
+	assert(entities.size() == masks.size());
+	ClearWithoutOffsets();
+	entitiesData.resize(entities.size());
+	for (size_t i = 0; i < entities.size(); ++i) {
+		entitiesData[i] = {aabbs[i], entities[i], masks[i]};
+	}
+	entitiesCount = entities.size();
+
+	RebuildWithoutOffsets(threadsCount);
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::RebuildWithoutOffsets(int32_t threadsCount)
+{
+	PrepareRebuild();
+	skipOffsetsInRebuild = true;
+	RebuildNodesParallel(threadsCount);
+	skipOffsetsInRebuild = false;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::RegisterAllOffsets()
+{
+	for (int32_t i = 0; i < entitiesData.size(); ++i) {
+		if (entitiesData[i].entity != EMPTY_ENTITY) {
+			entitiesOffsets.Set(entitiesData[i].entity, i);
+		}
+	}
+}
+
+namespace
+{
+template <typename T>
+void AppendRaw(std::vector<uint8_t> &buffer, const T *data, size_t count)
+{
+	if (count == 0) {
+		return;
+	}
+	const size_t offset = buffer.size();
+	buffer.resize(offset + count * sizeof(T));
+	memcpy(buffer.data() + offset, data, count * sizeof(T));
+}
+
+template <typename T>
+bool ReadRaw(std::span<const uint8_t> &buffer, T *data, size_t count)
+{
+	if (buffer.size() < count * sizeof(T)) {
+		return false;
+	} else if (count == 0) {
+		return true;
+	}
+	memcpy(data, buffer.data(), count * sizeof(T));
+	buffer = buffer.subspan(count * sizeof(T));
+	return true;
+}
+} // namespace
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::Serialize(std::vector<uint8_t> &buffer)
+{
+	if (rebuildForPending) {
+		FinishRebuildFor();
+	}
+	if (rebuildTree) {
+		Rebuild();
+	} else if (dirtyMax >= 0) {
+		Refit();
+	}
+
+	const int32_t header[5] = {entitiesCount, entitiesPowerOfTwoCount,
+							   bruteForceEntitiesAtEndCount,
+							   (int32_t)nodesHeapAabb.size(),
+							   (int32_t)entitiesData.size()};
+	buffer.reserve(buffer.size() + sizeof(header) +
+				   nodesHeapAabb.size() * sizeof(NodeData) +
+				   entitiesData.size() * sizeof(Data));
+	AppendRaw(buffer, header, 5);
+	AppendRaw(buffer, nodesHeapAabb.data(), nodesHeapAabb.size());
+	AppendRaw(buffer, entitiesData.data(), entitiesData.size());
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	DeserializeWithoutOffsets(std::span<const uint8_t> &buffer)
+{
+	assert(entitiesCount == 0);
+	std::span<const uint8_t> b = buffer;
+	int32_t header[5];
+	if (ReadRaw(b, header, 5) == false) {
+		return false;
+	}
+	const auto [count, powerOfTwoCount, bruteForceCount, nodesCount,
+				dataCount] = header;
+	if (count < 0 || nodesCount < 0 || dataCount < count ||
+		bruteForceCount < 0 || bruteForceCount > dataCount ||
+		b.size() < nodesCount * sizeof(NodeData) + dataCount * sizeof(Data)) {
+		return false;
+	}
+	// heap sizes are derived from number of entities in tree at last rebuild,
+	// tree without nodes was never built
+	const int32_t treeCount = dataCount - bruteForceCount;
+	if (powerOfTwoCount < 0 ||
+		(powerOfTwoCount != 0 &&
+		 std::has_single_bit((uint32_t)powerOfTwoCount) == false)) {
+		return false;
+	}
+	if (nodesCount != 0 || treeCount != 0) {
+		if (powerOfTwoCount < 2 || powerOfTwoCount < treeCount) {
+			return false;
+		}
+		if (SKIP_LOW_LAYERS) {
+			if (nodesCount != (powerOfTwoCount >> SKIP_LOW_LAYERS)) {
+				return false;
+			}
+		} else if (nodesCount < powerOfTwoCount / 2 ||
+				   nodesCount > powerOfTwoCount) {
+			return false;
+		}
+	}
+
+	ClearWithoutOffsets();
+	nodesHeapAabb.resize(nodesCount);
+	entitiesData.resize(dataCount);
+	ReadRaw(b, nodesHeapAabb.data(), nodesCount);
+	ReadRaw(b, entitiesData.data(), dataCount);
+
+	// count needs to match entities, brute force tail has no empty slots
+	int32_t nonEmpty = 0;
+	for (int32_t i = 0; i < dataCount; ++i) {
+		if (entitiesData[i].entity != EMPTY_ENTITY) {
+			++nonEmpty;
+		} else if (i >= treeCount) {
+			nonEmpty = -1;
+			break;
+		}
+	}
+	if (nonEmpty != count) {
+		ClearWithoutOffsets();
+		return false;
+	}
+
+	entitiesCount = count;
+	entitiesPowerOfTwoCount = powerOfTwoCount;
+	bruteForceEntitiesAtEndCount = bruteForceCount;
+	for (int32_t i = 0; i < dataCount - bruteForceCount; ++i) {
+		if (entitiesData[i].entity == EMPTY_ENTITY) {
+			AddHole(i);
+		}
+	}
+	buffer = b;
+	return true;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::RebuildNodesParallel(int32_t threadsCount)
+{
+	if (threadsCount <= 1) {
+		RebuildNode(1);
+		return;
+	}
+
+	// split upper levels until there are enough subtrees for all threads
+	std::vector<int32_t> level = {1}, next;
+	while (level.empty() == false && level.size() < threadsCount * 4) {
+		next.clear();
+		for (const int32_t nodeId : level) {
+			int32_t tcount = 0;
+			const int32_t c = RebuildNodePartial(nodeId, &tcount);
+			if (c > 1 && c < nodesHeapAabb.size()) {
+				next.push_back(c);
+				if (c + 1 < nodesHeapAabb.size()) {
+					next.push_back(c + 1);
+				}
+			}
+		}
+		std::swap(level, next);
+	}
+
+	auto worker = [this, &level, threadsCount](int32_t threadId) {
+		for (size_t i = threadId; i < level.size(); i += threadsCount) {
+			RebuildNode(level[i]);
+		}
+	};
+	std::vector<std::thread> workers;
+	workers.reserve(threadsCount - 1);
+	for (int32_t t = 1; t < threadsCount; ++t) {
+		workers.emplace_back(worker, t);
+	}
+	worker(0);
+	for (auto &w : workers) {
+		w.join();
+	}
 }
 
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
@@ -503,8 +956,10 @@ int32_t BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	}
 
 	if (count <= (2 << SKIP_LOW_LAYERS)) {
-		for (int32_t i = offset; i < offset + count; ++i) {
-			entitiesOffsets.Set(entitiesData[i].entity, i);
+		if (skipOffsetsInRebuild == false) {
+			for (int32_t i = offset; i < offset + count; ++i) {
+				entitiesOffsets.Set(entitiesData[i].entity, i);
+			}
 		}
 		if (orgCount <= 2) {
 			return -1;
@@ -611,6 +1066,114 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	}
 }
 
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::MarkDirty(int32_t offset)
+{
+	const int32_t n =
+		(offset + entitiesPowerOfTwoCount) >> (1 + SKIP_LOW_LAYERS);
+	if (n <= 0 || n >= nodesHeapAabb.size()) {
+		return;
+	}
+	if (dirtyNodes.size() < nodesHeapAabb.size()) {
+		dirtyNodes.resize(nodesHeapAabb.size(), 0);
+	}
+	dirtyNodes[n] = 1;
+	dirtyMin = std::min(dirtyMin, n);
+	dirtyMax = std::max(dirtyMax, n);
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
+											   SegmentType)>::ClearDirty()
+{
+	if (dirtyMax >= 0) {
+		std::fill(dirtyNodes.begin(), dirtyNodes.end(), 0);
+	}
+	dirtyMin = 0x7FFFFFFF;
+	dirtyMax = -1;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
+											   SegmentType)>::Refit()
+{
+	if (dirtyMax < 0) {
+		return;
+	}
+
+	const int32_t treeEntities =
+		entitiesData.size() - bruteForceEntitiesAtEndCount;
+
+	// lowest level, nodes are calculated from entities
+	for (int32_t n = dirtyMin; n <= dirtyMax; ++n) {
+		if (dirtyNodes[n] == 0) {
+			continue;
+		}
+		dirtyNodes[n] = 0;
+		dirtyNodes[n >> 1] = 1;
+		RefitNode(n, treeEntities);
+	}
+
+	// upper levels are contiguous in heap, each one is single linear sweep
+	for (int32_t lo = dirtyMin >> 1, hi = dirtyMax >> 1; hi > 0;
+		 lo >>= 1, hi >>= 1) {
+		for (int32_t n = lo; n <= hi; ++n) {
+			if (dirtyNodes[n] == 0) {
+				continue;
+			}
+			dirtyNodes[n] = 0;
+			dirtyNodes[n >> 1] = 1;
+			RefitNode(n, treeEntities);
+		}
+	}
+
+	dirtyNodes[0] = 0;
+	dirtyMin = 0x7FFFFFFF;
+	dirtyMax = -1;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	RefitNode(int32_t n, int32_t treeEntities)
+{
+	MaskType mask = 0;
+	Aabb aabb = {{0, 0, 0}, {0, 0, 0}};
+	if ((n << (1 + SKIP_LOW_LAYERS)) >= entitiesPowerOfTwoCount) {
+		// lowest level, node is calculated from entities
+		const int32_t start =
+			(n << (1 + SKIP_LOW_LAYERS)) - entitiesPowerOfTwoCount;
+		const int32_t end =
+			std::min<int32_t>(start + (2 << SKIP_LOW_LAYERS), treeEntities);
+		for (int32_t i = start; i < end; ++i) {
+			const auto &ed = entitiesData[i];
+			if ((ed.entity != EMPTY_ENTITY) && (ed.mask != 0)) {
+				if (mask != 0) {
+					aabb = aabb + ed.aabb;
+				} else {
+					aabb = ed.aabb;
+				}
+				mask |= ed.mask;
+			}
+		}
+		aabb = aabb.Expanded(BIG_EPSILON);
+	} else {
+		const int32_t nodesCount = nodesHeapAabb.size();
+		for (int32_t c = n << 1; c <= ((n << 1) | 1) && c < nodesCount; ++c) {
+			if (nodesHeapAabb[c].mask) {
+				if (mask) {
+					aabb = aabb + nodesHeapAabb[c].aabb;
+				} else {
+					aabb = nodesHeapAabb[c].aabb;
+				}
+				mask |= nodesHeapAabb[c].mask;
+			}
+		}
+	}
+	nodesHeapAabb[n].aabb = aabb;
+	nodesHeapAabb[n].mask = mask;
+}
+
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	SKIP_LOW_LAYERS, SegmentType)>::RebuildStep(RebuildProgress &progress)
@@ -623,12 +1186,16 @@ bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	case 0:
 		bruteForceEntitiesAtEndCount = 0;
 		rebuildTree = false;
-		entitiesPowerOfTwoCount = std::bit_ceil((uint32_t)entitiesCount);
+		nodesOutdated = false;
+		holes.clear();
+		ClearDirty();
+		entitiesPowerOfTwoCount =
+			std::max<int32_t>(std::bit_ceil((uint32_t)entitiesCount), 2);
 		if (SKIP_LOW_LAYERS) {
 			nodesHeapAabb.resize(entitiesPowerOfTwoCount >> SKIP_LOW_LAYERS);
 		} else {
 			nodesHeapAabb.resize(entitiesPowerOfTwoCount / 2 +
-								 (entitiesCount + 1) / 2 + 7);
+								 (entitiesCount + 1) / 2);
 		}
 		progress.stage = 1;
 		progress.it = 0;
@@ -645,7 +1212,9 @@ bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 		break;
 
 	case 2:
-		entitiesOffsets.Reserve(entitiesCount);
+		if (skipOffsetsInRebuild == false) {
+			entitiesOffsets.Reserve(entitiesCount);
+		}
 		progress.stage = 3;
 		break;
 
@@ -658,8 +1227,8 @@ bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	case 4:
 		for (int32_t i = 0; i < 4096 && progress.it < entitiesData.size();
 			 ++i, ++progress.it) {
-			if (entitiesData[i].entity == EMPTY_ENTITY) {
-				std::swap(entitiesData[i], entitiesData.back());
+			if (entitiesData[progress.it].entity == EMPTY_ENTITY) {
+				std::swap(entitiesData[progress.it], entitiesData.back());
 				PruneEmptyEntitiesAtEnd();
 			}
 		}
@@ -688,6 +1257,7 @@ bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 				progress.it = 0;
 			}
 			sum += tcount;
+			progress.work += tcount;
 		}
 		if (progress.size <= 0) {
 			progress.stage = 6;
@@ -703,11 +1273,360 @@ bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
 	return progress.done;
 }
 
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+float BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	GetRebuildProgress(const RebuildProgress &progress) const
+{
+	// Stages before 5 are linear passes, stage 5 processes every entity once
+	// per each heap level.
+	switch (progress.stage) {
+	case 0:
+		return 0.0f;
+	case 1:
+		return 0.04f * progress.it / std::max<size_t>(nodesHeapAabb.size(), 1);
+	case 2:
+	case 3:
+		return 0.04f;
+	case 4:
+		return 0.04f +
+			   0.04f * progress.it / std::max<size_t>(entitiesData.size(), 1);
+	case 5: {
+		const int32_t levels = std::max<int32_t>(
+			std::bit_width((uint32_t)entitiesPowerOfTwoCount) - 1 -
+				SKIP_LOW_LAYERS,
+			1);
+		const double total = (double)levels * std::max(entitiesCount, 1);
+		return 0.08f + 0.91f * std::min(progress.work / total, 1.0);
+	}
+	default:
+		return progress.done ? 1.0f : 0.99f;
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+float BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::RebuildFor(std::chrono::microseconds budget)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	if (rebuildForPending == false) {
+		if (rebuildShadow == nullptr) {
+			rebuildShadow = std::make_unique<BvhMedianSplitHeap>(EntityType(0));
+		}
+		rebuildShadow->ClearWithoutOffsets();
+		rebuildShadow->skipOffsetsInRebuild = true;
+		rebuildShadow->holesCompactionRatio = holesCompactionRatio;
+		rebuildShadow->entitiesData.reserve(entitiesCount);
+		rebuildForProgress = {};
+		rebuildForChanged.clear();
+		rebuildForChangesLost = false;
+		rebuildForOffsets.Clear();
+		if (nodesOutdated) {
+			rebuildForStage = REBUILD_FOR_REFIT_OLD_TREE;
+			rebuildForCursor = nodesHeapAabb.size() - 1;
+		} else {
+			rebuildForStage = REBUILD_FOR_COPY;
+			rebuildForCursor = 0;
+		}
+		rebuildForPending = true;
+	}
+	while (RebuildForStep() == false) {
+		if (std::chrono::steady_clock::now() >= deadline) {
+			return GetRebuildForProgress();
+		}
+	}
+	return 1.0f;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+float BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::GetRebuildForProgress() const
+{
+	// copying entities is counted as 5% of work, applying changes and
+	// registering offsets as another 5%
+	switch (rebuildForStage) {
+	case REBUILD_FOR_REFIT_OLD_TREE:
+		return 0.0f;
+	case REBUILD_FOR_COPY:
+		return 0.05f * rebuildForCursor /
+			   std::max<size_t>(entitiesData.size(), 1);
+	case REBUILD_FOR_BUILD:
+		return 0.05f +
+			   0.9f * rebuildShadow->GetRebuildProgress(rebuildForProgress);
+	case REBUILD_FOR_REGISTER_OFFSETS:
+		return 0.975f + 0.025f * rebuildForCursor /
+							std::max<size_t>(entitiesData.size(), 1);
+	default:
+		return 0.95f;
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+bool BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
+											   SegmentType)>::RebuildForStep()
+{
+	BvhMedianSplitHeap &shadow = *rebuildShadow;
+	switch (rebuildForStage) {
+	case REBUILD_FOR_REFIT_OLD_TREE: {
+		// Old tree answers queries until shadow is swapped in. Children have
+		// higher indices than parents, so descending sweep is bottom-up.
+		const int32_t treeEntities =
+			entitiesData.size() - bruteForceEntitiesAtEndCount;
+		const int32_t end = std::max(rebuildForCursor - REBUILD_FOR_SLICE, 0);
+		for (; rebuildForCursor > end; --rebuildForCursor) {
+			RefitNode(rebuildForCursor, treeEntities);
+		}
+		if (rebuildForCursor <= 0) {
+			ClearDirty();
+			nodesOutdated = false;
+			rebuildForStage = REBUILD_FOR_COPY;
+			rebuildForCursor = 0;
+		}
+		return false;
+	}
+	case REBUILD_FOR_COPY: {
+		// Entities may be moved between calls, they are recorded as changed
+		// and duplicates are removed when shadow is scanned
+		const int32_t end = std::min<int32_t>(
+			rebuildForCursor + REBUILD_FOR_SLICE, entitiesData.size());
+		for (; rebuildForCursor < end; ++rebuildForCursor) {
+			if (entitiesData[rebuildForCursor].entity != EMPTY_ENTITY) {
+				shadow.entitiesData.push_back(entitiesData[rebuildForCursor]);
+			}
+		}
+		shadow.entitiesCount = shadow.entitiesData.size();
+		if (rebuildForCursor >= entitiesData.size()) {
+			rebuildForStage = REBUILD_FOR_BUILD;
+		}
+		return false;
+	}
+	case REBUILD_FOR_BUILD:
+		if (shadow.RebuildStep(rebuildForProgress) == false) {
+			return false;
+		}
+		rebuildForOffsets.Reserve(std::max<size_t>(
+			shadow.entitiesData.size(), entitiesData.size()));
+		rebuildForStage = REBUILD_FOR_SCAN_SHADOW;
+		rebuildForScanEntities = rebuildForChangesLost;
+		rebuildForChangesLost = false;
+		rebuildForCursor = 0;
+		return false;
+	case REBUILD_FOR_SCAN_SHADOW: {
+		// Finds offsets of entities in shadow and brings them up to date.
+		// When tail entity is removed, last one takes its place and is
+		// scanned next.
+		const int32_t end = rebuildForCursor + REBUILD_FOR_SLICE;
+		while (rebuildForCursor < end &&
+			   rebuildForCursor < shadow.entitiesData.size()) {
+			const size_t shadowSize = shadow.entitiesData.size();
+			const EntityType entity =
+				shadow.entitiesData[rebuildForCursor].entity;
+			if (entity != EMPTY_ENTITY) {
+				int32_t *it = rebuildForOffsets.find(entity);
+				if (it && *it != rebuildForCursor &&
+					*it < shadow.entitiesData.size() &&
+					shadow.entitiesData[*it].entity == entity) {
+					// entity was moved while copying and copied twice
+					RemoveFromShadow(rebuildForCursor);
+				} else {
+					rebuildForOffsets[entity] = rebuildForCursor;
+					ReconcileShadowEntity(entity);
+				}
+			}
+			if (shadow.entitiesData.size() == shadowSize) {
+				++rebuildForCursor;
+			}
+		}
+		if (rebuildForCursor >= shadow.entitiesData.size()) {
+			rebuildForStage = rebuildForScanEntities
+								  ? REBUILD_FOR_SCAN_ENTITIES
+								  : REBUILD_FOR_APPLY_CHANGES;
+			rebuildForCursor = 0;
+		}
+		return false;
+	}
+	case REBUILD_FOR_SCAN_ENTITIES: {
+		// changes were lost, finds entities missing in shadow
+		const int32_t end = std::min<int32_t>(
+			rebuildForCursor + REBUILD_FOR_SLICE, entitiesData.size());
+		for (; rebuildForCursor < end; ++rebuildForCursor) {
+			if (entitiesData[rebuildForCursor].entity != EMPTY_ENTITY) {
+				ReconcileShadowEntity(entitiesData[rebuildForCursor].entity);
+			}
+		}
+		if (rebuildForCursor >= entitiesData.size()) {
+			rebuildForStage = REBUILD_FOR_APPLY_CHANGES;
+			rebuildForCursor = 0;
+		}
+		return false;
+	}
+	case REBUILD_FOR_APPLY_CHANGES: {
+		const int32_t end = std::min<int32_t>(
+			rebuildForCursor + REBUILD_FOR_SLICE, rebuildForChanged.size());
+		for (; rebuildForCursor < end; ++rebuildForCursor) {
+			ReconcileShadowEntity(rebuildForChanged[rebuildForCursor]);
+		}
+		if (rebuildForCursor < rebuildForChanged.size()) {
+			return false;
+		}
+		rebuildForChanged.clear();
+		rebuildForCursor = 0;
+		if (rebuildForChangesLost) {
+			// too many changes since scan, everything is compared again
+			rebuildForChangesLost = false;
+			rebuildForScanEntities = true;
+			rebuildForStage = REBUILD_FOR_SCAN_SHADOW;
+		} else {
+			SwapInRebuildShadow();
+		}
+		return false;
+	}
+	case REBUILD_FOR_REGISTER_OFFSETS: {
+		// entities moved or added after swap are already registered
+		const int32_t end = std::min<int32_t>(
+			rebuildForCursor + REBUILD_FOR_SLICE, entitiesData.size());
+		for (; rebuildForCursor < end; ++rebuildForCursor) {
+			const Data &ed = entitiesData[rebuildForCursor];
+			if (ed.entity != EMPTY_ENTITY) {
+				entitiesOffsets.Set(ed.entity, rebuildForCursor);
+			}
+		}
+		if (rebuildForCursor < entitiesData.size()) {
+			return false;
+		}
+		rebuildForPending = false;
+		rebuildForOffsets.Clear();
+		shadow.ClearWithoutOffsets();
+		CompactHolesIfNeeded();
+		return true;
+	}
+	}
+	return true;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	RecordRebuildForChange(EntityType entity)
+{
+	if (rebuildForPending == false ||
+		rebuildForStage == REBUILD_FOR_REFIT_OLD_TREE ||
+		rebuildForStage == REBUILD_FOR_REGISTER_OFFSETS) {
+		return;
+	}
+	if (rebuildForChanged.size() >=
+		std::max<size_t>(entitiesData.size(), REBUILD_FOR_SLICE)) {
+		rebuildForChanged.clear();
+		rebuildForChangesLost = true;
+	}
+	rebuildForChanged.push_back(entity);
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	ReconcileShadowEntity(EntityType entity)
+{
+	// Brings entity in shadow to the same state as here. Entities which are
+	// not yet in shadow are appended to its brute force tail.
+	BvhMedianSplitHeap &shadow = *rebuildShadow;
+	int32_t offset = FindOffset(entity);
+	if (offset >= entitiesData.size() ||
+		entitiesData[offset].entity != entity) {
+		// removed, map may be shared with other instances which own it now
+		offset = -1;
+	}
+	int32_t *it = rebuildForOffsets.find(entity);
+	int32_t shadowOffset = -1;
+	if (it && *it < shadow.entitiesData.size() &&
+		shadow.entitiesData[*it].entity == entity) {
+		shadowOffset = *it;
+	}
+
+	if (offset < 0) {
+		if (shadowOffset >= 0) {
+			rebuildForOffsets.Remove(entity);
+			RemoveFromShadow(shadowOffset);
+		}
+		return;
+	}
+
+	const Data &ed = entitiesData[offset];
+	if (shadowOffset < 0) {
+		rebuildForOffsets[entity] = shadow.entitiesData.size();
+		shadow.entitiesData.push_back(ed);
+		++shadow.bruteForceEntitiesAtEndCount;
+		++shadow.entitiesCount;
+		return;
+	}
+	Data &sd = shadow.entitiesData[shadowOffset];
+	if (ed.mask != sd.mask || !(ed.aabb == sd.aabb)) {
+		sd.aabb = ed.aabb;
+		sd.mask = ed.mask;
+		if (shadowOffset + shadow.bruteForceEntitiesAtEndCount <
+			shadow.entitiesData.size()) {
+			shadow.UpdateAabb(shadowOffset);
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	RemoveFromShadow(int32_t shadowOffset)
+{
+	BvhMedianSplitHeap &shadow = *rebuildShadow;
+	--shadow.entitiesCount;
+	if (shadowOffset + shadow.bruteForceEntitiesAtEndCount >=
+		shadow.entitiesData.size()) {
+		shadow.entitiesData[shadowOffset] = shadow.entitiesData.back();
+		shadow.entitiesData.pop_back();
+		--shadow.bruteForceEntitiesAtEndCount;
+		if (shadowOffset < shadow.entitiesData.size()) {
+			rebuildForOffsets[shadow.entitiesData[shadowOffset].entity] =
+				shadowOffset;
+		}
+	} else {
+		shadow.entitiesData[shadowOffset].entity = EMPTY_ENTITY;
+		shadow.entitiesData[shadowOffset].mask = 0;
+		shadow.AddHole(shadowOffset);
+		shadow.UpdateAabb(shadowOffset);
+	}
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(
+	SKIP_LOW_LAYERS, SegmentType)>::SwapInRebuildShadow()
+{
+	BvhMedianSplitHeap &shadow = *rebuildShadow;
+	shadow.PruneEmptyEntitiesAtEnd();
+	assert(shadow.entitiesCount == entitiesCount);
+
+	std::swap(entitiesData, shadow.entitiesData);
+	std::swap(nodesHeapAabb, shadow.nodesHeapAabb);
+	std::swap(holes, shadow.holes);
+	entitiesPowerOfTwoCount = shadow.entitiesPowerOfTwoCount;
+	bruteForceEntitiesAtEndCount = shadow.bruteForceEntitiesAtEndCount;
+	ClearDirty();
+	nodesOutdated = false;
+	rebuildTree = bruteForceEntitiesAtEndCount > maxNumberOfBruteforceEntities;
+	// until registered, offsets are found in rebuildForOffsets
+	rebuildForStage = REBUILD_FOR_REGISTER_OFFSETS;
+	rebuildForCursor = 0;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS,
+											   SegmentType)>::FinishRebuildFor()
+{
+	while (RebuildForStep() == false) {
+	}
+}
+
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
 	SplitLatterHalfToEmpty(BvhMedianSplitHeap &other)
 {
 	assert(!"Untested");
+	if (rebuildForPending) {
+		FinishRebuildFor();
+	}
 	
 	const int32_t startIndex = entitiesPowerOfTwoCount / 2;
 	const int32_t endIndex = entitiesData.size();
@@ -770,6 +1689,91 @@ void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
 	}
 }
 
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+BroadphaseStatistics BvhMedianSplitHeap<
+	SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::GetStatistics()
+{
+
+	BroadphaseStatistics stats;
+	const int32_t treeEntities =
+		entitiesData.size() - bruteForceEntitiesAtEndCount;
+	if (nodesHeapAabb.size() > 1 && treeEntities > 0) {
+		stats.rootSurface = nodesHeapAabb[1].aabb.GetSurface();
+		_Internal_GetStatistics(stats, 1, 0);
+	} else if (treeEntities > 0) {
+		// all entities are tested directly as single leaf
+		int32_t count = 0;
+		Aabb tight = entitiesData[0].aabb;
+		for (int32_t i = 0; i < treeEntities; ++i) {
+			if (entitiesData[i].entity != EMPTY_ENTITY) {
+				tight = count ? tight + entitiesData[i].aabb
+							  : entitiesData[i].aabb;
+				++count;
+			}
+		}
+		stats.rootSurface = tight.GetSurface();
+		stats.AddLeaf(0, tight.GetSurface(), tight.GetSurface(), count);
+	}
+	stats.AddUnsorted(bruteForceEntitiesAtEndCount);
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
+void BvhMedianSplitHeap<SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::
+	_Internal_GetStatistics(BroadphaseStatistics &stats, const int32_t nodeId,
+							int32_t depth) const
+{
+	const int32_t treeEntities =
+		entitiesData.size() - bruteForceEntitiesAtEndCount;
+	const int32_t n = nodeId << 1;
+
+	// same traversal as in _Internal_IntersectAabb
+	int32_t start = -1, end = -1;
+	if (n >= entitiesPowerOfTwoCount) {
+		start = n - entitiesPowerOfTwoCount;
+		end = std::min(start + 2, treeEntities);
+	} else if (SKIP_LOW_LAYERS && n >= nodesHeapAabb.size()) {
+		start = (n << SKIP_LOW_LAYERS) - entitiesPowerOfTwoCount;
+		end = std::min(start + (2 << SKIP_LOW_LAYERS), treeEntities);
+	}
+
+	const float surface = nodesHeapAabb[nodeId].aabb.GetSurface();
+	if (start >= 0) {
+		int32_t count = 0;
+		Aabb tight;
+		for (int32_t i = start; i < end; ++i) {
+			if (entitiesData[i].entity != EMPTY_ENTITY) {
+				tight = count ? tight + entitiesData[i].aabb
+							  : entitiesData[i].aabb;
+				++count;
+			}
+		}
+		stats.AddLeaf(depth, surface, count ? tight.GetSurface() : 0.0f,
+					  count);
+		return;
+	}
+
+	stats.AddNode(depth, surface);
+	bool valid[2] = {false, false};
+	for (int i = 0; i <= 1; ++i) {
+		if (n + i >= nodesHeapAabb.size()) {
+			continue;
+		}
+		int32_t first = n + i;
+		while (first < entitiesPowerOfTwoCount) {
+			first <<= 1;
+		}
+		valid[i] = first - entitiesPowerOfTwoCount < treeEntities;
+		if (valid[i]) {
+			_Internal_GetStatistics(stats, n + i, depth + 1);
+		}
+	}
+	if (valid[0] && valid[1]) {
+		stats.AddSiblings(nodesHeapAabb[n].aabb, nodesHeapAabb[n + 1].aabb);
+	}
+}
+
 SPP_TEMPLATE_DECL_MORE(int SKIP_LOW_LAYERS, typename SegmentType)
 BroadphaseBaseIterator<SPP_TEMPLATE_ARGS> *BvhMedianSplitHeap<
 	SPP_TEMPLATE_ARGS_MORE(SKIP_LOW_LAYERS, SegmentType)>::RestartIterator()
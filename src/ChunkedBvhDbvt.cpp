@@ -2,7 +2,15 @@
 // Copyright (c) 2024-2025 Marek Zalewski aka Drwalin
 // You should have received a copy of the MIT License along with this program.
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <cstdio>
+#include <limits>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "../glm/glm/vector_relational.hpp"
 #include "../glm/glm/common.hpp"
@@ -17,7 +25,9 @@ ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ChunkedBvhDbvt(int32_t denseEntityRan
 	  outerObjects(EntitiesOffsetsMapType_Reference(&entitiesOffsets, -1)),
 	  iterator(*this)
 {
-	chunks.reserve(10000);
+	chunks.reserve(1024);
+	chunkIdToIndex.Reserve(1024);
+	ApplyChunkGeometry({});
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -35,15 +45,15 @@ const char *ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetName() const
 			aabb = aabb + (it->aabb);
 		}
 	} else {
-		for (const auto &c : chunks) {
-			int32_t d = c.second.GetCount();
-			if (c.second.bvh.nodesHeapAabb.size() >= 2) {
-				aabb = aabb + c.second.ToGlobalAabb(c.second.bvh.nodesHeapAabb[1].aabb);
+		for (const Chunk &c : chunks) {
+			int32_t d = c.GetCount();
+			if (c.bvh.nodesHeapAabb.size() >= 2) {
+				aabb = aabb + c.ToGlobalAabb(c.bvh.nodesHeapAabb[1].aabb);
 			}
 			if (d > maxElemsInChunk) {
 				maxElemsInChunk = d;
-				a = c.second.bvh.nodesHeapAabb.capacity();
-				b = c.second.bvh.entitiesData.capacity();
+				a = c.bvh.nodesHeapAabb.capacity();
+				b = c.bvh.entitiesData.capacity();
 			}
 		}
 		for (auto it = (((ChunkedBvhDbvt*)this)->outerObjects).RestartIterator(); it->Valid(); it->Next()) {
@@ -63,18 +73,30 @@ SPP_TEMPLATE_DECL_NO_AABB
 void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Clear()
 {
 	chunks.clear();
+	chunkIdToIndex.Clear();
+	for (int32_t &c : chunksCountPerLevel) {
+		c = 0;
+	}
 	chunksBvh->Clear();
+	outerObjects.Clear();
 	entitiesOffsets.Clear();
 	entitiesCount = 0;
+	dirtyChunks.clear();
+	dirtyChunksHead = 0;
+	rebuildForDone = 0;
+	outerObjectsChanged = false;
+	chunksBvhChanged = false;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
 size_t ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetMemoryUsage() const
 {
-	size_t size = chunksBvh->GetMemoryUsage() + chunks.GetMemoryUsage() +
+	size_t size = chunksBvh->GetMemoryUsage() +
+				  chunks.capacity() * sizeof(Chunk) +
+				  chunkIdToIndex.GetMemoryUsage() +
 				  entitiesOffsets.GetMemoryUsage();
-	for (const auto &c : chunks) {
-		size += c.second.GetMemoryUsage();
+	for (const Chunk &c : chunks) {
+		size += c.GetMemoryUsage();
 	}
 	return size;
 }
@@ -84,21 +106,19 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ShrinkToFit()
 {
 	chunksBvh->ShrinkToFit();
 	entitiesOffsets.ShrinkToFit();
-	std::vector<int32_t> toRemove;
-	for (auto &c : chunks) {
-		if (c.second.GetCount() == 0) {
-			toRemove.push_back(c.first);
+	for (size_t i = 0; i < chunks.size();) {
+		if (chunks[i].GetCount() == 0) {
+			assert(chunksBvh->Exists(chunks[i].chunkId));
+			RemoveChunk(chunks[i].chunkId);
 		} else {
-			c.second.ShrinkToFit();
+			chunks[i].ShrinkToFit();
+			++i;
 		}
 	}
-
-	for (auto &c : toRemove) {
-		assert(chunksBvh->Exists(c));
-		chunksBvh->Remove(c);
-		chunks.erase(c);
-	}
+	chunks.shrink_to_fit();
+	chunkIdToIndex.ShrinkToFit();
 	chunksBvh->Rebuild();
+	chunksBvhChanged = false;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -116,6 +136,7 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Add(EntityType entity,
 
 	if (chunkId == -1) {
 		outerObjects.Add(entity, aabb, mask);
+		outerObjectsChanged = true;
 	} else {
 		Chunk *chunk = GetOrInitChunk(chunkId, aabb);
 		chunk->Add(entity, aabb, mask);
@@ -149,11 +170,12 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Update(EntityType entity,
 	if (oldChunkId == newChunkId) {
 		if (oldChunkId == -1) {
 			outerObjects.Update(entity, aabb);
+			outerObjectsChanged = true;
 		} else {
-			auto it = chunks.find(oldChunkId);
-			assert(it != chunks.end() &&
+			Chunk *chunk = GetChunkById(oldChunkId);
+			assert(chunk != nullptr &&
 				   "Updating entity within chunk that does not exist.");
-			it->second.Update(entity, aabb);
+			chunk->Update(entity, aabb);
 		}
 	} else {
 		MaskType mask = 0;
@@ -161,23 +183,23 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Update(EntityType entity,
 		if (oldChunkId == -1) {
 			mask = outerObjects.GetMask(entity);
 			outerObjects.Remove(entity);
+			outerObjectsChanged = true;
 		} else {
-			auto it = chunks.find(oldChunkId);
-			assert(it != chunks.end() &&
+			Chunk *oldChunk = GetChunkById(oldChunkId);
+			assert(oldChunk != nullptr &&
 				   "While updating entity trying to remove it from it's old "
 				   "chunk but that chunk does not exist.");
-			Chunk *oldChunk = &(it->second);
 			mask = oldChunk->GetMask(entity, offset);
 			oldChunk->Remove(entity);
 			if (oldChunk->GetCount() == 0) {
 // 				oldChunk->ShrinkToFit();
-				chunksBvh->Remove(oldChunkId);
-				chunks.erase(it);
+				RemoveChunk(oldChunkId);
 			}
 		}
 
 		if (newChunkId == -1) {
 			outerObjects.Add(entity, aabb, mask);
+			outerObjectsChanged = true;
 		} else {
 			GetOrInitChunk(newChunkId, aabb)->Add(entity, aabb, mask);
 		}
@@ -190,42 +212,457 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Update(EntityType entity,
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
-void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ShrinkToFitIncremental()
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::AddBatch(
+	std::span<const std::tuple<EntityType, Aabb, MaskType>> entities)
 {
-	const size_t chunkCount = chunks.bucket_count();
-	if (chunkCount == 0) {
-		[[unlikely]];
-		return;
+	batchEntries.clear();
+	for (const auto &[entity, aabb, mask] : entities) {
+		if (entitiesOffsets.find(entity) != nullptr) {
+			assert(!"Entity already exists");
+			continue;
+		}
+		batchEntries.push_back({GetChunkIdFromAabb(aabb), entity, mask, aabb});
 	}
-	const size_t bucket = (incrementalIterator1 %= chunkCount);
-	const size_t bucketSize = chunks.bucket_size(bucket);
-	if (incrementalIterator2 >= bucketSize) {
-		[[unlikely]];
-		++incrementalIterator1;
-		incrementalIterator2 = 0;
+	SortBatchEntriesByChunk();
+
+	for (size_t i = 0; i < batchEntries.size();) {
+		const int32_t chunkId = batchEntries[i].chunkId;
+		assert(chunkId != 0);
+		if (chunkId == -1) {
+			for (; i < batchEntries.size() && batchEntries[i].chunkId == -1;
+				 ++i) {
+				const BatchEntry &e = batchEntries[i];
+				outerObjects.Add(e.entity, e.aabb, e.mask);
+			}
+			outerObjectsChanged = true;
+		} else {
+			Chunk *chunk = GetOrInitChunk(chunkId, batchEntries[i].aabb);
+			for (; i < batchEntries.size() &&
+				   batchEntries[i].chunkId == chunkId;
+				 ++i) {
+				const BatchEntry &e = batchEntries[i];
+				chunk->Add(e.entity, e.aabb, e.mask);
+			}
+		}
+	}
+	entitiesCount += batchEntries.size();
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::BulkLoad(
+	std::span<const EntityType> entities, std::span<const Aabb> aabbs,
+	std::span<const MaskType> masks)
+{
+	assert(GetCount() == 0);
+	assert(entities.size() == aabbs.size());
+	assert(entities.size() == masks.size());
+	if (autoTuneOnBulkLoad) {
+		ApplyChunkGeometry(ComputeChunkGeometry(
+			aabbs, autoTuneTargetEntitiesPerChunk, autoTuneOuterFraction));
+	}
+	BulkLoadChunks(entities, aabbs, masks);
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::BulkLoadChunks(
+	std::span<const EntityType> entities, std::span<const Aabb> aabbs,
+	std::span<const MaskType> masks)
+{
+	batchEntries.clear();
+	batchEntries.reserve(entities.size());
+	for (size_t i = 0; i < entities.size(); ++i) {
+		batchEntries.push_back(
+			{GetChunkIdFromAabb(aabbs[i]), entities[i], masks[i], aabbs[i]});
+	}
+	SortBatchEntriesByChunk();
+	entitiesOffsets.Reserve(entities.size());
+
+	const size_t count = batchEntries.size();
+	std::vector<EntityType> bulkEntities(count);
+	std::vector<MaskType> bulkMasks(count);
+	std::vector<Aabb_i16> bulkLocalAabbs(count);
+
+	// ranges of batchEntries of each chunk, chunks are looked up after all
+	// of them are created
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (size_t i = 0; i < count;) {
+		const int32_t chunkId = batchEntries[i].chunkId;
+		assert(chunkId != 0);
+		size_t end = i + 1;
+		while (end < count && batchEntries[end].chunkId == chunkId) {
+			++end;
+		}
+		if (chunkId == -1) {
+			std::vector<Aabb> outerAabbs;
+			outerAabbs.reserve(end - i);
+			for (size_t j = i; j < end; ++j) {
+				bulkEntities[j] = batchEntries[j].entity;
+				bulkMasks[j] = batchEntries[j].mask;
+				outerAabbs.push_back(batchEntries[j].aabb);
+			}
+			outerObjects.BulkLoad(
+				std::span(bulkEntities).subspan(i, end - i), outerAabbs,
+				std::span(bulkMasks).subspan(i, end - i));
+		} else {
+			GetOrInitChunk(chunkId, batchEntries[i].aabb);
+			ranges.push_back({i, end});
+		}
+		i = end;
+	}
+	std::vector<Chunk *> rangeChunks(ranges.size());
+	for (size_t r = 0; r < ranges.size(); ++r) {
+		rangeChunks[r] = GetChunkById(batchEntries[ranges[r].first].chunkId);
+	}
+
+	std::atomic<size_t> nextRange = 0;
+	auto worker = [&]() {
+		for (size_t r = nextRange++; r < ranges.size(); r = nextRange++) {
+			Chunk *chunk = rangeChunks[r];
+			const auto [begin, end] = ranges[r];
+			for (size_t j = begin; j < end; ++j) {
+				const BatchEntry &e = batchEntries[j];
+				bulkEntities[j] = e.entity;
+				bulkMasks[j] = e.mask;
+				bulkLocalAabbs[j] = chunk->ToLocalAabb(e.aabb);
+			}
+			const size_t n = end - begin;
+			chunk->bvh.BulkLoadWithoutOffsets(
+				std::span(bulkEntities).subspan(begin, n),
+				std::span(bulkLocalAabbs).subspan(begin, n),
+				std::span(bulkMasks).subspan(begin, n), 1);
+			chunk->changes = 0;
+		}
+	};
+	RunParallel(std::min<int32_t>(this->GetBulkLoadThreadsCount(count),
+								  ranges.size()),
+				worker);
+
+	// shared offsets map is written only by this thread
+	for (Chunk *chunk : rangeChunks) {
+		chunk->bvh.RegisterAllOffsets();
+	}
+
+	entitiesCount += count;
+	batchEntries.clear();
+	chunksBvh->Rebuild();
+	chunksBvhChanged = false;
+	outerObjectsChanged = false;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::UpdateBatch(
+	std::span<const std::pair<EntityType, Aabb>> entities)
+{
+	batchEntries.clear();
+	int32_t movedCount = 0;
+	for (const auto &[entity, aabb] : entities) {
+		int32_t offset = 0;
+		const int32_t oldChunkId = GetChunkIdOfEntity(entity, offset);
+		if (oldChunkId == 0) {
+			assert(!"Entity does not exists");
+			continue;
+		}
+		if (oldChunkId != GetChunkIdFromAabb(aabb)) {
+			// moving between chunks is not batched
+			Update(entity, aabb);
+			++movedCount;
+			continue;
+		}
+		batchEntries.push_back({oldChunkId, entity, 0, aabb});
+	}
+	SortBatchEntriesByChunk();
+
+	for (size_t i = 0; i < batchEntries.size();) {
+		const int32_t chunkId = batchEntries[i].chunkId;
+		size_t end = i + 1;
+		while (end < batchEntries.size() &&
+			   batchEntries[end].chunkId == chunkId) {
+			++end;
+		}
+		if (chunkId == -1) {
+			for (; i < end; ++i) {
+				outerObjects.Update(batchEntries[i].entity,
+									batchEntries[i].aabb);
+			}
+			outerObjectsChanged = true;
+		} else {
+			Chunk *chunk = GetChunkById(chunkId);
+			assert(chunk != nullptr &&
+				   "Updating entity within chunk that does not exist.");
+			chunk->UpdateBatch(std::span(batchEntries).subspan(i, end - i));
+		}
+		i = end;
+	}
+
+	AdvanceRoundRobin(entities.size() - movedCount);
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RemoveBatch(
+	std::span<const EntityType> entities)
+{
+	batchEntries.clear();
+	for (const EntityType entity : entities) {
+		int32_t offset = 0;
+		const int32_t chunkId = GetChunkIdOfEntity(entity, offset);
+		if (chunkId == 0) {
+			continue;
+		}
+		batchEntries.push_back({chunkId, entity, 0, {}});
+	}
+	SortBatchEntriesByChunk();
+
+	for (size_t i = 0; i < batchEntries.size();) {
+		const int32_t chunkId = batchEntries[i].chunkId;
+		if (chunkId == -1) {
+			for (; i < batchEntries.size() && batchEntries[i].chunkId == -1;
+				 ++i) {
+				outerObjects.Remove(batchEntries[i].entity);
+			}
+			outerObjectsChanged = true;
+		} else {
+			Chunk *chunk = GetChunkById(chunkId);
+			assert(chunk != nullptr);
+			for (; i < batchEntries.size() &&
+				   batchEntries[i].chunkId == chunkId;
+				 ++i) {
+				chunk->Remove(batchEntries[i].entity);
+			}
+			if (chunk->GetCount() == 0) {
+				RemoveChunk(chunkId);
+			}
+		}
+	}
+	entitiesCount -= batchEntries.size();
+
+	AdvanceRoundRobin(batchEntries.size());
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::IngestBatch(
+	std::span<const std::tuple<EntityType, Aabb, MaskType>> entities)
+{
+	// last write wins for entities repeated in batch
+	std::vector<std::tuple<EntityType, Aabb, MaskType>> deduplicated;
+	{
+		FlatGroupIntMap<EntityType, uint32_t> lastIndex;
+		lastIndex.Reserve(entities.size());
+		for (size_t i = 0; i < entities.size(); ++i) {
+			lastIndex[std::get<0>(entities[i])] = i;
+		}
+		if (lastIndex.Size() != entities.size()) {
+			deduplicated.reserve(lastIndex.Size());
+			for (size_t i = 0; i < entities.size(); ++i) {
+				if (lastIndex[std::get<0>(entities[i])] == i) {
+					deduplicated.push_back(entities[i]);
+				}
+			}
+			entities = deduplicated;
+		}
+	}
+	const size_t count = entities.size();
+
+	// small batch would rebuild whole chunks for few of their entities
+	if (count * INGEST_MIN_FRACTION_INVERSE < (size_t)entitiesCount) {
+		std::vector<std::tuple<EntityType, Aabb, MaskType>> added;
+		std::vector<std::pair<EntityType, Aabb>> updated;
+		std::vector<MaskType> masks;
+		for (const auto &[entity, aabb, mask] : entities) {
+			if (Exists(entity)) {
+				updated.push_back({entity, aabb});
+				masks.push_back(mask);
+			} else {
+				added.push_back({entity, aabb, mask});
+			}
+		}
+		UpdateBatch(updated);
+		for (size_t i = 0; i < updated.size(); ++i) {
+			SetMask(updated[i].first, masks[i]);
+		}
+		AddBatch(added);
 		return;
 	}
-	
-	auto it = chunks.begin(bucket);
-	for (size_t i=0; i<incrementalIterator2; ++i) {
-		++it;
+
+	int32_t threads = this->GetBulkLoadThreadsCount(count);
+	if (threadsCount > 0) {
+		threads = std::min(threads, threadsCount);
 	}
-	auto chunkId = it->second.chunkId;
-	if (it->second.GetCount() != 0) {
-		[[likely]]
-		it->second.Rebuild();
-		it->second.ShrinkToFit();
-	} else if (chunkId > 0) {
-		[[likely]]
-		chunksBvh->Remove(chunkId);
-		chunks.erase(chunkId);
+
+	// target and current chunks are found in parallel, map is only read
+	batchEntries.resize(count);
+	std::vector<int32_t> oldChunkIds(count);
+	{
+		const size_t BLOCK_SIZE = 4096;
+		std::atomic<size_t> next = 0;
+		auto worker = [&]() {
+			for (size_t begin = next.fetch_add(BLOCK_SIZE); begin < count;
+				 begin = next.fetch_add(BLOCK_SIZE)) {
+				const size_t end = std::min(begin + BLOCK_SIZE, count);
+				for (size_t i = begin; i < end; ++i) {
+					const auto &[entity, aabb, mask] = entities[i];
+					int32_t offset;
+					oldChunkIds[i] = GetChunkIdOfEntity(entity, offset);
+					batchEntries[i] = {GetChunkIdFromAabb(aabb), entity, mask,
+									   aabb};
+				}
+			}
+		};
+		RunParallel(threads, worker);
 	}
-	
-	++incrementalIterator2;
-	if (incrementalIterator2 >= bucketSize) {
+
+	// Entities moving between chunks are removed from their old chunks and
+	// are added to target chunks as new ones. Outer objects are not
+	// partitioned, they are updated here.
+	int32_t addedCount = 0;
+	std::vector<int32_t> emptiedChunks;
+	for (size_t i = 0; i < count; ++i) {
+		const BatchEntry &e = batchEntries[i];
+		const int32_t oldChunkId = oldChunkIds[i];
+		if (oldChunkId == 0) {
+			++addedCount;
+		} else if (oldChunkId == -1 && e.chunkId != -1) {
+			outerObjects.Remove(e.entity);
+			outerObjectsChanged = true;
+		} else if (oldChunkId != -1 && oldChunkId != e.chunkId) {
+			Chunk *oldChunk = GetChunkById(oldChunkId);
+			assert(oldChunk != nullptr);
+			oldChunk->Remove(e.entity);
+			if (oldChunk->GetCount() == 0) {
+				emptiedChunks.push_back(oldChunkId);
+			}
+		}
+
+		if (e.chunkId == -1) {
+			if (oldChunkId == -1) {
+				outerObjects.Update(e.entity, e.aabb);
+				outerObjects.SetMask(e.entity, e.mask);
+			} else {
+				outerObjects.Add(e.entity, e.aabb, e.mask);
+			}
+			outerObjectsChanged = true;
+		}
+	}
+	for (int32_t chunkId : emptiedChunks) {
+		RemoveChunk(chunkId);
+	}
+
+	SortBatchEntriesByChunk();
+	entitiesOffsets.Reserve(entitiesCount + addedCount);
+
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (size_t i = 0; i < count;) {
+		const int32_t chunkId = batchEntries[i].chunkId;
+		size_t end = i + 1;
+		while (end < count && batchEntries[end].chunkId == chunkId) {
+			++end;
+		}
+		if (chunkId != -1) {
+			GetOrInitChunk(chunkId, batchEntries[i].aabb);
+			ranges.push_back({i, end});
+		}
+		i = end;
+	}
+	// chunks are looked up after all of them are created
+	std::vector<Chunk *> rangeChunks(ranges.size());
+	for (size_t r = 0; r < ranges.size(); ++r) {
+		rangeChunks[r] = GetChunkById(batchEntries[ranges[r].first].chunkId);
+	}
+
+	// Each chunk is rebuilt by single worker from it's entities not present
+	// in batch and entities of batch, shared map is not accessed
+	std::atomic<size_t> nextRange = 0;
+	auto worker = [&]() {
+		std::vector<EntityType> bulkEntities;
+		std::vector<Aabb_i16> bulkAabbs;
+		std::vector<MaskType> bulkMasks;
+		for (size_t r = nextRange++; r < ranges.size(); r = nextRange++) {
+			Chunk *chunk = rangeChunks[r];
+			const auto [begin, end] = ranges[r];
+			const auto range =
+				std::span(batchEntries).subspan(begin, end - begin);
+			auto byEntity = [](const BatchEntry &a, const BatchEntry &b) {
+				return a.entity < b.entity;
+			};
+			std::sort(range.begin(), range.end(), byEntity);
+
+			bulkEntities.clear();
+			bulkAabbs.clear();
+			bulkMasks.clear();
+			for (const auto &d : chunk->bvh.entitiesData) {
+				if (d.entity == EMPTY_ENTITY) {
+					continue;
+				}
+				auto it = std::lower_bound(range.begin(), range.end(),
+										   BatchEntry{0, d.entity, 0, {}},
+										   byEntity);
+				if (it != range.end() && it->entity == d.entity) {
+					continue;
+				}
+				bulkEntities.push_back(d.entity);
+				bulkAabbs.push_back(d.aabb);
+				bulkMasks.push_back(d.mask);
+			}
+			for (const BatchEntry &e : range) {
+				bulkEntities.push_back(e.entity);
+				bulkAabbs.push_back(chunk->ToLocalAabb(e.aabb));
+				bulkMasks.push_back(e.mask);
+			}
+
+			chunk->bvh.ClearWithoutOffsets();
+			chunk->bvh.BulkLoadWithoutOffsets(bulkEntities, bulkAabbs,
+											  bulkMasks, 1);
+			chunk->changes = 0;
+		}
+	};
+	RunParallel(std::min<int32_t>(threads, ranges.size()), worker);
+
+	// shared offsets map is written only by this thread
+	for (Chunk *chunk : rangeChunks) {
+		chunk->bvh.RegisterAllOffsets();
+	}
+	entitiesCount += addedCount;
+	batchEntries.clear();
+
+	AdvanceRoundRobin(count);
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SortBatchEntriesByChunk()
+{
+	std::sort(batchEntries.begin(), batchEntries.end(),
+			  [](const BatchEntry &a, const BatchEntry &b) {
+				  return a.chunkId < b.chunkId;
+			  });
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::AdvanceRoundRobin(
+	int32_t steps)
+{
+	const int32_t before = roundRobinCounter >> 8;
+	roundRobinCounter += steps;
+	for (int32_t i = before; i < (roundRobinCounter >> 8); ++i) {
+		ShrinkToFitIncremental();
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ShrinkToFitIncremental()
+{
+	if (chunks.empty()) {
+		[[unlikely]];
+		return;
+	}
+	const size_t index = (incrementalIterator %= chunks.size());
+	Chunk &chunk = chunks[index];
+	if (chunk.GetCount() != 0) {
 		[[likely]]
-		incrementalIterator2 = 0;
-		++incrementalIterator1;
+		chunk.Rebuild();
+		chunk.ShrinkToFit();
+		++incrementalIterator;
+	} else {
+		// last chunk is moved into this index, it will be visited next
+		RemoveChunk(chunk.chunkId);
 	}
 }
 
@@ -240,12 +677,11 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Remove(EntityType entity)
 		chunk->Remove(entity);
 		if (chunk->GetCount() == 0) {
 			[[unlikely]];
-			uint32_t id = chunk->chunkId;
-			chunksBvh->Remove(id);
-			chunks.erase(id);
+			RemoveChunk(chunk->chunkId);
 		}
 	} else {
 		outerObjects.Remove(entity);
+		outerObjectsChanged = true;
 	}
 
 	--entitiesCount;
@@ -256,32 +692,175 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Remove(EntityType entity)
 	}
 }
 
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::IntersectRayGridMarching(
+	typename RayCallbacks::InterChunkCb &cb, int32_t level)
+{
+	const ChunkLevel &l = chunkLevels[level];
+	const float s = l.chunkSize;
+	const int32_t limit = l.limitOffset;
+
+	// chunks extend by quarter of chunk size into neighbouring cells
+	const Aabb bounds{glm::vec3(-(limit - 1) * s - s * 0.25f),
+					  glm::vec3(limit * s + s * 0.25f)};
+	float tmin, tmax;
+	if (bounds.FastRayTest2(cb.start, cb.invDir, cb.signs, tmin, tmax) ==
+		false) {
+		return;
+	}
+	const float tBegin = glm::max(tmin, 0.0f);
+	if (tBegin > glm::min(tmax, cb.orgCb->cutFactor)) {
+		return;
+	}
+
+	const glm::vec3 p = cb.start + cb.dir * tBegin;
+	glm::ivec3 cell =
+		glm::clamp(glm::ivec3(glm::floor(p / s)), -(limit - 1), limit - 1);
+
+	glm::ivec3 step;
+	glm::vec3 tDelta, tNext;
+	for (int i = 0; i < 3; ++i) {
+		if (cb.dir[i] > 0.0f) {
+			step[i] = 1;
+			tDelta[i] = s * cb.invDir[i];
+			tNext[i] = ((cell[i] + 1) * s - cb.start[i]) * cb.invDir[i];
+		} else if (cb.dir[i] < 0.0f) {
+			step[i] = -1;
+			tDelta[i] = -s * cb.invDir[i];
+			tNext[i] = (cell[i] * s - cb.start[i]) * cb.invDir[i];
+		} else {
+			step[i] = 0;
+			tDelta[i] = tNext[i] = std::numeric_limits<float>::infinity();
+		}
+	}
+
+	// Any chunk hit at t is neighbour of cell containing point at t
+	auto TestCell = [&](glm::ivec3 c) {
+		if (glm::any(glm::lessThanEqual(c, glm::ivec3(-limit))) ||
+			glm::any(glm::greaterThanEqual(c, glm::ivec3(limit)))) {
+			return;
+		}
+		const int32_t chunkId = EncodeChunkId(c, level);
+		const Chunk *chunk = GetChunkById(chunkId);
+		if (chunk == nullptr) {
+			return;
+		}
+		cb.cutFactor = cb.orgCb->cutFactor;
+		cb.ExecuteIfRelevant(chunk->globalAabb, chunkId);
+	};
+
+	for (int x = -1; x <= 1; ++x) {
+		for (int y = -1; y <= 1; ++y) {
+			for (int z = -1; z <= 1; ++z) {
+				TestCell(cell + glm::ivec3(x, y, z));
+			}
+		}
+	}
+
+	while (true) {
+		int axis = 0;
+		if (tNext[1] < tNext[axis]) {
+			axis = 1;
+		}
+		if (tNext[2] < tNext[axis]) {
+			axis = 2;
+		}
+		const float tBoundary = tNext[axis];
+		if (tBoundary > tmax || tBoundary > cb.orgCb->cutFactor) {
+			break;
+		}
+		cell[axis] += step[axis];
+		tNext[axis] += tDelta[axis];
+		if (cell[axis] <= -limit || cell[axis] >= limit) {
+			break;
+		}
+
+		// only cells of leading plane of neighbourhood are new
+		const int a = (axis + 1) % 3;
+		const int b = (axis + 2) % 3;
+		glm::ivec3 c = cell;
+		c[axis] += step[axis];
+		for (int i = -1; i <= 1; ++i) {
+			for (int j = -1; j <= 1; ++j) {
+				c[a] = cell[a] + i;
+				c[b] = cell[b] + j;
+				TestCell(c);
+			}
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetRayTraversalMode(
+	RayTraversalMode mode)
+{
+	rayTraversalMode = mode;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+typename ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RayTraversalMode
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetRayTraversalMode() const
+{
+	return rayTraversalMode;
+}
+
 SPP_TEMPLATE_DECL_NO_AABB
 int32_t
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunkIdFromAabb(Aabb aabb) const
 {
-	glm::vec3 min = glm::floor(aabb.GetCenter() / chunkSize);
+	const glm::vec3 center = aabb.GetCenter();
 	glm::vec3 size = aabb.GetSizes();
 
 	float maxSize = glm::max(size.x, glm::max(size.y, size.z));
 
-	if (maxSize > maxChunkedEntitySize) {
-		return -1;
-	}
+	for (int32_t level = 0; level < CHUNK_LEVELS; ++level) {
+		const ChunkLevel &l = chunkLevels[level];
+		if (maxSize > l.maxEntitySize) {
+			continue;
+		}
 
-	if (glm::any(glm::lessThanEqual(min, glm::vec3(-limitChunkOffset)))) {
-		return -1;
-	}
+		glm::vec3 min = glm::floor(center / l.chunkSize);
+		if (glm::any(glm::lessThanEqual(min, glm::vec3(-l.limitOffset)))) {
+			continue;
+		}
+		if (glm::any(glm::greaterThanEqual(min, glm::vec3(l.limitOffset)))) {
+			continue;
+		}
 
-	if (glm::any(glm::greaterThanEqual(min, glm::vec3(limitChunkOffset)))) {
-		return -1;
+		return EncodeChunkId(min, level);
 	}
+	return -1;
+}
 
-	glm::ivec3 hs = min + 512.0f;
-	int32_t id =
-		(hs.x & 0x3FF) | ((hs.y & 0x3FF) << 10) | ((hs.z & 0x3FF) << 20);
+SPP_TEMPLATE_DECL_NO_AABB
+int32_t
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::EncodeChunkId(glm::ivec3 offset,
+														 int32_t level)
+{
+	if (level == 0) {
+		const glm::ivec3 hs = offset + 512;
+		return (hs.x & 0x3FF) | ((hs.y & 0x3FF) << 10) | ((hs.z & 0x3FF) << 20);
+	}
+	const glm::ivec3 hs = offset + 128;
+	return CHUNK_ID_LEVEL_BIT | ((level - 1) << 24) | (hs.x & 0xFF) |
+		   ((hs.y & 0xFF) << 8) | ((hs.z & 0xFF) << 16);
+}
 
-	return id;
+SPP_TEMPLATE_DECL_NO_AABB
+glm::ivec3
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::DecodeChunkId(int32_t chunkId,
+														 int32_t &level)
+{
+	if ((chunkId & CHUNK_ID_LEVEL_BIT) == 0) {
+		level = 0;
+		return glm::ivec3(chunkId & 0x3FF, (chunkId >> 10) & 0x3FF,
+						  (chunkId >> 20) & 0x3FF) -
+			   512;
+	}
+	level = ((chunkId >> 24) & 3) + 1;
+	return glm::ivec3(chunkId & 0xFF, (chunkId >> 8) & 0xFF,
+					  (chunkId >> 16) & 0xFF) -
+		   128;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -326,13 +905,11 @@ ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunkOfEntity(
 		if (segment == -1 || segment == 0) {
 			return nullptr;
 		}
-		auto it2 = chunks.find(segment);
-		if (it2 == chunks.end()) {
-			assert(!"Should not happen: entity exists and is assigned to a "
-					"chunk that does not exist.");
-			return nullptr;
-		}
-		return &(it2->second);
+		const Chunk *chunk = GetChunkById(segment);
+		assert(chunk != nullptr &&
+			   "Should not happen: entity exists and is assigned to a chunk "
+			   "that does not exist.");
+		return chunk;
 	}
 }
 
@@ -341,29 +918,53 @@ ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk *
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetOrInitChunk(int32_t chunkId,
 														  Aabb aabb)
 {
-	auto it = chunks.find(chunkId);
-	if (it == chunks.end()) {
-		// auto e = chunks.insert_or_assign(chunkId, std::move(Chunk(this,
-		//                                  chunkId, chunkSize, aabb)));
-		// auto e = chunks.emplace(chunkId,
-		//                         Chunk(this, chunkId, chunkSize, aabb));
-		Chunk *chunk = &(chunks[chunkId]);
-		chunk->Init(this, chunkId, chunkSize, aabb);
+	Chunk *chunk = GetChunkById(chunkId);
+	if (chunk == nullptr) {
+		chunkIdToIndex.Set(chunkId, chunks.size());
+		chunk = &(chunks.emplace_back());
+		int32_t level = 0;
+		DecodeChunkId(chunkId, level);
+		chunk->Init(this, chunkId, level, aabb);
+		++chunksCountPerLevel[level];
 		chunksBvh->Add(chunkId, chunk->globalAabb, ~0);
-		return chunk;
+		chunksBvhChanged = true;
 	}
-	return &(it->second);
+	return chunk;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk *
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunkById(uint32_t chunkId)
 {
-	auto it = chunks.find(chunkId);
-	if (it != chunks.end()) {
-		return &(it->second);
+	return (Chunk *)(((const ChunkedBvhDbvt *)this)->GetChunkById(chunkId));
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+const ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk *
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunkById(uint32_t chunkId) const
+{
+	const int32_t *index = chunkIdToIndex.find(chunkId);
+	if (index == nullptr) {
+		return nullptr;
+	}
+	return &(chunks[*index]);
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RemoveChunk(int32_t chunkId)
+{
+	const int32_t *it = chunkIdToIndex.find(chunkId);
+	assert(it != nullptr);
+	const int32_t index = *it;
+	--chunksCountPerLevel[chunks[index].level - chunkLevels];
+	chunksBvh->Remove(chunkId);
+	chunkIdToIndex.Remove(chunkId);
+	if (index + 1 != (int32_t)chunks.size()) {
+		chunks[index] = std::move(chunks.back());
+		chunkIdToIndex.Set(chunks[index].chunkId, index);
 	}
-	return &(it->second);
+	chunks.pop_back();
+	chunksBvhChanged = true;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -462,7 +1063,15 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::IntersectRay(RayCallback &cb)
 	interChunkCb.dbvt = this;
 	interChunkCb.orgCb = &cb;
 
-	chunksBvh->IntersectRay(interChunkCb);
+	if (rayTraversalMode == RAY_TRAVERSAL_GRID_MARCHING) {
+		for (int32_t level = 0; level < CHUNK_LEVELS; ++level) {
+			if (chunksCountPerLevel[level] > 0) {
+				IntersectRayGridMarching(interChunkCb, level);
+			}
+		}
+	} else {
+		chunksBvh->IntersectRay(interChunkCb);
+	}
 
 	cb.testedCount += interChunkCb.testedCount;
 	cb.testedCount += interChunkCb.intraCb.testedCount;
@@ -479,25 +1088,545 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Rebuild()
 {
 	chunksBvh->ShrinkToFit();
 	entitiesOffsets.ShrinkToFit();
-	std::vector<int32_t> toRemove;
-	for (auto &c : chunks) {
-		if (c.second.GetCount() == 0) {
-			toRemove.push_back(c.first);
+	for (size_t i = 0; i < chunks.size();) {
+		if (chunks[i].GetCount() == 0) {
+			assert(chunksBvh->Exists(chunks[i].chunkId));
+			RemoveChunk(chunks[i].chunkId);
 		} else {
-			c.second.Rebuild();
-			c.second.ShrinkToFit();
+			++i;
 		}
 	}
+	std::vector<Chunk *> toRebuild;
+	toRebuild.reserve(chunks.size());
+	for (Chunk &c : chunks) {
+		toRebuild.push_back(&c);
+	}
 
-	for (auto &c : toRemove) {
-		assert(chunksBvh->Exists(c));
-		chunksBvh->Remove(c);
-		chunks.erase(c);
+	RebuildChunks(toRebuild);
+	for (Chunk *c : toRebuild) {
+		c->ShrinkToFit();
 	}
+
 	chunksBvh->Rebuild();
-	
-	// TODO: Implement round robin rebuild / optimize / shrink to fit / delete
-	//         empty
+	chunksBvhChanged = false;
+	dirtyChunks.clear();
+	dirtyChunksHead = 0;
+	rebuildForDone = 0;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RebuildChangedChunks()
+{
+	// empty chunks are removed before taking pointers, removal moves chunks
+	for (size_t i = dirtyChunksHead; i < dirtyChunks.size(); ++i) {
+		Chunk *chunk = GetChunkById(dirtyChunks[i]);
+		if (chunk != nullptr && chunk->GetCount() == 0) {
+			RemoveChunk(dirtyChunks[i]);
+		}
+	}
+	std::vector<Chunk *> toRebuild;
+	for (size_t i = dirtyChunksHead; i < dirtyChunks.size(); ++i) {
+		Chunk *chunk = GetChunkById(dirtyChunks[i]);
+		if (chunk == nullptr || chunk->changes == 0) {
+			continue;
+		}
+		toRebuild.push_back(chunk);
+	}
+	// chunk id is queued again when chunk was rebuilt or recreated meanwhile
+	std::sort(toRebuild.begin(), toRebuild.end());
+	toRebuild.erase(std::unique(toRebuild.begin(), toRebuild.end()),
+					toRebuild.end());
+	dirtyChunks.clear();
+	dirtyChunksHead = 0;
+	rebuildForDone = 0;
+
+	RebuildChunks(toRebuild);
+
+	if (outerObjectsChanged) {
+		outerObjects.Rebuild();
+		outerObjectsChanged = false;
+	}
+	if (chunksBvhChanged) {
+		chunksBvh->Rebuild();
+		chunksBvhChanged = false;
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RebuildChunks(
+	std::span<Chunk *const> list)
+{
+	size_t work = 0;
+	for (Chunk *c : list) {
+		work += c->GetCount();
+	}
+	int32_t threads =
+		std::min<int32_t>(this->GetBulkLoadThreadsCount(work), list.size());
+	if (threadsCount > 0) {
+		threads = std::min(threads, threadsCount);
+	}
+
+	if (threads <= 1) {
+		for (Chunk *c : list) {
+			c->Rebuild();
+		}
+		return;
+	}
+
+	std::atomic<size_t> next = 0;
+	RunParallel(threads, [&]() {
+		for (size_t i = next++; i < list.size(); i = next++) {
+			list[i]->changes = 0;
+			list[i]->bvh.RebuildWithoutOffsets(1);
+		}
+	});
+
+	// shared offsets map is written only by this thread
+	for (Chunk *c : list) {
+		c->bvh.RegisterAllOffsets();
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RunParallel(
+	int32_t threads, const std::function<void()> &worker)
+{
+	if (threads > 1 && executor == nullptr) {
+		executor = std::make_shared<RebuildExecutor>(
+			std::max<int32_t>(std::thread::hardware_concurrency(), 2) - 1,
+			false);
+	}
+	if (threads > 1) {
+		threads = std::min(threads, executor->GetThreadsCount() + 1);
+	}
+	if (threads <= 1) {
+		worker();
+		return;
+	}
+
+	struct Control {
+		std::mutex mutex;
+		std::condition_variable condition;
+		int32_t running = 0;
+		bool closed = false;
+	};
+	auto control = std::make_shared<Control>();
+	for (int32_t t = 1; t < threads; ++t) {
+		// before any pending asynchronous rebuilds
+		executor->Enqueue(std::numeric_limits<int64_t>::max(),
+						  std::make_shared<std::atomic<bool>>(false),
+						  [control, &worker]() {
+							  {
+								  std::lock_guard lock(control->mutex);
+								  if (control->closed) {
+									  return;
+								  }
+								  ++control->running;
+							  }
+							  worker();
+							  std::lock_guard lock(control->mutex);
+							  if (--control->running == 0) {
+								  control->condition.notify_all();
+							  }
+						  });
+	}
+	worker();
+
+	std::unique_lock lock(control->mutex);
+	control->closed = true;
+	control->condition.wait(lock, [&]() { return control->running == 0; });
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetRebuildExecutor(
+	std::shared_ptr<RebuildExecutor> executor)
+{
+	this->executor = executor;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetChunkDynamicEntitiesLimit(
+	int32_t limit)
+{
+	chunkDynamicEntitiesLimit = limit;
+	for (Chunk &chunk : chunks) {
+		chunk.bvh.maxNumberOfBruteforceEntities = limit;
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetThreadsCount(
+	int32_t threadsCount)
+{
+	this->threadsCount = threadsCount;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetChunkGeometry(
+	ChunkGeometry geometry)
+{
+	if (GetCount() == 0) {
+		Clear();
+		ApplyChunkGeometry(geometry);
+		return;
+	}
+
+	std::vector<EntityType> entities;
+	std::vector<Aabb> aabbs;
+	std::vector<MaskType> masks;
+	entities.reserve(GetCount());
+	aabbs.reserve(GetCount());
+	masks.reserve(GetCount());
+	for (auto it = RestartIterator(); it->Valid(); it->Next()) {
+		entities.push_back(it->entity);
+		aabbs.push_back(it->aabb);
+		masks.push_back(it->mask);
+	}
+
+	Clear();
+	ApplyChunkGeometry(geometry);
+	BulkLoadChunks(entities, aabbs, masks);
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+typename ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ChunkGeometry
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunkGeometry() const
+{
+	return {chunkSize, chunkSizeMultiplier, maxChunkedEntitySize};
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ApplyChunkGeometry(
+	ChunkGeometry geometry)
+{
+	assert(chunks.empty());
+	assert(geometry.chunkSize > 0.0f);
+	assert(geometry.maxChunkedEntitySize <= geometry.chunkSize * 0.5f);
+	// local aabbs are 1.5 of chunk size with margin of 2 steps in int16
+	assert(geometry.chunkSize * geometry.chunkSizeMultiplier <= 21840.0f);
+
+	chunkSize = geometry.chunkSize;
+	chunkSizeMultiplier = geometry.chunkSizeMultiplier;
+	maxChunkedEntitySize = geometry.maxChunkedEntitySize;
+
+	float factor = 1.0f;
+	for (int32_t i = 0; i < CHUNK_LEVELS; ++i) {
+		ChunkLevel &l = chunkLevels[i];
+		l.chunkSize = chunkSize * factor;
+		l.maxEntitySize = maxChunkedEntitySize * factor;
+		l.limitOffset = i == 0 ? limitChunkOffset : limitChunkOffsetHigherLevels;
+		// coarser levels keep quantization as long as they fit into int16
+		float multiplier = chunkSizeMultiplier;
+		while (l.chunkSize * multiplier > 21840.0f) {
+			multiplier *= 0.5f;
+		}
+		l.invScale = glm::vec3(multiplier);
+		l.scale = glm::vec3(1.0f) / l.invScale;
+		const glm::ivec3 inner = glm::ivec3(l.chunkSize * multiplier);
+		l.localAabbInner = {-inner, inner};
+		l.localAabb = {(-inner * 3) / 2, (inner * 3) / 2};
+		factor *= CHUNK_LEVEL_FACTOR;
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+typename ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ChunkGeometry
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::ComputeChunkGeometry(
+	std::span<const Aabb> aabbs, int32_t targetEntitiesPerChunk,
+	float outerFraction)
+{
+	ChunkGeometry geometry;
+	if (aabbs.empty()) {
+		return geometry;
+	}
+
+	const size_t stride = std::max<size_t>(aabbs.size() / 4096, 1);
+	std::vector<float> sizes;
+	std::vector<glm::vec3> centers;
+	sizes.reserve(aabbs.size() / stride + 1);
+	centers.reserve(aabbs.size() / stride + 1);
+	float extent = 0.0f;
+	for (size_t i = 0; i < aabbs.size(); i += stride) {
+		const glm::vec3 size = aabbs[i].GetSizes();
+		const glm::vec3 center = aabbs[i].GetCenter();
+		sizes.push_back(glm::max(size.x, glm::max(size.y, size.z)));
+		centers.push_back(center);
+		const glm::vec3 c = glm::abs(center);
+		extent = glm::max(extent, glm::max(c.x, glm::max(c.y, c.z)));
+	}
+	// larger entities than this quantile are outer objects
+	const size_t q = std::min<size_t>(
+		sizes.size() * (1.0f - glm::clamp(outerFraction, 0.0f, 1.0f)),
+		sizes.size() - 1);
+	std::nth_element(sizes.begin(), sizes.begin() + q, sizes.end());
+	const float maxEntitySize = sizes[q];
+
+	// whole world needs to fit into range of chunk ids
+	float minChunkSize =
+		glm::max(maxEntitySize * 2.0f, extent / float(limitChunkOffset - 1));
+	minChunkSize = glm::max(minChunkSize, 1.0f / 64.0f);
+	// power of two sizes keep chunk bounds exact
+	float bestSize = std::exp2(std::ceil(std::log2(minChunkSize)));
+	const float maxChunkSize = glm::max(bestSize, 4.0f * extent);
+
+	std::vector<int32_t> ids;
+	ids.reserve(centers.size());
+	for (float size = bestSize; size <= maxChunkSize; size *= 2.0f) {
+		ids.clear();
+		for (const glm::vec3 c : centers) {
+			ids.push_back(EncodeChunkId(glm::ivec3(glm::floor(c / size)), 0));
+		}
+		std::sort(ids.begin(), ids.end());
+		const size_t occupied =
+			std::unique(ids.begin(), ids.end()) - ids.begin();
+		// sampled occupancy is lower than real, so this overestimates
+		if (float(aabbs.size()) / occupied > targetEntitiesPerChunk) {
+			break;
+		}
+		bestSize = size;
+	}
+
+	geometry.chunkSize = bestSize;
+	geometry.maxChunkedEntitySize = bestSize * 0.5f;
+	// finest power of two quantization fitting in int16 local coordinates
+	geometry.chunkSizeMultiplier =
+		std::exp2(std::floor(std::log2(16384.0f / bestSize)));
+	return geometry;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::AutoTuneChunkGeometry(
+	int32_t targetEntitiesPerChunk, float outerFraction)
+{
+	std::vector<Aabb> aabbs;
+	aabbs.reserve(GetCount());
+	for (auto it = RestartIterator(); it->Valid(); it->Next()) {
+		aabbs.push_back(it->aabb);
+	}
+	SetChunkGeometry(
+		ComputeChunkGeometry(aabbs, targetEntitiesPerChunk, outerFraction));
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SetAutoTuneOnBulkLoad(
+	bool enable, int32_t targetEntitiesPerChunk, float outerFraction)
+{
+	autoTuneOnBulkLoad = enable;
+	autoTuneTargetEntitiesPerChunk = targetEntitiesPerChunk;
+	autoTuneOuterFraction = outerFraction;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+bool ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::SerializeChunk(
+	int32_t chunkId, std::vector<uint8_t> &buffer)
+{
+	Chunk *chunk = GetChunkById(chunkId);
+	if (chunk == nullptr) {
+		return false;
+	}
+	const ChunkImageHeader header{
+		CHUNK_IMAGE_MAGIC,
+		CHUNK_IMAGE_VERSION,
+		sizeof(ChunkNodeData),
+		sizeof(ChunkData),
+		chunkId,
+		chunkSize,
+		chunkSizeMultiplier};
+	const size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(header));
+	memcpy(buffer.data() + offset, &header, sizeof(header));
+	chunk->bvh.Serialize(buffer);
+	return true;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+bool ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::UnloadChunk(
+	int32_t chunkId, std::vector<uint8_t> &buffer)
+{
+	if (SerializeChunk(chunkId, buffer) == false) {
+		return false;
+	}
+	Chunk *chunk = GetChunkById(chunkId);
+	for (const auto &d : chunk->bvh.entitiesData) {
+		if (d.entity != EMPTY_ENTITY) {
+			entitiesOffsets.Remove(d.entity);
+		}
+	}
+	entitiesCount -= chunk->GetCount();
+	RemoveChunk(chunkId);
+	return true;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+bool ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::LoadChunk(
+	std::span<const uint8_t> &buffer)
+{
+	ChunkImageHeader header;
+	if (buffer.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, buffer.data(), sizeof(header));
+	if (header.magic != CHUNK_IMAGE_MAGIC ||
+		header.version != CHUNK_IMAGE_VERSION ||
+		header.sizeofNodeData != sizeof(ChunkNodeData) ||
+		header.sizeofData != sizeof(ChunkData) ||
+		header.chunkId <= 0 ||
+		header.chunkSize != chunkSize ||
+		header.chunkSizeMultiplier != chunkSizeMultiplier ||
+		GetChunkById(header.chunkId) != nullptr) {
+		return false;
+	}
+
+	// any aabb with center inside of chunk initializes it's bounds
+	int32_t level = 0;
+	const glm::ivec3 offset = DecodeChunkId(header.chunkId, level);
+	if (level >= CHUNK_LEVELS) {
+		return false;
+	}
+	const glm::vec3 center =
+		(glm::vec3(offset) + 0.5f) * chunkLevels[level].chunkSize;
+	Chunk *chunk = GetOrInitChunk(header.chunkId, Aabb{center, center});
+
+	std::span<const uint8_t> b = buffer.subspan(sizeof(header));
+	bool valid = chunk->bvh.DeserializeWithoutOffsets(b);
+
+	// offsets are registered one by one, so that entities repeated inside of
+	// image are rejected too
+	const auto &data = chunk->bvh.entitiesData;
+	int32_t registered = 0;
+	for (; valid && registered < (int32_t)data.size(); ++registered) {
+		const EntityType entity = data[registered].entity;
+		if (entity == EMPTY_ENTITY) {
+			continue;
+		} else if (entitiesOffsets.find(entity)) {
+			valid = false;
+			break;
+		}
+		entitiesOffsets.Set(entity, {header.chunkId, registered});
+	}
+	if (valid == false) {
+		for (int32_t i = 0; i < registered; ++i) {
+			if (data[i].entity != EMPTY_ENTITY) {
+				entitiesOffsets.Remove(data[i].entity);
+			}
+		}
+		chunk->bvh.ClearWithoutOffsets();
+		RemoveChunk(header.chunkId);
+		return false;
+	}
+
+	entitiesCount += chunk->GetCount();
+	buffer = b;
+	return true;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+float ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RebuildFor(
+	std::chrono::microseconds budget)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	if (dirtyChunksHead > 64 && dirtyChunksHead * 2 > dirtyChunks.size()) {
+		dirtyChunks.erase(dirtyChunks.begin(),
+						  dirtyChunks.begin() + dirtyChunksHead);
+		dirtyChunksHead = 0;
+	}
+	while (true) {
+		const auto left =
+			std::max(std::chrono::duration_cast<std::chrono::microseconds>(
+						 deadline - std::chrono::steady_clock::now()),
+					 std::chrono::microseconds(0));
+		float current = 0.0f;
+		if (dirtyChunksHead < dirtyChunks.size()) {
+			Chunk *chunk = GetChunkById(dirtyChunks[dirtyChunksHead]);
+			if (chunk == nullptr || chunk->changes == 0) {
+				// chunk was removed or rebuilt in the meantime
+				++dirtyChunksHead;
+				continue;
+			}
+			current = chunk->bvh.RebuildFor(left);
+			if (current >= 1.0f) {
+				chunk->changes = 0;
+				++dirtyChunksHead;
+				++rebuildForDone;
+			}
+		} else if (outerObjectsChanged) {
+			current = outerObjects.RebuildFor(left);
+			if (current >= 1.0f) {
+				outerObjectsChanged = false;
+				++rebuildForDone;
+			}
+		} else if (chunksBvhChanged) {
+			current = chunksBvh->RebuildFor(left);
+			if (current >= 1.0f) {
+				chunksBvhChanged = false;
+				++rebuildForDone;
+			}
+		} else {
+			dirtyChunks.clear();
+			dirtyChunksHead = 0;
+			rebuildForDone = 0;
+			return 1.0f;
+		}
+
+		if (std::chrono::steady_clock::now() >= deadline) {
+			if (current >= 1.0f) {
+				current = 0.0f;
+			}
+			const int32_t pending = (dirtyChunks.size() - dirtyChunksHead) +
+									(outerObjectsChanged ? 1 : 0) +
+									(chunksBvhChanged ? 1 : 0);
+			if (pending == 0) {
+				continue;
+			}
+			return (rebuildForDone + current) /
+				   float(rebuildForDone + pending);
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RebuildIncremental()
+{
+	RebuildFor(std::chrono::microseconds(0));
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+BroadphaseStatistics ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+
+	const BroadphaseStatistics top = chunksBvh->GetStatistics();
+	const BroadphaseStatistics outer = outerObjects.GetStatistics();
+	stats.rootSurface = std::max(top.rootSurface, outer.rootSurface);
+	stats.nodesCount = top.nodesCount + top.leavesCount;
+	stats.nodesSurface = top.nodesSurface + top.leavesCost +
+						 top.unsortedEntitiesCount * stats.rootSurface;
+	stats.siblingOverlapVolume = top.siblingOverlapVolume;
+	stats.maxDepth = top.maxDepth;
+
+	for (const auto &it : GetChunksStatistics()) {
+		stats.Merge(it.second, 1, 1.0f, it.second.rootSurface);
+	}
+	stats.Merge(outer, 0);
+
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+std::vector<std::pair<int32_t, BroadphaseStatistics>>
+ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::GetChunksStatistics()
+{
+	std::vector<std::pair<int32_t, BroadphaseStatistics>> ret;
+	ret.reserve(chunks.size());
+	for (Chunk &chunk : chunks) {
+		BroadphaseStatistics stats;
+		stats.rootSurface = chunk.globalAabb.GetSurface();
+		stats.Merge(chunk.bvh.GetStatistics(), 0, chunk.level->scale.x);
+		stats.Finish();
+		ret.push_back({chunk.chunkId, stats});
+	}
+	return ret;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
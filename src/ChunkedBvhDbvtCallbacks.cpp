@@ -67,13 +67,18 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::RayCallbacks::InterChunkCb::
 	this->end = cb.end;
 
 	memcpy(intraCb.signs, cb.signs, sizeof(cb.signs));
-	intraCb.dir = cb.dir * dbvt->chunkSizeMultiplier;
+	// dir, invDir and length are scaled by level of chunk, start and end are
+	// translated for each chunk
 	intraCb.dirNormalized = cb.dirNormalized;
 	intraCb.invDir = cb.invDir;
-	intraCb.length = cb.length * dbvt->chunkSizeMultiplier;
+	preparedLevel = nullptr;
 
 	intraCb.start = cb.start;
 	intraCb.end = cb.end;
+
+	// all variables are copied from initialized cb
+	this->initedVars = true;
+	intraCb.initedVars = true;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -11,42 +11,38 @@ namespace spp
 SPP_TEMPLATE_DECL_NO_AABB
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Chunk() {}
 
-/*
 SPP_TEMPLATE_DECL_NO_AABB
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Chunk(Chunk &&c)
 {
-	scale = c.scale;
-	invScale = c.invScale;
-	localAabb = c.localAabb;
-	localAabbInner = c.localAabbInner;
-	globalAabb = c.globalAabb;
-	globalAabbInner = c.globalAabbInner;
-	new (&bvh) InternalBvhHeap(std::move(c.bvh));
-	bp = c.bp;
-	c.bp = nullptr;
+	*this = std::move(c);
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk &
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::operator=(Chunk &&c)
 {
-	scale = c.scale;
-	invScale = c.invScale;
-	localAabb = c.localAabb;
-	localAabbInner = c.localAabbInner;
-	globalAabb = c.globalAabb;
-	globalAabbInner = c.globalAabbInner;
+	if (this == &c) {
+		return *this;
+	}
 	if (bp) {
 		bvh.~InternalBvhHeap();
-		bvh = std::move(c.bvh);
-	} else {
-		new (&bvh) InternalBvhHeap(std::move(c.bvh));
 	}
+	globalAabb = c.globalAabb;
+	globalAabbInner = c.globalAabbInner;
+	globalCenter = c.globalCenter;
+	chunkId = c.chunkId;
+	level = c.level;
+	changes = c.changes;
 	bp = c.bp;
-	c.bp = nullptr;
+	if (c.bp) {
+		new (&bvh) InternalBvhHeap(std::move(c.bvh));
+		// iterator of moved bvh points to data of the old one
+		bvh.RestartIterator();
+		c.bvh.~InternalBvhHeap();
+		c.bp = nullptr;
+	}
 	return *this;
 }
-*/
 
 SPP_TEMPLATE_DECL_NO_AABB
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::~Chunk()
@@ -60,7 +56,7 @@ ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::~Chunk()
 SPP_TEMPLATE_DECL_NO_AABB
 void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Init(ChunkedBvhDbvt *bp,
 															int32_t chunkId,
-															float chunkSize,
+															int32_t level,
 															Aabb aabb)
 {
 	if (this->bp) {
@@ -68,28 +64,36 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Init(ChunkedBvhDbvt *bp,
 	}
 	this->chunkId = chunkId;
 	this->bp = bp;
+	this->level = &(bp->chunkLevels[level]);
+	const float chunkSize = this->level->chunkSize;
 	new (&bvh) InternalBvhHeap{
 		EntitiesOffsetsMapType_Reference(&(bp->entitiesOffsets), chunkId)};
+	bvh.maxNumberOfBruteforceEntities = bp->chunkDynamicEntitiesLimit;
 
 	glm::ivec3 chunkOffset = glm::floor(aabb.GetCenter() / chunkSize);
 	glm::vec3 minGlobalOffset = ((glm::vec3)chunkOffset) * chunkSize;
-// 	localAabbInner = {-glm::ivec3(chunkSize * bp->chunkSizeMultiplier),
-// 					  glm::ivec3(chunkSize * bp->chunkSizeMultiplier)};
-// 	localAabb = {localAabbInner.min * 2, localAabbInner.max * 2};
 	globalAabbInner.min = minGlobalOffset;
 	globalAabbInner.max = minGlobalOffset + chunkSize;
 	globalAabb.min = minGlobalOffset - chunkSize * 0.25f;
 	globalAabb.max = minGlobalOffset + chunkSize * 1.25f;
-// 	invScale = glm::vec3(bp->chunkSizeMultiplier);
-// 	scale = glm::vec3(1.0f) / invScale;
 	globalCenter = globalAabb.GetCenter();
 }
 
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::MarkChanged(int count)
+{
+	if (changes == 0) {
+		bp->dirtyChunks.push_back(chunkId);
+	}
+	changes += count;
+}
+
 SPP_TEMPLATE_DECL_NO_AABB
 void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Add(EntityType entity,
 														   Aabb aabb,
 														   MaskType mask)
 {
+	MarkChanged();
 	Aabb_i16 b2 = ToLocalAabb(aabb);
 	bvh.Add(entity, b2, mask);
 }
@@ -99,13 +103,37 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Update(EntityType entity,
 															  Aabb _aabb)
 {
 	Aabb_i16 aabb = ToLocalAabb(_aabb);
-	bvh.Update(entity, aabb);
+	// full dynamic stage falls back to refitting entity in tree
+	if (bvh.UpdateIntoBruteForce(entity, aabb) == false ||
+		bvh.bruteForceEntitiesAtEndCount * 2 > bp->chunkDynamicEntitiesLimit) {
+		MarkChanged();
+	}
+}
+
+SPP_TEMPLATE_DECL_NO_AABB
+void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::UpdateBatch(
+	std::span<const BatchEntry> entries)
+{
+	if (bvh.bruteForceEntitiesAtEndCount + (int32_t)entries.size() <=
+		bp->chunkDynamicEntitiesLimit) {
+		for (const BatchEntry &e : entries) {
+			Update(e.entity, e.aabb);
+		}
+		return;
+	}
+	MarkChanged(entries.size());
+	auto &local = bp->batchLocal;
+	local.clear();
+	for (const BatchEntry &e : entries) {
+		local.push_back({e.entity, ToLocalAabb(e.aabb)});
+	}
+	bvh.UpdateBatch(local);
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
 void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Remove(EntityType entity)
 {
-	changes++;
+	MarkChanged();
 	bvh.Remove(entity);
 }
 
@@ -120,6 +148,7 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::RebuildIfNeeded()
 SPP_TEMPLATE_DECL_NO_AABB
 void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::Rebuild()
 {
+	changes = 0;
 	bvh.Rebuild();
 }
 
@@ -161,8 +190,8 @@ Aabb_i16 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::ToLocalAabb(
 	assert(glob.IsIn(org.min));
 	assert(glob.IsIn(org.max));
 	assert(glob.ContainsAll(org));
-	assert(localAabb.ContainsAll(aabb));
-	assert(localAabbInner.IsIn(aabb.GetCenter()));
+	assert(level->localAabb.ContainsAll(aabb));
+	assert(level->localAabbInner.IsIn(aabb.GetCenter()));
 	assert(globalAabbInner.IsIn(glob.GetCenter()));
 	assert(globalAabbInner.IsIn(org.GetCenter()));
 	assert(globalAabb.ContainsAll(glob));
@@ -183,8 +212,8 @@ Aabb ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::ToGlobalAabb(
 	Aabb_i16 _aabb) const
 {
 	Aabb aabb = _aabb;
-	aabb.min = glm::fma(aabb.min, scale, globalCenter);
-	aabb.max = glm::fma(aabb.max, scale, globalCenter);
+	aabb.min = glm::fma(aabb.min, level->scale, globalCenter);
+	aabb.max = glm::fma(aabb.max, level->scale, globalCenter);
 	return aabb;
 }
 
@@ -192,7 +221,7 @@ SPP_TEMPLATE_DECL_NO_AABB
 glm::vec3
 ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::ToLocalVec(glm::vec3 p) const
 {
-	return (p - globalCenter) * invScale;
+	return (p - globalCenter) * level->invScale;
 }
 
 SPP_TEMPLATE_DECL_NO_AABB
@@ -218,8 +247,17 @@ void ChunkedBvhDbvt<SPP_TEMPLATE_ARGS_NO_AABB>::Chunk::IntersectRay(
 	auto &intraCb = cb->intraCb;
 	intraCb.chunk = this;
 
+	// scale is uniform, so only translation differs between chunks of the
+	// same level
+	if (cb->preparedLevel != level) {
+		cb->preparedLevel = level;
+		intraCb.dir = cb->dir * level->invScale;
+		intraCb.invDir = cb->invDir * level->scale;
+		intraCb.length = cb->length * level->invScale.x;
+	}
 	intraCb.start = ToLocalVec(cb->start);
-	intraCb.end = ToLocalVec(cb->end);
+	intraCb.end = intraCb.start + intraCb.dir;
+	intraCb.cutFactor = cb->orgCb->cutFactor;
 
 	bvh.IntersectRay(intraCb);
 }
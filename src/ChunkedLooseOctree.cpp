@@ -4,8 +4,13 @@
 
 #include <cassert>
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <thread>
+
 #include "../glm/glm/common.hpp"
-#include "../glm/glm/ext/vector_uint3.hpp"
+#include "../glm/glm/vector_relational.hpp"
 
 #include "../include/spatial_partitioning/ChunkedLooseOctree.hpp"
 
@@ -26,7 +31,10 @@ ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::ChunkedLooseOctree(int32_t chunkSize,
 	this->chunkSizeHalf = chunkSize / 2;
 	this->worldSizeHalf = worldSize / 2;
 	this->chunkCheckOffset = (chunkSizeHalf * (loosness - 1.0f));
-	this->rootNode = nodes.Add({.halfSize = worldSize});
+	// node cells are split in halves down to single units
+	assert(std::has_single_bit((uint32_t)chunkSize) && chunkSize >= 2);
+	assert(std::has_single_bit((uint32_t)worldSize) && worldSize >= chunkSize);
+	this->rootNode = nodes.Add({.halfSize = worldSizeHalf});
 }
 
 SPP_TEMPLATE_DECL
@@ -70,9 +78,7 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
 {
 	if (FitsInChunk(aabb)) {
 		int32_t offset = data.Add(entity, {aabb, entity, mask});
-		int32_t chunkId = GetCreateChunkId(aabb.GetCenter());
-		data[offset].chunkId = chunkId;
-		AddToChunk(chunkId, offset);
+		AddToChunk(GetCreateChunkId(aabb.GetCenter()), offset);
 	} else {
 		int32_t offset = data.Add(entity, {aabb, entity, mask});
 		data[offset].big = true;
@@ -89,23 +95,22 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
 		d.aabb = aabb;
 		if (FitsInChunk(aabb)) {
 			bigObjects.Remove(entity);
-			int32_t chunkId = GetCreateChunkId(aabb.GetCenter());
-			d.chunkId = chunkId;
 			d.big = false;
-			AddToChunk(chunkId, offset);
+			AddToChunk(GetCreateChunkId(aabb.GetCenter()), offset);
 		} else {
 			bigObjects.Update(entity, aabb);
 		}
+	} else if (FitsInChunk(aabb) == false) {
+		RemoveFromChunk(offset);
+		d.aabb = aabb;
+		d.big = true;
+		bigObjects.Add(entity, aabb, d.mask);
 	} else {
-		glm::ivec4 a = GetNodePosSize(d.aabb);
-		glm::ivec4 b = GetNodePosSize(aabb);
 		d.aabb = aabb;
-		if (a != b) {
-			int32_t nodeId = d.nodeId;
+		const int32_t nodeId = d.nodeId;
+		if (GetCreateNodeId(aabb) != nodeId) {
 			UnlinkFromChunk(offset);
-			int32_t chunkId = GetCreateChunkId(aabb.GetCenter());
-			data[offset].chunkId = chunkId;
-			AddToChunk(chunkId, offset);
+			AddToChunk(GetCreateChunkId(aabb.GetCenter()), offset);
 			CleanIfEmptyNodes(nodeId);
 		}
 	}
@@ -128,7 +133,11 @@ SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity,
 													MaskType mask)
 {
-	data[data.GetOffset(entity)].mask = mask;
+	Data &d = data[data.GetOffset(entity)];
+	d.mask = mask;
+	if (d.big) {
+		bigObjects.SetMask(entity, mask);
+	}
 }
 
 SPP_TEMPLATE_DECL
@@ -162,6 +171,15 @@ AabbCentered ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::NodeData::GetAabb() const
 						glm::vec3(halfSize, halfSize, halfSize)};
 }
 
+SPP_TEMPLATE_DECL
+AabbCentered
+ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetLooseAabb(int32_t nodeId) const
+{
+	const NodeData &n = nodes[nodeId];
+	const float h = n.halfSize * loosness;
+	return AabbCentered{glm::vec3(n.cx, n.cy, n.cz), glm::vec3(h, h, h)};
+}
+
 SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 {
@@ -172,6 +190,7 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 	cb.broadphase = this;
 
 	bigObjects.IntersectAabb(cb);
+	cb.broadphase = this;
 	_Internal_IntersectAabb(cb, rootNode);
 }
 
@@ -182,7 +201,7 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectAabb(
 	NodeData &n = nodes[nodeId];
 	++cb.nodesTestedCount;
 
-	if (cb.IsRelevant(n.GetAabb()) == false) {
+	if (cb.IsRelevant(GetLooseAabb(nodeId)) == false) {
 		return;
 	}
 
@@ -215,7 +234,9 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
 	cb.broadphase = this;
 	cb.InitVariables();
 
-	_Internal_IntersectRay(cb, 1);
+	bigObjects.IntersectRay(cb);
+	cb.broadphase = this;
+	_Internal_IntersectRay(cb, rootNode);
 }
 
 SPP_TEMPLATE_DECL
@@ -226,7 +247,7 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectRay(
 	++cb.nodesTestedCount;
 
 	float near, far;
-	if (cb.IsRelevant(n.GetAabb(), near, far) == false) {
+	if (cb.IsRelevant(GetLooseAabb(nodeId), near, far) == false) {
 		return;
 	}
 
@@ -249,81 +270,154 @@ SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::Rebuild() { bigObjects.Rebuild(); }
 
 SPP_TEMPLATE_DECL
-glm::ivec3
-ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetMaxChunk(glm::vec3 point) const
+BroadphaseStatistics ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetStatistics()
 {
-	return (point + chunkCheckOffset) / (float)chunkSize;
+	BroadphaseStatistics stats;
+	stats.rootSurface = nodes[rootNode].GetAabb().GetSurface();
+	_Internal_GetStatistics(stats, rootNode, 0);
+	stats.Merge(bigObjects.GetStatistics(), 0);
+	stats.Finish();
+	return stats;
 }
 
 SPP_TEMPLATE_DECL
-glm::ivec3
-ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetMinChunk(glm::vec3 point) const
+void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_GetStatistics(
+	BroadphaseStatistics &stats, const int32_t nodeId, int32_t depth) const
 {
-	return (point - chunkCheckOffset) / (float)chunkSize;
-}
+	const NodeData &n = nodes[nodeId];
+	const float surface = n.GetAabb().GetSurface();
 
-SPP_TEMPLATE_DECL
-glm::ivec4
-ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetNodePosSize(Aabb aabb) const
-{
-	glm::vec3 s = aabb.max - aabb.min;
-	float sm = glm::max(s.x, glm::max(s.y, s.z)) * loosnessInv;
-	int32_t orgSize = sm * 2.0f;
-	int32_t size = 1 << std::bit_width((uint32_t)orgSize);
-	glm::ivec3 center = aabb.GetCenter();
-	center *= size;
-	center /= (chunkSize / size);
-	return {center, size};
+	if (n.firstEntity > 0) {
+		Aabb tight = data[n.firstEntity].aabb;
+		int64_t count = 0;
+		for (int32_t of = n.firstEntity; of > 0; of = data[of].nextDataId) {
+			tight = tight.Sum(data[of].aabb);
+			++count;
+		}
+		stats.AddLeaf(depth, surface, tight.GetSurface(), count);
+	}
+
+	bool hasChildren = false;
+	for (int i = 0; i < 8; ++i) {
+		const int32_t c = n.childrenIdLinear[i];
+		if (c == 0) {
+			continue;
+		}
+		hasChildren = true;
+		for (int j = i + 1; j < 8; ++j) {
+			if (n.childrenIdLinear[j]) {
+				stats.AddSiblings(
+					nodes[c].GetAabb(),
+					nodes[n.childrenIdLinear[j]].GetAabb());
+			}
+		}
+		_Internal_GetStatistics(stats, c, depth + 1);
+	}
+	if (hasChildren) {
+		stats.AddNode(depth, surface);
+	}
 }
 
 SPP_TEMPLATE_DECL
 bool ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::FitsInChunk(Aabb aabb) const
 {
-	const glm::ivec3 a = GetMaxChunk(aabb.min);
-	const glm::ivec3 b = GetMinChunk(aabb.max);
-	const glm::ivec3 c = b - a;
-	const glm::uvec3 d = c;
-	return ((d.x | d.y | d.z) & 0x80000000u) == 0;
+	// entity needs to fit into loose bounds of chunk which contains its center
+	const glm::vec3 s = aabb.GetSizes();
+	if (glm::max(s.x, glm::max(s.y, s.z)) * 0.5f > chunkCheckOffset) {
+		return false;
+	}
+	const glm::vec3 c = aabb.GetCenter();
+	return glm::all(glm::greaterThanEqual(c, glm::vec3(-worldSizeHalf))) &&
+		   glm::all(glm::lessThan(c, glm::vec3(worldSizeHalf)));
+}
+
+SPP_TEMPLATE_DECL
+int32_t ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetCreateChildId(int32_t nodeId,
+																glm::vec3 pos)
+{
+	const NodeData &n = nodes[nodeId];
+	const int x = pos.x >= n.cx;
+	const int y = pos.y >= n.cy;
+	const int z = pos.z >= n.cz;
+	int32_t childId = n.childrenId[x][y][z];
+	if (childId == 0) {
+		NodeData child;
+		child.parentId = nodeId;
+		child.halfSize = n.halfSize >> 1;
+		child.cx = n.cx + (x ? child.halfSize : -child.halfSize);
+		child.cy = n.cy + (y ? child.halfSize : -child.halfSize);
+		child.cz = n.cz + (z ? child.halfSize : -child.halfSize);
+		// n is invalidated by Add
+		childId = nodes.Add(std::move(child));
+		nodes[nodeId].childrenId[x][y][z] = childId;
+	}
+	return childId;
 }
 
 SPP_TEMPLATE_DECL
 int32_t ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetCreateChunkId(glm::vec3 pos)
 {
-	assert(false);
-	return 0;
+	int32_t nodeId = rootNode;
+	while (nodes[nodeId].halfSize > chunkSizeHalf) {
+		nodeId = GetCreateChildId(nodeId, pos);
+	}
+	if (nodes[nodeId].chunkId == 0) {
+		const NodeData &n = nodes[nodeId];
+		ChunkData chunk;
+		chunk.cx = n.cx;
+		chunk.cy = n.cy;
+		chunk.cz = n.cz;
+		chunk.smallNodeId = nodeId;
+		chunk.parentId = n.parentId;
+		const int32_t chunkId = chunks.Add(std::move(chunk));
+		nodes[nodeId].chunkId = chunkId;
+	}
+	return nodes[nodeId].chunkId;
 }
 
 SPP_TEMPLATE_DECL
 int32_t ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetChunkId(glm::vec3 pos) const
 {
-	assert(false);
-	return 0;
+	int32_t nodeId = rootNode;
+	while (nodeId && nodes[nodeId].halfSize > chunkSizeHalf) {
+		const NodeData &n = nodes[nodeId];
+		nodeId = n.childrenId[pos.x >= n.cx][pos.y >= n.cy][pos.z >= n.cz];
+	}
+	return nodeId ? nodes[nodeId].chunkId : 0;
 }
 
 SPP_TEMPLATE_DECL
 int32_t
 ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetChunkId(EntityType entity) const
 {
-	assert(false);
-	return 0;
+	const int32_t offset = data.GetOffset(entity);
+	return offset > 0 ? data[offset].chunkId : 0;
 }
 
 SPP_TEMPLATE_DECL
 int32_t ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetCreateNodeId(Aabb aabb)
 {
-	assert(false);
-	return 0;
+	const glm::vec3 center = aabb.GetCenter();
+	const glm::vec3 s = aabb.GetSizes();
+	const float halfExtent = glm::max(s.x, glm::max(s.y, s.z)) * 0.5f;
+	int32_t nodeId = chunks[GetCreateChunkId(center)].smallNodeId;
+	// descend while entity fits into loose bounds of child containing center
+	while (nodes[nodeId].halfSize > 1 &&
+		   halfExtent <= (nodes[nodeId].halfSize >> 1) * (loosness - 1.0f)) {
+		nodeId = GetCreateChildId(nodeId, center);
+	}
+	return nodeId;
 }
 
 SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::AddToChunk(int32_t chunkId,
 													   int32_t entityOffset)
 {
+	const int32_t nodeId = GetCreateNodeId(data[entityOffset].aabb);
 	Data &d = data[entityOffset];
-	chunkId = d.chunkId;
-
-	d.nodeId = GetCreateNodeId(d.aabb);
-
+	d.chunkId = chunkId;
+	d.nodeId = nodeId;
+	d.prevDataId = 0;
 	d.nextDataId = nodes[d.nodeId].firstEntity;
 	nodes[d.nodeId].firstEntity = entityOffset;
 	if (d.nextDataId) {
@@ -352,7 +446,7 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::UnlinkFromChunk(
 		nodes[nodeId].firstEntity = d.nextDataId;
 	}
 	if (d.nextDataId) {
-		data[d.nextDataId].prevDataId = d.nextDataId;
+		data[d.nextDataId].prevDataId = d.prevDataId;
 	}
 	d.nodeId = 0;
 	d.chunkId = 0;
@@ -416,26 +510,81 @@ void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::SetChunkData(
 
 SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetChunks(
-	Aabb aabb, std::vector<int32_t> chunks)
+	Aabb aabb, std::vector<int32_t> &chunkIds) const
 {
-	assert(false);
+	GetChunks([](Aabb test, void *testData) { return test && *(Aabb *)testData; },
+			  &aabb, chunkIds);
 }
 
 SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::GetChunks(
 	bool (*isIn)(Aabb test, void *testData), void *testData,
-	std::vector<int32_t> chunksData)
+	std::vector<int32_t> &chunkIds) const
+{
+	chunkIds.clear();
+	_Internal_GetChunks(isIn, testData, chunkIds, rootNode);
+}
+
+SPP_TEMPLATE_DECL
+void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_GetChunks(
+	bool (*isIn)(Aabb test, void *testData), void *testData,
+	std::vector<int32_t> &chunkIds, const int32_t nodeId) const
 {
-	assert(false);
+	const NodeData &n = nodes[nodeId];
+	if (isIn(n.GetAabb(), testData) == false) {
+		return;
+	}
+	if (n.halfSize == chunkSizeHalf) {
+		if (n.chunkId) {
+			chunkIds.push_back(n.chunkId);
+		}
+		return;
+	}
+	for (int i = 0; i < 8; ++i) {
+		if (n.childrenIdLinear[i]) {
+			_Internal_GetChunks(isIn, testData, chunkIds, n.childrenIdLinear[i]);
+		}
+	}
 }
 
 SPP_TEMPLATE_DECL
 void ChunkedLooseOctree<SPP_TEMPLATE_ARGS>::ForEachChunkData(
 	bool (*isIn)(Aabb test, void *testData), void *testData,
 	void (*func)(ChunkedLooseOctree &self, int32_t chunk, void *userData),
-	void *userData)
+	void *userData, int32_t threadsCount)
 {
-	assert(false);
+	std::vector<int32_t> list;
+	GetChunks(isIn, testData, list);
+	std::erase_if(list, [this](int32_t chunkId) {
+		return chunks[chunkId].userData.get() == nullptr;
+	});
+
+	if (threadsCount <= 0) {
+		threadsCount = std::thread::hardware_concurrency();
+	}
+	threadsCount = std::min<int32_t>(threadsCount, list.size());
+
+	if (threadsCount <= 1) {
+		for (int32_t chunkId : list) {
+			func(*this, chunkId, userData);
+		}
+		return;
+	}
+
+	std::atomic<size_t> next = 0;
+	auto worker = [&]() {
+		for (size_t i = next++; i < list.size(); i = next++) {
+			func(*this, list[i], userData);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (int32_t t = 1; t < threadsCount; ++t) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto &w : workers) {
+		w.join();
+	}
 }
 
 SPP_TEMPLATE_DECL
@@ -4,6 +4,9 @@
 
 #include <cstdio>
 
+#include <thread>
+#include <algorithm>
+
 #include "../include/spatial_partitioning/Dbvh.hpp"
 
 namespace spp
@@ -23,12 +26,15 @@ void Dbvh<SPP_TEMPLATE_ARGS>::Clear()
 	nodes.Clear();
 	rootNode = nodes.Add({});
 	fastRebalance = false;
+	rebalanceCursor = 1;
+	fatAabbs.clear();
 }
 
 SPP_TEMPLATE_DECL
 size_t Dbvh<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
 {
-	return data.GetMemoryUsage() + nodes.GetMemoryUsage();
+	return data.GetMemoryUsage() + nodes.GetMemoryUsage() +
+		   fatAabbs.capacity() * sizeof(Aabb);
 }
 
 SPP_TEMPLATE_DECL
@@ -45,6 +51,14 @@ void Dbvh<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb, MaskType mask)
 	assert(rootNode != 0);
 
 	const int32_t offset = data.Add(entity, {aabb, entity, mask});
+	if (enlargedAabbs) {
+		if (fatAabbs.size() <= offset) {
+			fatAabbs.resize(offset + 1);
+		}
+		fatAabbs[offset] = EnlargedAabb(aabb, {0, 0, 0});
+		// nodes are built from enlarged aabb
+		aabb = fatAabbs[offset];
+	}
 
 	for (int32_t i = 0; i < 2; ++i) {
 		if (nodes[rootNode].children[i] <= 0) {
@@ -161,12 +175,208 @@ int32_t Dbvh<SPP_TEMPLATE_ARGS>::CountDepth() const
 
 SPP_TEMPLATE_DECL
 void Dbvh<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
+{
+	Dbvh::Update(entity, aabb, {0, 0, 0});
+}
+
+SPP_TEMPLATE_DECL
+void Dbvh<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb,
+									 glm::vec3 velocity)
 {
 	int32_t offset = data.GetOffset(entity);
 	data[offset].aabb = aabb;
+	if (enlargedAabbs) {
+		if (fatAabbs[offset].ContainsAll(aabb)) {
+			return;
+		}
+		fatAabbs[offset] = EnlargedAabb(aabb, velocity);
+	}
 	UpdateAabb(data[offset].parent);
 }
 
+SPP_TEMPLATE_DECL
+void Dbvh<SPP_TEMPLATE_ARGS>::SetEnlargedAabbs(bool enabled, float margin,
+											   float velocityPrediction)
+{
+	fatMargin = margin;
+	fatVelocityPrediction = velocityPrediction;
+	if (enabled == enlargedAabbs) {
+		return;
+	}
+	enlargedAabbs = enabled;
+	if (enabled) {
+		fatAabbs.resize(data._Data()._Data().size());
+		for (size_t i = 0; i < fatAabbs.size(); ++i) {
+			fatAabbs[i] = EnlargedAabb(data[i].aabb, {0, 0, 0});
+		}
+	} else {
+		fatAabbs.clear();
+		fatAabbs.shrink_to_fit();
+	}
+	// aabbs of all entities changed, refit whole tree
+	refitMarks.clear();
+	refitMarks.resize(nodes._Data().size(), 1);
+	RefitMarked(rootNode);
+	refitMarks.assign(refitMarks.size(), 0);
+}
+
+SPP_TEMPLATE_DECL
+Aabb Dbvh<SPP_TEMPLATE_ARGS>::EnlargedAabb(const Aabb &aabb,
+										   glm::vec3 velocity) const
+{
+	velocity *= fatVelocityPrediction;
+	spp::Aabb e = ((spp::Aabb)aabb).Expanded(fatMargin);
+	e.min += glm::min(velocity, glm::vec3(0.0f));
+	e.max += glm::max(velocity, glm::vec3(0.0f));
+	// union protects from rounding of integer aabbs
+	return ((Aabb)e) + aabb;
+}
+
+SPP_TEMPLATE_DECL
+void Dbvh<SPP_TEMPLATE_ARGS>::UpdateBatch(
+	std::span<const std::pair<EntityType, Aabb>> entities)
+{
+	if (entities.size() == 0) {
+		return;
+	}
+	refitMarks.resize(nodes._Data().size(), 0);
+	for (const auto &[entity, aabb] : entities) {
+		const int32_t offset = data.GetOffset(entity);
+		data[offset].aabb = aabb;
+		if (enlargedAabbs) {
+			if (fatAabbs[offset].ContainsAll(aabb)) {
+				continue;
+			}
+			fatAabbs[offset] = EnlargedAabb(aabb, {0, 0, 0});
+		}
+		for (int32_t id = data[offset].parent; id > 0 && refitMarks[id] == 0;
+			 id = nodes[id].parent) {
+			refitMarks[id] = 1;
+		}
+	}
+	RefitMarked(rootNode);
+}
+
+SPP_TEMPLATE_DECL
+Aabb Dbvh<SPP_TEMPLATE_ARGS>::RefitMarked(const int32_t nodeId)
+{
+	refitMarks[nodeId] = 0;
+	for (int i = 0; i < 2; ++i) {
+		const int32_t c = nodes[nodeId].children[i];
+		if (c > OFFSET) {
+			nodes[nodeId].aabb[i] = enlargedAabbs ? fatAabbs[c - OFFSET]
+												  : data[c - OFFSET].aabb;
+		} else if (c > 0 && refitMarks[c]) {
+			nodes[nodeId].aabb[i] = RefitMarked(c);
+		}
+	}
+	const NodeData &n = nodes[nodeId];
+	if (n.children[0] > 0 && n.children[1] > 0) {
+		DoBestNodeRotation(nodeId);
+		return nodes[nodeId].aabb[0] + nodes[nodeId].aabb[1];
+	}
+	return n.aabb[n.children[0] > 0 ? 0 : 1];
+}
+
+SPP_TEMPLATE_DECL
+void Dbvh<SPP_TEMPLATE_ARGS>::BulkLoad(std::span<const EntityType> entities,
+									   std::span<const Aabb> aabbs,
+									   std::span<const MaskType> masks)
+{
+	assert(GetCount() == 0);
+	assert(entities.size() == aabbs.size());
+	assert(entities.size() == masks.size());
+	Clear();
+	if (entities.size() < 2) {
+		for (size_t i = 0; i < entities.size(); ++i) {
+			Add(entities[i], aabbs[i], masks[i]);
+		}
+		return;
+	}
+
+	data.Reserve(entities.size() + 1);
+	buildOffsets.resize(entities.size());
+	for (size_t i = 0; i < entities.size(); ++i) {
+		assert(Exists(entities[i]) == false);
+		buildOffsets[i] =
+			data.Add(entities[i], {aabbs[i], entities[i], masks[i]});
+	}
+	const size_t size = data._Data()._Data().size();
+	buildCenters.resize(size);
+	if (enlargedAabbs) {
+		fatAabbs.resize(size);
+	}
+	for (const int32_t o : buildOffsets) {
+		if (enlargedAabbs) {
+			fatAabbs[o] = EnlargedAabb(data[o].aabb, {0, 0, 0});
+		}
+		buildCenters[o] = (glm::vec3)data[o].aabb.GetCenter();
+	}
+
+	// internal nodes of n entities have ids [1, n-1]
+	nodes._Data().resize(entities.size());
+	rootNode = BuildRange(buildOffsets, 0, 0,
+						  this->GetBulkLoadThreadsCount(entities.size()));
+
+	buildOffsets.clear();
+	buildCenters.clear();
+	buildCenters.shrink_to_fit();
+}
+
+SPP_TEMPLATE_DECL
+int32_t Dbvh<SPP_TEMPLATE_ARGS>::BuildRange(std::span<int32_t> offsets,
+											int32_t begin, int32_t parent,
+											int32_t threadsCount)
+{
+	if (offsets.size() == 1) {
+		data[offsets[0]].parent = parent;
+		return offsets[0] + OFFSET;
+	}
+
+	glm::vec3 min = buildCenters[offsets[0]];
+	glm::vec3 max = min;
+	for (const int32_t o : offsets) {
+		min = glm::min(min, buildCenters[o]);
+		max = glm::max(max, buildCenters[o]);
+	}
+	const glm::vec3 ext = max - min;
+	int axis = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (ext[axis] < ext[i]) {
+			axis = i;
+		}
+	}
+
+	const int32_t mid = offsets.size() / 2;
+	std::nth_element(offsets.begin(), offsets.begin() + mid, offsets.end(),
+					 [this, axis](int32_t l, int32_t r) {
+						 return buildCenters[l][axis] < buildCenters[r][axis];
+					 });
+
+	const int32_t nodeId = begin + mid;
+	NodeData &node = nodes[nodeId];
+	node.parent = parent;
+	if (threadsCount > 1) {
+		std::thread thread([&]() {
+			node.children[0] =
+				BuildRange(offsets.first(mid), begin, nodeId, threadsCount / 2);
+		});
+		node.children[1] = BuildRange(offsets.subspan(mid), begin + mid, nodeId,
+									  threadsCount - threadsCount / 2);
+		thread.join();
+	} else {
+		node.children[0] = BuildRange(offsets.first(mid), begin, nodeId, 1);
+		node.children[1] =
+			BuildRange(offsets.subspan(mid), begin + mid, nodeId, 1);
+	}
+	for (int i = 0; i < 2; ++i) {
+		node.aabb[i] = GetDirectAabb(node.children[i]);
+	}
+	node.mask = GetDirectMask(node.children[0]) |
+				GetDirectMask(node.children[1]);
+	return nodeId;
+}
+
 SPP_TEMPLATE_DECL
 void Dbvh<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
 {
@@ -344,9 +554,74 @@ void Dbvh<SPP_TEMPLATE_ARGS>::_Internal_IntersectRay(RayCallback &cb,
 	}
 }
 
+SPP_TEMPLATE_DECL
+BroadphaseStatistics Dbvh<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+	const NodeData &root = nodes[rootNode];
+	if (root.children[0] > 0 || root.children[1] > 0) {
+		spp::Aabb aabb;
+		if (root.children[0] > 0 && root.children[1] > 0) {
+			aabb = root.aabb[0] + root.aabb[1];
+		} else {
+			aabb = root.aabb[root.children[0] > 0 ? 0 : 1];
+		}
+		stats.rootSurface = aabb.GetSurface();
+		_Internal_GetStatistics(stats, rootNode, 0, stats.rootSurface);
+	}
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL
+void Dbvh<SPP_TEMPLATE_ARGS>::_Internal_GetStatistics(
+	BroadphaseStatistics &stats, const int32_t nodeId, int32_t depth,
+	float surface) const
+{
+	const NodeData &n = nodes[nodeId];
+	stats.AddNode(depth, surface);
+	for (int i = 0; i < 2; ++i) {
+		const int32_t c = n.children[i];
+		if (c <= 0) {
+			continue;
+		} else if (c > OFFSET) {
+			stats.AddLeaf(depth + 1, n.aabb[i].GetSurface(),
+						  data[c - OFFSET].aabb.GetSurface(), 1);
+		} else {
+			_Internal_GetStatistics(stats, c, depth + 1,
+									n.aabb[i].GetSurface());
+		}
+	}
+	if (n.children[0] > 0 && n.children[1] > 0) {
+		stats.AddSiblings(n.aabb[0], n.aabb[1]);
+	}
+}
+
 SPP_TEMPLATE_DECL
 void Dbvh<SPP_TEMPLATE_ARGS>::Rebuild() { FastRebalance(); }
 
+SPP_TEMPLATE_DECL
+float Dbvh<SPP_TEMPLATE_ARGS>::RebuildFor(std::chrono::microseconds budget)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	const int32_t nodesCount = nodes._Data().size();
+	do {
+		const int32_t end = std::min(rebalanceCursor + 64, nodesCount);
+		for (; rebalanceCursor < end; ++rebalanceCursor) {
+			const NodeData &n = nodes[rebalanceCursor];
+			// skip free nodes
+			if (n.children[0] > 0 && n.children[1] > 0) {
+				DoBestNodeRotation(rebalanceCursor);
+			}
+		}
+		if (rebalanceCursor >= nodesCount) {
+			rebalanceCursor = 1;
+			return 1.0f;
+		}
+	} while (std::chrono::steady_clock::now() < deadline);
+	return float(rebalanceCursor) / float(nodesCount);
+}
+
 SPP_TEMPLATE_DECL
 void Dbvh<SPP_TEMPLATE_ARGS>::FastRebalance()
 {
@@ -636,6 +911,9 @@ Aabb Dbvh<SPP_TEMPLATE_ARGS>::GetDirectAabb(int32_t node) const
 		assert(!"cannot happen");
 		return {};
 	} else if (node > OFFSET) {
+		if (enlargedAabbs) {
+			return fatAabbs[node - OFFSET];
+		}
 		return data[node - OFFSET].aabb.Expanded(BIG_EPSILON);
 	} else {
 		if (nodes[node].children[0] > 0) {
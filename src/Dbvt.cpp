@@ -29,6 +29,8 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Clear()
 {
 	ents.Clear();
 	dbvt.clear();
+	rebuildForPassesLeft = 0;
+	rebuildForPassesTotal = 0;
 }
 
 SPP_TEMPLATE_DECL_OFFSET
@@ -46,6 +48,9 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::SmallRebuildIfNeeded()
 	if (requiresRebuild > 1000) {
 		IncrementalOptimize(requiresRebuild / 13 + 1);
 		requiresRebuild = 0;
+		if (sahOptimizeBudget.count() > 0) {
+			SahOptimize(sahOptimizeBudget);
+		}
 	}
 }
 
@@ -55,6 +60,28 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::IncrementalOptimize(int iterations)
 	dbvt.optimizeIncremental(iterations);
 }
 
+SPP_TEMPLATE_DECL_OFFSET
+int32_t
+Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::SahOptimize(std::chrono::microseconds budget)
+{
+	return dbvt.optimizeSah(budget);
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::SetSahOptimizeBudget(
+	std::chrono::microseconds budget)
+{
+	sahOptimizeBudget = budget;
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::SetEnlargedAabbs(bool enabled,
+													 float margin,
+													 float velocityPrediction)
+{
+	dbvt.setEnlargedAabbs(enabled, margin, velocityPrediction);
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Add(EntityType entity, Aabb aabb,
 										 MaskType mask)
@@ -68,10 +95,22 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Add(EntityType entity, Aabb aabb,
 
 SPP_TEMPLATE_DECL_OFFSET
 void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Update(EntityType entity, Aabb aabb)
+{
+	Dbvt::Update(entity, aabb, {0, 0, 0});
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Update(EntityType entity, Aabb aabb,
+											glm::vec3 velocity)
 {
 	OffsetType offset = ents.GetOffset(entity);
 	if (offset > 0) {
 		ents[offset].aabb = aabb;
+		if (dbvt.isEnlargedAabbs()) {
+			if (dbvt.updateEnlargedAabb(offset, velocity) == false) {
+				return;
+			}
+		}
 		dbvt.updateEntityOffset(offset, aabb);
 		requiresRebuild++;
 	} else {
@@ -79,6 +118,50 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Update(EntityType entity, Aabb aabb)
 	}
 }
 
+SPP_TEMPLATE_DECL_OFFSET
+void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::UpdateBatch(
+	std::span<const std::pair<EntityType, Aabb>> entities)
+{
+	batchOffsets.clear();
+	for (const auto &[entity, aabb] : entities) {
+		OffsetType offset = ents.GetOffset(entity);
+		if (offset > 0) {
+			ents[offset].aabb = aabb;
+			if (dbvt.isEnlargedAabbs()) {
+				if (dbvt.updateEnlargedAabb(offset, {0, 0, 0}) == false) {
+					continue;
+				}
+			}
+			batchOffsets.push_back(offset);
+		} else {
+			assert(Exists(entity) == true);
+		}
+	}
+	dbvt.updateEntityOffsets(batchOffsets);
+	requiresRebuild += batchOffsets.size();
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::BulkLoad(
+	std::span<const EntityType> entities, std::span<const Aabb> aabbs,
+	std::span<const MaskType> masks)
+{
+	assert(GetCount() == 0);
+	assert(entities.size() == aabbs.size());
+	assert(entities.size() == masks.size());
+	Clear();
+	ents.Reserve(entities.size() + 1);
+	batchOffsets.resize(entities.size());
+	for (size_t i = 0; i < entities.size(); ++i) {
+		assert(Exists(entities[i]) == false);
+		batchOffsets[i] =
+			ents.Add(entities[i], Data{aabbs[i], 0, entities[i], masks[i]});
+	}
+	dbvt.build(batchOffsets, this->GetBulkLoadThreadsCount(entities.size()));
+	batchOffsets.clear();
+	requiresRebuild = 0;
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Remove(EntityType entity)
 {
@@ -141,6 +224,36 @@ void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::Rebuild()
 	SmallRebuildIfNeeded();
 }
 
+SPP_TEMPLATE_DECL_OFFSET
+float Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::RebuildFor(
+	std::chrono::microseconds budget)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	if (rebuildForPassesLeft <= 0) {
+		rebuildForPassesTotal = std::max<int32_t>(ents.Size(), 1);
+		rebuildForPassesLeft = rebuildForPassesTotal;
+		requiresRebuild = 0;
+	}
+	do {
+		const int32_t passes = std::min<int32_t>(rebuildForPassesLeft, 64);
+		dbvt.optimizeIncremental(passes);
+		rebuildForPassesLeft -= passes;
+		if (rebuildForPassesLeft <= 0) {
+			return 1.0f;
+		}
+	} while (std::chrono::steady_clock::now() < deadline);
+	return 1.0f - float(rebuildForPassesLeft) / float(rebuildForPassesTotal);
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+BroadphaseStatistics Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+	dbvt.getStatistics(stats);
+	stats.Finish();
+	return stats;
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 void Dbvt<SPP_TEMPLATE_ARGS_OFFSET>::IntersectAabb(AabbCallback &cb)
 {
@@ -2,15 +2,17 @@
 // Copyright (c) 2024-2025 Marek Zalewski aka Drwalin
 // You should have received a copy of the MIT License along with this program.
 
+#include <cmath>
 #include <cstdio>
-#include <cstring>
-
+#include <algorithm>
 #include <bit>
 
 #include "../glm/glm/ext/vector_int3.hpp"
 #include "../glm/glm/common.hpp"
+#include "../glm/glm/vector_relational.hpp"
 
 #include "../include/spatial_partitioning/HashLooseOctree.hpp"
+#include "../include/spatial_partitioning/Morton.hpp"
 
 namespace spp
 {
@@ -20,12 +22,11 @@ SPP_TEMPLATE_DECL
 HashLooseOctree<SPP_TEMPLATE_ARGS>::HashLooseOctree(float resolution,
 													int32_t levels,
 													float loosenessFactor)
-	: nodes(12289,
-			typename HashLooseOctree<SPP_TEMPLATE_ARGS>::Key::Hash(this)),
-	  loosenessFactor(loosenessFactor),
+	: loosenessFactor(loosenessFactor),
 	  invLoosenessFactor(1.0f / loosenessFactor), resolution(resolution),
 	  invResolution(1.0f / resolution), levels(levels), iterator(*this)
 {
+	assert(levels <= 20);
 	Clear();
 }
 SPP_TEMPLATE_DECL
@@ -44,19 +45,21 @@ SPP_TEMPLATE_DECL
 void HashLooseOctree<SPP_TEMPLATE_ARGS>::Clear()
 {
 	data.Clear();
-	nodes.clear();
+	nodes.Clear();
 }
 
 SPP_TEMPLATE_DECL
 size_t HashLooseOctree<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
 {
-	return data.GetMemoryUsage() + nodes.bucket_count() * sizeof(void *) +
-		   nodes.size() *
-			   (sizeof(void *) * 2lu + sizeof(Key) + sizeof(NodeData));
+	return data.GetMemoryUsage() + nodes.GetMemoryUsage();
 }
 
 SPP_TEMPLATE_DECL
-void HashLooseOctree<SPP_TEMPLATE_ARGS>::ShrinkToFit() { data.ShrinkToFit(); }
+void HashLooseOctree<SPP_TEMPLATE_ARGS>::ShrinkToFit()
+{
+	data.ShrinkToFit();
+	nodes.ShrinkToFit();
+}
 
 SPP_TEMPLATE_DECL
 int32_t HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcHashMinLevel(Aabb aabb)
@@ -75,33 +78,48 @@ int32_t HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcHashMinLevel(Aabb aabb)
 	return minLevel;
 }
 
-#define ROT64(V, R) ((V << R) | (V >> (64 - R)))
+SPP_TEMPLATE_DECL
+glm::ivec3 HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcLocalPos(Aabb aabb) const
+{
+	return glm::floor(aabb.GetCenter() * invResolution);
+}
 
 SPP_TEMPLATE_DECL
-uint64_t HashLooseOctree<SPP_TEMPLATE_ARGS>::Hash(const glm::vec3 pos,
-												  int32_t level) const
+uint64_t HashLooseOctree<SPP_TEMPLATE_ARGS>::NodeKey(glm::ivec3 pos,
+													 int32_t level) const
 {
 	if (level > levels) {
-		return 3141592653589793238lu;
+		pos = {0, 0, 0};
+		level = levels + 1;
 	}
+	assert(glm::all(glm::lessThan(glm::abs(pos), glm::ivec3(1 << 20))));
 
-	const glm::ivec3 p = pos * invResolution;
-	return Hash(p, level);
+	// positions are biased to be non negative, marker bit above Morton code
+	// makes keys of different levels distinct
+	const glm::uvec3 p = (pos >> level) + ((1 << 20) >> level);
+	return (1llu << (3 * (21 - level))) | SpreadBits3(p.x) |
+		   (SpreadBits3(p.y) << 1) | (SpreadBits3(p.z) << 2);
 }
 
 SPP_TEMPLATE_DECL
-uint64_t HashLooseOctree<SPP_TEMPLATE_ARGS>::Hash(const glm::ivec3 pos,
-												  int32_t level) const
+void HashLooseOctree<SPP_TEMPLATE_ARGS>::DecodeNodeKey(uint64_t key,
+													   glm::ivec3 &pos,
+													   int32_t &level)
 {
-	if (level > levels) {
-		return 3141592653589793238lu;
-	}
+	const int32_t bits = 63 - std::countl_zero(key);
+	level = 21 - bits / 3;
+	key ^= 1llu << bits;
+	const glm::ivec3 p = {CompactBits3(key), CompactBits3(key >> 1),
+						  CompactBits3(key >> 2)};
+	pos = (p - ((1 << 20) >> level)) << level;
+}
 
-	const glm::ivec3 a = pos >> level;
-	return (14695981039346656037lu ^ ((uint64_t)((uint32_t)a.x)) ^
-			ROT64((uint64_t)((uint32_t)a.x), 21) ^
-			ROT64((uint64_t)((uint32_t)a.x), 42)) *
-		   1099511628211lu;
+SPP_TEMPLATE_DECL
+int32_t HashLooseOctree<SPP_TEMPLATE_ARGS>::ChildId(glm::ivec3 pos,
+													int32_t level)
+{
+	const glm::ivec3 p = pos >> (level - 1);
+	return (p.x & 1) | ((p.y & 1) << 1) | ((p.z & 1) << 2);
 }
 
 SPP_TEMPLATE_DECL
@@ -115,35 +133,13 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
 		if (d.mask != mask) {
 			SetMask(entity, mask);
 		}
-		if (d.aabb != aabb) {
+		if ((Aabb)d.aabb != aabb) {
 			Update(entity, aabb);
 		}
 		return;
 	}
 
-	int32_t level = CalcHashMinLevel(aabb);
-	const glm::ivec3 pos = ((glm::vec3)aabb.GetCenter()) * invResolution;
-
-	{
-		NodeData &nd = nodes[Key(this, pos, level)];
-		nd.directChildrenCount++;
-
-		data[offset].next = nd.firstChild;
-		data[offset].prev = -1;
-		if (nd.firstChild >= 0) {
-			data[nd.firstChild].prev = offset;
-		}
-		nd.mask |= mask;
-		nd.firstChild = offset;
-	}
-
-	for (++level; level <= levels; ++level) {
-		glm::ivec3 p = glm::ivec3(pos) >> (level - 1);
-		const int32_t childId = (p.x & 1) | ((p.y & 1) << 1) | ((p.y & 1) << 2);
-		NodeData &nd = nodes[Key(this, pos, level)];
-		nd.childrenInNodesCounts[childId]++;
-		nd.mask |= mask;
-	}
+	LinkNode(offset, CalcLocalPos(aabb), CalcHashMinLevel(aabb), levels + 1);
 }
 
 SPP_TEMPLATE_DECL
@@ -154,107 +150,97 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
 	data[offset].aabb = aabb;
 
 	const int32_t oldLevel = CalcHashMinLevel(oldAabb);
-	int32_t level = CalcHashMinLevel(aabb);
+	const int32_t level = CalcHashMinLevel(aabb);
+	const glm::ivec3 oldPos = CalcLocalPos(oldAabb);
+	const glm::ivec3 pos = CalcLocalPos(aabb);
 
-	if (level != oldLevel) {
-		MaskType mask = data[offset].mask;
-		Remove(entity);
-		Add(entity, aabb, mask);
+	if (level == oldLevel && NodeKey(oldPos, level) == NodeKey(pos, level)) {
 		return;
 	}
 
-	const glm::ivec3 oldPos = ((glm::vec3)oldAabb.GetCenter()) * invResolution;
-	const glm::ivec3 pos = ((glm::vec3)aabb.GetCenter()) * invResolution;
-
-	if (oldPos == pos) {
-		return;
+	// children counts of ancestors of common node of both positions do not
+	// change
+	int32_t untilLevel = std::max(level, oldLevel) + 1;
+	while (untilLevel <= levels &&
+		   NodeKey(oldPos, untilLevel - 1) != NodeKey(pos, untilLevel - 1)) {
+		++untilLevel;
 	}
 
-	{
-		NodeData &oldNd = nodes[Key(this, oldPos, level)];
-		NodeData &nd = nodes[Key(this, pos, level)];
+	UnlinkNode(offset, oldPos, oldLevel, untilLevel);
+	LinkNode(offset, pos, level, untilLevel);
+}
 
-		oldNd.directChildrenCount--;
-		if (data[offset].prev >= 0) {
-			data[data[offset].prev].next = data[offset].next;
-		} else {
-			oldNd.firstChild = data[offset].next;
-		}
-		if (data[offset].next >= 0) {
-			data[data[offset].next].prev = data[offset].prev;
-		}
+SPP_TEMPLATE_DECL
+void HashLooseOctree<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
+{
+	const int32_t offset = data.GetOffset(entity);
+	const Aabb aabb = data[offset].aabb;
+	UnlinkNode(offset, CalcLocalPos(aabb), CalcHashMinLevel(aabb), levels + 1);
+	data.RemoveByKey(entity);
+}
 
+SPP_TEMPLATE_DECL
+void HashLooseOctree<SPP_TEMPLATE_ARGS>::LinkNode(int32_t offset,
+												  glm::ivec3 pos, int32_t level,
+												  int32_t untilLevel)
+{
+	Data &d = data[offset];
+	{
+		NodeData &nd = nodes[NodeKey(pos, level)];
 		nd.directChildrenCount++;
-		data[offset].next = nd.firstChild;
-		data[offset].prev = -1;
+
+		d.next = nd.firstChild;
+		d.prev = -1;
 		if (nd.firstChild >= 0) {
 			data[nd.firstChild].prev = offset;
 		}
+		nd.mask |= d.mask;
 		nd.firstChild = offset;
-		nd.mask |= data[offset].mask;
 	}
 
-	for (++level; level <= levels; ++level) {
-		if (Key(this, oldPos, level) == Key(this, pos, level)) {
-			break;
-		}
-
-		NodeData &oldNd = nodes[Key(this, oldPos, level)];
-		NodeData &nd = nodes[Key(this, pos, level)];
-
-		glm::ivec3 op = glm::ivec3(oldPos) >> (level - 1);
-		const int32_t oldChildId =
-			(op.x & 1) | ((op.y & 1) << 1) | ((op.y & 1) << 2);
-		oldNd.childrenInNodesCounts[oldChildId]--;
-
-		glm::ivec3 p = glm::ivec3(pos) >> (level - 1);
-		const int32_t childId = (p.x & 1) | ((p.y & 1) << 1) | ((p.y & 1) << 2);
-		nd.childrenInNodesCounts[childId]++;
-		nd.mask |= data[offset].mask;
+	for (++level; level < untilLevel && level <= levels; ++level) {
+		NodeData &nd = nodes[NodeKey(pos, level)];
+		nd.childrenInNodesCounts[ChildId(pos, level)]++;
+		nd.mask |= d.mask;
 	}
 }
 
 SPP_TEMPLATE_DECL
-void HashLooseOctree<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
+void HashLooseOctree<SPP_TEMPLATE_ARGS>::UnlinkNode(int32_t offset,
+													glm::ivec3 pos,
+													int32_t level,
+													int32_t untilLevel)
 {
-	const int32_t offset = data.GetOffset(entity);
-	const Aabb aabb = data[offset].aabb;
-	// 	MaskType mask = data[offset].mask;
-	data[offset] = {};
-	int32_t level = CalcHashMinLevel(aabb);
-
-	const glm::ivec3 pos = ((glm::vec3)aabb.GetCenter()) * invResolution;
-
+	Data &d = data[offset];
 	{
-		NodeData &nd = nodes[Key(this, pos, level)];
+		const uint64_t key = NodeKey(pos, level);
+		NodeData &nd = *nodes.find(key);
 
 		nd.directChildrenCount--;
-		if (data[offset].prev >= 0) {
-			data[data[offset].prev].next = data[offset].next;
+		if (d.prev >= 0) {
+			data[d.prev].next = d.next;
 		} else {
-			nd.firstChild = data[offset].next;
+			nd.firstChild = d.next;
 		}
-		if (data[offset].next >= 0) {
-			data[data[offset].next].prev = data[offset].prev;
+		if (d.next >= 0) {
+			data[d.next].prev = d.prev;
 		}
+		d.prev = -1;
+		d.next = -1;
 
-		if (nd.firstChild == -1 || nd.HasIndirectChildren() == 0) {
-			nodes.erase(Key(this, pos, level));
+		if (nd.firstChild < 0 && nd.HasIndirectChildren() == false) {
+			nodes.Remove(key);
 		}
 	}
 
-	for (++level; level <= levels; ++level) {
-		NodeData &nd = nodes[Key(this, pos, level)];
-		glm::ivec3 op = glm::ivec3(pos) >> (level - 1);
-		const int32_t oldChildId =
-			(op.x & 1) | ((op.y & 1) << 1) | ((op.y & 1) << 2);
-		nd.childrenInNodesCounts[oldChildId]--;
-		if (nd.firstChild == -1 || nd.HasIndirectChildren() == 0) {
-			nodes.erase(Key(this, pos, level));
+	for (++level; level < untilLevel && level <= levels; ++level) {
+		const uint64_t key = NodeKey(pos, level);
+		NodeData &nd = *nodes.find(key);
+		nd.childrenInNodesCounts[ChildId(pos, level)]--;
+		if (nd.firstChild < 0 && nd.HasIndirectChildren() == false) {
+			nodes.Remove(key);
 		}
 	}
-
-	data.RemoveByKey(entity);
 }
 
 SPP_TEMPLATE_DECL
@@ -264,16 +250,14 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity,
 	const int32_t offset = data.GetOffset(entity);
 	const Aabb aabb = data[offset].aabb;
 	data[offset].mask = mask;
-	data[offset] = {};
-	int32_t level = CalcHashMinLevel(aabb);
 
-	const glm::ivec3 pos = ((glm::vec3)aabb.GetCenter()) * invResolution;
-
-	NodeData &nd = nodes[Key(this, pos, level)];
-	nd.mask |= mask;
+	const glm::ivec3 pos = CalcLocalPos(aabb);
+	int32_t level = CalcHashMinLevel(aabb);
 
-	for (; level <= levels; ++level) {
-		NodeData &nd = nodes[Key(this, pos, level)];
+	// masks of nodes are only extended
+	nodes.find(NodeKey(pos, level))->mask |= mask;
+	for (++level; level <= levels; ++level) {
+		NodeData &nd = *nodes.find(NodeKey(pos, level));
 		if ((nd.mask & mask) == mask) {
 			break;
 		}
@@ -325,6 +309,97 @@ Aabb HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcLocalAabbOfNode(glm::ivec3 pos,
 	return aabb;
 }
 
+SPP_TEMPLATE_DECL
+spp::Aabb
+HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcLocalLooseAabbOfNode(glm::ivec3 pos,
+															 int32_t level) const
+{
+	const float size = std::ldexp(1.0f, level);
+	const float overlap = loosenessFactor * size * 0.5f;
+	return {(glm::vec3)pos - overlap, (glm::vec3)pos + size + overlap};
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics HashLooseOctree<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	// gathered in local units, scaled by resolution when merged
+	BroadphaseStatistics local;
+	spp::Aabb rootAabb = AABB_INVALID;
+
+	nodes.ForEach([&](uint64_t key, const NodeData &node) {
+		glm::ivec3 pos;
+		int32_t level;
+		DecodeNodeKey(key, pos, level);
+
+		int64_t count = 0;
+		spp::Aabb tight = AABB_INVALID;
+		for (int32_t n = node.firstChild; n >= 0; n = data[n].next) {
+			tight = tight + (spp::Aabb)data[n].aabb;
+			++count;
+		}
+
+		if (level > levels) {
+			local.AddUnsorted(count);
+			return;
+		}
+
+		const int32_t depth = levels - level;
+		const spp::Aabb aabb = CalcLocalLooseAabbOfNode(pos, level);
+		const float surface = aabb.GetSurface();
+		if (level == levels) {
+			rootAabb = rootAabb + aabb;
+		}
+
+		if (count > 0) {
+			local.AddLeaf(depth, surface, tight.GetSurface(), count);
+		}
+
+		if (level == 0) {
+			return;
+		}
+		const int32_t ihalf = 1 << (level - 1);
+		bool hasChildren = false;
+		for (int32_t i = 0; i < 8; ++i) {
+			if (node.childrenInNodesCounts[i] == 0) {
+				continue;
+			}
+			hasChildren = true;
+			const glm::ivec3 is = {i & 1, (i >> 1) & 1, (i >> 2) & 1};
+			const spp::Aabb a =
+				CalcLocalLooseAabbOfNode(pos + is * ihalf, level - 1);
+			for (int32_t j = i + 1; j < 8; ++j) {
+				if (node.childrenInNodesCounts[j] == 0) {
+					continue;
+				}
+				const glm::ivec3 js = {j & 1, (j >> 1) & 1, (j >> 2) & 1};
+				local.AddSiblings(
+					a, CalcLocalLooseAabbOfNode(pos + js * ihalf, level - 1));
+			}
+		}
+		if (hasChildren) {
+			local.AddNode(depth, surface);
+		}
+	});
+
+	BroadphaseStatistics stats;
+	if (rootAabb.min.x <= rootAabb.max.x) {
+		stats.rootSurface =
+			rootAabb.GetSurface() * (double)resolution * resolution;
+	}
+	stats.Merge(local, 0, resolution);
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL
+spp::Aabb
+HashLooseOctree<SPP_TEMPLATE_ARGS>::CalcLooseAabbOfNode(glm::ivec3 pos,
+														int32_t level) const
+{
+	const spp::Aabb aabb = CalcLocalLooseAabbOfNode(pos, level);
+	return {aabb.min * resolution, aabb.max * resolution};
+}
+
 SPP_TEMPLATE_DECL
 void HashLooseOctree<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 {
@@ -344,12 +419,15 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 	 * iterate over structured objects, usually up to 2 iterations in each
 	 * direction should happen
 	 */
-	const float topLevelBorder =
-		((1 << (levels - 1)) * (loosenessFactor - 1.0));
-	glm::ivec3 a = CalcLocalAabbOfNode(cbaabb.min - decltype(Aabb::min)(topLevelBorder), levels).min;
-	glm::ivec3 b = CalcLocalAabbOfNode(cbaabb.max + decltype(Aabb::min)(topLevelBorder), levels).max;
+	const float topLevelBorder = (1 << (levels - 1)) * loosenessFactor;
+	glm::ivec3 a =
+		CalcLocalAabbOfNode(glm::floor(cbaabb.min - topLevelBorder), levels)
+			.min;
+	glm::ivec3 b =
+		CalcLocalAabbOfNode(glm::floor(cbaabb.max + topLevelBorder), levels)
+			.min;
 	const int32_t stride = 1 << levels;
-	for (glm::vec3 p = a; p.x <= b.x; p.x += stride) {
+	for (glm::ivec3 p = a; p.x <= b.x; p.x += stride) {
 		for (p.y = a.y; p.y <= b.y; p.y += stride) {
 			for (p.z = a.z; p.z <= b.z; p.z += stride) {
 				_Internal_IntersectAabb(cb, p, levels, cbaabb);
@@ -362,14 +440,14 @@ SPP_TEMPLATE_DECL
 void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectAabb(
 	AabbCallback &cb, glm::ivec3 pos, int32_t level, const Aabb &cbaabb)
 {
-	auto it = nodes.find(Key(this, pos, level));
-	if (it == nodes.end()) {
+	const NodeData *node = nodes.find(NodeKey(pos, level));
+	if (node == nullptr) {
 		return;
 	}
 
-	auto nodeData = it->second;
+	const NodeData nodeData = *node;
 
-	_Inernal_IntersectAabbIterateOverData(cb, nodeData.firstChild, cbaabb);
+	_Inernal_IntersectAabbIterateOverData(cb, nodeData.firstChild);
 
 	if (level == 0 || level > levels) {
 		return;
@@ -405,7 +483,7 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectAabb(
 			continue;
 		}
 
-		const glm::ivec3 is = {i & 1, (i << 1) & 1, (i << 2) & 1};
+		const glm::ivec3 is = {i & 1, (i >> 1) & 1, (i >> 2) & 1};
 		const glm::ivec3 isd = is + 1;
 
 		int32_t j = 0;
@@ -421,14 +499,14 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectAabb(
 
 SPP_TEMPLATE_DECL
 void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Inernal_IntersectAabbIterateOverData(
-	AabbCallback &cb, int32_t firstNode, const Aabb &cbaabb)
+	AabbCallback &cb, int32_t firstNode)
 {
 	int32_t n = firstNode;
 	while (n >= 0) {
 		auto &N = data[n];
 		if (N.mask & cb.mask) {
 			++cb.nodesTestedCount;
-			if (N.aabb && cbaabb) {
+			if (cb.IsRelevant(N.aabb)) {
 				++cb.testedCount;
 				cb.callback(&cb, N.entity);
 			}
@@ -450,69 +528,35 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
 	// iterate over unfit objects
 	_Internal_IntersectRay(cb, {0, 0, 0}, levels + 1);
 
-	glm::ivec3 dirs = glm::sign(cb.dir);
-
-	const float topLevelBorder =
-		((1 << (levels - 1)) * (loosenessFactor - 1.0));
-	glm::ivec3 p =
-		CalcLocalAabbOfNode(glm::min(cb.start, cb.end) - topLevelBorder, levels)
+	// top level nodes overlapping bounds of ray, visited along ray direction
+	const float topLevelBorder = (1 << (levels - 1)) * loosenessFactor;
+	const glm::ivec3 a =
+		CalcLocalAabbOfNode(glm::floor(glm::min(cb.start, cb.end) *
+										   invResolution -
+									   topLevelBorder),
+							levels)
 			.min;
-	glm::ivec3 b =
-		CalcLocalAabbOfNode(glm::max(cb.start, cb.end) + topLevelBorder, levels)
-			.max;
-	glm::ivec3 strides = dirs * (1 << levels);
-
-	const float size = 1 << levels;
-	const float margin = (size * (loosenessFactor - 1.0f) * 0.5);
-
-	glm::vec3 d = glm::abs(cb.dir);
-
-	glm::ivec3 axesImportance = {0, 1, 2};
-	{
-		int32_t _a = 0, _b = 0;
-		for (int32_t i = 1; i < 3; ++i) {
-			if (d[i] < d[_a]) {
-				_a = i;
-			} else if (d[i] > d[_b]) {
-				_b = i;
-			}
-		}
-		if (_a != _b) {
-			int32_t _c = 3 ^ _a ^ _b;
-			axesImportance = {_a, _c, _b};
-		}
+	const glm::ivec3 b =
+		CalcLocalAabbOfNode(glm::floor(glm::max(cb.start, cb.end) *
+										   invResolution +
+									   topLevelBorder),
+							levels)
+			.min;
+	const int32_t stride = 1 << levels;
+	const glm::ivec3 count = (b - a) / stride + 1;
+	glm::ivec3 first, step;
+	for (int32_t i = 0; i < 3; ++i) {
+		first[i] = cb.dir[i] < 0 ? b[i] : a[i];
+		step[i] = cb.dir[i] < 0 ? -stride : stride;
 	}
-	const glm::ivec3 ai = axesImportance;
 
-#define FOR(X)                                                                 \
-	for (; dirs[X] > 0 ? p[X] <= b[X] : p[X] >= b[X]; p[X] += strides[X])
-	FOR(ai[0])
-	{
-		const float X = p[ai[0]];
-		const float t1 = (X - cb.start[ai[0]]) / cb.dirNormalized[ai[0]];
-		p[ai[1]] = cb.dirNormalized[ai[1]] * t1 + cb.start[ai[1]] -
-				   margin * dirs[ai[1]];
-		const float t2 =
-			(X + strides[ai[0]] - cb.start[ai[0]]) / cb.dirNormalized[ai[0]];
-		b[ai[1]] = cb.dirNormalized[ai[1]] * t2 + cb.start[ai[1]] +
-				   margin * dirs[ai[1]];
-		FOR(ai[1])
-		{
-			float Y = p[ai[1]];
-			const float t1 = (Y - cb.start[ai[1]]) / cb.dirNormalized[ai[1]];
-			p[ai[2]] = cb.dirNormalized[ai[2]] * t1 + cb.start[ai[2]] -
-					   margin * dirs[ai[2]];
-			const float t2 = (X + strides[ai[1]] - cb.start[ai[1]]) /
-							 cb.dirNormalized[ai[1]];
-			b[ai[2]] = cb.dirNormalized[ai[2]] * t2 + cb.start[ai[2]] +
-					   margin * dirs[ai[2]];
-			FOR(ai[2])
-			{
-				spp::Aabb aabb = CalcLocalAabbOfNode(p, levels);
-				float __n, __f;
-				if (aabb.FastRayTestCenter(
-						cb.start * invResolution, cb.dirNormalized, cb.invDir,
-						cb.length * invResolution * cb.cutFactor, __n, __f)) {
+	glm::ivec3 i, p;
+	for (i.x = 0, p.x = first.x; i.x < count.x; ++i.x, p.x += step.x) {
+		for (i.y = 0, p.y = first.y; i.y < count.y; ++i.y, p.y += step.y) {
+			for (i.z = 0, p.z = first.z; i.z < count.z; ++i.z, p.z += step.z) {
+				float near, far;
+				if (cb.IsRelevant((AabbCentered)CalcLooseAabbOfNode(p, levels),
+								  near, far)) {
 					_Internal_IntersectRay(cb, p, levels);
 				}
 			}
@@ -525,12 +569,12 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectRay(RayCallback &cb,
 																glm::ivec3 pos,
 																int32_t level)
 {
-	auto it = nodes.find(Key(this, pos, level));
-	if (it == nodes.end()) {
+	const NodeData *node = nodes.find(NodeKey(pos, level));
+	if (node == nullptr) {
 		return;
 	}
 
-	auto nodeData = it->second;
+	const NodeData nodeData = *node;
 
 	_Inernal_IntersectRayIterateOverData(cb, nodeData.firstChild);
 
@@ -552,35 +596,26 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectRay(RayCallback &cb,
 			continue;
 		}
 
-		const glm::ivec3 is = {i & 1, (i << 1) & 1, (i << 2) & 1};
+		const glm::ivec3 is = {i & 1, (i >> 1) & 1, (i >> 2) & 1};
 
-		glm::ivec3 p = pos + is * ihalfSize;
-		spp::Aabb aabb = {p, p + ihalfSize};
 		float __n, __f;
-		if (aabb.FastRayTestCenter(cb.start * invResolution, cb.dirNormalized,
-								   cb.invDir, cb.length * invResolution, __n,
-								   __f)) {
-
-			if (__n < cb.cutFactor) {
-				int j = 0;
-				for (; i < ordsCount; ++j) {
-					if (ords[j].near > __n) {
-						break;
-					}
-				}
-				if (ordsCount != j) {
-					memmove(ords + j + 1, ords + j,
-							(ordsCount - j) * sizeof(Ords));
-				}
-				ords[j] = {__n, i};
+		if (cb.IsRelevant(
+				(AabbCentered)CalcLooseAabbOfNode(pos + is * ihalf, level - 1),
+				__n, __f)) {
+			// insertion sort by distance of entering child
+			int32_t j = ordsCount;
+			for (; j > 0 && ords[j - 1].near > __n; --j) {
+				ords[j] = ords[j - 1];
 			}
+			ords[j] = {__n, i};
+			++ordsCount;
 		}
 	}
 
 	for (int32_t _i = 0; _i < ordsCount; ++_i) {
 		int32_t i = ords[_i].i;
-		const glm::ivec3 is = {i & 1, (i << 1) & 1, (i << 2) & 1};
-		if (ords[_i].near < cb.cutFactor) {
+		const glm::ivec3 is = {i & 1, (i >> 1) & 1, (i >> 2) & 1};
+		if (ords[_i].near <= cb.cutFactor) {
 			_Internal_IntersectRay(cb, pos + is * ihalf, level - 1);
 		}
 	}
@@ -594,14 +629,7 @@ void HashLooseOctree<SPP_TEMPLATE_ARGS>::_Inernal_IntersectRayIterateOverData(
 	while (n >= 0) {
 		auto &N = data[n];
 		if (N.mask & cb.mask) {
-			++cb.nodesTestedCount;
-
-			float __n, __f;
-			if (N.aabb.FastRayTestCenter(cb.start * invResolution,
-										 cb.dirNormalized, cb.invDir,
-										 cb.length * invResolution, __n, __f)) {
-				cb.ExecuteCallback(N.entity);
-			}
+			cb.ExecuteIfRelevant(N.aabb, N.entity);
 		}
 		n = data[n].next;
 	}
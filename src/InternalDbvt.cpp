@@ -21,6 +21,10 @@ misrepresented as being the original software.
 
 #include <cstdio>
 
+#include <algorithm>
+#include <thread>
+#include <limits>
+
 #include "../glm/glm/common.hpp"
 
 #include "../include/spatial_partitioning/Dbvt.hpp"
@@ -75,6 +79,15 @@ template <typename Aabb> inline bool NotEqual(const Aabb &a, const Aabb &b)
 			(a.max.y != b.max.y) || (a.max.z != b.max.z));
 }
 
+inline uint32_t ExpandBits10(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 int btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::indexof(OffsetType node) const
 {
@@ -133,6 +146,16 @@ OffsetType btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::getParent(OffsetType node) const
 
 SPP_TEMPLATE_DECL_OFFSET
 Aabb btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::getLeafAabb(OffsetType leaf) const
+{
+	assert(leaf && isLeaf(leaf));
+	if (enlargedAabbs) {
+		return fatAabbs[leaf - OFFSET];
+	}
+	return (*ents)[leaf - OFFSET].aabb;
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+Aabb btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::getLeafEntityAabb(OffsetType leaf) const
 {
 	assert(leaf && isLeaf(leaf));
 	return (*ents)[leaf - OFFSET].aabb;
@@ -295,12 +318,9 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::insertleaf(OffsetType root,
 		if (parent) {
 			assert(parent);
 			assert(!isLeaf(parent));
-			{
-				const int i = indexofLeaf(sibling);
-				assert(nodes[parent].childs[i] == sibling);
-				assert(nodes[parent].childs[1 - i] != sibling);
-				assert(getParent(nodes[parent].childs[i]) == parent);
-			}
+			assert(nodes[parent].childs[indexofLeaf(sibling)] == sibling);
+			assert(nodes[parent].childs[1 - indexofLeaf(sibling)] != sibling);
+			assert(getParent(sibling) == parent);
 			nodes[parent].childs[indexofLeaf(sibling)] = node;
 			nodes[node].childs[0] = sibling;
 			nodes[node].childs[1] = leaf;
@@ -330,10 +350,9 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::insertleaf(OffsetType root,
 	}
 	assert(!isLeaf(getLeafParent(leaf)));
 	if (getLeafParent(leaf)) {
-		const OffsetType p = getLeafParent(leaf);
-		const int i = indexofLeaf(leaf);
-		assert(nodes[p].childs[i] == leaf);
-		assert(nodes[p].childs[1 - i] != leaf);
+		assert(nodes[getLeafParent(leaf)].childs[indexofLeaf(leaf)] == leaf);
+		assert(nodes[getLeafParent(leaf)].childs[1 - indexofLeaf(leaf)] !=
+			   leaf);
 	} else {
 		assert(rootId == leaf);
 	}
@@ -440,6 +459,8 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::clear()
 	nodes.resize(1);
 	rootId = 0;
 	m_opath = 0;
+	sahCursor = 1;
+	fatAabbs.clear();
 	nodes[0] = {{{1, 1, 1}, {-1, -1, -1}}, 0, {0, 0}};
 }
 
@@ -464,13 +485,319 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::optimizeIncremental(int passes)
 	}
 }
 
+SPP_TEMPLATE_DECL_OFFSET
+int btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::optimizeSah(
+	std::chrono::nanoseconds budget)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	if (!rootId || isLeaf(rootId)) {
+		return 0;
+	}
+
+	// Nodes array is scanned in windows starting where previous call ended,
+	// worst nodes of each window by inefficiency measure
+	// M_area * M_min * M_sum are reinserted.
+	const size_t WINDOW = 1024;
+	int reinserted = 0;
+	size_t scanned = 0;
+	while (scanned < nodes.size() &&
+		   std::chrono::steady_clock::now() < deadline) {
+		if (sahCursor >= nodes.size()) {
+			sahCursor = 1;
+		}
+		const size_t end = std::min(nodes.size(), sahCursor + WINDOW);
+		scanned += end - sahCursor;
+
+		sahCandidates.clear();
+		for (; sahCursor < end; ++sahCursor) {
+			const OffsetType node = sahCursor;
+			if (nodes[node].childs[1] == 0 || node == rootId) {
+				continue;
+			}
+			const float a = getNodeAabb(node).GetSurface() + 0.0001f;
+			const float a0 =
+				getAabb(nodes[node].childs[0]).GetSurface() + 0.0001f;
+			const float a1 =
+				getAabb(nodes[node].childs[1]).GetSurface() + 0.0001f;
+			const float cost =
+				a * (a / std::min(a0, a1)) * (2.0f * a / (a0 + a1));
+			sahCandidates.push_back({cost, node});
+		}
+
+		const size_t count =
+			std::min<size_t>(sahCandidates.size(),
+							 std::max<size_t>(1, sahCandidates.size() / 32));
+		std::partial_sort(sahCandidates.begin(),
+						  sahCandidates.begin() + count, sahCandidates.end(),
+						  [](const SahEntry &l, const SahEntry &r) {
+							  return l.cost > r.cost;
+						  });
+
+		for (size_t i = 0; i < count; ++i) {
+			if (std::chrono::steady_clock::now() >= deadline) {
+				break;
+			}
+			// node ids are reused by previous reinsertions, skip those which
+			// are no longer valid internal nodes
+			const OffsetType node = sahCandidates[i].node;
+			if (node >= nodes.size() || node == rootId ||
+				nodes[node].childs[1] == 0 || getNodeParent(node) == 0) {
+				continue;
+			}
+			const OffsetType a = nodes[node].childs[0];
+			const OffsetType b = nodes[node].childs[1];
+			detachNode(node);
+			insertSubtree(a);
+			insertSubtree(b);
+			++reinserted;
+		}
+	}
+	IsTreeValid();
+	return reinserted;
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::refitUpwards(OffsetType node)
+{
+	while (node) {
+		const Aabb pb = getNodeAabb(node);
+		nodes[node].aabb =
+			getAabb(nodes[node].childs[0]) + getAabb(nodes[node].childs[1]);
+		if (!NotEqual(pb, nodes[node].aabb)) {
+			break;
+		}
+		node = getNodeParent(node);
+	}
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::detachNode(const OffsetType node)
+{
+	assert(isInternal(node));
+	const OffsetType parent = getNodeParent(node);
+	assert(parent);
+	const OffsetType sibling = nodes[parent].childs[1 - indexofNode(node)];
+	const OffsetType grand = getNodeParent(parent);
+	if (grand) {
+		nodes[grand].childs[indexofNode(parent)] = sibling;
+		setParent(sibling, grand);
+		refitUpwards(grand);
+	} else {
+		rootId = sibling;
+		setParent(sibling, 0);
+	}
+	setParent(nodes[node].childs[0], 0);
+	setParent(nodes[node].childs[1], 0);
+	deletenode(parent);
+	deletenode(node);
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::insertSubtree(const OffsetType sub)
+{
+	assert(getParent(sub) == 0);
+	const Aabb aabb = getAabb(sub);
+	if (!rootId) {
+		rootId = sub;
+		return;
+	}
+	const OffsetType sibling = findBestSibling(aabb);
+	const OffsetType parent = getParent(sibling);
+	const int i = parent ? indexof(sibling) : 0;
+	const OffsetType node = createnode(parent, aabb, getAabb(sibling));
+	nodes[node].childs[0] = sibling;
+	nodes[node].childs[1] = sub;
+	setParent(sibling, node);
+	setParent(sub, node);
+	if (parent) {
+		nodes[parent].childs[i] = node;
+		refitUpwards(parent);
+	} else {
+		rootId = node;
+	}
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+OffsetType
+btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::findBestSibling(const Aabb &aabb)
+{
+	// branch-and-bound, cost of sibling is surface of new parent node plus
+	// surface growth of all its ancestors
+	const float area = aabb.GetSurface();
+	OffsetType best = rootId;
+	float bestCost = (getAabb(rootId) + aabb).GetSurface();
+	sahQueue.clear();
+	sahQueue.push_back({0.0f, rootId});
+	while (!sahQueue.empty()) {
+		std::pop_heap(sahQueue.begin(), sahQueue.end());
+		const SahEntry e = sahQueue.back();
+		sahQueue.pop_back();
+		if (e.cost + area >= bestCost) {
+			break;
+		}
+		const Aabb nodeAabb = getAabb(e.node);
+		const float direct = (nodeAabb + aabb).GetSurface();
+		if (direct + e.cost < bestCost) {
+			bestCost = direct + e.cost;
+			best = e.node;
+		}
+		if (isInternal(e.node)) {
+			const float inherited = e.cost + direct - nodeAabb.GetSurface();
+			if (inherited + area < bestCost) {
+				for (int i = 0; i < 2; ++i) {
+					sahQueue.push_back({inherited, nodes[e.node].childs[i]});
+					std::push_heap(sahQueue.begin(), sahQueue.end());
+				}
+			}
+		}
+	}
+	return best;
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::insert(const Aabb &aabb,
 											  OffsetType entityOffset)
 {
 	OffsetType leaf = getLeafId(entityOffset);
 // 	assert(!ContainsRecurence(leaf));
-	insertleaf(rootId, leaf, aabb);
+	if (enlargedAabbs) {
+		if (fatAabbs.size() <= entityOffset) {
+			fatAabbs.resize((size_t)entityOffset + 1);
+		}
+		fatAabbs[entityOffset] = enlargedAabb(aabb, {0, 0, 0});
+		insertleaf(rootId, leaf, fatAabbs[entityOffset]);
+	} else {
+		insertleaf(rootId, leaf, aabb);
+	}
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::build(
+	std::span<OffsetType> entityOffsets, int32_t threadsCount)
+{
+	assert(rootId == 0);
+	clear();
+	if (entityOffsets.empty()) {
+		return;
+	}
+	const size_t size = ents->_Data()._Data().size();
+	buildCenters.resize(size);
+	if (enlargedAabbs) {
+		fatAabbs.resize(size);
+	}
+	for (const OffsetType o : entityOffsets) {
+		if (enlargedAabbs) {
+			fatAabbs[o] = enlargedAabb((*ents)[o].aabb, {0, 0, 0});
+		}
+		buildCenters[o] = (glm::vec3)getLeafAabb(getLeafId(o)).GetCenter();
+	}
+	// internal nodes of n leaves have ids [1, n-1]
+	nodes.resize(entityOffsets.size());
+	rootId = buildRange(entityOffsets, 0, 0, threadsCount);
+	buildCenters.clear();
+	buildCenters.shrink_to_fit();
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+OffsetType btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::buildRange(
+	std::span<OffsetType> entityOffsets, size_t begin, OffsetType parent,
+	int32_t threadsCount)
+{
+	if (entityOffsets.size() == 1) {
+		const OffsetType leaf = getLeafId(entityOffsets[0]);
+		setLeafParent(leaf, parent);
+		return leaf;
+	}
+
+	glm::vec3 min = buildCenters[entityOffsets[0]];
+	glm::vec3 max = min;
+	for (const OffsetType o : entityOffsets) {
+		min = glm::min(min, buildCenters[o]);
+		max = glm::max(max, buildCenters[o]);
+	}
+	const glm::vec3 ext = max - min;
+	int axis = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (ext[axis] < ext[i]) {
+			axis = i;
+		}
+	}
+
+	const size_t mid = entityOffsets.size() / 2;
+	std::nth_element(
+		entityOffsets.begin(), entityOffsets.begin() + mid, entityOffsets.end(),
+		[this, axis](OffsetType l, OffsetType r) {
+			return buildCenters[l][axis] < buildCenters[r][axis];
+		});
+
+	const OffsetType node = begin + mid;
+	NodeData &n = nodes[node];
+	n.parent = parent;
+	if (threadsCount > 1) {
+		std::thread thread([&]() {
+			n.childs[0] = buildRange(entityOffsets.first(mid), begin, node,
+									 threadsCount / 2);
+		});
+		n.childs[1] = buildRange(entityOffsets.subspan(mid), begin + mid, node,
+								 threadsCount - threadsCount / 2);
+		thread.join();
+	} else {
+		n.childs[0] = buildRange(entityOffsets.first(mid), begin, node, 1);
+		n.childs[1] =
+			buildRange(entityOffsets.subspan(mid), begin + mid, node, 1);
+	}
+	n.aabb = getAabb(n.childs[0]) + getAabb(n.childs[1]);
+	return node;
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::setEnlargedAabbs(
+	bool enabled, float margin, float velocityPrediction)
+{
+	fatMargin = margin;
+	fatVelocityPrediction = velocityPrediction;
+	if (enabled == enlargedAabbs) {
+		return;
+	}
+	enlargedAabbs = enabled;
+	if (enabled == false) {
+		fatAabbs.clear();
+		fatAabbs.shrink_to_fit();
+	} else {
+		fatAabbs.resize(ents->_Data()._Data().size());
+		for (size_t i = 0; i < fatAabbs.size(); ++i) {
+			fatAabbs[i] = enlargedAabb((*ents)[i].aabb, {0, 0, 0});
+		}
+	}
+	// leaves changed their aabbs, all internal nodes need to be refitted
+	if (rootId && isLeaf(rootId) == false) {
+		refitMarks.clear();
+		refitMarks.resize(nodes.size(), 1);
+		refitMarked(rootId);
+		refitMarks.assign(refitMarks.size(), 0);
+	}
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+bool btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateEnlargedAabb(
+	OffsetType entityOffset, const glm::vec3 &velocity)
+{
+	const Aabb aabb = (*ents)[entityOffset].aabb;
+	if (Contain(fatAabbs[entityOffset], aabb)) {
+		return false;
+	}
+	fatAabbs[entityOffset] = enlargedAabb(aabb, velocity);
+	return true;
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+Aabb btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::enlargedAabb(
+	const Aabb &aabb, const glm::vec3 &velocity) const
+{
+	spp::Aabb e = ((spp::Aabb)aabb).Expanded(fatMargin);
+	SignedExpand(e, velocity * fatVelocityPrediction);
+	// union protects from rounding of integer aabbs
+	return ((Aabb)e) + aabb;
 }
 
 SPP_TEMPLATE_DECL_OFFSET
@@ -497,8 +824,8 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateLeaf(OffsetType leaf, int lookahead
 }
 
 SPP_TEMPLATE_DECL_OFFSET
-void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateEntityOffset(OffsetType entityOffset,
-														  const Aabb &aabb)
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateEntityOffset(
+	OffsetType entityOffset, [[maybe_unused]] const Aabb &aabb)
 {
 	OffsetType leaf = getLeafId(entityOffset);
 // 	assert(ContainsRecurence(leaf));
@@ -510,11 +837,91 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateEntityOffset(OffsetType entityOffse
 
 	assert(!NotEqual((*ents)[entityOffset].aabb, aabb));
 
-	insertleaf(root, leaf, aabb);
+	insertleaf(root, leaf, getLeafAabb(leaf));
 	assert(!isLeaf(getLeafParent(leaf)));
 	IsTreeValid();
 }
 
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateEntityOffsets(
+	std::span<const OffsetType> entityOffsets)
+{
+	batchMoved.clear();
+	batchInPlace.clear();
+	glm::vec3 min(std::numeric_limits<float>::max());
+	glm::vec3 max(-std::numeric_limits<float>::max());
+	for (const OffsetType entityOffset : entityOffsets) {
+		const OffsetType leaf = getLeafId(entityOffset);
+		const OffsetType parent = getLeafParent(leaf);
+		if (parent == 0) {
+			// leaf is root
+			continue;
+		}
+		const Aabb aabb = getLeafAabb(leaf);
+		if (Contain(nodes[parent].aabb, aabb)) {
+			batchInPlace.push_back(leaf);
+		} else {
+			batchMoved.push_back({0, leaf});
+			const glm::vec3 c = (glm::vec3)aabb.GetCenter();
+			min = glm::min(min, c);
+			max = glm::max(max, c);
+		}
+	}
+
+	for (const auto &it : batchMoved) {
+		removeleaf(it.second);
+	}
+
+	if (batchMoved.size() > 1) {
+		const glm::vec3 scale =
+			1023.0f / glm::max(max - min, glm::vec3(0.0001f));
+		for (auto &it : batchMoved) {
+			const glm::uvec3 q =
+				((glm::vec3)getLeafAabb(it.second).GetCenter() - min) * scale;
+			it.first = (ExpandBits10(q.x) << 2) | (ExpandBits10(q.y) << 1) |
+					   ExpandBits10(q.z);
+		}
+		std::sort(batchMoved.begin(), batchMoved.end());
+	}
+
+	for (const auto &it : batchMoved) {
+		insertleaf(rootId, it.second, getLeafAabb(it.second));
+	}
+
+	if (batchInPlace.empty()) {
+		return;
+	}
+	refitMarks.resize(nodes.size(), 0);
+	for (const OffsetType leaf : batchInPlace) {
+		for (OffsetType n = getLeafParent(leaf); n && refitMarks[n] == 0;
+			 n = getNodeParent(n)) {
+			refitMarks[n] = 1;
+		}
+	}
+	if (isInternal(rootId) && refitMarks[rootId]) {
+		refitMarked(rootId);
+	}
+	IsTreeValid();
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+Aabb btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::refitMarked(const OffsetType node)
+{
+	refitMarks[node] = 0;
+	Aabb aabb[2];
+	for (int i = 0; i < 2; ++i) {
+		const OffsetType c = nodes[node].childs[i];
+		if (isLeaf(c)) {
+			aabb[i] = getLeafAabb(c);
+		} else if (refitMarks[c]) {
+			aabb[i] = refitMarked(c);
+		} else {
+			aabb[i] = getNodeAabb(c);
+		}
+	}
+	return nodes[node].aabb = aabb[0] + aabb[1];
+}
+
 SPP_TEMPLATE_DECL_OFFSET
 void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::remove(OffsetType entityOffset)
 {
@@ -539,20 +946,29 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::updateOffsetOfEntity(
 		int i = indexof(oldLeaf);
 		nodes[parent].childs[i] = newLeaf;
 	}
+	if (enlargedAabbs) {
+		if (fatAabbs.size() <= newEntityOffset) {
+			fatAabbs.resize((size_t)newEntityOffset + 1);
+		}
+		fatAabbs[newEntityOffset] = fatAabbs[oldEntityOffset];
+	}
 }
 
 SPP_TEMPLATE_DECL_OFFSET
 void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::collideTV(AabbCallback &cb)
 {
 	if (rootId) {
-		stack.clear();
+		// Per thread, so that queries can run concurrently. Query started
+		// from callback uses part of stack above base.
+		thread_local std::vector<OffsetType> stack;
+		const size_t base = stack.size();
 		stack.push_back(rootId);
 		do {
 			OffsetType node = stack.back();
 			stack.pop_back();
 			if (isLeaf(node)) {
 				if (getLeafMask(node) & cb.mask) {
-					cb.ExecuteIfRelevant(getLeafAabb(node),
+					cb.ExecuteIfRelevant(getLeafEntityAabb(node),
 										 getLeafEntity(node));
 				}
 			} else {
@@ -564,7 +980,7 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::collideTV(AabbCallback &cb)
 					stack.push_back(nodes[node].childs[1]);
 				}
 			}
-		} while (!stack.empty());
+		} while (stack.size() > base);
 	}
 }
 
@@ -572,14 +988,17 @@ SPP_TEMPLATE_DECL_OFFSET
 void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::rayTestInternal(RayCallback &cb)
 {
 	if (rootId) {
-		stack.clear();
+		// Per thread, so that queries can run concurrently. Query started
+		// from callback uses part of stack above base.
+		thread_local std::vector<OffsetType> stack;
+		const size_t base = stack.size();
 		stack.push_back(rootId);
 		do {
 			OffsetType node = stack.back();
 			stack.pop_back();
 			if (isLeaf(node)) {
 				if (getLeafMask(node) & cb.mask) {
-					cb.ExecuteIfRelevant(getLeafAabb(node),
+					cb.ExecuteIfRelevant(getLeafEntityAabb(node),
 										 getLeafEntity(node));
 				}
 			} else {
@@ -591,15 +1010,42 @@ void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::rayTestInternal(RayCallback &cb)
 					stack.push_back(nodes[node].childs[1]);
 				}
 			}
-		} while (!stack.empty());
+		} while (stack.size() > base);
 	}
 }
 
 SPP_TEMPLATE_DECL_OFFSET
 size_t btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::GetMemoryUsage() const
 {
-	return stack.capacity() * sizeof(OffsetType) +
-		   nodes.capacity() * sizeof(NodeData);
+	return nodes.capacity() * sizeof(NodeData) +
+		   (sahQueue.capacity() + sahCandidates.capacity()) * sizeof(SahEntry) +
+		   fatAabbs.capacity() * sizeof(Aabb);
+}
+
+SPP_TEMPLATE_DECL_OFFSET
+void btDbvt<SPP_TEMPLATE_ARGS_OFFSET>::getStatistics(
+	BroadphaseStatistics &stats) const
+{
+	if (rootId == 0) {
+		return;
+	}
+	stats.rootSurface = getAabb(rootId).GetSurface();
+	std::vector<std::pair<OffsetType, int32_t>> stk;
+	stk.push_back({rootId, 0});
+	while (stk.empty() == false) {
+		const auto [node, depth] = stk.back();
+		stk.pop_back();
+		if (isLeaf(node)) {
+			stats.AddLeaf(depth, getLeafAabb(node).GetSurface(),
+						  getLeafEntityAabb(node).GetSurface(), 1);
+			continue;
+		}
+		const NodeData &n = nodes[node];
+		stats.AddNode(depth, n.aabb.GetSurface());
+		stats.AddSiblings(getAabb(n.childs[0]), getAabb(n.childs[1]));
+		stk.push_back({n.childs[0], depth + 1});
+		stk.push_back({n.childs[1], depth + 1});
+	}
 }
 
 SPP_TEMPLATE_DECL_OFFSET
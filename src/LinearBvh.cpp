@@ -0,0 +1,684 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#include <cstdio>
+#include <cstring>
+
+#include <bit>
+#include <atomic>
+#include <thread>
+#include <barrier>
+#include <algorithm>
+
+#include "../glm/glm/common.hpp"
+
+#include "../include/spatial_partitioning/LinearBvh.hpp"
+#include "../include/spatial_partitioning/Morton.hpp"
+
+namespace spp
+{
+// Length of common prefix of keys[i] and keys[j], duplicated keys are
+// distinguished by their indices
+static inline int32_t LbvhDelta(const uint64_t *keys, int32_t n, int32_t i,
+								int32_t j)
+{
+	if (j < 0 || j >= n) {
+		return -1;
+	}
+	const uint64_t a = keys[i];
+	const uint64_t b = keys[j];
+	if (a == b) {
+		return 64 + std::countl_zero((uint32_t)(i ^ j));
+	}
+	return std::countl_zero(a ^ b);
+}
+
+SPP_TEMPLATE_DECL
+struct LinearBvh<SPP_TEMPLATE_ARGS>::BuildSharedData {
+	inline const static int32_t RADIX_BITS = 11;
+	inline const static int32_t RADIX_SIZE = 1 << RADIX_BITS;
+
+	BuildSharedData(int32_t threadsCount)
+		: barrier(threadsCount), boundsMin(threadsCount),
+		  boundsMax(threadsCount), histograms(threadsCount * RADIX_SIZE),
+		  threadsCount(threadsCount)
+	{
+	}
+
+	std::barrier<> barrier;
+	std::vector<glm::vec3> boundsMin;
+	std::vector<glm::vec3> boundsMax;
+	std::vector<uint32_t> histograms;
+	int32_t threadsCount = 1;
+	int32_t axisBits = 10;
+	int32_t passes = 3;
+};
+
+SPP_TEMPLATE_DECL
+LinearBvh<SPP_TEMPLATE_ARGS>::LinearBvh(EntityType denseEntityRange)
+	: entitiesOffsets(denseEntityRange), iterator(*this)
+{
+}
+
+SPP_TEMPLATE_DECL
+LinearBvh<SPP_TEMPLATE_ARGS>::~LinearBvh() {}
+
+SPP_TEMPLATE_DECL
+const char *LinearBvh<SPP_TEMPLATE_ARGS>::GetName() const
+{
+	return "LinearBvh";
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::Clear()
+{
+	entitiesOffsets.Clear();
+	entitiesData.clear();
+	nodes.clear();
+	leafParents.clear();
+	leavesCount = 0;
+	entitiesCount = 0;
+	rebuildTree = false;
+}
+
+SPP_TEMPLATE_DECL
+size_t LinearBvh<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
+{
+	return entitiesOffsets.GetMemoryUsage() +
+		   entitiesData.capacity() * sizeof(Data) +
+		   nodes.capacity() * sizeof(NodeData) +
+		   leafParents.capacity() * sizeof(uint32_t) +
+		   mortonCodes.capacity() * sizeof(uint64_t) +
+		   sortedIndices.capacity() * sizeof(int32_t) +
+		   tmpEntitiesData.capacity() * sizeof(Data) +
+		   visits.capacity() * sizeof(uint32_t);
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::ShrinkToFit()
+{
+	entitiesData.shrink_to_fit();
+	nodes.shrink_to_fit();
+	leafParents.shrink_to_fit();
+	mortonCodes.clear();
+	mortonCodes.shrink_to_fit();
+	sortedIndices.clear();
+	sortedIndices.shrink_to_fit();
+	tmpEntitiesData.clear();
+	tmpEntitiesData.shrink_to_fit();
+	visits.clear();
+	visits.shrink_to_fit();
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
+									   MaskType mask)
+{
+	if (entitiesOffsets.find(entity) != nullptr) {
+		assert(!"Entity already exists");
+		return;
+	}
+	entitiesOffsets.Set(entity, entitiesData.size());
+	entitiesData.push_back({aabb, entity, mask});
+	++entitiesCount;
+	if (((int32_t)entitiesData.size()) - leavesCount >
+		maxNumberOfBruteforceEntities) {
+		rebuildTree = true;
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
+{
+	const int32_t offset = entitiesOffsets[entity];
+	assert(offset >= 0);
+	entitiesData[offset].aabb = aabb;
+	if (offset < leavesCount && rebuildTree == false) {
+		ExtendUpwards(offset, aabb);
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
+{
+	auto it = entitiesOffsets.find(entity);
+	if (it == nullptr) {
+		return;
+	}
+	const int32_t offset = *it;
+	entitiesOffsets.Remove(entity);
+	--entitiesCount;
+
+	if (entitiesCount == 0) {
+		entitiesData.clear();
+		nodes.clear();
+		leafParents.clear();
+		leavesCount = 0;
+		rebuildTree = false;
+		return;
+	}
+
+	if (offset >= leavesCount) {
+		if (offset + 1 < entitiesData.size()) {
+			entitiesData[offset] = entitiesData.back();
+			entitiesOffsets.Set(entitiesData[offset].entity, offset);
+		}
+		entitiesData.pop_back();
+		return;
+	}
+
+	entitiesData[offset].entity = EMPTY_ENTITY;
+	entitiesData[offset].mask = 0;
+	UpdateMasksUpwards(offset);
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity, MaskType mask)
+{
+	auto it = entitiesOffsets.find(entity);
+	if (it == nullptr) {
+		return;
+	}
+	const int32_t offset = *it;
+	if (entitiesData[offset].mask == mask) {
+		return;
+	}
+	entitiesData[offset].mask = mask;
+	if (offset < leavesCount) {
+		UpdateMasksUpwards(offset);
+	}
+}
+
+SPP_TEMPLATE_DECL
+int32_t LinearBvh<SPP_TEMPLATE_ARGS>::GetCount() const
+{
+	return entitiesCount;
+}
+
+SPP_TEMPLATE_DECL
+bool LinearBvh<SPP_TEMPLATE_ARGS>::Exists(EntityType entity) const
+{
+	return entitiesOffsets.Has(entity);
+}
+
+SPP_TEMPLATE_DECL
+Aabb LinearBvh<SPP_TEMPLATE_ARGS>::GetAabb(EntityType entity) const
+{
+	auto it = entitiesOffsets.find(entity);
+	if (it != nullptr) {
+		return entitiesData[*it].aabb;
+	}
+	return {};
+}
+
+SPP_TEMPLATE_DECL
+MaskType LinearBvh<SPP_TEMPLATE_ARGS>::GetMask(EntityType entity) const
+{
+	auto it = entitiesOffsets.find(entity);
+	if (it != nullptr) {
+		return entitiesData[*it].mask;
+	}
+	return 0;
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
+{
+	if (cb.callback == nullptr) {
+		return;
+	}
+
+	if (rebuildTree) {
+		Rebuild();
+	}
+
+	cb.broadphase = this;
+
+	if (leavesCount == 1) {
+		auto &ed = entitiesData[0];
+		if ((ed.mask & cb.mask) && ed.entity != EMPTY_ENTITY) {
+			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+		}
+	} else if (leavesCount > 1 && (nodes[0].mask & cb.mask)) {
+		// Tree depth is limited by 64 bits of key and 32 bits of index
+		uint32_t stack[128];
+		int32_t size = 0;
+		++cb.nodesTestedCount;
+		if (cb.IsRelevant(nodes[0].aabb)) {
+			stack[size++] = 0;
+		}
+		while (size > 0) {
+			const NodeData &node = nodes[stack[--size]];
+			for (int i = 0; i < 2; ++i) {
+				const uint32_t c = node.children[i];
+				if (c & LEAF_BIT) {
+					auto &ed = entitiesData[c & ~LEAF_BIT];
+					if ((ed.mask & cb.mask) && ed.entity != EMPTY_ENTITY) {
+						cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+					}
+				} else if (nodes[c].mask & cb.mask) {
+					++cb.nodesTestedCount;
+					if (cb.IsRelevant(nodes[c].aabb)) {
+						stack[size++] = c;
+					}
+				}
+			}
+		}
+	}
+
+	for (int32_t i = leavesCount; i < entitiesData.size(); ++i) {
+		auto &ed = entitiesData[i];
+		if (ed.mask & cb.mask) {
+			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
+{
+	if (cb.callback == nullptr) {
+		return;
+	}
+
+	if (rebuildTree) {
+		Rebuild();
+	}
+
+	cb.broadphase = this;
+	cb.InitVariables();
+
+	if (leavesCount == 1) {
+		auto &ed = entitiesData[0];
+		if ((ed.mask & cb.mask) && ed.entity != EMPTY_ENTITY) {
+			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+		}
+	} else if (leavesCount > 1 && (nodes[0].mask & cb.mask)) {
+		struct StackEntry {
+			uint32_t node;
+			float near;
+		} stack[128];
+		int32_t size = 0;
+		float __n[2], __f[2];
+		++cb.nodesTestedCount;
+		if (cb.IsRelevant(nodes[0].aabb, __n[0], __f[0])) {
+			stack[size++] = {0, __n[0]};
+		}
+		while (size > 0) {
+			const StackEntry e = stack[--size];
+			if (e.near > cb.cutFactor) {
+				continue;
+			}
+			const NodeData &node = nodes[e.node];
+			int __has = 0;
+			for (int i = 0; i < 2; ++i) {
+				const uint32_t c = node.children[i];
+				if (c & LEAF_BIT) {
+					auto &ed = entitiesData[c & ~LEAF_BIT];
+					if ((ed.mask & cb.mask) && ed.entity != EMPTY_ENTITY) {
+						cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+					}
+				} else if (nodes[c].mask & cb.mask) {
+					++cb.nodesTestedCount;
+					if (cb.IsRelevant(nodes[c].aabb, __n[i], __f[i])) {
+						__has += i + 1;
+					}
+				}
+			}
+			switch (__has) {
+			case 0:
+				break;
+			case 1:
+				stack[size++] = {node.children[0], __n[0]};
+				break;
+			case 2:
+				stack[size++] = {node.children[1], __n[1]};
+				break;
+			case 3:
+				if (__n[1] < __n[0]) {
+					stack[size++] = {node.children[0], __n[0]};
+					stack[size++] = {node.children[1], __n[1]};
+				} else {
+					stack[size++] = {node.children[1], __n[1]};
+					stack[size++] = {node.children[0], __n[0]};
+				}
+				break;
+			}
+		}
+	}
+
+	for (int32_t i = leavesCount; i < entitiesData.size(); ++i) {
+		auto &ed = entitiesData[i];
+		if (ed.mask & cb.mask) {
+			cb.ExecuteIfRelevant(ed.aabb, ed.entity);
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::SetThreadsCount(int32_t threadsCount)
+{
+	this->threadsCount = threadsCount;
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::Rebuild()
+{
+	rebuildTree = false;
+
+	std::erase_if(entitiesData, [](const Data &d) {
+		return d.entity == EMPTY_ENTITY;
+	});
+
+	const int32_t n = entitiesData.size();
+	leavesCount = n;
+	if (n == 0) {
+		nodes.clear();
+		leafParents.clear();
+		return;
+	}
+
+	nodes.resize(n - 1);
+	leafParents.resize(n);
+	mortonCodes.resize(n * 2);
+	sortedIndices.resize(n * 2);
+	tmpEntitiesData.resize(n);
+	visits.resize(n - 1);
+
+	if (n > 1) {
+		nodes[0].parent = NONE;
+	}
+	leafParents[0] = NONE;
+
+	const int32_t MIN_ENTITIES_PER_THREAD = 4096;
+	int32_t threads = threadsCount > 0
+						  ? threadsCount
+						  : (int32_t)std::thread::hardware_concurrency();
+	threads = std::clamp(threads, 1,
+						 std::max<int32_t>(n / MIN_ENTITIES_PER_THREAD, 1));
+
+	BuildSharedData shared(threads);
+	if (n <= (1 << 18)) {
+		shared.axisBits = 10;
+		shared.passes = 3;
+	} else {
+		shared.axisBits = 21;
+		shared.passes = 6;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (int32_t t = 1; t < threads; ++t) {
+		workers.emplace_back(
+			[this, t, &shared]() { BuildThread(t, shared); });
+	}
+	BuildThread(0, shared);
+	for (auto &w : workers) {
+		w.join();
+	}
+
+	std::swap(entitiesData, tmpEntitiesData);
+	entitiesOffsets.Reserve(n);
+	for (int32_t i = 0; i < n; ++i) {
+		entitiesOffsets.Set(entitiesData[i].entity, i);
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::BuildThread(int32_t threadId,
+											   BuildSharedData &shared)
+{
+	const int32_t RADIX_BITS = BuildSharedData::RADIX_BITS;
+	const int32_t RADIX_SIZE = BuildSharedData::RADIX_SIZE;
+	const int32_t T = shared.threadsCount;
+	const int32_t n = leavesCount;
+	const int32_t beg = (int64_t)n * threadId / T;
+	const int32_t end = (int64_t)n * (threadId + 1) / T;
+	const int32_t nodesBeg = (int64_t)(n - 1) * threadId / T;
+	const int32_t nodesEnd = (int64_t)(n - 1) * (threadId + 1) / T;
+
+	{ // centers bounds
+		glm::vec3 min = glm::vec3(entitiesData[beg].aabb.GetCenter());
+		glm::vec3 max = min;
+		for (int32_t i = beg + 1; i < end; ++i) {
+			const glm::vec3 c = glm::vec3(entitiesData[i].aabb.GetCenter());
+			min = glm::min(min, c);
+			max = glm::max(max, c);
+		}
+		shared.boundsMin[threadId] = min;
+		shared.boundsMax[threadId] = max;
+		for (int32_t i = nodesBeg; i < nodesEnd; ++i) {
+			visits[i] = 0;
+		}
+	}
+	shared.barrier.arrive_and_wait();
+
+	{ // morton codes
+		glm::vec3 min = shared.boundsMin[0];
+		glm::vec3 max = shared.boundsMax[0];
+		for (int32_t t = 1; t < T; ++t) {
+			min = glm::min(min, shared.boundsMin[t]);
+			max = glm::max(max, shared.boundsMax[t]);
+		}
+		const float maxCoord = (float)((1u << shared.axisBits) - 1);
+		const glm::vec3 ext = max - min;
+		glm::vec3 scale;
+		for (int i = 0; i < 3; ++i) {
+			scale[i] = ext[i] > 0.0f ? maxCoord / ext[i] : 0.0f;
+		}
+		for (int32_t i = beg; i < end; ++i) {
+			const glm::vec3 c = glm::vec3(entitiesData[i].aabb.GetCenter());
+			const glm::vec3 q =
+				glm::min((c - min) * scale, glm::vec3(maxCoord));
+			mortonCodes[i] = (SpreadBits3((uint64_t)q.x) << 2) |
+							 (SpreadBits3((uint64_t)q.y) << 1) |
+							 SpreadBits3((uint64_t)q.z);
+			sortedIndices[i] = i;
+		}
+	}
+	shared.barrier.arrive_and_wait();
+
+	// parallel LSD radix sort
+	uint64_t *keys = mortonCodes.data();
+	uint64_t *keysTmp = keys + n;
+	int32_t *ids = sortedIndices.data();
+	int32_t *idsTmp = ids + n;
+	uint32_t offsets[RADIX_SIZE];
+	for (int32_t pass = 0; pass < shared.passes; ++pass) {
+		const int32_t shift = pass * RADIX_BITS;
+		uint32_t *hist = shared.histograms.data() + threadId * RADIX_SIZE;
+		memset(hist, 0, RADIX_SIZE * sizeof(uint32_t));
+		for (int32_t i = beg; i < end; ++i) {
+			hist[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+		}
+		shared.barrier.arrive_and_wait();
+
+		uint32_t sum = 0;
+		for (int32_t d = 0; d < RADIX_SIZE; ++d) {
+			for (int32_t t = 0; t < T; ++t) {
+				if (t == threadId) {
+					offsets[d] = sum;
+				}
+				sum += shared.histograms[t * RADIX_SIZE + d];
+			}
+		}
+		for (int32_t i = beg; i < end; ++i) {
+			const uint32_t pos =
+				offsets[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+			keysTmp[pos] = keys[i];
+			idsTmp[pos] = ids[i];
+		}
+		shared.barrier.arrive_and_wait();
+
+		std::swap(keys, keysTmp);
+		std::swap(ids, idsTmp);
+	}
+
+	// gather entities in sorted order
+	for (int32_t i = beg; i < end; ++i) {
+		tmpEntitiesData[i] = entitiesData[ids[i]];
+	}
+
+	// Karras split
+	for (int32_t i = nodesBeg; i < nodesEnd; ++i) {
+		const int32_t d =
+			LbvhDelta(keys, n, i, i + 1) - LbvhDelta(keys, n, i, i - 1) > 0
+				? 1
+				: -1;
+		const int32_t dmin = LbvhDelta(keys, n, i, i - d);
+		int32_t lmax = 2;
+		while (LbvhDelta(keys, n, i, i + lmax * d) > dmin) {
+			lmax <<= 1;
+		}
+		int32_t l = 0;
+		for (int32_t t = lmax >> 1; t >= 1; t >>= 1) {
+			if (LbvhDelta(keys, n, i, i + (l + t) * d) > dmin) {
+				l += t;
+			}
+		}
+		const int32_t j = i + l * d;
+		const int32_t dnode = LbvhDelta(keys, n, i, j);
+		int32_t s = 0;
+		for (int32_t div = 2;; div <<= 1) {
+			const int32_t t = (l + div - 1) / div;
+			if (LbvhDelta(keys, n, i, i + (s + t) * d) > dnode) {
+				s += t;
+			}
+			if (t <= 1) {
+				break;
+			}
+		}
+		const int32_t gamma = i + s * d + std::min(d, 0);
+
+		NodeData &node = nodes[i];
+		if (std::min(i, j) == gamma) {
+			node.children[0] = gamma | LEAF_BIT;
+			leafParents[gamma] = i;
+		} else {
+			node.children[0] = gamma;
+			nodes[gamma].parent = i;
+		}
+		if (std::max(i, j) == gamma + 1) {
+			node.children[1] = (gamma + 1) | LEAF_BIT;
+			leafParents[gamma + 1] = i;
+		} else {
+			node.children[1] = gamma + 1;
+			nodes[gamma + 1].parent = i;
+		}
+	}
+	shared.barrier.arrive_and_wait();
+
+	// bottom-up refit, second visitor of a node computes its aabb
+	for (int32_t i = beg; i < end; ++i) {
+		uint32_t p = leafParents[i];
+		while (p != NONE) {
+			if (std::atomic_ref<uint32_t>(visits[p]).fetch_add(
+					1, std::memory_order_acq_rel) == 0) {
+				break;
+			}
+			NodeData &node = nodes[p];
+			Aabb aabb[2];
+			MaskType mask = 0;
+			for (int k = 0; k < 2; ++k) {
+				const uint32_t c = node.children[k];
+				if (c & LEAF_BIT) {
+					const Data &ed = tmpEntitiesData[c & ~LEAF_BIT];
+					aabb[k] = ed.aabb.Expanded(BIG_EPSILON);
+					mask |= ed.mask;
+				} else {
+					aabb[k] = nodes[c].aabb;
+					mask |= nodes[c].mask;
+				}
+			}
+			node.aabb = aabb[0] + aabb[1];
+			node.mask = mask;
+			p = node.parent;
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::UpdateMasksUpwards(int32_t leaf)
+{
+	for (uint32_t p = leafParents[leaf]; p != NONE; p = nodes[p].parent) {
+		NodeData &node = nodes[p];
+		MaskType mask = 0;
+		for (int k = 0; k < 2; ++k) {
+			const uint32_t c = node.children[k];
+			if (c & LEAF_BIT) {
+				mask |= entitiesData[c & ~LEAF_BIT].mask;
+			} else {
+				mask |= nodes[c].mask;
+			}
+		}
+		if (node.mask == mask) {
+			break;
+		}
+		node.mask = mask;
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearBvh<SPP_TEMPLATE_ARGS>::ExtendUpwards(int32_t leaf, Aabb aabb)
+{
+	aabb = aabb.Expanded(BIG_EPSILON);
+	for (uint32_t p = leafParents[leaf]; p != NONE; p = nodes[p].parent) {
+		NodeData &node = nodes[p];
+		if (node.aabb.ContainsAll(aabb)) {
+			break;
+		}
+		node.aabb = node.aabb + aabb;
+	}
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseBaseIterator<SPP_TEMPLATE_ARGS> *
+LinearBvh<SPP_TEMPLATE_ARGS>::RestartIterator()
+{
+	iterator = {*this};
+	return &iterator;
+}
+
+SPP_TEMPLATE_DECL
+LinearBvh<SPP_TEMPLATE_ARGS>::Iterator::Iterator(LinearBvh &bp)
+{
+	data = &bp.entitiesData;
+	it = -1;
+	Next();
+}
+
+SPP_TEMPLATE_DECL
+LinearBvh<SPP_TEMPLATE_ARGS>::Iterator::~Iterator() {}
+
+SPP_TEMPLATE_DECL
+bool LinearBvh<SPP_TEMPLATE_ARGS>::Iterator::Next()
+{
+	do {
+		++it;
+	} while (Valid() && (*data)[it].entity == EMPTY_ENTITY);
+
+	return FetchData();
+}
+
+SPP_TEMPLATE_DECL
+bool LinearBvh<SPP_TEMPLATE_ARGS>::Iterator::FetchData()
+{
+	if (Valid()) {
+		this->entity = (*data)[it].entity;
+		this->aabb = (*data)[it].aabb;
+		this->mask = (*data)[it].mask;
+		return true;
+	}
+	return false;
+}
+
+SPP_TEMPLATE_DECL
+bool LinearBvh<SPP_TEMPLATE_ARGS>::Iterator::Valid()
+{
+	return it < data->size();
+}
+
+SPP_DEFINE_VARIANTS(LinearBvh)
+
+} // namespace spp
@@ -0,0 +1,556 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#include "../glm/glm/ext/vector_int3.hpp"
+#include "../glm/glm/common.hpp"
+#include "../glm/glm/vector_relational.hpp"
+
+#include "../include/spatial_partitioning/LinearLooseOctree.hpp"
+#include "../include/spatial_partitioning/Morton.hpp"
+
+namespace spp
+{
+namespace experimental
+{
+SPP_TEMPLATE_DECL
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::LinearLooseOctree(float resolution,
+														int32_t levels,
+														float loosenessFactor)
+	: loosenessFactor(loosenessFactor),
+	  invLoosenessFactor(1.0f / loosenessFactor), resolution(resolution),
+	  invResolution(1.0f / resolution), levels(levels), iterator(*this)
+{
+	assert(levels <= 20);
+	Clear();
+}
+
+SPP_TEMPLATE_DECL
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::~LinearLooseOctree() {}
+
+SPP_TEMPLATE_DECL
+const char *LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetName() const
+{
+	return "LinearLooseOctree";
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::Clear()
+{
+	data.Clear();
+	entities.clear();
+	nodes.clear();
+	pending.clear();
+	bigEntitiesCount = 0;
+	deadEntitiesCount = 0;
+}
+
+SPP_TEMPLATE_DECL
+size_t LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
+{
+	return data.GetMemoryUsage() + entities.capacity() * sizeof(Entity) +
+		   nodes.capacity() * sizeof(NodeData) +
+		   pending.capacity() * sizeof(int32_t);
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::ShrinkToFit()
+{
+	data.ShrinkToFit();
+	entities.shrink_to_fit();
+	nodes.shrink_to_fit();
+	pending.shrink_to_fit();
+}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::CalcNodeKey(Aabb aabb,
+													   NodeKey &key) const
+{
+	aabb.min *= invResolution;
+	aabb.max *= invResolution;
+	const glm::vec3 sizes = aabb.GetSizes();
+	const float _size = glm::max(sizes.x, glm::max(sizes.y, sizes.z));
+	const int32_t size = _size * invLoosenessFactor;
+	const int32_t level = std::bit_width<uint32_t>(size);
+	if (level > levels) {
+		return false;
+	}
+
+	const glm::vec3 center = glm::floor(aabb.GetCenter());
+	if (glm::any(glm::greaterThanEqual(glm::abs(center),
+									   glm::vec3(1 << 20)))) {
+		return false;
+	}
+
+	// minimal corner of node, biased to be non negative
+	const glm::uvec3 u =
+		((glm::ivec3(center) >> level) << level) + (1 << 20);
+	key.code = SpreadBits3(u.x) | (SpreadBits3(u.y) << 1) |
+			   (SpreadBits3(u.z) << 2);
+	key.level = level;
+	return true;
+}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::IsSameNode(Aabb a, Aabb b) const
+{
+	NodeKey ka, kb;
+	const bool fa = CalcNodeKey(a, ka);
+	const bool fb = CalcNodeKey(b, kb);
+	return fa == fb && (fa == false || ka == kb);
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
+											   MaskType mask)
+{
+	const int32_t offset = data.Add(entity, {aabb, entity, mask});
+
+	if (offset <= 0) {
+		Data &d = data[data.GetOffset(entity)];
+		if (d.mask != mask) {
+			SetMask(entity, mask);
+		}
+		if ((Aabb)d.aabb != aabb) {
+			Update(entity, aabb);
+		}
+		return;
+	}
+
+	AddToPending(offset);
+	RebuildIfNeeded();
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
+{
+	const int32_t offset = data.GetOffset(entity);
+	Data &d = data[offset];
+	if (d.slot >= 0) {
+		if (IsSameNode(d.aabb, aabb)) {
+			d.aabb = aabb;
+			entities[d.slot].aabb = aabb;
+			return;
+		}
+		DetachFromNode(offset);
+	}
+	data[offset].aabb = aabb;
+	RebuildIfNeeded();
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
+{
+	const int32_t offset = data.GetOffset(entity);
+	Data &d = data[offset];
+	if (d.slot >= 0) {
+		entities[d.slot].entity = EMPTY_ENTITY;
+		entities[d.slot].mask = 0;
+		++deadEntitiesCount;
+	} else {
+		RemoveFromPending(offset);
+	}
+	data.RemoveByKey(entity);
+	RebuildIfNeeded();
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity,
+												   MaskType mask)
+{
+	const int32_t offset = data.GetOffset(entity);
+	Data &d = data[offset];
+	const MaskType oldMask = d.mask;
+	d.mask = mask;
+	if (d.slot < 0) {
+		return;
+	}
+	// masks of nodes cover only old mask and there are no links to parents
+	if (d.slot < bigEntitiesCount || (mask & ~oldMask) == 0) {
+		entities[d.slot].mask = mask;
+	} else {
+		DetachFromNode(offset);
+		RebuildIfNeeded();
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::AddToPending(int32_t offset)
+{
+	Data &d = data[offset];
+	d.slot = -1;
+	d.pendingId = pending.size();
+	pending.push_back(offset);
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::RemoveFromPending(int32_t offset)
+{
+	const int32_t id = data[offset].pendingId;
+	const int32_t last = pending.back();
+	pending[id] = last;
+	data[last].pendingId = id;
+	pending.pop_back();
+	data[offset].pendingId = -1;
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::DetachFromNode(int32_t offset)
+{
+	Data &d = data[offset];
+	entities[d.slot].entity = EMPTY_ENTITY;
+	entities[d.slot].mask = 0;
+	++deadEntitiesCount;
+	AddToPending(offset);
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::RebuildIfNeeded()
+{
+	// pending entities are tested by every query, regroup before they
+	// dominate query time
+	const size_t changed = pending.size() + deadEntitiesCount;
+	if (changed > std::max<size_t>(256, data.Size() / 8)) {
+		Rebuild();
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::Rebuild()
+{
+	auto &vec = data._Data()._Data();
+
+	std::vector<std::pair<NodeKey, int32_t>> items;
+	items.reserve(data.Size());
+	entities.clear();
+	nodes.clear();
+	pending.clear();
+	deadEntitiesCount = 0;
+
+	for (int32_t offset = 1; offset < (int32_t)vec.size(); ++offset) {
+		Data &d = vec[offset];
+		if (d.entity == EMPTY_ENTITY) {
+			continue;
+		}
+		d.pendingId = -1;
+		NodeKey key;
+		if (CalcNodeKey(d.aabb, key)) {
+			items.push_back({key, offset});
+		} else {
+			d.slot = entities.size();
+			entities.push_back({d.aabb, d.entity, d.mask});
+		}
+	}
+	bigEntitiesCount = entities.size();
+
+	std::sort(items.begin(), items.end(),
+			  [](const auto &a, const auto &b) { return a.first < b.first; });
+
+	// Nodes are emitted in preorder, stack holds ancestors of current node.
+	// Missing ancestors are created, so that subtrees can be skipped.
+	struct StackEntry {
+		int32_t id;
+		uint64_t code;
+	};
+	std::vector<StackEntry> stack;
+	const auto CloseNode = [&]() {
+		const int32_t id = stack.back().id;
+		stack.pop_back();
+		nodes[id].skip = nodes.size();
+		if (stack.empty() == false) {
+			nodes[stack.back().id].mask |= nodes[id].mask;
+		}
+	};
+	const auto OpenNode = [&](uint64_t code, int32_t level) {
+		const glm::ivec3 p = {CompactBits3(code), CompactBits3(code >> 1),
+							  CompactBits3(code >> 2)};
+		NodeData node;
+		node.pos = p - (1 << 20);
+		node.level = level;
+		node.firstEntity = entities.size();
+		node.entitiesCount = 0;
+		node.skip = -1;
+		node.mask = 0;
+		stack.push_back({(int32_t)nodes.size(), code});
+		nodes.push_back(node);
+	};
+
+	for (size_t i = 0; i < items.size();) {
+		const NodeKey key = items[i].first;
+
+		// close nodes which are not ancestors of current key
+		while (stack.empty() == false) {
+			const int32_t shift = 3 * nodes[stack.back().id].level;
+			if ((stack.back().code >> shift) == (key.code >> shift)) {
+				break;
+			}
+			CloseNode();
+		}
+
+		const int32_t fromLevel =
+			stack.empty() ? levels : nodes[stack.back().id].level - 1;
+		for (int32_t level = fromLevel; level > key.level; --level) {
+			const int32_t shift = 3 * level;
+			OpenNode(key.code >> shift << shift, level);
+		}
+		OpenNode(key.code, key.level);
+
+		NodeData &node = nodes.back();
+		for (; i < items.size() && items[i].first == key; ++i) {
+			Data &d = vec[items[i].second];
+			d.slot = entities.size();
+			entities.push_back({d.aabb, d.entity, d.mask});
+			node.mask |= d.mask;
+		}
+		node.entitiesCount = entities.size() - node.firstEntity;
+	}
+
+	while (stack.empty() == false) {
+		CloseNode();
+	}
+}
+
+SPP_TEMPLATE_DECL
+int32_t LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetCount() const
+{
+	return data.Size();
+}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::Exists(EntityType entity) const
+{
+	return data.GetOffset(entity) > 0;
+}
+
+SPP_TEMPLATE_DECL
+Aabb LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetAabb(EntityType entity) const
+{
+	int32_t offset = data.GetOffset(entity);
+	if (offset > 0) {
+		return data[offset].aabb;
+	}
+	return {};
+}
+
+SPP_TEMPLATE_DECL
+MaskType LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetMask(EntityType entity) const
+{
+	int32_t offset = data.GetOffset(entity);
+	if (offset > 0) {
+		return data[offset].mask;
+	}
+	return 0;
+}
+
+SPP_TEMPLATE_DECL
+spp::Aabb
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::CalcLocalLooseAabbOfNode(int32_t nodeId) const
+{
+	const NodeData &node = nodes[nodeId];
+	const float size = std::ldexp(1.0f, node.level);
+	const float overlap = loosenessFactor * size * 0.5f;
+	return {(glm::vec3)node.pos - overlap,
+			(glm::vec3)node.pos + size + overlap};
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
+{
+	if (cb.callback == nullptr) {
+		return;
+	}
+	cb.broadphase = this;
+
+	const auto Test = [&](const auto &e) {
+		if (e.mask & cb.mask) {
+			++cb.nodesTestedCount;
+			if (cb.IsRelevant(e.aabb)) {
+				++cb.testedCount;
+				cb.callback(&cb, e.entity);
+			}
+		}
+	};
+
+	for (int32_t i = 0; i < bigEntitiesCount; ++i) {
+		Test(entities[i]);
+	}
+	for (const int32_t offset : pending) {
+		Test(data[offset]);
+	}
+
+	spp::Aabb cbaabb = cb.aabb;
+	cbaabb.min *= invResolution;
+	cbaabb.max *= invResolution;
+
+	// stackless preorder traversal, subtrees are skipped as whole
+	for (int32_t i = 0; i < (int32_t)nodes.size();) {
+		const NodeData &node = nodes[i];
+		++cb.nodesTestedCount;
+		if ((node.mask & cb.mask) == 0 ||
+			!(CalcLocalLooseAabbOfNode(i) && cbaabb)) {
+			i = node.skip;
+			continue;
+		}
+		const int32_t end = node.firstEntity + node.entitiesCount;
+		for (int32_t e = node.firstEntity; e < end; ++e) {
+			Test(entities[e]);
+		}
+		++i;
+	}
+}
+
+SPP_TEMPLATE_DECL
+void LinearLooseOctree<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
+{
+	if (cb.callback == nullptr) {
+		return;
+	}
+	cb.broadphase = this;
+	cb.InitVariables();
+
+	for (int32_t i = 0; i < bigEntitiesCount; ++i) {
+		const Entity &e = entities[i];
+		if (e.mask & cb.mask) {
+			cb.ExecuteIfRelevant(e.aabb, e.entity);
+		}
+	}
+	for (const int32_t offset : pending) {
+		const Data &d = data[offset];
+		if (d.mask & cb.mask) {
+			cb.ExecuteIfRelevant(d.aabb, d.entity);
+		}
+	}
+
+	for (int32_t i = 0; i < (int32_t)nodes.size();) {
+		const NodeData &node = nodes[i];
+		++cb.nodesTestedCount;
+		const spp::Aabb local = CalcLocalLooseAabbOfNode(i);
+		if ((node.mask & cb.mask) == 0 ||
+			!cb.IsRelevant((AabbCentered)spp::Aabb{local.min * resolution,
+												   local.max * resolution})) {
+			i = node.skip;
+			continue;
+		}
+		const int32_t end = node.firstEntity + node.entitiesCount;
+		for (int32_t e = node.firstEntity; e < end; ++e) {
+			const Entity &E = entities[e];
+			if (E.mask & cb.mask) {
+				cb.ExecuteIfRelevant(E.aabb, E.entity);
+			}
+		}
+		++i;
+	}
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics LinearLooseOctree<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	// gathered in local units, scaled by resolution when merged
+	BroadphaseStatistics local;
+	spp::Aabb rootAabb = AABB_INVALID;
+
+	local.AddUnsorted(bigEntitiesCount + pending.size());
+
+	for (int32_t i = 0; i < (int32_t)nodes.size(); ++i) {
+		const NodeData &node = nodes[i];
+		const int32_t depth = levels - node.level;
+		const spp::Aabb aabb = CalcLocalLooseAabbOfNode(i);
+		const float surface = aabb.GetSurface();
+		if (node.level == levels) {
+			rootAabb = rootAabb + aabb;
+		}
+
+		int64_t count = 0;
+		spp::Aabb tight = AABB_INVALID;
+		const int32_t end = node.firstEntity + node.entitiesCount;
+		for (int32_t e = node.firstEntity; e < end; ++e) {
+			if (entities[e].entity != EMPTY_ENTITY) {
+				tight = tight + (spp::Aabb)entities[e].aabb;
+				++count;
+			}
+		}
+		if (count > 0) {
+			tight.min *= invResolution;
+			tight.max *= invResolution;
+			local.AddLeaf(depth, surface, tight.GetSurface(), count);
+		}
+
+		// children are following nodes chained by their skip indices
+		if (i + 1 < node.skip) {
+			local.AddNode(depth, surface);
+			for (int32_t a = i + 1; a < node.skip; a = nodes[a].skip) {
+				const spp::Aabb aa = CalcLocalLooseAabbOfNode(a);
+				for (int32_t b = nodes[a].skip; b < node.skip;
+					 b = nodes[b].skip) {
+					local.AddSiblings(aa, CalcLocalLooseAabbOfNode(b));
+				}
+			}
+		}
+	}
+
+	BroadphaseStatistics stats;
+	if (rootAabb.min.x <= rootAabb.max.x) {
+		stats.rootSurface =
+			rootAabb.GetSurface() * (double)resolution * resolution;
+	}
+	stats.Merge(local, 0, resolution);
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseBaseIterator<SPP_TEMPLATE_ARGS> *
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::RestartIterator()
+{
+	iterator = {*this};
+	return &iterator;
+}
+
+SPP_TEMPLATE_DECL
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::Iterator::Iterator(LinearLooseOctree &bp)
+{
+	data = &bp.data._Data()._Data();
+	it = 0;
+	Next();
+}
+
+SPP_TEMPLATE_DECL
+LinearLooseOctree<SPP_TEMPLATE_ARGS>::Iterator::~Iterator() {}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::Iterator::Next()
+{
+	do {
+		++it;
+	} while (Valid() && (*data)[it].entity == EMPTY_ENTITY);
+	return FetchData();
+}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::Iterator::FetchData()
+{
+	if (Valid()) {
+		this->entity = (*data)[it].entity;
+		this->aabb = (*data)[it].aabb;
+		this->mask = (*data)[it].mask;
+		return true;
+	}
+	return false;
+}
+
+SPP_TEMPLATE_DECL
+bool LinearLooseOctree<SPP_TEMPLATE_ARGS>::Iterator::Valid()
+{
+	return it < data->size();
+}
+
+SPP_DEFINE_VARIANTS(LinearLooseOctree)
+
+} // namespace experimental
+} // namespace spp
@@ -424,6 +424,53 @@ void LooseOctree<SPP_TEMPLATE_ARGS>::_Internal_IntersectRay(RayCallback &cb,
 	}
 }
 
+SPP_TEMPLATE_DECL
+BroadphaseStatistics LooseOctree<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	BroadphaseStatistics stats;
+	stats.rootSurface = GetAabbOfNode(rootNode).GetSurface();
+	_Internal_GetStatistics(stats, rootNode, 0);
+	stats.Finish();
+	return stats;
+}
+
+SPP_TEMPLATE_DECL
+void LooseOctree<SPP_TEMPLATE_ARGS>::_Internal_GetStatistics(
+	BroadphaseStatistics &stats, const int32_t n, int32_t depth) const
+{
+	const NodeData &node = nodes[n];
+	const float surface = GetAabbOfNode(n).GetSurface();
+
+	if (node.firstEntity) {
+		spp::Aabb tight = data[node.firstEntity].aabb;
+		int64_t count = 0;
+		for (int32_t c = node.firstEntity; c; c = data[c].next) {
+			tight = tight + (spp::Aabb)data[c].aabb;
+			++count;
+		}
+		stats.AddLeaf(depth, surface, tight.GetSurface(), count);
+	}
+
+	bool hasChildren = false;
+	for (int32_t i = 0; i < 8; ++i) {
+		const int32_t c = node.children[i];
+		if (c == 0) {
+			continue;
+		}
+		hasChildren = true;
+		for (int32_t j = i + 1; j < 8; ++j) {
+			if (node.children[j]) {
+				stats.AddSiblings(GetAabbOfNode(c),
+								  GetAabbOfNode(node.children[j]));
+			}
+		}
+		_Internal_GetStatistics(stats, c, depth + 1);
+	}
+	if (hasChildren) {
+		stats.AddNode(depth, surface);
+	}
+}
+
 SPP_TEMPLATE_DECL
 BroadphaseBaseIterator<SPP_TEMPLATE_ARGS> *
 LooseOctree<SPP_TEMPLATE_ARGS>::RestartIterator()
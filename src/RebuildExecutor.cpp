@@ -0,0 +1,111 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "../include/spatial_partitioning/RebuildExecutor.hpp"
+
+namespace spp
+{
+RebuildExecutor::RebuildExecutor(int32_t threadsCount, bool lowPriority,
+								 int32_t pinnedCpu)
+{
+	if (threadsCount <= 0) {
+		threadsCount = std::max<int32_t>(std::thread::hardware_concurrency(), 1);
+	}
+	threads.reserve(threadsCount);
+	for (int32_t i = 0; i < threadsCount; ++i) {
+		threads.emplace_back(&RebuildExecutor::WorkerThread, this, lowPriority,
+							 pinnedCpu);
+	}
+}
+
+RebuildExecutor::~RebuildExecutor()
+{
+	{
+		std::lock_guard lock(mutex);
+		stop = true;
+		// owners of dropped rebuilds wait for these flags
+		for (Job &job : jobs) {
+			job.finished->store(true);
+		}
+		jobs.clear();
+	}
+	condition.notify_all();
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
+void RebuildExecutor::Enqueue(int64_t priority,
+							  std::shared_ptr<std::atomic<bool>> finished,
+							  std::function<void()> &&rebuild)
+{
+	{
+		std::lock_guard lock(mutex);
+		if (stop) {
+			finished->store(true);
+			return;
+		}
+		jobs.push_back({priority, std::move(finished), std::move(rebuild)});
+		std::push_heap(jobs.begin(), jobs.end());
+	}
+	condition.notify_one();
+}
+
+int32_t RebuildExecutor::GetPendingCount()
+{
+	std::lock_guard lock(mutex);
+	return jobs.size();
+}
+
+int32_t RebuildExecutor::GetThreadsCount() const { return threads.size(); }
+
+void RebuildExecutor::WorkerThread(bool lowPriority, int32_t pinnedCpu)
+{
+#if defined(__linux__)
+	if (lowPriority) {
+		// on linux nice value is per thread
+		setpriority(PRIO_PROCESS, 0, 10);
+	}
+	if (pinnedCpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(pinnedCpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#elif defined(_WIN32)
+	if (lowPriority) {
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	}
+	if (pinnedCpu >= 0) {
+		SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << pinnedCpu);
+	}
+#endif
+
+	while (true) {
+		Job job;
+		{
+			std::unique_lock lock(mutex);
+			condition.wait(lock, [this]() { return stop || !jobs.empty(); });
+			if (stop) {
+				return;
+			}
+			std::pop_heap(jobs.begin(), jobs.end());
+			job = std::move(jobs.back());
+			jobs.pop_back();
+		}
+		job.rebuild();
+		job.finished->store(true);
+	}
+}
+} // namespace spp
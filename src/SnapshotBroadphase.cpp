@@ -0,0 +1,353 @@
+// This file is part of SpatialPartitioning.
+// Copyright (c) 2025 Marek Zalewski aka Drwalin
+// You should have received a copy of the MIT License along with this program.
+
+#include <cassert>
+#include <cstdio>
+
+#include <thread>
+
+#include "../include/spatial_partitioning/SnapshotBroadphase.hpp"
+
+namespace spp
+{
+SPP_TEMPLATE_DECL
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::SnapshotBroadphase(
+	std::unique_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> &&a,
+	std::unique_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> &&b, int32_t maxReaders)
+{
+	assert(a->GetCount() == 0 && b->GetCount() == 0);
+	assert(a->QueriesModifyState() == false &&
+		   b->QueriesModifyState() == false &&
+		   "Queries of wrapped structure are not safe for concurrent readers");
+	structures[0] = std::move(a);
+	structures[1] = std::move(b);
+	privateCopy = structures[0].get();
+	published.store(structures[1].get());
+	this->maxReaders = maxReaders;
+	slots = std::make_unique<ReaderSlot[]>(maxReaders);
+}
+
+SPP_TEMPLATE_DECL
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::~SnapshotBroadphase()
+{
+	for (int32_t i = 0; i < maxReaders; ++i) {
+		assert(slots[i].epoch.load() == 0 && "Reader is still querying");
+	}
+}
+
+SPP_TEMPLATE_DECL
+const char *SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetName() const
+{
+	thread_local char *n = new char[1024];
+	snprintf(n, 1023, "SnapshotBroadphase %s", structures[0]->GetName());
+	return n;
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Clear()
+{
+	Writable()->Clear();
+	log.clear();
+	log.push_back({{}, EMPTY_ENTITY, 0, OP_CLEAR});
+}
+
+SPP_TEMPLATE_DECL
+size_t SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
+{
+	return structures[0]->GetMemoryUsage() + structures[1]->GetMemoryUsage() +
+		   (log.capacity() + replayLog.capacity()) * sizeof(Operation) +
+		   maxReaders * sizeof(ReaderSlot);
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::ShrinkToFit()
+{
+	Writable()->ShrinkToFit();
+	log.shrink_to_fit();
+	replayLog.shrink_to_fit();
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
+												MaskType mask)
+{
+	Writable()->Add(entity, aabb, mask);
+	log.push_back({aabb, entity, mask, OP_ADD});
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Update(EntityType entity,
+												   Aabb aabb)
+{
+	Writable()->Update(entity, aabb);
+	log.push_back({aabb, entity, 0, OP_UPDATE});
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
+{
+	Writable()->Remove(entity);
+	log.push_back({{}, entity, 0, OP_REMOVE});
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity,
+													MaskType mask)
+{
+	Writable()->SetMask(entity, mask);
+	log.push_back({{}, entity, mask, OP_SET_MASK});
+}
+
+SPP_TEMPLATE_DECL
+int32_t SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetCount() const
+{
+	return Current()->GetCount();
+}
+
+SPP_TEMPLATE_DECL
+bool SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Exists(EntityType entity) const
+{
+	return Current()->Exists(entity);
+}
+
+SPP_TEMPLATE_DECL
+Aabb SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetAabb(EntityType entity) const
+{
+	return Current()->GetAabb(entity);
+}
+
+SPP_TEMPLATE_DECL
+MaskType SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetMask(EntityType entity) const
+{
+	return Current()->GetMask(entity);
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
+{
+	Current()->IntersectAabb(cb);
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
+{
+	Current()->IntersectRay(cb);
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Rebuild()
+{
+	Writable()->Rebuild();
+	log.push_back({{}, EMPTY_ENTITY, 0, OP_REBUILD});
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	return Writable()->GetStatistics();
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseBaseIterator<SPP_TEMPLATE_ARGS> *
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::RestartIterator()
+{
+	return Current()->RestartIterator();
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Commit()
+{
+	if (privateReady == false) {
+		// nothing changed since last commit
+		return;
+	}
+
+	// Finish lazy refits/rebuilds, so that readers do not modify snapshot.
+	AabbCallback cb;
+	cb.mask = 0;
+	cb.callback = [](AabbCallback *, EntityType) {};
+	privateCopy->IntersectAabb(cb);
+
+	BroadphaseBase<SPP_TEMPLATE_ARGS> *previous =
+		published.exchange(privateCopy);
+	reclaimEpoch = epoch.fetch_add(1) + 1;
+	version.fetch_add(1);
+
+	privateCopy = previous;
+	std::swap(log, replayLog);
+	log.clear();
+	privateReady = false;
+}
+
+SPP_TEMPLATE_DECL
+uint64_t SnapshotBroadphase<SPP_TEMPLATE_ARGS>::GetVersion() const
+{
+	return version.load();
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseBase<SPP_TEMPLATE_ARGS> *
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Writable()
+{
+	if (privateReady) {
+		return privateCopy;
+	}
+
+	WaitForReaders(reclaimEpoch);
+
+	for (const Operation &op : replayLog) {
+		switch (op.type) {
+		case OP_ADD:
+			privateCopy->Add(op.entity, op.aabb, op.mask);
+			break;
+		case OP_UPDATE:
+			privateCopy->Update(op.entity, op.aabb);
+			break;
+		case OP_REMOVE:
+			privateCopy->Remove(op.entity);
+			break;
+		case OP_SET_MASK:
+			privateCopy->SetMask(op.entity, op.mask);
+			break;
+		case OP_REBUILD:
+			privateCopy->Rebuild();
+			break;
+		case OP_CLEAR:
+			privateCopy->Clear();
+			break;
+		}
+	}
+	replayLog.clear();
+	privateReady = true;
+	return privateCopy;
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseBase<SPP_TEMPLATE_ARGS> *
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Current() const
+{
+	if (privateReady) {
+		return privateCopy;
+	}
+	return published.load();
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::WaitForReaders(uint64_t epoch)
+{
+	for (int32_t i = 0; i < maxReaders; ++i) {
+		while (true) {
+			const uint64_t e = slots[i].epoch.load();
+			if (e == 0 || e >= epoch) {
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+}
+
+SPP_TEMPLATE_DECL
+typename SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::CreateReader()
+{
+	Reader reader;
+	while (TryCreateReader(reader) == false) {
+		std::this_thread::yield();
+	}
+	return reader;
+}
+
+SPP_TEMPLATE_DECL
+bool SnapshotBroadphase<SPP_TEMPLATE_ARGS>::TryCreateReader(Reader &reader)
+{
+	for (int32_t i = 0; i < maxReaders; ++i) {
+		bool expected = false;
+		if (slots[i].used.compare_exchange_strong(expected, true)) {
+			reader = Reader(this, i);
+			return true;
+		}
+	}
+	return false;
+}
+
+SPP_TEMPLATE_DECL
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::Reader(SnapshotBroadphase *owner,
+													  int32_t slot)
+	: owner(owner), slot(slot)
+{
+}
+
+SPP_TEMPLATE_DECL
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::Reader(Reader &&other)
+	: owner(other.owner), slot(other.slot)
+{
+	other.owner = nullptr;
+	other.slot = -1;
+}
+
+SPP_TEMPLATE_DECL
+typename SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader &
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::operator=(Reader &&other)
+{
+	if (this != &other) {
+		this->~Reader();
+		owner = other.owner;
+		slot = other.slot;
+		other.owner = nullptr;
+		other.slot = -1;
+	}
+	return *this;
+}
+
+SPP_TEMPLATE_DECL
+SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::~Reader()
+{
+	if (owner) {
+		owner->slots[slot].used.store(false);
+		owner = nullptr;
+		slot = -1;
+	}
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::IntersectAabb(
+	AabbCallback &cb)
+{
+	assert(owner);
+	std::atomic<uint64_t> &e = owner->slots[slot].epoch;
+	// Epoch needs to be visible before loading snapshot, so that writer
+	// waits for this reader if snapshot is replaced meanwhile. Nested query
+	// keeps epoch of outer one, which protects every newer snapshot too.
+	const uint64_t outer = e.load();
+	if (outer == 0) {
+		e.store(owner->epoch.load());
+	}
+	owner->published.load()->IntersectAabb(cb);
+	e.store(outer);
+}
+
+SPP_TEMPLATE_DECL
+void SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::IntersectRay(
+	RayCallback &cb)
+{
+	assert(owner);
+	std::atomic<uint64_t> &e = owner->slots[slot].epoch;
+	const uint64_t outer = e.load();
+	if (outer == 0) {
+		e.store(owner->epoch.load());
+	}
+	owner->published.load()->IntersectRay(cb);
+	e.store(outer);
+}
+
+SPP_TEMPLATE_DECL
+uint64_t SnapshotBroadphase<SPP_TEMPLATE_ARGS>::Reader::GetVersion() const
+{
+	assert(owner);
+	return owner->version.load();
+}
+
+SPP_DEFINE_VARIANTS(SnapshotBroadphase)
+
+} // namespace spp
@@ -2,7 +2,10 @@
 // Copyright (c) 2025 Marek Zalewski aka Drwalin
 // You should have received a copy of the MIT License along with this program.
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <type_traits>
 
 #include "../glm/glm/common.hpp"
 
@@ -70,6 +73,9 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Clear()
 	}
 	dynamic->Clear();
 	optimised->Clear();
+	ResetSleeping();
+	dynamicCountAfterRebuild = 0;
+	ResetQueryCost();
 }
 
 SPP_TEMPLATE_DECL
@@ -81,9 +87,12 @@ size_t ThreeStageDbvh<SPP_TEMPLATE_ARGS>::GetMemoryUsage() const
 
 		   6 * 32 +
 
-		   toRemoveAfterRebuild.capacity() * sizeof(EntityType) +
+		   integrationRemoves.capacity() * sizeof(EntityType) +
+		   integrationDynamic.capacity() *
+			   sizeof(std::tuple<EntityType, Aabb, MaskType>) +
 
-		   setMaskAfterRebuild.GetMemoryUsage();
+		   operationsAfterRebuild.GetMemoryUsage() +
+		   lastUpdateTicks.GetMemoryUsage();
 }
 
 SPP_TEMPLATE_DECL
@@ -94,7 +103,8 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::ShrinkToFit()
 		dbvhs[1]->ShrinkToFit();
 	}
 	dynamic->ShrinkToFit();
-	toRemoveAfterRebuild.shrink_to_fit();
+	integrationRemoves.shrink_to_fit();
+	integrationDynamic.shrink_to_fit();
 }
 
 SPP_TEMPLATE_DECL
@@ -110,12 +120,15 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::StartFastAdding()
 		optimised->Add(it->entity, it->aabb, it->mask);
 	}
 	dynamic->Clear();
+	ResetSleeping();
+	dynamicCountAfterRebuild = 0;
 
 	tests = 0;
 	dynamicUpdates = 0;
 	optimisedUpdates = 0;
 	finishedRebuilding->store(false);
 	tests = 0;
+	ResetQueryCost();
 }
 
 SPP_TEMPLATE_DECL
@@ -132,6 +145,12 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Add(EntityType entity, Aabb aabb,
 	} else {
 		dynamicUpdates++;
 		dynamic->Add(entity, aabb, mask);
+		if (rebuild) {
+			operationsAfterRebuild[entity] = {OP_DYNAMIC, 0};
+		}
+		if (sleepingTicks > 0) {
+			MarkAwake(entity);
+		}
 	}
 }
 
@@ -147,14 +166,17 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
 
 	TryIntegrateOptimised();
 
+	if (rebuild) {
+		operationsAfterRebuild[entity] = {OP_DYNAMIC, 0};
+	}
+	if (sleepingTicks > 0) {
+		MarkAwake(entity);
+	}
+
 	if (dynamic->Exists(entity)) {
 		dynamicUpdates++;
 		dynamic->Update(entity, aabb);
 	} else {
-		if (rebuild) {
-			toRemoveAfterRebuild.push_back(entity);
-		}
-
 		assert(optimised->Exists(entity) && "This is an alternative scenario");
 		MaskType mask = optimised->GetMask(entity);
 		optimised->Remove(entity);
@@ -164,7 +186,7 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Update(EntityType entity, Aabb aabb)
 		dynamic->Add(entity, aabb, mask);
 	}
 
-	if (dynamicUpdates + optimisedUpdates > 100000) {
+	if (ShouldRebuild()) {
 		TryScheduleRebuild();
 	}
 }
@@ -182,7 +204,17 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Remove(EntityType entity)
 	TryIntegrateOptimised();
 
 	if (rebuild) {
-		toRemoveAfterRebuild.push_back(entity);
+		operationsAfterRebuild[entity] = {OP_REMOVE, 0};
+	}
+	if (sleepingTicks > 0) {
+		auto it = lastUpdateTicks.find(entity);
+		if (it != lastUpdateTicks.end()) {
+			if (currentTick - it->second < sleepingTicks) {
+				--awakeByTick[it->second % sleepingTicks];
+				--awakeCount;
+			}
+			lastUpdateTicks.erase(it);
+		}
 	}
 
 	if (dynamic->Exists(entity)) {
@@ -201,10 +233,13 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::SetMask(EntityType entity,
 {
 	if (dynamic->Exists(entity)) {
 		dynamic->SetMask(entity, mask);
+		if (rebuild) {
+			operationsAfterRebuild[entity] = {OP_DYNAMIC, 0};
+		}
 	} else if (optimised->Exists(entity)) {
 		optimised->SetMask(entity, mask);
 		if (rebuild) {
-			setMaskAfterRebuild[entity] = mask;
+			operationsAfterRebuild[entity] = {OP_SET_MASK, mask};
 		}
 	} else {
 		ASSERT(false);
@@ -216,57 +251,61 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::TryIntegrateOptimised()
 {
 	if (rebuild) {
 		if (finishedRebuilding->load()) {
+			const auto start = std::chrono::steady_clock::now();
 			if (clear) {
 				clear = false;
 				rebuild->Clear();
 				rebuild = nullptr;
 			} else {
-				optimised->Clear();
 				std::swap(_optimised, _rebuild);
 				optimised = _optimised.get();
 				rebuild = nullptr;
-
-				for (auto entity : toRemoveAfterRebuild) {
-					if (optimised->Exists(entity)) {
-						optimised->Remove(entity);
-					}
-				}
-				setMaskAfterRebuild.clear();
-
-				for (auto it : setMaskAfterRebuild) {
-					if (optimised->Exists(it.first)) {
-						optimised->SetMask(it.first, it.second);
-					}
-				}
-				toRemoveAfterRebuild.clear();
-
-				for (auto it = dynamic->RestartIterator(); it->Valid();
-					 it->Next()) {
-					if (optimised->Exists(it->entity)) {
-						auto a = it->aabb;
-						auto b = optimised->GetAabb(it->entity);
-						glm::vec3 c = glm::abs(a.min - b.min);
-						glm::vec3 d = glm::abs(a.max - b.max);
-
-						float len = c.x + c.y + c.z + d.x + d.y + d.z;
-						if (len < 0.001) {
-							toRemoveAfterRebuild.push_back(it->entity);
-						} else {
-							optimised->Remove(it->entity);
+				// old optimised stage would keep copy of all entities until
+				// next rebuild starts
+				_rebuild->Clear();
+
+				integrationRemoves.clear();
+				integrationDynamic.clear();
+				for (const auto &it : operationsAfterRebuild) {
+					const EntityType entity = it.first;
+					switch (it.second.type) {
+					case OP_DYNAMIC:
+						assert(dynamic->Exists(entity));
+						integrationDynamic.push_back(
+							{entity, dynamic->GetAabb(entity),
+							 dynamic->GetMask(entity)});
+						[[fallthrough]];
+					case OP_REMOVE:
+						if (optimised->Exists(entity)) {
+							integrationRemoves.push_back(entity);
 						}
+						break;
+					case OP_SET_MASK:
+						if (optimised->Exists(entity)) {
+							optimised->SetMask(entity, it.second.mask);
+						}
+						break;
 					}
 				}
-				for (auto entity : toRemoveAfterRebuild) {
-					dynamic->Remove(entity);
-				}
-				toRemoveAfterRebuild.clear();
+				optimised->RemoveBatch(integrationRemoves);
 
-				for (auto it = dynamic->RestartIterator(); it->Valid();
-					 it->Next()) {
-					assert(optimised->Exists(it->entity) == false);
-				}
+				// Every other entity of dynamic stage is already in rebuilt
+				// one, so dynamic stage is refilled with changed entities.
+				dynamic->Clear();
+				dynamic->AddBatch(integrationDynamic);
+
+				integrationRemoves.clear();
+				integrationDynamic.clear();
+				dynamicCountAfterRebuild = dynamic->GetCount();
 			}
+			operationsAfterRebuild.clear();
 			finishedRebuilding->store(false);
+			if (rebuildNanoseconds >= 0.0) {
+				rebuildNanoseconds +=
+					std::chrono::duration<double, std::nano>(
+						std::chrono::steady_clock::now() - start)
+						.count();
+			}
 		}
 	}
 }
@@ -281,14 +320,21 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::TryScheduleRebuild()
 	}
 
 	if (scheduleRebuildFunc && dbvhs[1] != nullptr) {
+		const auto start = std::chrono::steady_clock::now();
 		rebuild = _rebuild.get();
 		rebuild->Clear();
 		for (auto it = optimised->RestartIterator(); it->Valid(); it->Next()) {
 			rebuild->Add(it->entity, it->aabb, it->mask);
 		}
 
+		operationsAfterRebuild.clear();
 		for (auto it = dynamic->RestartIterator(); it->Valid(); it->Next()) {
-			rebuild->Add(it->entity, it->aabb, it->mask);
+			if (IsSleeping(it->entity)) {
+				rebuild->Add(it->entity, it->aabb, it->mask);
+			} else {
+				// awake entities stay in dynamic stage after integration
+				operationsAfterRebuild[it->entity] = {OP_DYNAMIC, 0};
+			}
 		}
 
 		tests = 0;
@@ -296,16 +342,18 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::TryScheduleRebuild()
 		optimisedUpdates = 0;
 		finishedRebuilding->store(false);
 
-		toRemoveAfterRebuild.clear();
-		setMaskAfterRebuild.clear();
+		ResetQueryCost();
 
 		scheduleRebuildFunc(_finishedRebuilding, _rebuild,
 							scheduleUpdateUserData);
+
+		// Rebuild itself runs in background, only copying and integration
+		// is a cost for this thread.
+		rebuildNanoseconds = std::chrono::duration<double, std::nano>(
+								 std::chrono::steady_clock::now() - start)
+								 .count();
 	} else {
 		Rebuild();
-
-		toRemoveAfterRebuild.clear();
-		setMaskAfterRebuild.clear();
 	}
 }
 
@@ -356,8 +404,7 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::IntersectAabb(AabbCallback &cb)
 
 	TryIntegrateOptimised();
 
-	dynamic->IntersectAabb(cb);
-	optimised->IntersectAabb(cb);
+	IntersectMeasured(cb);
 }
 
 SPP_TEMPLATE_DECL
@@ -369,29 +416,143 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::IntersectRay(RayCallback &cb)
 
 	TryIntegrateOptimised();
 
-	dynamic->IntersectRay(cb);
-	optimised->IntersectRay(cb);
+	IntersectMeasured(cb);
+}
+
+SPP_TEMPLATE_DECL
+bool ThreeStageDbvh<SPP_TEMPLATE_ARGS>::QueriesModifyState() const
+{
+	return true;
+}
+
+SPP_TEMPLATE_DECL
+template <typename CB>
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::IntersectMeasured(CB &cb)
+{
+	// measure time only of every 64th query to limit overhead of clock
+	const bool measureTime = (queriesCount++ & 63) == 0;
+	std::chrono::steady_clock::time_point start;
+	if (measureTime) {
+		start = std::chrono::steady_clock::now();
+	}
+
+	const size_t t0 = cb.nodesTestedCount + cb.testedCount;
+	if (dynamic->GetCount() > 0) {
+		if constexpr (std::is_same_v<CB, AabbCallback>) {
+			dynamic->IntersectAabb(cb);
+		} else {
+			dynamic->IntersectRay(cb);
+		}
+	}
+	const size_t t1 = cb.nodesTestedCount + cb.testedCount;
+	if constexpr (std::is_same_v<CB, AabbCallback>) {
+		optimised->IntersectAabb(cb);
+	} else {
+		optimised->IntersectRay(cb);
+	}
+	const size_t t2 = cb.nodesTestedCount + cb.testedCount;
+
+	if (measureTime && t2 > t0) {
+		const double ns = std::chrono::duration<double, std::nano>(
+							  std::chrono::steady_clock::now() - start)
+							  .count();
+		const double current = ns / (t2 - t0);
+		if (nanosecondsPerTest <= 0.0) {
+			nanosecondsPerTest = current;
+		} else {
+			nanosecondsPerTest = nanosecondsPerTest * 0.875 + current * 0.125;
+		}
+	}
+
+	RegisterQueryCost(t1 - t0, t2 - t1);
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::RegisterQueryCost(
+	size_t dynamicTests, size_t optimisedTests)
+{
+	const double total = dynamicTests + optimisedTests;
+	// While dynamic stage did not grow much, structure is as good as after
+	// rebuild.
+	if ((int64_t)(dynamic->GetCount() - dynamicCountAfterRebuild) * 16 <=
+		optimised->GetCount()) {
+		baselineTestsSum += total;
+		++baselineQueries;
+		baselineTests = baselineTestsSum / baselineQueries;
+	}
+	if (baselineTests < 0.0) {
+		excessTests += dynamicTests;
+	} else {
+		excessTests += total - baselineTests;
+	}
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::ResetQueryCost()
+{
+	excessTests = 0.0;
+	baselineTestsSum = 0.0;
+	baselineQueries = 0;
+}
+
+SPP_TEMPLATE_DECL
+bool ThreeStageDbvh<SPP_TEMPLATE_ARGS>::ShouldRebuild() const
+{
+	if (rebuildNanoseconds < 0.0 || nanosecondsPerTest <= 0.0) {
+		// nothing measured yet
+		return dynamicUpdates + optimisedUpdates > 100000;
+	}
+	// Excess cost of queries since last rebuild is expected to repeat until
+	// next rebuild, rebuild when it pays off.
+	return excessTests * nanosecondsPerTest > rebuildNanoseconds;
 }
 
 SPP_TEMPLATE_DECL
 void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Rebuild()
 {
+	const auto start = std::chrono::steady_clock::now();
 	if (rebuild) {
 		clear = true;
 	}
 
+	integrationDynamic.clear();
 	for (auto it = dynamic->RestartIterator(); it->Valid(); it->Next()) {
-		optimised->Add(it->entity, it->aabb, it->mask);
+		if (IsSleeping(it->entity)) {
+			optimised->Add(it->entity, it->aabb, it->mask);
+		} else {
+			integrationDynamic.push_back({it->entity, it->aabb, it->mask});
+		}
 	}
 	optimised->Rebuild();
 
 	dynamic->Clear();
+	dynamic->AddBatch(integrationDynamic);
+	integrationDynamic.clear();
+	dynamicCountAfterRebuild = dynamic->GetCount();
 
 	tests = 0;
 	dynamicUpdates = 0;
 	optimisedUpdates = 0;
 	finishedRebuilding->store(false);
 	tests = 0;
+	ResetQueryCost();
+
+	rebuildNanoseconds = std::chrono::duration<double, std::nano>(
+							 std::chrono::steady_clock::now() - start)
+							 .count();
+}
+
+SPP_TEMPLATE_DECL
+BroadphaseStatistics ThreeStageDbvh<SPP_TEMPLATE_ARGS>::GetStatistics()
+{
+	const BroadphaseStatistics a = optimised->GetStatistics();
+	const BroadphaseStatistics b = dynamic->GetStatistics();
+	BroadphaseStatistics stats;
+	stats.rootSurface = std::max(a.rootSurface, b.rootSurface);
+	stats.Merge(a, 0);
+	stats.Merge(b, 0);
+	stats.Finish();
+	return stats;
 }
 
 SPP_TEMPLATE_DECL
@@ -471,6 +632,105 @@ void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::SetRebuildSchedulerFunction(
 	this->scheduleUpdateUserData = scheduleUpdateUserData;
 }
 
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::SetSleepingTicks(int32_t ticks)
+{
+	sleepingTicks = std::max(ticks, 0);
+	ResetSleeping();
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::Tick()
+{
+	++currentTick;
+	if (sleepingTicks <= 0) {
+		return;
+	}
+
+	// entities last updated sleepingTicks ago fall asleep
+	int32_t &fallingAsleep = awakeByTick[currentTick % sleepingTicks];
+	awakeCount -= fallingAsleep;
+	fallingAsleep = 0;
+
+	if (fastAdding) {
+		return;
+	}
+	TryIntegrateOptimised();
+	const int32_t sleepingInDynamic = dynamic->GetCount() - awakeCount;
+	if (sleepingInDynamic > std::max(optimised->GetCount() / 16, 64) ||
+		ShouldRebuild()) {
+		TryScheduleRebuild();
+	}
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::MarkAwake(EntityType entity)
+{
+	auto it = lastUpdateTicks.find(entity);
+	if (it != lastUpdateTicks.end()) {
+		if (currentTick - it->second < sleepingTicks) {
+			--awakeByTick[it->second % sleepingTicks];
+			--awakeCount;
+		}
+		it->second = currentTick;
+	} else {
+		lastUpdateTicks[entity] = currentTick;
+	}
+	++awakeByTick[currentTick % sleepingTicks];
+	++awakeCount;
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::ResetSleeping()
+{
+	lastUpdateTicks.clear();
+	awakeByTick.clear();
+	awakeByTick.resize(sleepingTicks, 0);
+	awakeCount = 0;
+}
+
+SPP_TEMPLATE_DECL
+bool ThreeStageDbvh<SPP_TEMPLATE_ARGS>::IsSleeping(EntityType entity) const
+{
+	if (sleepingTicks <= 0) {
+		return true;
+	}
+	auto it = lastUpdateTicks.find(entity);
+	if (it == lastUpdateTicks.end()) {
+		return true;
+	}
+	return currentTick - it->second >= sleepingTicks;
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::SetRebuildExecutor(
+	std::shared_ptr<RebuildExecutor> executor)
+{
+	if (executor) {
+		SetRebuildSchedulerFunction(ScheduleRebuildOnExecutor, executor);
+	} else {
+		SetRebuildSchedulerFunction(nullptr, nullptr);
+	}
+}
+
+SPP_TEMPLATE_DECL
+void ThreeStageDbvh<SPP_TEMPLATE_ARGS>::ScheduleRebuildOnExecutor(
+	std::shared_ptr<std::atomic<bool>> finishedRebuilding,
+	std::shared_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> dbvh,
+	std::shared_ptr<void> executor)
+{
+	const int64_t priority = dbvh->GetCount();
+	// Structure is held weakly, so that rebuilds of destroyed ThreeStageDbvh
+	// are skipped.
+	std::weak_ptr<BroadphaseBase<SPP_TEMPLATE_ARGS>> weak = dbvh;
+	((RebuildExecutor *)executor.get())
+		->Enqueue(priority, finishedRebuilding, [weak]() {
+			if (auto dbvh = weak.lock()) {
+				dbvh->Rebuild();
+			}
+		});
+}
+
 SPP_DEFINE_VARIANTS(ThreeStageDbvh)
 
 } // namespace spp
@@ -2,13 +2,13 @@
 
 #include <string>
 #include <thread>
-#include <mutex>
-#include <queue>
 #include <algorithm>
 #include <random>
 #include <vector>
 #include <chrono>
 #include <map>
+#include <span>
+#include <tuple>
 
 #include "../glm/glm/common.hpp"
 #include "../glm/glm/geometric.hpp"
@@ -16,8 +16,11 @@
 #include "../include/spatial_partitioning/BroadPhaseBase.hpp"
 #include "../include/spatial_partitioning/BruteForce.hpp"
 #include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/LinearBvh.hpp"
 #include "../include/spatial_partitioning/Dbvh.hpp"
+#include "../include/spatial_partitioning/ChunkedLooseOctree.hpp"
 #include "../include/spatial_partitioning/HashLooseOctree.hpp"
+#include "../include/spatial_partitioning/LinearLooseOctree.hpp"
 #include "../include/spatial_partitioning/LooseOctree.hpp"
 #include "../include/spatial_partitioning/BulletDbvh.hpp"
 #include "../include/spatial_partitioning/BulletDbvt.hpp"
@@ -45,6 +48,8 @@ size_t MIXED_AABB_COUNT = 2;
 size_t MIXED_RAY_COUNT = 2;
 size_t MIXED_UPDATE_COUNT = 1;
 size_t SWITCH_MIXED_AABB_WITH_UPDATE_COUNTS_FOR_FIRST_N_TESTS = 0;
+int64_t MIXED_REBUILD_FOR_BUDGET_US = -1;
+bool BATCH_API = false;
 
 bool disable_benchmark_report = false;
 
@@ -118,6 +123,12 @@ void _SetEntityAabb(std::vector<spp::Aabb> &aabbs, EntityType entity,
 	aabbs[entity] = aabb;
 }
 
+// Tick() is called on these structures after each mixed update step
+std::vector<spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *>
+	tickedStructures;
+// These structures are loaded with IngestLoad()
+std::vector<spp::ChunkedBvhDbvt<EntityType, uint32_t, 0> *> ingestStructures;
+
 std::vector<EntityType> ee;
 std::vector<glm::vec3> vv;
 
@@ -465,6 +476,15 @@ size_t SingleTest(spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *broad
 			}
 		};
 
+		static std::vector<std::pair<EntityType, spp::Aabb>> pendingUpdates;
+		pendingUpdates.clear();
+		auto flushUpdates = [&]() {
+			if (pendingUpdates.empty() == false) {
+				TEST_TIMING(broadphase->UpdateBatch(pendingUpdates), cbAabb);
+				pendingUpdates.clear();
+			}
+		};
+
 		const size_t stride =
 			MIXED_AABB_COUNT + MIXED_RAY_COUNT + MIXED_UPDATE_COUNT;
 		
@@ -492,6 +512,7 @@ size_t SingleTest(spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *broad
 				}
 				if (((i * MIXED_UPDATE_COUNT) / stride + j) % 55 == 0 ||
 					broadphase->Exists(e) == false) {
+					flushUpdates();
 					if (broadphase->Exists(e) == false) {
 						spp::Aabb aabb = aabbsToTest[i];
 						aabb.max = aabb.min + ((aabb.max-aabb.min) / 5.0f);
@@ -502,7 +523,12 @@ size_t SingleTest(spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *broad
 						e = popRandom(s, i, removeEntities);
 
 						if (broadphase->Exists(e)) {
-							TEST_TIMING(broadphase->Remove(e), cbAabb);
+							if (BATCH_API) {
+								TEST_TIMING(broadphase->RemoveBatch({&e, 1}),
+											cbAabb);
+							} else {
+								TEST_TIMING(broadphase->Remove(e), cbAabb);
+							}
 							removeEntities.push_back(e);
 						} else {
 							spp::Aabb aabb = aabbsToTest[i];
@@ -536,10 +562,33 @@ size_t SingleTest(spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *broad
 						aabb.max.y = y + h;
 // 						aabb.max = aabb.min + (aabb.max-aabb.min) / 5.0f;
 					}
-					TEST_TIMING(broadphase->Update(e, aabb), cbAabb);
+					if (BATCH_API) {
+						auto it = std::find_if(
+							pendingUpdates.begin(), pendingUpdates.end(),
+							[e](const auto &p) { return p.first == e; });
+						if (it != pendingUpdates.end()) {
+							it->second = aabb;
+						} else {
+							pendingUpdates.push_back({e, aabb});
+						}
+					} else {
+						TEST_TIMING(broadphase->Update(e, aabb), cbAabb);
+					}
 					_SetEntityAabb(currentEntitiesAabbs, e, aabb);
 				}
 			}
+			flushUpdates();
+
+			for (auto t : tickedStructures) {
+				if (t == broadphase) {
+					TEST_TIMING(t->Tick(), cbAabb);
+				}
+			}
+
+			if (MIXED_REBUILD_FOR_BUDGET_US >= 0) {
+				broadphase->RebuildFor(
+					std::chrono::microseconds(MIXED_REBUILD_FOR_BUDGET_US));
+			}
 
 			for (int j = 0; j < MIXED_RAY_COUNT; ++j, ++i) {
 				cbRay.hasHit = false;
@@ -1211,72 +1260,121 @@ void Test(std::vector<spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *>
 	fflush(stdout);
 }
 
-void EnqueueRebuildThreaded(std::shared_ptr<std::atomic<bool>> fin,
-							std::shared_ptr<spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>> dbvh,
-							std::shared_ptr<void> data)
+template <typename BvhType>
+bool TryBulkLoadBvhWithoutOffsets(
+	spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *bp,
+	std::span<const EntityType> ents, std::span<const spp::Aabb> aabbs,
+	std::span<const uint32_t> masks)
 {
-	static std::atomic<int> size = 0;
-	static std::mutex mutex;
-	static bool done = false;
-	using Pair = std::pair<std::shared_ptr<std::atomic<bool>>,
-						   std::shared_ptr<spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>>>;
-	static std::queue<Pair> queue;
-	if (done == false) {
-		done = true;
-		std::thread thread = std::thread([]() {
-			while (true) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(5));
-				if (size.load() > 0) {
-					Pair p;
-					bool has = false;
-					{
-						std::lock_guard lock(mutex);
-						if (queue.empty() == false) {
-							p = queue.front();
-							queue.pop();
-							has = true;
-							--size;
-						}
-					}
-					if (has && p.second.use_count() > 1) {
-						// auto beg = std::chrono::steady_clock::now();
-						p.second->Rebuild();
-						/*
-						auto end = std::chrono::steady_clock::now();
-						auto diff = end - beg;
-						int64_t ns =
-							std::chrono::duration_cast<std::chrono::nanoseconds,
-													   int64_t>(diff)
-								.count();
-						double us = double(ns) / 1000.0;
-						if (false) {
-							printf("                        "
-								   "%s (%i) "
-								   "Async rebuild of : %.3f us/op\n",
-								   p.second->GetName(), p.second->GetCount(),
-								   us / double(TOTAL_AABB_MOVEMENTS));
-							fflush(stdout);
-						}
-						*/
+	if (auto bvh = dynamic_cast<BvhType *>(bp)) {
+		// explicit threads count, to build in parallel on any machine
+		bvh->BulkLoadWithoutOffsets(ents, aabbs, masks, 4);
+		bvh->RegisterAllOffsets();
+		return true;
+	}
+	return false;
+}
 
-						p.first->store(true);
-					}
-				}
-			}
-		});
-		thread.detach();
+// Removes every 7th entity with RemoveBatch and adds half of them back with
+// AddBatch.
+void RemoveAndAddBatch(
+	spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *bp,
+	const std::vector<EntityData> &entities)
+{
+	std::vector<EntityType> removed;
+	std::vector<std::tuple<EntityType, spp::Aabb, uint32_t>> added;
+	for (size_t i = 0; i < entities.size(); i += 7) {
+		removed.push_back(entities[i].id);
+		if ((i / 7) % 2 == 0) {
+			added.push_back({entities[i].id, entities[i].aabb, entities[i].mask});
+		}
+	}
+	bp->RemoveBatch(removed);
+	bp->AddBatch(added);
+}
+
+// Loads all entities with BulkLoad, then calls RemoveAndAddBatch().
+void BatchLoad(spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0> *bp,
+			   const std::vector<EntityData> &entities,
+			   std::vector<spp::Aabb> &currentEntitiesAabbs)
+{
+	std::vector<EntityType> ents;
+	std::vector<spp::Aabb> aabbs;
+	std::vector<uint32_t> masks;
+	for (const auto &e : entities) {
+		ents.push_back(e.id);
+		aabbs.push_back(e.aabb);
+		masks.push_back(e.mask);
+		_SetEntityAabb(currentEntitiesAabbs, e.id, e.aabb);
+	}
+
+	if (TryBulkLoadBvhWithoutOffsets<
+			spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(
+			bp, ents, aabbs, masks)) {
+	} else if (TryBulkLoadBvhWithoutOffsets<
+				   spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(
+				   bp, ents, aabbs, masks)) {
+	} else {
+		bp->BulkLoad(ents, aabbs, masks);
+	}
+	RemoveAndAddBatch(bp, entities);
+}
+
+// Ingests the world three times. First 3/4 of entities are scattered, so
+// that later they move between chunks, between chunks and outer objects and
+// out of far away chunks which become empty. Then all entities but every
+// 37th are ingested with real aabbs and masks, and at last a batch small
+// enough to go through incremental updates.
+void IngestLoad(spp::ChunkedBvhDbvt<EntityType, uint32_t, 0> *bp,
+				const std::vector<EntityData> &entities,
+				std::vector<spp::Aabb> &currentEntitiesAabbs)
+{
+	std::vector<std::tuple<EntityType, spp::Aabb, uint32_t>> batch;
+	for (size_t i = 0; i < entities.size(); ++i) {
+		const auto &e = entities[i];
+		spp::Aabb a = e.aabb;
+		if (i % 4 == 3) {
+			continue;
+		} else if (i % 5 == 0) {
+			a.min += glm::vec3(5000, 0, 5000);
+			a.max += glm::vec3(5000, 0, 5000);
+		} else if (i % 5 == 1) {
+			a.max += glm::vec3(3000, 3000, 3000);
+		} else if (i % 5 == 2) {
+			a.max = a.min + glm::vec3(0.5f, 0.5f, 0.5f);
+		} else if (i % 5 == 3) {
+			a.min += glm::vec3(100, 0, -100);
+			a.max += glm::vec3(100, 0, -100);
+		}
+		batch.push_back({e.id, a, i % 3 ? e.mask : 0});
 	}
-	if (fin.get() != nullptr) {
-		std::lock_guard lock(mutex);
-		queue.push({fin, dbvh});
-		++size;
+	bp->IngestBatch(batch);
+
+	batch.clear();
+	for (size_t i = 0; i < entities.size(); ++i) {
+		if (i % 37 != 0) {
+			batch.push_back({entities[i].id, entities[i].aabb, entities[i].mask});
+		}
+	}
+	bp->IngestBatch(batch);
+
+	batch.clear();
+	for (size_t i = 0; i < entities.size(); i += 37) {
+		batch.push_back({entities[i].id, entities[i].aabb, entities[i].mask});
+	}
+	bp->IngestBatch(batch);
+
+	for (const auto &e : entities) {
+		_SetEntityAabb(currentEntitiesAabbs, e.id, e.aabb);
 	}
 }
 
+std::shared_ptr<spp::RebuildExecutor> rebuildExecutor;
+
 int main(int argc, char **argv)
 {
 	const auto START_MAIN = std::chrono::steady_clock::now();
-	EnqueueRebuildThreaded(nullptr, nullptr, nullptr);
+	rebuildExecutor = std::make_shared<spp::RebuildExecutor>();
 
 	bool enablePrepass = true;
 	bool enable_memory_shrink_to_fit = false;
@@ -1332,10 +1430,15 @@ int main(int argc, char **argv)
 				   "\t-benchmark\n"
 				   "\t-disable-nodes-test-count-print\n"
 				   "\t-switch-mixed-aabb-with-update-counts-for-first-n-tests=\n"
+				   "\t-mixed-rebuild-for=$MICROSECONDS (RebuildFor() after each mixed update)\n"
+				   "\t-batch-api (load and move entities with BulkLoad, *Batch methods)\n"
 				   "\tBF              - BruteForce\n"
 				   "\tBVH             - BvhMedianSplitHeap\n"
 				   "\tBVH1            - BvhMedianSplitHeap1\n"
+				   "\tBVHR            - BvhMedianSplitHeap (refit on next read)\n"
+				   "\tLBVH            - LinearBvh (Morton codes, parallel radix sort)\n"
 				   "\tDBVT            - Rewritten btDbvt from Bullet\n"
+				   "\tDBVTSAH         - Rewritten btDbvt from Bullet with SAH reinsertion\n"
 				   "\tDBVT16          - Rewritten btDbvt from Bullet (16 bit index)\n"
 				   "\tDBVH            - Dbvh (DynamicBoundingVolumeHierarchy)\n"
 				   "\tBTDBVH          - BulletDbvh (Bullet dbvh - two stages)\n"
@@ -1343,6 +1446,11 @@ int main(int argc, char **argv)
 				   "\tCHUNKBVHBTDBVT  - BVH of chunks and two stage BtDbvt and Bvh within chunk\n" // ChunkedBvhDbvt
 				   "\tCHUNKBVHDBVT    - BVH of chunks and two stage Dbvt and Bvh within chunk\n" // ChunkedBvhDbvt
 				   "\tCHUNKBVHBVH     - BVH of chunks and two stage Bvh within chunk\n" // ChunkedBvhDbvt
+				   "\tCHUNKBVHBVH_LVL - BVH of chunks and two stage Bvh within chunk (small chunks, entities in coarser levels)\n" // ChunkedBvhDbvt
+				   "\tCHUNKBVHBVH_GRID - BVH of chunks and two stage Bvh within chunk (grid marching rays)\n" // ChunkedBvhDbvt
+				   "\tCHUNKBVHBVH_LVL_GRID - BVH of chunks and two stage Bvh within chunk (small chunks, grid marching rays)\n" // ChunkedBvhDbvt
+				   "\tCHUNKBVHBVH_INGEST - BVH of chunks and two stage Bvh within chunk (loaded with IngestBatch)\n" // ChunkedBvhDbvt
+				   "\tCHUNKBVHBVH_LVL_INGEST - BVH of chunks and two stage Bvh within chunk (small chunks, loaded with IngestBatch)\n" // ChunkedBvhDbvt
 				   "\tTSH_BF          - ThreeStageDbvh BvhMedian + BruteForce\n"
 				   "\tTSH_BTDBVT      - ThreeStageDbvh BvhMedian + BulletDbvt\n"
 				   "\tTSH_BTDBVT1     - ThreeStageDbvh BvhMedian1 + BulletDbvt\n"
@@ -1352,6 +1460,8 @@ int main(int argc, char **argv)
 				   "\tTSH_DBVH        - ThreeStageDbvh BvhMedian + Dbvh\n"
 				   "\tTSH_DBVT        - ThreeStageDbvh BvhMedian + Dbvt\n"
 				   "\tTSH_DBVT1       - ThreeStageDbvh BvhMedian1 + Dbvt\n"
+				   "\tTSH_LBVH        - ThreeStageDbvh LinearBvh + Dbvt\n"
+				   "\tTSH_SLEEP       - ThreeStageDbvh BvhMedian + Dbvt (sleeping entities, Tick() in mixed tests)\n"
 				   "\tTSH_BVH         - ThreeStageDbvh BvhMedian + BvhMedian (no schedule)\n"
 				   "\tTSH_BVH1s       - ThreeStageDbvh BvhMedian1 + BvhMedian1\n"
 				   "\tTSH_BVHs        - ThreeStageDbvh BvhMedian + BvhMedian\n"
@@ -1360,6 +1470,7 @@ int main(int argc, char **argv)
 				   "\tTSH_BTDBVT2     - ThreeStageDbvh BulletDbvt + BulletDbvt (no schedule)\n"
 				   "\tTSH_1_BVH1_DBVT - ThreeStageDbvh BvhMedian1 + BvhMedian1 (no schedule)\n"
 				   "\tHLO             - HashedLooseOctree\n"
+				   "\tLLO             - LinearLooseOctree\n"
 				   "\tLO              - LooseOctree\n");
 			return 0;
 		} else if (std::string(argv[i]).starts_with("-random-seed=random")) {
@@ -1376,6 +1487,11 @@ int main(int argc, char **argv)
 		} else if (std::string(argv[i]).starts_with("-mixed-update-count=")) {
 			MIXED_UPDATE_COUNT =
 				atoll(argv[i] + strlen("-mixed-update-count="));
+		} else if (std::string(argv[i]).starts_with("-mixed-rebuild-for=")) {
+			MIXED_REBUILD_FOR_BUDGET_US =
+				atoll(argv[i] + strlen("-mixed-rebuild-for="));
+		} else if (std::string(argv[i]).starts_with("-batch-api")) {
+			BATCH_API = true;
 		} else if (std::string(argv[i]).starts_with("-disable-nodes-test-count-print")) {
 			DISABLE_NODES_TEST_COUNT_PRINT = true;
 		} else if (std::string(argv[i]).starts_with("-switch-mixed-aabb-with-update-counts-for-first-n-tests=")) {
@@ -1422,8 +1538,19 @@ int main(int argc, char **argv)
 				spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1> *bvh;
 				bvh = new spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>(TOTAL_ENTITIES);
 				broadphases.push_back(bvh);
+			} else if (strcmp(str, "BVHR") == false) {
+				spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0> *bvh;
+				bvh = new spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>(TOTAL_ENTITIES);
+				bvh->SetAabbUpdatePolicy(bvh->ON_UPDATE_REFIT_ON_NEXT_READ);
+				broadphases.push_back(bvh);
+			} else if (strcmp(str, "LBVH") == false) {
+				broadphases.push_back(new spp::LinearBvh<spp::Aabb, EntityType, uint32_t, 0>(TOTAL_ENTITIES));
 			} else if (strcmp(str, "DBVT") == false) {
 				broadphases.push_back(new spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>);
+			} else if (strcmp(str, "DBVTSAH") == false) {
+				auto dbvt = new spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>;
+				dbvt->SetSahOptimizeBudget(std::chrono::microseconds(500));
+				broadphases.push_back(dbvt);
 			} else if (strcmp(str, "DBVT16") == false) {
 				broadphases.push_back(new spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint16_t>);
 			} else if (strcmp(str, "DBVH") == false) {
@@ -1439,27 +1566,50 @@ int main(int argc, char **argv)
 				broadphases.push_back(new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::Dbvt<spp::Aabb, uint32_t, uint32_t, 0, uint32_t>()));
 			} else if (strcmp(str, "CHUNKBVHBVH") == false) {
 				broadphases.push_back(new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024)));
+			} else if (strcmp(str, "CHUNKBVHBVH_LVL") == false) {
+				auto *chunked = new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024));
+				// levels hold entities up to 1, 4 and 16 units
+				chunked->SetChunkGeometry({4.0f, 32.0f, 1.0f});
+				broadphases.push_back(chunked);
+			} else if (strcmp(str, "CHUNKBVHBVH_GRID") == false) {
+				auto *chunked = new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024));
+				chunked->SetRayTraversalMode(chunked->RAY_TRAVERSAL_GRID_MARCHING);
+				broadphases.push_back(chunked);
+			} else if (strcmp(str, "CHUNKBVHBVH_LVL_GRID") == false) {
+				auto *chunked = new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024));
+				chunked->SetChunkGeometry({4.0f, 32.0f, 1.0f});
+				chunked->SetRayTraversalMode(chunked->RAY_TRAVERSAL_GRID_MARCHING);
+				broadphases.push_back(chunked);
+			} else if (strcmp(str, "CHUNKBVHBVH_INGEST") == false) {
+				auto *chunked = new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024));
+				ingestStructures.push_back(chunked);
+				broadphases.push_back(chunked);
+			} else if (strcmp(str, "CHUNKBVHBVH_LVL_INGEST") == false) {
+				auto *chunked = new spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>(TOTAL_ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(64*1024));
+				chunked->SetChunkGeometry({4.0f, 32.0f, 1.0f});
+				ingestStructures.push_back(chunked);
+				broadphases.push_back(chunked);
 				
 			} else if (strcmp(str, "TSH_BF") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_unique<spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BTDBVT") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_unique<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BTDBVT1") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_unique<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BTDBVT1_NOR") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
@@ -1472,7 +1622,7 @@ int main(int argc, char **argv)
 					std::make_shared<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>(),
 					std::make_shared<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>(),
 					std::make_unique<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BTDBVT2") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
@@ -1485,21 +1635,37 @@ int main(int argc, char **argv)
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_unique<spp::Dbvh<spp::Aabb, EntityType, uint32_t, 0>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_DBVT") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_DBVT1") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
+				broadphases.push_back(tsdbvh);
+			} else if (strcmp(str, "TSH_LBVH") == false) {
+				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
+					std::make_shared<spp::LinearBvh<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
+					std::make_shared<spp::LinearBvh<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
+					std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
+				broadphases.push_back(tsdbvh);
+			} else if (strcmp(str, "TSH_SLEEP") == false) {
+				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
+					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
+					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
+					std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
+				tsdbvh->SetSleepingTicks(64);
+				tickedStructures.push_back(tsdbvh);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BVH") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
@@ -1518,14 +1684,14 @@ int main(int argc, char **argv)
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 					std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(0));
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_BVH1s") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(TOTAL_ENTITIES),
 					std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0, 1>>(0));
-				tsdbvh->SetRebuildSchedulerFunction(EnqueueRebuildThreaded);
+				tsdbvh->SetRebuildExecutor(rebuildExecutor);
 				broadphases.push_back(tsdbvh);
 			} else if (strcmp(str, "TSH_1_BVH1_DBVT") == false) {
 				spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0> *tsdbvh = new spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>(
@@ -1548,11 +1714,15 @@ int main(int argc, char **argv)
 			} else if (strcmp(str, "HLO") == false) {
 				broadphases.push_back(
 					new spp::experimental::HashLooseOctree<spp::Aabb, EntityType, uint32_t, 0>(1.0, 13, 1.6));
+			} else if (strcmp(str, "LLO") == false) {
+				broadphases.push_back(
+					new spp::experimental::LinearLooseOctree<spp::Aabb, EntityType, uint32_t, 0>(1.0, 13, 1.6));
 			} else if (strcmp(str, "LO") == false) {
 				broadphases.push_back(new spp::experimental::LooseOctree<spp::Aabb, EntityType, uint32_t, 0>(
 					-glm::vec3(1, 1, 1) * (1024 * 16.f), 15, 1.6));
 			} else if (strcmp(str, "CLO") == false) {
-				printf("ChunkedLooseOctree not implemented\n");
+				broadphases.push_back(new spp::experimental::ChunkedLooseOctree<spp::Aabb, EntityType, uint32_t, 0>(
+					32, 1024 * 32, 1.6));
 			}
 			fflush(stdout);
 		}
@@ -1564,7 +1734,7 @@ int main(int argc, char **argv)
 				 std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 				 std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(TOTAL_ENTITIES),
 				 std::make_unique<spp::BulletDbvt<spp::Aabb, EntityType, uint32_t, 0>>()),
-			 s->SetRebuildSchedulerFunction(EnqueueRebuildThreaded), s)};
+			 s->SetRebuildExecutor(rebuildExecutor), s)};
 	}
 	
 	currentEntitiesAabbs.resize(broadphases.size());
@@ -1678,12 +1848,23 @@ int main(int argc, char **argv)
 		for (int II = 0; II < broadphases.size(); ++II) {
 			auto bp = broadphases[II];
 			entities = old;
+			std::map<EntityType, spp::Aabb> batch;
 			auto beg = std::chrono::steady_clock::now();
 			for (size_t i = 0; i < ee.size(); ++i) {
 				spp::Aabb &a = entities[ee[i] - 1].aabb;
 				a.min += vv[i];
 				a.max += vv[i];
-				bp->Update(ee[i], a);
+				if (BATCH_API) {
+					batch[ee[i]] = a;
+					if (batch.size() >= 512 || i + 1 == ee.size()) {
+						std::vector<std::pair<EntityType, spp::Aabb>> b(
+							batch.begin(), batch.end());
+						bp->UpdateBatch(b);
+						batch.clear();
+					}
+				} else {
+					bp->Update(ee[i], a);
+				}
 				_SetEntityAabb(currentEntitiesAabbs[II], ee[i], a);
 			}
 			auto end = std::chrono::steady_clock::now();
@@ -1793,16 +1974,26 @@ int main(int argc, char **argv)
 
 	for (int II = 0; II < broadphases.size(); ++II) {
 		auto bp = broadphases[II];
+		auto ingest = std::find(ingestStructures.begin(), ingestStructures.end(), bp);
 		auto beg = std::chrono::steady_clock::now();
-		bp->StartFastAdding();
-		for (const auto &e : entities) {
-			assert(e.id > 0);
-			if (bp->Exists(e.id) == false) {
-				bp->Add(e.id, e.aabb, e.mask);
-				_SetEntityAabb(currentEntitiesAabbs[II], e.id, e.aabb);
+		if (ingest != ingestStructures.end() && bp->GetCount() == 0) {
+			IngestLoad(*ingest, entities, currentEntitiesAabbs[II]);
+			if (BATCH_API) {
+				RemoveAndAddBatch(bp, entities);
+			}
+		} else if (BATCH_API && bp->GetCount() == 0) {
+			BatchLoad(bp, entities, currentEntitiesAabbs[II]);
+		} else {
+			bp->StartFastAdding();
+			for (const auto &e : entities) {
+				assert(e.id > 0);
+				if (bp->Exists(e.id) == false) {
+					bp->Add(e.id, e.aabb, e.mask);
+					_SetEntityAabb(currentEntitiesAabbs[II], e.id, e.aabb);
+				}
 			}
+			bp->StopFastAdding();
 		}
-		bp->StopFastAdding();
 		auto end = std::chrono::steady_clock::now();
 		auto diff = end - beg;
 		int64_t ns =
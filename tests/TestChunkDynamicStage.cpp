@@ -0,0 +1,170 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/ChunkedBvhDbvt.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using ChunkedType = spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 20000;
+const int32_t DYNAMIC_LIMIT = 8;
+// moved entities of single chunk before comparing, several times the limit
+const int32_t MOVED_PER_CHUNK = DYNAMIC_LIMIT * 4;
+const int32_t ROUNDS = 4;
+const int32_t QUERIES = 500;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-300, 300);
+	std::uniform_real_distribution<float> distSize(0.2, 6);
+	glm::vec3 p = {distPos(mt), distPos(mt) / 4.0f, distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+// Moves and resizes aabb, retries until it stays in the same chunk
+spp::Aabb MovedInChunk(ChunkedType *chunked, spp::Aabb aabb)
+{
+	const int32_t chunkId = chunked->GetChunkIdFromAabb(aabb);
+	std::uniform_real_distribution<float> dist(-3, 3);
+	for (int32_t i = 0; i < 16; ++i) {
+		const glm::vec3 d = {dist(mt), dist(mt), dist(mt)};
+		const glm::vec3 s = {dist(mt), dist(mt), dist(mt)};
+		spp::Aabb moved = {aabb.min + d, glm::max(aabb.max + d + s,
+												  aabb.min + d + 0.1f)};
+		if (chunked->GetChunkIdFromAabb(moved) == chunkId) {
+			return moved;
+		}
+	}
+	return aabb;
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+// Chunked structure reports hits against quantized aabbs, exact aabbs are
+// used to filter them before comparing with BruteForce
+std::vector<EntityType> Query(BroadphaseType *bp, spp::Aabb query,
+							  const std::vector<spp::Aabb> &aabbs)
+{
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = query;
+	cb.callback = Collect;
+	bp->IntersectAabb(cb);
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+	std::erase_if(hits, [&](EntityType e) { return !(aabbs[e] && query); });
+	return hits;
+}
+
+// Queries random areas and exact aabbs of moved entities, so that each
+// refitted entity is searched for
+size_t Compare(BroadphaseType *bp, BroadphaseType *bf,
+			   const std::vector<spp::Aabb> &aabbs,
+			   const std::vector<EntityType> &moved)
+{
+	size_t errors = bp->GetCount() != bf->GetCount() ? 1 : 0;
+	for (int32_t i = 0; i < QUERIES; ++i) {
+		spp::Aabb q = RandomAabb();
+		q.max += glm::vec3(40, 10, 40);
+		if (Query(bp, q, aabbs) != Query(bf, q, aabbs)) {
+			++errors;
+		}
+	}
+	for (EntityType e : moved) {
+		if (Query(bp, aabbs[e], aabbs) != Query(bf, aabbs[e], aabbs)) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Moves within their chunks more entities than fit into dynamic stage of the
+// chunk, without rebuild in between. Entities moved after dynamic stage is
+// full are refitted in chunk tree. Results are compared with BruteForce
+// before and after rebuild of changed chunks.
+int main()
+{
+	bool ok = true;
+	ChunkedType *chunked = new ChunkedType(
+		ENTITIES + 1,
+		new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(1024));
+	chunked->SetChunkDynamicEntitiesLimit(DYNAMIC_LIMIT);
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+	std::vector<spp::Aabb> aabbs(ENTITIES + 1);
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		aabbs[e] = RandomAabb();
+		chunked->Add(e, aabbs[e], ~0);
+		bf.Add(e, aabbs[e], ~0);
+	}
+	chunked->Rebuild();
+
+	size_t errorsBefore = 0, errorsAfter = 0, fullChunks = 0;
+	for (int32_t round = 0; round < ROUNDS; ++round) {
+		std::map<int32_t, std::vector<EntityType>> chunkEntities;
+		for (EntityType e = 1; e <= ENTITIES; ++e) {
+			const int32_t chunkId = chunked->GetChunkIdFromAabb(aabbs[e]);
+			if (chunkId != -1) {
+				chunkEntities[chunkId].push_back(e);
+			}
+		}
+		std::vector<EntityType> moved;
+		for (auto &[chunkId, entities] : chunkEntities) {
+			if (entities.size() <= MOVED_PER_CHUNK) {
+				continue;
+			}
+			++fullChunks;
+			std::shuffle(entities.begin(), entities.end(), mt);
+			for (int32_t i = 0; i < MOVED_PER_CHUNK; ++i) {
+				const EntityType e = entities[i];
+				aabbs[e] = MovedInChunk(chunked, aabbs[e]);
+				chunked->Update(e, aabbs[e]);
+				bf.Update(e, aabbs[e]);
+				moved.push_back(e);
+			}
+			// entities already moved are moved again, some of them are in
+			// dynamic stage and some were refitted in tree
+			for (int32_t i = 0; i < MOVED_PER_CHUNK; i += 3) {
+				const EntityType e = entities[i];
+				aabbs[e] = MovedInChunk(chunked, aabbs[e]);
+				chunked->Update(e, aabbs[e]);
+				bf.Update(e, aabbs[e]);
+			}
+		}
+		errorsBefore += Compare(chunked, &bf, aabbs, moved);
+		chunked->RebuildChangedChunks();
+		errorsAfter += Compare(chunked, &bf, aabbs, moved);
+	}
+	ok &= Report("chunks with full dynamic stage",
+				 errorsBefore + (fullChunks == 0 ? 1 : 0));
+	ok &= Report("after rebuild of changed chunks", errorsAfter);
+
+	delete chunked;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/ChunkedBvhDbvt.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using ChunkedType = spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 20000;
+const int32_t UNLOADED_CHUNKS = 12;
+const int32_t QUERIES = 500;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-300, 300);
+	std::uniform_real_distribution<float> distSize(0.2, 6);
+	glm::vec3 p = {distPos(mt), distPos(mt) / 4.0f, distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+ChunkedType *NewChunked()
+{
+	return new ChunkedType(
+		ENTITIES,
+		new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(1024));
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+// Chunked structure reports hits against quantized aabbs, exact aabbs are
+// used to filter them before comparing with BruteForce
+std::vector<EntityType> Query(BroadphaseType *bp, spp::Aabb query,
+							  const std::vector<spp::Aabb> &aabbs)
+{
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = query;
+	cb.callback = Collect;
+	bp->IntersectAabb(cb);
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+	std::erase_if(hits, [&](EntityType e) { return !(aabbs[e] && query); });
+	return hits;
+}
+
+size_t Compare(BroadphaseType *bp, BroadphaseType *bf,
+			   const std::vector<spp::Aabb> &aabbs)
+{
+	size_t errors = bp->GetCount() != bf->GetCount() ? 1 : 0;
+	for (int32_t i = 0; i < QUERIES; ++i) {
+		spp::Aabb q = RandomAabb();
+		q.max += glm::vec3(40, 10, 40);
+		if (Query(bp, q, aabbs) != Query(bf, q, aabbs)) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Unloads some chunks, compares with BruteForce without their entities,
+// loads them back and compares with all entities again. Images with
+// different geometry, duplicated entity or truncated buffer are rejected
+// without modifying structure.
+int main()
+{
+	bool ok = true;
+	ChunkedType *chunked = NewChunked();
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+	std::vector<spp::Aabb> aabbs(ENTITIES + 1);
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		aabbs[e] = RandomAabb();
+		chunked->Add(e, aabbs[e], ~0);
+		bf.Add(e, aabbs[e], ~0);
+	}
+	chunked->Rebuild();
+	ok &= Report("before unload", Compare(chunked, &bf, aabbs));
+
+	std::vector<int32_t> chunkIds;
+	for (EntityType e = 1; chunkIds.size() < UNLOADED_CHUNKS; ++e) {
+		const int32_t chunkId = chunked->GetChunkIdFromAabb(aabbs[e]);
+		if (chunkId > 0 && std::find(chunkIds.begin(), chunkIds.end(),
+									 chunkId) == chunkIds.end()) {
+			chunkIds.push_back(chunkId);
+		}
+	}
+
+	std::vector<std::vector<uint8_t>> images(chunkIds.size());
+	std::vector<EntityType> unloaded;
+	size_t errors = 0;
+	for (size_t i = 0; i < chunkIds.size(); ++i) {
+		if (chunked->UnloadChunk(chunkIds[i], images[i]) == false) {
+			++errors;
+		}
+	}
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		const int32_t chunkId = chunked->GetChunkIdFromAabb(aabbs[e]);
+		if (std::find(chunkIds.begin(), chunkIds.end(), chunkId) !=
+			chunkIds.end()) {
+			bf.Remove(e);
+			unloaded.push_back(e);
+		}
+	}
+	errors += Compare(chunked, &bf, aabbs);
+	ok &= Report("after unload", errors);
+
+	{
+		// wrong geometry
+		ChunkedType *other = NewChunked();
+		ChunkedType::ChunkGeometry geometry;
+		geometry.chunkSize = 32.0f;
+		geometry.maxChunkedEntitySize = 16.0f;
+		other->SetChunkGeometry(geometry);
+		std::span<const uint8_t> b = images[0];
+		errors = other->LoadChunk(b) ? 1 : 0;
+		errors += other->GetCount() != 0 ? 1 : 0;
+		delete other;
+
+		// truncated buffer
+		b = std::span<const uint8_t>(images[0]).first(images[0].size() - 1);
+		errors += chunked->LoadChunk(b) ? 1 : 0;
+		b = std::span<const uint8_t>(images[0]).first(16);
+		errors += chunked->LoadChunk(b) ? 1 : 0;
+
+		// unknown version
+		std::vector<uint8_t> image = images[0];
+		image[4] ^= 0xFF;
+		b = image;
+		errors += chunked->LoadChunk(b) ? 1 : 0;
+
+		// entity of image added in other chunk
+		EntityType dup = 0;
+		for (EntityType e : unloaded) {
+			if (chunked->GetChunkIdFromAabb(aabbs[e]) == chunkIds[0]) {
+				dup = e;
+				break;
+			}
+		}
+		const spp::Aabb far = {{1000, 0, 1000}, {1001, 1, 1001}};
+		chunked->Add(dup, far, ~0);
+		b = images[0];
+		errors += chunked->LoadChunk(b) ? 1 : 0;
+		errors += chunked->GetCount() != bf.GetCount() + 1 ? 1 : 0;
+		chunked->Remove(dup);
+
+		errors += Compare(chunked, &bf, aabbs);
+		ok &= Report("rejected images", errors);
+	}
+
+	errors = 0;
+	for (auto &image : images) {
+		std::span<const uint8_t> b = image;
+		if (chunked->LoadChunk(b) == false || b.empty() == false) {
+			++errors;
+		}
+	}
+	for (EntityType e : unloaded) {
+		bf.Add(e, aabbs[e], ~0);
+	}
+	errors += Compare(chunked, &bf, aabbs);
+
+	// loaded chunks need to accept further modifications
+	for (size_t i = 0; i < unloaded.size(); i += 3) {
+		const EntityType e = unloaded[i];
+		aabbs[e] = RandomAabb();
+		chunked->Update(e, aabbs[e]);
+		bf.Update(e, aabbs[e]);
+	}
+	for (size_t i = 1; i < unloaded.size(); i += 5) {
+		chunked->Remove(unloaded[i]);
+		bf.Remove(unloaded[i]);
+	}
+	errors += Compare(chunked, &bf, aabbs);
+	ok &= Report("after reload", errors);
+
+	// loading the same image twice fails
+	std::vector<uint8_t> image;
+	chunked->SerializeChunk(chunkIds[1], image);
+	std::span<const uint8_t> b = image;
+	ok &= Report("load of already loaded chunk",
+				 chunked->LoadChunk(b) ? 1 : 0);
+
+	delete chunked;
+	return ok ? 0 : 1;
+}
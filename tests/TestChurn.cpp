@@ -0,0 +1,119 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../include/spatial_partitioning/BroadPhaseBase.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/ChunkedBvhDbvt.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using BvhType = spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 50000;
+const int32_t ROUNDS = 400;
+const int32_t CHURN_PER_ROUND = 2000;
+const int32_t WARMUP_ROUNDS = 20;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-500, 500);
+	std::uniform_real_distribution<float> distSize(0.2, 4);
+	glm::vec3 p = {distPos(mt), distPos(mt) / 8.0f, distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+size_t Query(BroadphaseType *bp)
+{
+	struct _Cb : public spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0> {
+		size_t hits = 0;
+	} cb;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = {{-50, -50, -50}, {50, 50, 50}};
+	typedef void (*CbT)(spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0> *,
+						EntityType);
+	cb.callback = (CbT) + [](_Cb *cb, EntityType entity) { cb->hits++; };
+	bp->IntersectAabb(cb);
+	return cb.hits;
+}
+
+// Removes random entities and adds them back in every round, with a query
+// between rounds. Memory usage after warm-up needs to stay bounded.
+bool ChurnTest(BroadphaseType *bp, const char *name)
+{
+	std::vector<EntityType> present, removed;
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		bp->Add(e, RandomAabb(), ~0);
+		present.push_back(e);
+	}
+	bp->Rebuild();
+
+	size_t warmupMemory = 0, maxMemory = 0;
+	for (int32_t round = 0; round < ROUNDS; ++round) {
+		for (int32_t i = 0; i < CHURN_PER_ROUND; ++i) {
+			const size_t id = mt() % present.size();
+			const EntityType e = present[id];
+			present[id] = present.back();
+			present.pop_back();
+			bp->Remove(e);
+			removed.push_back(e);
+		}
+		for (int32_t i = 0; i < CHURN_PER_ROUND / 2; ++i) {
+			const EntityType e = present[mt() % present.size()];
+			bp->Update(e, RandomAabb());
+		}
+		for (const EntityType e : removed) {
+			bp->Add(e, RandomAabb(), ~0);
+			present.push_back(e);
+		}
+		removed.clear();
+		Query(bp);
+
+		if (round + 1 == WARMUP_ROUNDS) {
+			warmupMemory = bp->GetMemoryUsage();
+		} else if (round >= WARMUP_ROUNDS) {
+			maxMemory = std::max(maxMemory, bp->GetMemoryUsage());
+		}
+	}
+
+	const bool ok = bp->GetCount() == ENTITIES && maxMemory <= warmupMemory * 2;
+	printf("%-48s memory after warm-up: %10lu B, max: %10lu B ... %s\n", name,
+		   warmupMemory, maxMemory, ok ? "OK" : "ERRORS");
+	return ok;
+}
+
+int main()
+{
+	bool ok = true;
+	{
+		BvhType bvh(ENTITIES);
+		ok &= ChurnTest(&bvh, "BvhMedianSplitHeap");
+	}
+	{
+		BvhType bvh(ENTITIES);
+		bvh.SetHolesCompactionRatio(0.0f);
+		ok &= ChurnTest(&bvh, "BvhMedianSplitHeap (no holes compaction)");
+	}
+	{
+		BvhType bvh(ENTITIES);
+		bvh.SetAabbUpdatePolicy(BvhType::ON_UPDATE_REFIT_ON_NEXT_READ);
+		ok &= ChurnTest(&bvh, "BvhMedianSplitHeap (refit on next read)");
+	}
+	{
+		BvhType bvh(ENTITIES);
+		bvh.SetAabbUpdatePolicy(BvhType::ON_UPDATE_QUEUE_FULL_REBUILD_ON_NEXT_READ);
+		ok &= ChurnTest(&bvh, "BvhMedianSplitHeap (rebuild on update)");
+	}
+	{
+		spp::ChunkedBvhDbvt<EntityType, uint32_t, 0> chunked(
+			ENTITIES, new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(
+						  64 * 1024));
+		ok &= ChurnTest(&chunked, "ChunkedBvhDbvt");
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+// Built second time with SPP_TEST_FLAT_GROUP_SWAR to test group matching used
+// on targets without SSE2
+#if defined(SPP_TEST_FLAT_GROUP_SWAR)
+#undef __SSE2__
+#endif
+
+#include <cstdio>
+
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../include/spatial_partitioning/FlatGroupIntMap.hpp"
+
+#if defined(__SSE2__)
+const size_t EXPECTED_GROUP = 16;
+#else
+const size_t EXPECTED_GROUP = 8;
+#endif
+
+const int32_t OPERATIONS = 2000000;
+const int32_t COMPARE_EVERY = 4096;
+const int32_t GROWTH_ENTRIES = 200000;
+const int32_t TOMBSTONE_ROUNDS = 2000;
+const int32_t TOMBSTONE_MAX_REPLACEMENTS = 10000;
+
+std::mt19937_64 mt(12345);
+
+uint32_t RandomKey32() { return mt() % 4096; }
+
+// Coordinates packed like chunk ids, only few low bits of each part vary
+uint64_t RandomKey64()
+{
+	const uint64_t x = mt() % 16, y = mt() % 16, z = mt() % 16;
+	return (x << 42) | (y << 21) | z;
+}
+
+template <typename KeyType>
+size_t CompareContents(const spp::FlatGroupIntMap<KeyType, uint64_t> &map,
+					   const std::unordered_map<KeyType, uint64_t> &ref)
+{
+	std::vector<std::pair<KeyType, uint64_t>> a, b(ref.begin(), ref.end());
+	map.ForEach([&](KeyType key, const uint64_t &value) {
+		a.push_back({key, value});
+	});
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	size_t errors = map.Size() != ref.size() ? 1 : 0;
+	errors += a != b ? 1 : 0;
+	for (const auto &[key, value] : ref) {
+		const uint64_t *v = map.find(key);
+		if (v == nullptr || *v != value) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+// Inserts, assigns, removes, reinserts removed keys and looks up random keys
+// of small key space, with occasional Reserve(), ShrinkToFit() and Clear()
+template <typename KeyType> size_t TestRandomOperations(KeyType (*randomKey)())
+{
+	spp::FlatGroupIntMap<KeyType, uint64_t> map;
+	std::unordered_map<KeyType, uint64_t> ref;
+	std::vector<KeyType> removed;
+	size_t errors = 0;
+	for (int32_t i = 0; i < OPERATIONS; ++i) {
+		const uint32_t op = mt() % 16;
+		if (op < 6) {
+			const KeyType key = randomKey();
+			const uint64_t value = mt();
+			map[key] = value;
+			ref[key] = value;
+		} else if (op == 6) {
+			if (removed.empty() == false) {
+				const KeyType key = removed.back();
+				removed.pop_back();
+				const uint64_t value = mt();
+				map[key] = value;
+				ref[key] = value;
+			}
+		} else if (op < 11) {
+			const KeyType key = randomKey();
+			const bool r = map.Remove(key);
+			if (r != (ref.erase(key) > 0)) {
+				++errors;
+			}
+			if (r) {
+				removed.push_back(key);
+			}
+		} else if (op < 15) {
+			const KeyType key = randomKey();
+			const uint64_t *v = map.find(key);
+			auto it = ref.find(key);
+			if ((v == nullptr) != (it == ref.end()) ||
+				(v && *v != it->second) || map.Has(key) != (v != nullptr)) {
+				++errors;
+			}
+		} else {
+			switch (mt() % 64) {
+			case 0:
+				map.Reserve(ref.size() * (1 + mt() % 4));
+				break;
+			case 1:
+				map.ShrinkToFit();
+				break;
+			case 2:
+				map.Clear();
+				ref.clear();
+				removed.clear();
+				break;
+			}
+		}
+		if (i % COMPARE_EVERY == 0) {
+			errors += CompareContents(map, ref);
+		}
+	}
+	errors += CompareContents(map, ref);
+	return errors;
+}
+
+// Grows table through many rehashes, removes most of keys and shrinks it
+size_t TestGrowthAndShrink()
+{
+	spp::FlatGroupIntMap<uint64_t, uint64_t> map;
+	std::unordered_map<uint64_t, uint64_t> ref;
+	for (uint64_t i = 0; i < GROWTH_ENTRIES; ++i) {
+		map[i << 16] = i;
+		ref[i << 16] = i;
+	}
+	size_t errors = CompareContents(map, ref);
+	const size_t grownMemory = map.GetMemoryUsage();
+	for (uint64_t i = 0; i < GROWTH_ENTRIES; ++i) {
+		if (i % 97) {
+			errors += map.Remove(i << 16) ? 0 : 1;
+			ref.erase(i << 16);
+		}
+	}
+	errors += map.Remove(1) ? 1 : 0;
+	map.ShrinkToFit();
+	errors += map.GetMemoryUsage() * 16 > grownMemory ? 1 : 0;
+	errors += map.GetTombstonesCount() != 0 ? 1 : 0;
+	errors += CompareContents(map, ref);
+	for (uint64_t i = 0; i < GROWTH_ENTRIES; i += 2) {
+		map[i << 16] = i + 1;
+		ref[i << 16] = i + 1;
+	}
+	errors += CompareContents(map, ref);
+	return errors;
+}
+
+// Keeps smallest table close to maximal load while replacing keys, so that
+// groups become full and removals in them leave tombstones. Later inserts
+// have to reuse them without rehash. Table is recreated once tombstones
+// trigger rehash.
+size_t TestTombstoneReuse()
+{
+	const size_t capacity = EXPECTED_GROUP * 2;
+	const size_t maxSize = capacity * 7 / 8;
+	size_t errors = 0, created = 0, reused = 0;
+	for (int32_t round = 0; round < TOMBSTONE_ROUNDS; ++round) {
+		spp::FlatGroupIntMap<uint32_t, uint64_t> map;
+		std::unordered_map<uint32_t, uint64_t> ref;
+		uint32_t nextKey = mt();
+		map[nextKey] = 0;
+		ref[nextKey] = 0;
+		const size_t memory = map.GetMemoryUsage();
+		const size_t size = maxSize - 1 - mt() % 4;
+		while (map.Size() < size) {
+			++nextKey;
+			map[nextKey] = nextKey;
+			ref[nextKey] = nextKey;
+		}
+		for (int32_t i = 0; i < TOMBSTONE_MAX_REPLACEMENTS &&
+							map.GetMemoryUsage() == memory;
+			 ++i) {
+			auto it = std::next(ref.begin(), mt() % ref.size());
+			const size_t t = map.GetTombstonesCount();
+			errors += map.Remove(it->first) ? 0 : 1;
+			ref.erase(it);
+			created += map.GetTombstonesCount() > t ? 1 : 0;
+
+			++nextKey;
+			const size_t t2 = map.GetTombstonesCount();
+			map[nextKey] = nextKey;
+			ref[nextKey] = nextKey;
+			if (map.GetMemoryUsage() == memory &&
+				map.GetTombstonesCount() < t2) {
+				++reused;
+			}
+			errors += CompareContents(map, ref);
+		}
+		if (map.GetMemoryUsage() != memory) {
+			errors += map.GetTombstonesCount() != 0 ? 1 : 0;
+		}
+		errors += CompareContents(map, ref);
+	}
+	errors += created == 0 ? 1 : 0;
+	errors += reused == 0 ? 1 : 0;
+	return errors;
+}
+
+// Smallest table has two groups, entries are stored as key and value pairs
+size_t TestGroupWidth()
+{
+	spp::FlatGroupIntMap<uint32_t, uint64_t> map;
+	map[1] = 1;
+	const size_t slots = EXPECTED_GROUP * 2;
+	const size_t expected =
+		slots * (sizeof(int8_t) + sizeof(std::pair<uint32_t, uint64_t>));
+	return map.GetMemoryUsage() != expected ? 1 : 0;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Compares FlatGroupIntMap with std::unordered_map under random operations,
+// growth and shrinking, and checks that tombstones are reused. Group width
+// confirms which variant of group matching is tested.
+int main()
+{
+	bool ok = true;
+	ok &= Report(EXPECTED_GROUP == 16 ? "SSE2 group width" : "SWAR group width",
+				 TestGroupWidth());
+	ok &= Report("uint32_t keys random operations",
+				 TestRandomOperations<uint32_t>(RandomKey32));
+	ok &= Report("uint64_t keys random operations",
+				 TestRandomOperations<uint64_t>(RandomKey64));
+	ok &= Report("growth and shrink", TestGrowthAndShrink());
+	ok &= Report("tombstone reuse", TestTombstoneReuse());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/ChunkedBvhDbvt.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using ChunkedType = spp::ChunkedBvhDbvt<EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+using IngestEntry = std::tuple<EntityType, spp::Aabb, uint32_t>;
+
+const int32_t ENTITIES = 20000;
+// entities beyond initial ones are added by later batches
+const int32_t MAX_ENTITIES = 24000;
+const int32_t QUERIES = 500;
+const int32_t ROUNDS = 6;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-300, 300);
+	std::uniform_real_distribution<float> distSize(0.2, 6);
+	glm::vec3 p = {distPos(mt), distPos(mt) / 4.0f, distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+// Small moves mostly stay in chunk, others jump across the world or become
+// outer objects
+spp::Aabb MovedAabb(spp::Aabb aabb)
+{
+	switch (mt() % 8) {
+	case 0:
+		return RandomAabb();
+	case 1: {
+		spp::Aabb a = RandomAabb();
+		a.max += glm::vec3(150, 20, 150);
+		return a;
+	}
+	default: {
+		std::uniform_real_distribution<float> dist(-2, 2);
+		const glm::vec3 d = {dist(mt), dist(mt), dist(mt)};
+		return {aabb.min + d, aabb.max + d};
+	}
+	}
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+// Chunked structure reports hits against quantized aabbs, exact aabbs are
+// used to filter them before comparing with BruteForce
+std::vector<EntityType> Query(BroadphaseType *bp, spp::Aabb query,
+							  const std::vector<spp::Aabb> &aabbs)
+{
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = query;
+	cb.callback = Collect;
+	bp->IntersectAabb(cb);
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+	std::erase_if(hits, [&](EntityType e) { return !(aabbs[e] && query); });
+	return hits;
+}
+
+size_t Compare(BroadphaseType *bp, BroadphaseType *bf,
+			   const std::vector<spp::Aabb> &aabbs)
+{
+	size_t errors = bp->GetCount() != bf->GetCount() ? 1 : 0;
+	for (int32_t i = 0; i < QUERIES; ++i) {
+		spp::Aabb q = RandomAabb();
+		q.max += glm::vec3(40, 10, 40);
+		if (Query(bp, q, aabbs) != Query(bf, q, aabbs)) {
+			++errors;
+		}
+	}
+	for (EntityType e = 1; e <= MAX_ENTITIES; ++e) {
+		if (bp->Exists(e) != bf->Exists(e)) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Batch of given size with moved existing entities, new entities and some
+// entities repeated with different aabbs, only last entry of repeated entity
+// is applied to BruteForce
+std::vector<IngestEntry> MakeBatch(size_t size, EntityType &nextNew,
+								   spp::BruteForce<spp::Aabb, EntityType,
+												   uint32_t, 0> &bf,
+								   std::vector<spp::Aabb> &aabbs)
+{
+	std::vector<IngestEntry> batch;
+	for (size_t i = 0; i < size; ++i) {
+		EntityType e;
+		if (nextNew <= MAX_ENTITIES && mt() % 16 == 0) {
+			e = nextNew++;
+			aabbs[e] = RandomAabb();
+		} else {
+			e = 1 + mt() % (nextNew - 1);
+			aabbs[e] = MovedAabb(aabbs[e]);
+		}
+		batch.push_back({e, aabbs[e], ~0u});
+		if (mt() % 32 == 0) {
+			aabbs[e] = MovedAabb(aabbs[e]);
+			batch.push_back({e, aabbs[e], ~0u});
+		}
+	}
+	std::shuffle(batch.begin(), batch.end(), mt);
+	for (const auto &[e, aabb, mask] : batch) {
+		aabbs[e] = aabb;
+		if (bf.Exists(e)) {
+			bf.Update(e, aabb);
+		} else {
+			bf.Add(e, aabb, mask);
+		}
+	}
+	return batch;
+}
+
+// Ingests batches moving entities between chunks and into outer objects,
+// large ones rebuild touched chunks and small ones go through UpdateBatch()
+// and AddBatch(). Results are compared with BruteForce.
+int main()
+{
+	bool ok = true;
+	ChunkedType *chunked = new ChunkedType(
+		MAX_ENTITIES + 1,
+		new spp::BvhMedianSplitHeap<spp::Aabb, uint32_t, uint32_t, 0>(1024));
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+	std::vector<spp::Aabb> aabbs(MAX_ENTITIES + 1);
+
+	std::vector<IngestEntry> batch;
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		aabbs[e] = RandomAabb();
+		batch.push_back({e, aabbs[e], ~0u});
+		bf.Add(e, aabbs[e], ~0);
+	}
+	chunked->IngestBatch(batch);
+	ok &= Report("initial ingest", Compare(chunked, &bf, aabbs));
+
+	EntityType nextNew = ENTITIES + 1;
+	size_t errors = 0;
+	for (int32_t round = 0; round < ROUNDS; ++round) {
+		batch = MakeBatch(ENTITIES / 3, nextNew, bf, aabbs);
+		chunked->IngestBatch(batch);
+		errors += Compare(chunked, &bf, aabbs);
+	}
+	ok &= Report("large batches with cross-chunk moves", errors);
+
+	errors = 0;
+	for (int32_t round = 0; round < ROUNDS; ++round) {
+		batch = MakeBatch(ENTITIES / 64, nextNew, bf, aabbs);
+		chunked->IngestBatch(batch);
+		errors += Compare(chunked, &bf, aabbs);
+	}
+	ok &= Report("small batches with cross-chunk moves", errors);
+
+	// ingested chunks need to accept further modifications
+	errors = 0;
+	for (EntityType e = 1; e < nextNew; e += 7) {
+		aabbs[e] = MovedAabb(aabbs[e]);
+		chunked->Update(e, aabbs[e]);
+		bf.Update(e, aabbs[e]);
+	}
+	for (EntityType e = 3; e < nextNew; e += 11) {
+		chunked->Remove(e);
+		bf.Remove(e);
+	}
+	chunked->Rebuild();
+	errors += Compare(chunked, &bf, aabbs);
+	ok &= Report("modifications after ingest", errors);
+
+	delete chunked;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/Dbvt.hpp"
+#include "../include/spatial_partitioning/ThreeStageDbvh.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using ThreeStageType = spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 20000;
+const int32_t MOVED = ENTITIES / 4;
+const int32_t IDLE_QUERIES = 100000;
+// queries after which sustained excess cost has to trigger rebuild
+const int32_t MAX_QUERIES_TO_REBUILD = 200000;
+// rebuild triggering is checked on updates
+const int32_t QUERIES_PER_UPDATE = 64;
+const int32_t COMPARE_QUERIES = 300;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-300, 300);
+	std::uniform_real_distribution<float> distSize(0.2, 6);
+	glm::vec3 p = {distPos(mt), distPos(mt), distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+std::vector<EntityType> Query(BroadphaseType *bp, spp::Aabb query)
+{
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = query;
+	cb.callback = Collect;
+	bp->IntersectAabb(cb);
+	std::sort(hits.begin(), hits.end());
+	return hits;
+}
+
+size_t Compare(BroadphaseType *bp, BroadphaseType *bf)
+{
+	size_t errors = bp->GetCount() != bf->GetCount() ? 1 : 0;
+	for (int32_t i = 0; i < COMPARE_QUERIES; ++i) {
+		spp::Aabb q = RandomAabb();
+		q.max += glm::vec3(40, 40, 40);
+		if (Query(bp, q) != Query(bf, q)) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Counts scheduled rebuilds and does them immediately
+void CountingScheduler(std::shared_ptr<std::atomic<bool>> finishedRebuilding,
+					   std::shared_ptr<BroadphaseType> dbvh,
+					   std::shared_ptr<void> data)
+{
+	++*(int32_t *)data.get();
+	dbvh->Rebuild();
+	finishedRebuilding->store(true);
+}
+
+// Queries until rebuild is scheduled or maxQueries are done. Entity 1 is
+// updated without moving it every few queries, so that rebuild triggering
+// is checked without changing structure.
+int32_t QueryUntilRebuild(ThreeStageType *tsh, const int32_t *schedules,
+						  int32_t maxQueries)
+{
+	const int32_t before = *schedules;
+	const spp::Aabb aabb = tsh->GetAabb(1);
+	int32_t queries = 0;
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.callback = Collect;
+	while (queries < maxQueries && *schedules == before) {
+		for (int32_t i = 0; i < QUERIES_PER_UPDATE; ++i, ++queries) {
+			hits.clear();
+			cb.aabb = RandomAabb();
+			cb.aabb.max += glm::vec3(20, 20, 20);
+			tsh->IntersectAabb(cb);
+		}
+		tsh->Update(1, aabb);
+	}
+	return queries;
+}
+
+// Rebuild timing is measured by initial rebuild. Queries of unchanged
+// structure must not schedule rebuild, while queries testing many entities
+// moved into dynamic stage have to schedule it once their excess cost
+// exceeds cost of rebuild.
+int main()
+{
+	bool ok = true;
+	ThreeStageType *tsh = new ThreeStageType(
+		std::make_shared<
+			spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(
+			ENTITIES + 1),
+		std::make_shared<
+			spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(
+			ENTITIES + 1),
+		std::make_unique<
+			spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
+	auto schedules = std::make_shared<int32_t>(0);
+	tsh->SetRebuildSchedulerFunction(CountingScheduler, schedules);
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		const spp::Aabb aabb = RandomAabb();
+		tsh->Add(e, aabb, ~0);
+		bf.Add(e, aabb, ~0);
+	}
+	tsh->Rebuild();
+
+	QueryUntilRebuild(tsh, schedules.get(), IDLE_QUERIES);
+	ok &= Report("idle structure", *schedules);
+
+	for (int32_t i = 0; i < MOVED; ++i) {
+		const EntityType e = 2 + mt() % (ENTITIES - 1);
+		const spp::Aabb aabb = RandomAabb();
+		tsh->Update(e, aabb);
+		bf.Update(e, aabb);
+	}
+	const int32_t before = *schedules;
+	const int32_t queries =
+		QueryUntilRebuild(tsh, schedules.get(), MAX_QUERIES_TO_REBUILD);
+	ok &= Report("sustained excess query cost",
+				 (*schedules != before + 1 ? 1 : 0) +
+					 (queries >= MAX_QUERIES_TO_REBUILD ? 1 : 0));
+
+	size_t errors = Compare(tsh, &bf);
+	const int32_t after = *schedules;
+	QueryUntilRebuild(tsh, schedules.get(), IDLE_QUERIES);
+	errors += *schedules != after ? 1 : 0;
+	ok &= Report("idle structure after rebuild", errors);
+
+	delete tsh;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/Dbvt.hpp"
+#include "../include/spatial_partitioning/RebuildExecutor.hpp"
+#include "../include/spatial_partitioning/ThreeStageDbvh.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using ThreeStageType = spp::ThreeStageDbvh<spp::Aabb, EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 5000;
+const int32_t QUERIES = 300;
+// ThreeStageDbvh without measured rebuild time schedules rebuild after this
+// many updates
+const int32_t UPDATES_TO_SCHEDULE = 100001;
+
+std::mt19937_64 mt(12345);
+
+spp::Aabb RandomAabb()
+{
+	std::uniform_real_distribution<float> distPos(-300, 300);
+	std::uniform_real_distribution<float> distSize(0.2, 6);
+	glm::vec3 p = {distPos(mt), distPos(mt), distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+std::vector<EntityType> Query(BroadphaseType *bp, spp::Aabb query)
+{
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.aabb = query;
+	cb.callback = Collect;
+	bp->IntersectAabb(cb);
+	std::sort(hits.begin(), hits.end());
+	return hits;
+}
+
+size_t Compare(BroadphaseType *bp, BroadphaseType *bf)
+{
+	size_t errors = bp->GetCount() != bf->GetCount() ? 1 : 0;
+	for (int32_t i = 0; i < QUERIES; ++i) {
+		spp::Aabb q = RandomAabb();
+		q.max += glm::vec3(40, 40, 40);
+		if (Query(bp, q) != Query(bf, q)) {
+			++errors;
+		}
+	}
+	return errors;
+}
+
+bool Report(const char *name, size_t errors)
+{
+	printf("%-48s errors: %lu ... %s\n", name, errors,
+		   errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Occupies single worker of executor until armed is set. With untilDropped
+// it waits also until no other job is pending, which happens when destructor
+// drops them.
+void Block(spp::RebuildExecutor *executor, std::atomic<bool> *armed,
+		   std::atomic<bool> *started, bool untilDropped)
+{
+	executor->Enqueue(std::numeric_limits<int64_t>::max(),
+					  std::make_shared<std::atomic<bool>>(false),
+					  [executor, armed, started, untilDropped]() {
+						  started->store(true);
+						  while (armed->load() == false ||
+								 (untilDropped &&
+								  executor->GetPendingCount() > 0)) {
+							  std::this_thread::sleep_for(
+								  std::chrono::milliseconds(1));
+						  }
+					  });
+	while (started->load() == false) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+ThreeStageType *NewThreeStage()
+{
+	return new ThreeStageType(
+		std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType,
+												 uint32_t, 0>>(ENTITIES + 1),
+		std::make_shared<spp::BvhMedianSplitHeap<spp::Aabb, EntityType,
+												 uint32_t, 0>>(ENTITIES + 1),
+		std::make_unique<
+			spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>());
+}
+
+void UpdateMany(BroadphaseType *a, BroadphaseType *b, int32_t count)
+{
+	for (int32_t i = 0; i < count; ++i) {
+		const EntityType e = 1 + mt() % ENTITIES;
+		const spp::Aabb aabb = RandomAabb();
+		a->Update(e, aabb);
+		b->Update(e, aabb);
+	}
+}
+
+// Destroys executor while rebuilds are pending in it. Their finished flags
+// need to be set, otherwise ThreeStageDbvh waits for its rebuild forever and
+// never schedules next one.
+int main()
+{
+	bool ok = true;
+
+	{
+		auto executor = std::make_unique<spp::RebuildExecutor>(1);
+		std::atomic<bool> armed = false, started = false;
+		Block(executor.get(), &armed, &started, true);
+		auto finished = std::make_shared<std::atomic<bool>>(false);
+		std::atomic<bool> executed = false;
+		executor->Enqueue(0, finished, [&executed]() { executed = true; });
+		armed = true;
+		executor.reset();
+		ok &= Report("pending job dropped by destructor",
+					 (finished->load() ? 0 : 1) + (executed.load() ? 1 : 0));
+	}
+
+	ThreeStageType *tsh = NewThreeStage();
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		const spp::Aabb aabb = RandomAabb();
+		tsh->Add(e, aabb, ~0);
+		bf.Add(e, aabb, ~0);
+	}
+	tsh->Rebuild();
+
+	{
+		auto executor = std::make_shared<spp::RebuildExecutor>(1);
+		std::atomic<bool> armed = false, started = false;
+		Block(executor.get(), &armed, &started, true);
+		tsh->SetRebuildExecutor(executor);
+		UpdateMany(tsh, &bf, UPDATES_TO_SCHEDULE);
+		const size_t errors = executor->GetPendingCount() != 1 ? 1 : 0;
+		tsh->SetRebuildExecutor(nullptr);
+		armed = true;
+		executor.reset();
+		// integrates dropped rebuild, queries are not done yet so that next
+		// rebuild is still triggered by count of updates
+		UpdateMany(tsh, &bf, 1000);
+		ok &= Report("ThreeStageDbvh rebuild in destroyed executor",
+					 errors);
+	}
+
+	{
+		// next rebuild is scheduled on new executor
+		auto executor = std::make_shared<spp::RebuildExecutor>(1);
+		std::atomic<bool> armed = false, started = false;
+		Block(executor.get(), &armed, &started, false);
+		tsh->SetRebuildExecutor(executor);
+		UpdateMany(tsh, &bf, UPDATES_TO_SCHEDULE);
+		size_t errors = executor->GetPendingCount() != 1 ? 1 : 0;
+		armed = true;
+		while (executor->GetPendingCount() > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		UpdateMany(tsh, &bf, 1000);
+		errors += Compare(tsh, &bf);
+		ok &= Report("ThreeStageDbvh rebuild on new executor", errors);
+		delete tsh;
+	}
+
+	return ok ? 0 : 1;
+}
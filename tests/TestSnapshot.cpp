@@ -0,0 +1,297 @@
+#include <cstdio>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../include/spatial_partitioning/BruteForce.hpp"
+#include "../include/spatial_partitioning/BvhMedianSplitHeap.hpp"
+#include "../include/spatial_partitioning/Dbvt.hpp"
+#include "../include/spatial_partitioning/SnapshotBroadphase.hpp"
+
+using EntityType = uint32_t;
+using BroadphaseType = spp::BroadphaseBase<spp::Aabb, EntityType, uint32_t, 0>;
+using SnapshotType = spp::SnapshotBroadphase<spp::Aabb, EntityType, uint32_t, 0>;
+using AabbCallbackType = spp::AabbCallback<spp::Aabb, EntityType, uint32_t, 0>;
+
+const int32_t ENTITIES = 2000;
+const int32_t COMMITS = 300;
+const int32_t UPDATES_PER_COMMIT = 100;
+const int32_t READERS = 4;
+const size_t MAX_RECORDS_PER_READER = 3000;
+
+spp::Aabb RandomAabb(std::mt19937_64 &mt)
+{
+	std::uniform_real_distribution<float> distPos(-100, 100);
+	std::uniform_real_distribution<float> distSize(0.5, 5);
+	glm::vec3 p = {distPos(mt), distPos(mt), distPos(mt)};
+	glm::vec3 s = {distSize(mt), distSize(mt), distSize(mt)};
+	return {p, p + s};
+}
+
+struct CollectCb : public AabbCallbackType {
+	std::vector<EntityType> *hits = nullptr;
+};
+
+void Collect(AabbCallbackType *cb, EntityType entity)
+{
+	((CollectCb *)cb)->hits->push_back(entity);
+}
+
+// State of all entities after given commit, empty aabb marks removed entity
+struct State {
+	std::vector<spp::Aabb> aabbs;
+	std::vector<bool> alive;
+};
+
+std::vector<EntityType> Expected(const State &state, spp::Aabb query)
+{
+	std::vector<EntityType> ret;
+	for (EntityType e = 1; e < state.alive.size(); ++e) {
+		if (state.alive[e] && (state.aabbs[e] && query)) {
+			ret.push_back(e);
+		}
+	}
+	return ret;
+}
+
+std::vector<EntityType> Filter(const State &state, spp::Aabb query,
+							   std::vector<EntityType> hits)
+{
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+	std::vector<EntityType> ret;
+	for (EntityType e : hits) {
+		if (e < state.alive.size() && state.alive[e] &&
+			(state.aabbs[e] && query)) {
+			ret.push_back(e);
+		}
+	}
+	return ret;
+}
+
+struct Record {
+	spp::Aabb query;
+	uint64_t versionBefore;
+	uint64_t versionAfter;
+	std::vector<EntityType> hits;
+};
+
+// Reader threads query while writer updates and commits. Every query
+// result has to match one of states published during that query, final
+// snapshot has to match BruteForce.
+bool ConcurrentTest(std::unique_ptr<BroadphaseType> &&a,
+					std::unique_ptr<BroadphaseType> &&b, const char *name)
+{
+	std::mt19937_64 mt(12345);
+	SnapshotType snapshot(std::move(a), std::move(b));
+	spp::BruteForce<spp::Aabb, EntityType, uint32_t, 0> bf;
+
+	std::vector<State> states(COMMITS + 2);
+	State state;
+	state.aabbs.resize(ENTITIES + 1);
+	state.alive.resize(ENTITIES + 1, false);
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		state.aabbs[e] = RandomAabb(mt);
+		state.alive[e] = true;
+		snapshot.Add(e, state.aabbs[e], ~0);
+		bf.Add(e, state.aabbs[e], ~0);
+	}
+	snapshot.Rebuild();
+	states[snapshot.GetVersion() + 1] = state;
+	snapshot.Commit();
+
+	std::atomic<bool> stop = false;
+	std::vector<std::vector<Record>> records(READERS);
+	std::vector<std::thread> readers;
+	for (int32_t t = 0; t < READERS; ++t) {
+		readers.emplace_back([&, t]() {
+			std::mt19937_64 rmt(t + 1);
+			SnapshotType::Reader reader = snapshot.CreateReader();
+			std::vector<EntityType> hits;
+			CollectCb cb;
+			cb.hits = &hits;
+			cb.mask = ~(uint32_t)0;
+			cb.callback = Collect;
+			while (stop.load() == false) {
+				spp::Aabb q = RandomAabb(rmt);
+				q.max += glm::vec3(10, 10, 10);
+				hits.clear();
+				cb.aabb = q;
+				const uint64_t v0 = reader.GetVersion();
+				reader.IntersectAabb(cb);
+				const uint64_t v1 = reader.GetVersion();
+				if (records[t].size() < MAX_RECORDS_PER_READER) {
+					records[t].push_back({q, v0, v1, hits});
+				}
+				std::this_thread::yield();
+			}
+		});
+	}
+
+	for (int32_t c = 0; c < COMMITS; ++c) {
+		for (int32_t i = 0; i < UPDATES_PER_COMMIT; ++i) {
+			const EntityType e = (mt() % ENTITIES) + 1;
+			if (state.alive[e] == false) {
+				state.aabbs[e] = RandomAabb(mt);
+				state.alive[e] = true;
+				snapshot.Add(e, state.aabbs[e], ~0);
+				bf.Add(e, state.aabbs[e], ~0);
+			} else if (mt() % 16 == 0) {
+				state.alive[e] = false;
+				snapshot.Remove(e);
+				bf.Remove(e);
+			} else {
+				glm::vec3 d = RandomAabb(mt).min * 0.05f;
+				state.aabbs[e].min += d;
+				state.aabbs[e].max += d;
+				snapshot.Update(e, state.aabbs[e]);
+				bf.Update(e, state.aabbs[e]);
+			}
+		}
+		if (c % 50 == 49) {
+			snapshot.Rebuild();
+		}
+		states[snapshot.GetVersion() + 1] = state;
+		snapshot.Commit();
+		std::this_thread::yield();
+	}
+	stop.store(true);
+	for (auto &t : readers) {
+		t.join();
+	}
+
+	size_t errors = 0, checked = 0;
+	for (const auto &recs : records) {
+		for (const Record &r : recs) {
+			bool match = false;
+			for (uint64_t v = r.versionBefore;
+				 v <= r.versionAfter + 1 && v < states.size() && !match; ++v) {
+				if (states[v].alive.empty()) {
+					continue;
+				}
+				match = Filter(states[v], r.query, r.hits) ==
+						Expected(states[v], r.query);
+			}
+			errors += match ? 0 : 1;
+			++checked;
+		}
+	}
+
+	SnapshotType::Reader reader = snapshot.CreateReader();
+	std::vector<EntityType> hits;
+	CollectCb cb;
+	cb.hits = &hits;
+	cb.mask = ~(uint32_t)0;
+	cb.callback = Collect;
+	for (int32_t i = 0; i < 500; ++i) {
+		spp::Aabb q = RandomAabb(mt);
+		q.max += glm::vec3(10, 10, 10);
+		hits.clear();
+		cb.aabb = q;
+		reader.IntersectAabb(cb);
+		std::vector<EntityType> bfHits;
+		cb.hits = &bfHits;
+		bf.IntersectAabb(cb);
+		cb.hits = &hits;
+		if (Filter(state, q, hits) != Filter(state, q, bfHits)) {
+			++errors;
+		}
+	}
+	if (snapshot.GetCount() != bf.GetCount()) {
+		++errors;
+	}
+
+	printf("%-48s checked queries: %6lu, errors: %lu ... %s\n", name, checked,
+		   errors, errors ? "ERRORS" : "OK");
+	return errors == 0;
+}
+
+// Nested query on the same reader must not release outer query, writer
+// cannot reuse snapshot until outer query finishes.
+bool NestedTest()
+{
+	std::mt19937_64 mt(12345);
+	SnapshotType snapshot(
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(ENTITIES),
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(ENTITIES));
+	for (EntityType e = 1; e <= ENTITIES; ++e) {
+		snapshot.Add(e, RandomAabb(mt), ~0);
+	}
+	snapshot.Commit();
+
+	static SnapshotType *sb = &snapshot;
+	static SnapshotType::Reader reader;
+	static std::atomic<bool> writerDone = false;
+	static bool outerStarted = false;
+	static bool writerFinishedDuringOuter = false;
+	static size_t innerHits = 0;
+	sb = &snapshot;
+	reader = snapshot.CreateReader();
+	writerDone = false;
+	outerStarted = false;
+
+	AabbCallbackType outer;
+	outer.mask = ~(uint32_t)0;
+	outer.aabb = {{-1000, -1000, -1000}, {1000, 1000, 1000}};
+	outer.callback = [](AabbCallbackType *, EntityType) {
+		if (outerStarted) {
+			return;
+		}
+		outerStarted = true;
+
+		AabbCallbackType inner;
+		inner.mask = ~(uint32_t)0;
+		inner.aabb = {{-1000, -1000, -1000}, {1000, 1000, 1000}};
+		inner.callback = [](AabbCallbackType *, EntityType) { ++innerHits; };
+		reader.IntersectAabb(inner);
+
+		std::thread writer([]() {
+			sb->Update(1, {{0, 0, 0}, {1, 1, 1}});
+			sb->Commit();
+			// waits for outer query, which still reads previous snapshot
+			sb->Update(2, {{0, 0, 0}, {1, 1, 1}});
+			writerDone.store(true);
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		writerFinishedDuringOuter = writerDone.load();
+		writer.detach();
+	};
+	reader.IntersectAabb(outer);
+	while (writerDone.load() == false) {
+		std::this_thread::yield();
+	}
+	reader = SnapshotType::Reader();
+
+	SnapshotType::Reader r1, r2;
+	SnapshotType small(
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(16),
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(16),
+		1);
+	const bool first = small.TryCreateReader(r1);
+	const bool second = small.TryCreateReader(r2);
+
+	const bool ok = innerHits == ENTITIES && writerFinishedDuringOuter == false &&
+					first && second == false;
+	printf("%-48s ... %s\n", "nested query / reader slots", ok ? "OK" : "ERRORS");
+	return ok;
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= ConcurrentTest(
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(ENTITIES),
+		std::make_unique<spp::BvhMedianSplitHeap<spp::Aabb, EntityType, uint32_t, 0>>(ENTITIES),
+		"SnapshotBroadphase BvhMedianSplitHeap");
+	ok &= ConcurrentTest(
+		std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>(),
+		std::make_unique<spp::Dbvt<spp::Aabb, EntityType, uint32_t, 0, uint32_t>>(),
+		"SnapshotBroadphase Dbvt");
+	ok &= NestedTest();
+	return ok ? 0 : 1;
+}